@@ -37,7 +37,10 @@ BucketStore::BucketStore() {
 // Public API
 // ---------------------------------------------------------------------------
 
-bool BucketStore::begin() {
+bool BucketStore::begin(const char *dir) {
+    snprintf(_path, sizeof(_path), "%s/" BUCKET_FILE, dir);
+    snprintf(_tmpPath, sizeof(_tmpPath), "%s/" BUCKET_TMP_FILE, dir);
+
     // LittleFS.begin() is a no-op if already mounted (FakeGatoHistoryService
     // mounts it with format-on-fail=true during its constructor).  Calling it
     // again is safe and ensures we have a mount before any file access.
@@ -46,13 +49,13 @@ bool BucketStore::begin() {
         return false;
     }
 
-    // Create the /navien directory if it doesn't exist.
-    if (!LittleFS.exists("/navien")) {
-        if (!LittleFS.mkdir("/navien")) {
-            Serial.println("BucketStore: failed to create /navien directory");
+    // Create the data directory if it doesn't exist.
+    if (!LittleFS.exists(dir)) {
+        if (!LittleFS.mkdir(dir)) {
+            Serial.printf("BucketStore: failed to create %s directory\n", dir);
             return false;
         }
-        Serial.println("BucketStore: created /navien directory");
+        Serial.printf("BucketStore: created %s directory\n", dir);
     }
 
     // Try to load an existing file.
@@ -118,11 +121,11 @@ int BucketStore::nonZeroCount() const {
 // ---------------------------------------------------------------------------
 
 bool BucketStore::load() {
-    if (!LittleFS.exists(BUCKET_FILE)) {
+    if (!LittleFS.exists(_path)) {
         return false;
     }
 
-    File f = LittleFS.open(BUCKET_FILE, "r");
+    File f = LittleFS.open(_path, "r");
     if (!f) {
         Serial.println("BucketStore: failed to open buckets.bin for reading");
         return false;
@@ -154,7 +157,7 @@ bool BucketStore::load() {
 
 bool BucketStore::writeAtomic() {
     // Write to .tmp first.
-    File f = LittleFS.open(BUCKET_TMP_FILE, "w");
+    File f = LittleFS.open(_tmpPath, "w");
     if (!f) {
         Serial.println("BucketStore: failed to open buckets.tmp for writing");
         return false;
@@ -167,14 +170,14 @@ bool BucketStore::writeAtomic() {
     if (written != sizeof(BucketFile)) {
         Serial.printf("BucketStore: short write to buckets.tmp (%u/%u bytes)\n",
                       (unsigned)written, (unsigned)sizeof(BucketFile));
-        LittleFS.remove(BUCKET_TMP_FILE);
+        LittleFS.remove(_tmpPath);
         return false;
     }
 
     // Atomically replace the live file.
-    if (!LittleFS.rename(BUCKET_TMP_FILE, BUCKET_FILE)) {
+    if (!LittleFS.rename(_tmpPath, _path)) {
         Serial.println("BucketStore: rename buckets.tmp -> buckets.bin failed");
-        LittleFS.remove(BUCKET_TMP_FILE);
+        LittleFS.remove(_tmpPath);
         return false;
     }
 
@@ -24,9 +24,10 @@ SOFTWARE.
 
 #include <stdint.h>
 
-// File paths on LittleFS
-#define BUCKET_FILE     "/navien/buckets.bin"
-#define BUCKET_TMP_FILE "/navien/buckets.tmp"
+// File names on LittleFS, inside the directory passed to begin()
+#define BUCKET_DIR      "/navien"
+#define BUCKET_FILE     "buckets.bin"
+#define BUCKET_TMP_FILE "buckets.tmp"
 
 // Magic number: "NAVI" in little-endian ASCII bytes
 #define BUCKET_MAGIC          0x4E415649u
@@ -61,9 +62,9 @@ class BucketStore {
 public:
     BucketStore();
 
-    // Initialise: mount check, create /navien directory, load or create
-    // buckets.bin.  Returns true on success.
-    bool begin();
+    // Initialise: mount check, create dir (default /navien), load or create
+    // buckets.bin inside it.  Returns true on success.
+    bool begin(const char *dir = BUCKET_DIR);
 
     // Atomically write the in-RAM _buckets to LittleFS.
     // Returns true on success.
@@ -95,7 +96,7 @@ private:
     // or has a bad magic/version (caller should create a fresh file).
     bool load();
 
-    // Write _buckets to BUCKET_TMP_FILE then atomically rename to BUCKET_FILE.
+    // Write _buckets to _tmpPath then atomically rename to _path.
     bool writeAtomic();
 
     // Initialise _buckets to a valid empty state for the given year.
@@ -104,4 +105,8 @@ private:
     // The primary in-RAM working copy.  Must live on the heap as a class
     // member — 12,104 bytes is too large for any task stack.
     BucketFile _buckets;
+
+    // Full paths of BUCKET_FILE and BUCKET_TMP_FILE, set by begin().
+    char _path[32];
+    char _tmpPath[32];
 };
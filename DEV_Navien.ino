@@ -24,17 +24,18 @@ SOFTWARE.
 #include "esp_mac.h"  // required - exposes esp_mac_type_t values
 #include "FakeGatoScheduler.h"
 #include "FakeGatoHistoryService.h"
-extern Navien navienSerial;
+extern Navien *const navienBuses[NAVIEN_BUSES];
+extern NavienLearner *learners[NAVIEN_BUSES];
 
-// Global so that Telnet can dump history state.
-FakeGatoHistoryService *historyService;
-FakeGatoScheduler *scheduler;
+// Global so that Telnet can dump history state. One per bus.
+FakeGatoHistoryService *historyServices[NAVIEN_BUSES];
+FakeGatoScheduler *schedulers[NAVIEN_BUSES];
 
 CUSTOM_CHAR(ValvePosition, E863F12E-079E-48FF-8F27-9C2605A29F52, PR+EV, UINT8, 0, 0, 100, true);
 CUSTOM_CHAR_DATA(ProgramCommand, E863F12C-079E-48FF-8F27-9C2605A29F52, PW + EV);
 
-Characteristic::FirmwareRevision *firmwareRevision;
-Characteristic::HardwareRevision *hardwareRevision;
+Characteristic::FirmwareRevision *firmwareRevision[NAVIEN_BUSES];
+Characteristic::HardwareRevision *hardwareRevision[NAVIEN_BUSES];
 
 struct DEV_Navien : Service::Thermostat {
 
@@ -71,10 +72,17 @@ struct DEV_Navien : Service::Thermostat {
 
   bool accessoryInfoSet = false;
   bool activelyControllingUnit = false;
+  uint32_t cascadeSequence = 0;  // Last state.cascade update shown
 
-  DEV_Navien()
-    : Service::Thermostat() {
-    Serial.printf("\n*** Creating Navien Thermostat***\n");
+  // The heater this thermostat shows and controls
+  uint8_t bus;
+  Navien &navien;
+  FakeGatoScheduler *scheduler;
+  FakeGatoHistoryService *historyService;
+
+  DEV_Navien(uint8_t bus)
+    : Service::Thermostat(), bus(bus), navien(*navienBuses[bus]) {
+    Serial.printf("\n*** Creating Navien Thermostat %u ***\n", bus);
 
     // Current Heating Cooling State (Read-Only)
     currentState = new Characteristic::CurrentHeatingCoolingState();
@@ -97,11 +105,22 @@ struct DEV_Navien : Service::Thermostat {
     programCommand = new Characteristic::ProgramCommand();
     // Create the scheduler class that will handle schedule management
     // and operations.
-    scheduler = new FakeGatoScheduler();
+    scheduler = schedulers[bus] = new FakeGatoScheduler(navien, learners[bus], bus);
     scheduler->begin();
 
     // Create a history service
-    historyService = new FakeGatoHistoryService();
+    historyService = historyServices[bus] = new FakeGatoHistoryService(bus);
+
+    // Commands are retried by Navien until the heater reports them, only
+    // the outcome is logged here
+    navien.onCommandComplete([](Navien::SendKind kind, uint8_t arg, Navien::CommandResult result, void *context) {
+      static const char *results[] = { "confirmed", "superseded", "failed", "dropped" };
+#if NAVIEN_BUSES > 1
+      WEBLOG("Bus %u: command %s(%u) %s\n", ((Navien *)context)->busId(), Navien::sendKindName(kind), arg, results[result]);
+#else
+      WEBLOG("Command %s(%u) %s\n", Navien::sendKindName(kind), arg, results[result]);
+#endif
+    }, &navien);
   }
 
   boolean update() override {
@@ -112,9 +131,9 @@ struct DEV_Navien : Service::Thermostat {
       // Check to see if the user overrides current schedule
       switch (targetState->getNewVal()) {
         case OFF:
-          if (navienSerial.currentState()->water[0].recirculation_active) {
-            ret = navienSerial.recirculation(0);
-            WEBLOG("Ignore schedule, turning off recirculation: %s\n", ret > 0 ? "Success" : "Failed");
+          if (navien.currentState()->water[0].recirculation_active) {
+            ret = navien.recirculation(0);
+            WEBLOG("Ignore schedule, turning off recirculation: %s\n", ret >= 0 ? "Queued" : "Failed");
           } else {
             WEBLOG("Ignore schedule, leaving recirculation off\n");
           }
@@ -141,8 +160,8 @@ struct DEV_Navien : Service::Thermostat {
       // Ignore temparature requests that are not valid
       float newSetPoint = targetTemp->getNewVal<float>();
       if (newSetPoint >= Navien::TEMPERATURE_MIN && newSetPoint <= Navien::TEMPERATURE_MAX) {
-        ret = navienSerial.setTemp(targetTemp->getNewVal<float>());
-        WEBLOG("Temperature target changed to %s: %s\n", temp2String(targetTemp->getNewVal<float>()).c_str(), ret > 0 ? "Success" : "Failed");
+        ret = navien.setTemp(targetTemp->getNewVal<float>());
+        WEBLOG("Temperature target changed to %s: %s\n", temp2String(targetTemp->getNewVal<float>()).c_str(), ret >= 0 ? "Queued" : "Failed");
       } else {
         WEBLOG("Ignoring Temperature target of %s as it is out of range", temp2String(targetTemp->getNewVal<float>()).c_str());
       }
@@ -165,28 +184,33 @@ struct DEV_Navien : Service::Thermostat {
     // Is the scheduler ready
     if (scheduler->getCurrentState() != SchedulerBase::Unknown) {
       // Are we taking over controlling the unit
-      if (!activelyControllingUnit && navienSerial.controlAvailable()) {
+      if (!activelyControllingUnit && navien.controlAvailable()) {
         WEBLOG("No Navilink present, taking control of Navien and setting initial state");
         activelyControllingUnit = true;
         takeControl();
-      } else if (activelyControllingUnit && !navienSerial.controlAvailable()) {
+      } else if (activelyControllingUnit && !navien.controlAvailable()) {
         WEBLOG("Navilink present, no longer controlling the unit");
         activelyControllingUnit = false;
       }
     }
 
-    float outletTemp = navienSerial.currentState()->gas.outlet_temp;
+    float outletTemp = navien.currentState()->gas.outlet_temp;
     if (currentTemp->timeVal() > 5000 && fabs(currentTemp->getVal<float>() - outletTemp) > 0.50) {  // if it's been more than 5 seconds since last update, and temperature has changed
       currentTemp->setVal(outletTemp);
       //Serial.printf("Navien current Temperature is %s.\n", temp2String(currentTemp->getNewVal<float>()).c_str());
     }
 
-    int operatingCap = (int)roundf(navienSerial.currentState()->water[0].operating_capacity);
-    if (operatingCap != valvePosition->getVal()) {
-      valvePosition->setVal(operatingCap);
+    // Mean across cascaded units; only look again after the totals move
+    const Navien::NAVIEN_STATE_CASCADE &cascade = navien.currentState()->cascade;
+    if (cascade.sequence != cascadeSequence) {
+      cascadeSequence = cascade.sequence;
+      int operatingCap = (int)roundf(cascade.mean_capacity());
+      if (operatingCap != valvePosition->getVal()) {
+        valvePosition->setVal(operatingCap);
+      }
     }
 
-    if (!scheduler->enabled() && !navienSerial.currentState()->water[0].external_recirculation && !navienSerial.currentState()->water[0].internal_recirculation) {
+    if (!scheduler->enabled() && !navien.currentState()->water[0].external_recirculation && !navien.currentState()->water[0].internal_recirculation) {
       programMode.setVal(0);
     } else if (scheduler->getCurrentState() == SchedulerBase::Override) {
       programMode.setVal(2);
@@ -196,16 +220,16 @@ struct DEV_Navien : Service::Thermostat {
 
     // Navien is actively maintaining the set point
     bool navienActivelyMaintainingTemp = 
-      navienSerial.currentState()->water[0].recirculation_active || navienSerial.currentState()->gas.current_gas_usage > 0;
+      navien.currentState()->water[0].recirculation_active || navien.currentState()->gas.current_gas_usage > 0;
 
-    float setTemp = navienSerial.currentState()->gas.set_temp;
+    float setTemp = navien.currentState()->gas.set_temp;
     if ((targetTemp->getVal<float>() != setTemp) && (setTemp >= Navien::TEMPERATURE_MIN) && (setTemp <= Navien::TEMPERATURE_MAX)) {
       targetTemp->setVal(setTemp);
       Serial.printf("Navien target Temperature is %s.\n", temp2String(targetTemp->getNewVal<float>()).c_str());
     }
 
     // Check the state of the Navien and update appropriately
-    int heating_state = navienSerial.currentState()->gas.current_gas_usage > 0 ? HEATING : IDLE;
+    int heating_state = navien.currentState()->gas.current_gas_usage > 0 ? HEATING : IDLE;
     if (currentState->getVal() != heating_state) {
       Serial.printf("Updating heat state %d\n", heating_state);
       currentState->setVal(heating_state);
@@ -224,7 +248,7 @@ struct DEV_Navien : Service::Thermostat {
     }
 
         // display_metric is 1 for Metric, 0 for Imperial.
-    bool display_metric = navienSerial.currentState()->water[0].display_metric;
+    bool display_metric = navien.currentState()->water[0].display_metric;
     if (display_metric && displayUnits.getVal() != CELSIUS) {
       displayUnits.setVal(CELSIUS);
     } else if (!display_metric && displayUnits.getVal() != FAHRENHEIT) {
@@ -233,15 +257,15 @@ struct DEV_Navien : Service::Thermostat {
 
     // Try updating the version number
     if (!accessoryInfoSet) {
-      firmwareRevision->setString(String(navienSerial.currentState()->gas.controller_version).c_str());
-      hardwareRevision->setString(String(navienSerial.currentState()->gas.panel_version).c_str());
+      firmwareRevision[bus]->setString(String(navien.currentState()->gas.controller_version).c_str());
+      hardwareRevision[bus]->setString(String(navien.currentState()->gas.panel_version).c_str());
       accessoryInfoSet = true;
     }
 
     // Make the logging pretty. Bounce the setTemp in the log *only* between the actual setTemp when
     // it is heating and Navien's min temperature when it isn't
     float logSetTemp = navienActivelyMaintainingTemp ? setTemp : Navien::TEMPERATURE_MIN;
-    historyService->accumulateLogEntry(outletTemp, logSetTemp, (uint8_t)operatingCap, targetState->getVal(), 0);
+    historyService->accumulateLogEntry(outletTemp, logSetTemp, (uint8_t)valvePosition->getVal(), targetState->getVal(), 0);
   
     scheduler->loop();
   }
@@ -256,35 +280,38 @@ struct DEV_Navien : Service::Thermostat {
 
   void takeControl() {
     // When a NaviLink unit disappears, the Navien state changes.
-    // We need to set the Navien to the state the scheduler expects
+    // We need to set the Navien to the state the scheduler expects.
+    // Navien retries each command until the heater reports it, so one
+    // already pending (e.g. from the scheduler) is not sent again.
 
     // Do nothing if the scheduler is not enabled
     if (!scheduler->enabled()) {
       return;
     }
 
+    const Navien::NAVIEN_STATE_WATER &water = navien.currentState()->water[0];
     switch (scheduler->getCurrentState()) {
       case SchedulerBase::InActive:
         // Unit should be on and Reciculation should be off
-        if (!navienSerial.currentState()->water[0].system_power)
-          navienSerial.power(1);
-        if (navienSerial.currentState()->water[0].recirculation_active)
-          navienSerial.recirculation(0);
+        if (!water.system_power && !navien.commandPending(Navien::SEND_POWER, 1))
+          navien.power(1);
+        if (water.recirculation_active && !navien.commandPending(Navien::SEND_RECIRCULATION, 0))
+          navien.recirculation(0);
         break;
 
       case SchedulerBase::Active:
       case SchedulerBase::Override:
         // Unit should be on and Reciculation should be on
-        if (!navienSerial.currentState()->water[0].system_power)
-          navienSerial.power(1);
-        if (!navienSerial.currentState()->water[0].recirculation_active)
-          navienSerial.recirculation(0);
+        if (!water.system_power && !navien.commandPending(Navien::SEND_POWER, 1))
+          navien.power(1);
+        if (!water.recirculation_active && !navien.commandPending(Navien::SEND_RECIRCULATION, 1))
+          navien.recirculation(1);
         break;
 
       case SchedulerBase::Vacation:
         // Unit should be Off
-        if (navienSerial.currentState()->water[0].system_power)
-          navienSerial.power(0);
+        if (water.system_power && !navien.commandPending(Navien::SEND_POWER, 0))
+          navien.power(0);
       break;
     }
   }
@@ -293,10 +320,13 @@ struct DEV_Navien : Service::Thermostat {
 struct DEV_HotWaterSwitch : Service::Switch {
 
   Characteristic::On *switchOn;
+  Navien &navien;
+  FakeGatoScheduler *scheduler;
 
-  DEV_HotWaterSwitch()
-    : Service::Switch() {
-    Serial.printf("\n*** Creating Hot Water Switch ***\n");
+  // Created after the bus's DEV_Navien, which owns the scheduler
+  DEV_HotWaterSwitch(uint8_t bus)
+    : Service::Switch(), navien(*navienBuses[bus]), scheduler(schedulers[bus]) {
+    Serial.printf("\n*** Creating Hot Water Switch %u ***\n", bus);
     switchOn = new Characteristic::On(false);
   }
 
@@ -319,8 +349,8 @@ struct DEV_HotWaterSwitch : Service::Switch {
 
   void loop() override {
     bool navienActivelyMaintainingTemp =
-      navienSerial.currentState()->water[0].recirculation_active ||
-      navienSerial.currentState()->gas.current_gas_usage > 0;
+      navien.currentState()->water[0].recirculation_active ||
+      navien.currentState()->gas.current_gas_usage > 0;
 
     if (switchOn->getVal<bool>() != navienActivelyMaintainingTemp) {
       switchOn->setVal(navienActivelyMaintainingTemp);
@@ -345,25 +375,34 @@ String getSerialNumber() {
   return mac;
 }
 
+// A thermostat and hot water switch per bus. Bus 0 keeps the original
+// names and serial numbers so existing pairings are not disturbed.
 void setupHomeSpanAccessories() {
 
-  new SpanAccessory();
-  new Service::AccessoryInformation();
-  new Characteristic::Identify();
-  new Characteristic::Manufacturer("Navien");
-  new Characteristic::Model("NPE-240A");
-  firmwareRevision = new Characteristic::FirmwareRevision("-");
-  hardwareRevision = new Characteristic::HardwareRevision("-");
-  new Characteristic::SerialNumber(getSerialNumber().c_str());
-
-  new DEV_Navien();
-
-  new SpanAccessory();
-  new Service::AccessoryInformation();
-  new Characteristic::Identify();
-  new Characteristic::Name("Hot Water");
-  new Characteristic::Manufacturer("Navien");
-  new Characteristic::Model("NPE-240A");
-  new Characteristic::SerialNumber((getSerialNumber() + "-SW").c_str());
-  new DEV_HotWaterSwitch();
+  for (uint8_t bus = 0; bus < NAVIEN_BUSES; bus++) {
+    String suffix = bus ? String(" ") + (bus + 1) : String();
+    String serial = getSerialNumber() + (bus ? String("-") + bus : String());
+
+    new SpanAccessory();
+    new Service::AccessoryInformation();
+    new Characteristic::Identify();
+    if (bus)
+      new Characteristic::Name(("Navien" + suffix).c_str());
+    new Characteristic::Manufacturer("Navien");
+    new Characteristic::Model("NPE-240A");
+    firmwareRevision[bus] = new Characteristic::FirmwareRevision("-");
+    hardwareRevision[bus] = new Characteristic::HardwareRevision("-");
+    new Characteristic::SerialNumber(serial.c_str());
+
+    new DEV_Navien(bus);
+
+    new SpanAccessory();
+    new Service::AccessoryInformation();
+    new Characteristic::Identify();
+    new Characteristic::Name(("Hot Water" + suffix).c_str());
+    new Characteristic::Manufacturer("Navien");
+    new Characteristic::Model("NPE-240A");
+    new Characteristic::SerialNumber((serial + "-SW").c_str());
+    new DEV_HotWaterSwitch(bus);
+  }
 }
@@ -32,10 +32,16 @@
 #define LOG_ENTRY_FREQ_ONE_MIN  60000
 #define HISTORY_FILE "/history.bin"
 
-FakeGatoHistoryService::FakeGatoHistoryService() 
+FakeGatoHistoryService::FakeGatoHistoryService(uint8_t bus) 
   : Service::FakeGatoHistoryData(), logInterval(LOG_ENTRY_FREQ_TEN_MIN) {
     Serial.println(F("Configuring Eve History Service"));
 
+    // Bus 0 keeps the original file name
+    if (bus == 0)
+      strcpy(historyFile, HISTORY_FILE);
+    else
+      snprintf(historyFile, sizeof(historyFile), "/history%u.bin", bus);
+
     if (!LittleFS.begin(true)) {
       Serial.println("LittleFS Mount Failed");
     }
@@ -228,7 +234,7 @@ void FakeGatoHistoryService::printData(uint8_t *data, int len) {
 }
 
 bool FakeGatoHistoryService::saveHistory() {
-    File file = LittleFS.open(HISTORY_FILE, "w");
+    File file = LittleFS.open(historyFile, "w");
     if (!file) return false;
     size_t written = file.write((uint8_t*)&store, sizeof(PersistHistoryData));
     file.close();
@@ -236,7 +242,7 @@ bool FakeGatoHistoryService::saveHistory() {
 }
 
 bool FakeGatoHistoryService::loadHistory() {
-    File file = LittleFS.open(HISTORY_FILE, "r");
+    File file = LittleFS.open(historyFile, "r");
     if (!file) return false;
     size_t readBytes = file.read((uint8_t*)&store, sizeof(PersistHistoryData));
     file.close();
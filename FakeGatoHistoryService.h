@@ -88,7 +88,7 @@ struct AveragedEntry {
 
 class FakeGatoHistoryService : public Service::FakeGatoHistoryData {
 public:
-    FakeGatoHistoryService();
+    FakeGatoHistoryService(uint8_t bus = 0);
     void accumulateLogEntry(float currentTemp, float targetTemp, uint8_t valvePercent, uint8_t thermoTarget, uint8_t openWindow);
     void generateTimedHistoryEntry();
     void addHistoryEntry(float currentTemp, float targetTemp, uint8_t valvePercent, uint8_t thermoTarget, uint8_t openWindow);
@@ -113,5 +113,6 @@ private:
     bool restarted = true;
     bool sendTime = true;
     int logInterval;
+    char historyFile[16];
     void printData(uint8_t *data, int len);
 };
\ No newline at end of file
@@ -30,16 +30,16 @@
 #include <climits>
 #include <cmath>
 
-extern Navien navienSerial;
-extern NavienLearner *learner;
-
-FakeGatoScheduler::FakeGatoScheduler()
-: SchedulerBase() {
+FakeGatoScheduler::FakeGatoScheduler(Navien &navien, NavienLearner *learner, uint8_t bus)
+: SchedulerBase(), navien(navien), learner(learner) {
 
   programData = new Characteristic::ProgramData();
   
+  char nvsName[16];
+  savedDataNamespace(bus, nvsName, sizeof(nvsName));
+
   size_t len;
-  nvs_open("SAVED_DATA",NVS_READWRITE,&savedData);       // open a new namespace called SAVED_DATA in the NVS
+  nvs_open(nvsName,NVS_READWRITE,&savedData);       // open this bus's namespace (SAVED_DATA, SAVED_DATA1, ...) in the NVS
   if(!nvs_get_blob(savedData,"PROG_SEND_DATA",NULL,&len)) {        // if PROG_SEND_DATA data found
     nvs_get_blob(savedData,"PROG_SEND_DATA",&prog_send_data,&len);       // retrieve data
     loadSlotScoresFromStorage();
@@ -76,6 +76,15 @@ FakeGatoScheduler::FakeGatoScheduler()
   refreshProgramData = true;
 }
 
+// Bus 0 keeps the original namespace so existing schedules survive
+// adding a second heater.
+void FakeGatoScheduler::savedDataNamespace(uint8_t bus, char *name, size_t size) {
+  if (bus == 0)
+    snprintf(name, size, "SAVED_DATA");
+  else
+    snprintf(name, size, "SAVED_DATA%u", bus);
+}
+
 void FakeGatoScheduler::resetSlotScores() {
   for (int d = 0; d < 7; d++) {
     for (int s = 0; s < SLOT_SCORE_STORAGE_SLOTS; s++) {
@@ -156,29 +165,29 @@ void FakeGatoScheduler::stateChange(State newState){
       // Fall through
     case State::Active:
       WEBLOG("SCHEDULER going Active %s", newState == State::Override ? "- Override" : "" );
-      if (!navienSerial.currentState()->water[0].system_power)
-        navienSerial.power(true);
-      if (!navienSerial.currentState()->water[0].recirculation_active)
-        if (navienSerial.recirculation(true) == -1)
+      if (!navien.currentState()->water[0].system_power)
+        navien.power(true);
+      if (!navien.currentState()->water[0].recirculation_active)
+        if (navien.recirculation(true) == -1)
           WEBLOG("Failed to enable Recirculation.");
         // ignore setpoints as they only go to 30 degC
-        //navienSerial.setTemp(0.5 * prog_send_data.temperatures.comfortScheduleTemp);
+        //navien.setTemp(0.5 * prog_send_data.temperatures.comfortScheduleTemp);
       break;
       
     case State::InActive:
       WEBLOG("SCHEDULER going Inactive");
-      if (!navienSerial.currentState()->water[0].system_power)
-        navienSerial.power(true);
-      if (navienSerial.recirculation(false) == -1)
+      if (!navien.currentState()->water[0].system_power)
+        navien.power(true);
+      if (navien.recirculation(false) == -1)
         WEBLOG("Failed to disable Recirculation.");
         // ignore setpoints as they only go to 30 degC
-        //navienSerial.setTemp(0.5 * prog_send_data.temperatures.comfortScheduleTemp);
+        //navien.setTemp(0.5 * prog_send_data.temperatures.comfortScheduleTemp);
       break;
       
     case State::Vacation:
       WEBLOG("SCHEDULER going Vacation");
-      navienSerial.recirculation(false);
-      if (navienSerial.power(false) == -1)
+      navien.recirculation(false);
+      if (navien.power(false) == -1)
         WEBLOG("Failed to turn power off");
       break;
   }
@@ -400,8 +409,8 @@ void FakeGatoScheduler::parseProgramData(uint8_t *data, int len) {
         // Eve app only allows up to 30degC/86degF
         prog_send_data.temperatures.header = TEMPERATURES;
         prog_send_data.temperatures.unknown = 0x00;
-        prog_send_data.temperatures.defaultTemp = navienSerial.currentState()->gas.set_temp * 2;
-        prog_send_data.temperatures.comfortScheduleTemp = navienSerial.currentState()->gas.set_temp * 2;
+        prog_send_data.temperatures.defaultTemp = navien.currentState()->gas.set_temp * 2;
+        prog_send_data.temperatures.comfortScheduleTemp = navien.currentState()->gas.set_temp * 2;
         prog_send_data.temperatures.economyScheduleTemp = Navien::TEMPERATURE_MIN;
         byte_offset += sizeof(PROG_CMD_TEMPERATURES);
         storeData = true;
@@ -614,7 +623,7 @@ bool FakeGatoScheduler::setWeekScheduleFromJSON(const String &json) {
 
 int FakeGatoScheduler::begin() {
   if (SchedulerBase::begin()) {
-    // Check schedVersion in SAVED_DATA.  Any firmware prior to Phase 3 stored
+    // Check schedVersion in this bus's namespace.  Any firmware prior to Phase 3 stored
     // local-time slots; version 1 means slots are already UTC.  If missing or
     // wrong, clear the schedule so the user re-pushes from Eve (which will
     // then convert via convertEveSlotsToUTC on the next write).
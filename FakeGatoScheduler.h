@@ -26,6 +26,9 @@
 #include "HomeSpan.h"
 #include <math.h>
 
+class Navien;
+class NavienLearner;
+
   // Custom Characteristics.
 CUSTOM_CHAR_DATA(ProgramData, E863F12F-079E-48FF-8F27-9C2605A29F52, PR + EV);
 
@@ -34,7 +37,9 @@ public:
   static constexpr int ACTIVE_SLOT_LIMIT = 3;  // keep in sync with PeakFinder MAX_SLOTS_PER_DAY
   static constexpr int SLOT_SCORE_STORAGE_SLOTS = 4;  // mirrors Eve wire struct slot[4]
 
-  FakeGatoScheduler();
+  // Drives recirculation on navien and applies schedules produced by
+  // learner (may be NULL). Program state is kept per bus in NVS.
+  FakeGatoScheduler(Navien &navien, NavienLearner *learner, uint8_t bus = 0);
   virtual ~FakeGatoScheduler() {}
   
   virtual int begin();
@@ -50,6 +55,9 @@ public:
 
   static String getSchedulerState(int state); // Return the state as a string
 
+  // NVS namespace holding the program state of a bus's scheduler
+  static void savedDataNamespace(uint8_t bus, char *name, size_t size);
+
   // When the Service recieves Eve Program Data,
   // this function is called to process it.
   void parseProgramData(uint8_t *data, int len);
@@ -118,6 +126,8 @@ protected:
   static void printDaySchedule(CMD_DAY_SCHEDULE *daySchedule);
   
   Characteristic::ProgramData *programData;
+  Navien &navien;
+  NavienLearner *learner;
   
   nvs_handle savedData;
   bool refreshProgramData; // Keep track to see if we need to refresh the data sent for Program Data
@@ -24,10 +24,11 @@ SOFTWARE.
 
 #include "FakeGatoScheduler.h"
 #include "NavienLearner.h"
-extern FakeGatoScheduler* scheduler;
-extern NavienLearner *learner;
+extern Navien *const navienBuses[NAVIEN_BUSES];
+extern FakeGatoScheduler* schedulers[NAVIEN_BUSES];
+extern NavienLearner *learners[NAVIEN_BUSES];
 
-String getNextTransitionTime() {
+String getNextTransitionTime(const FakeGatoScheduler *scheduler) {
   time_t nextStateTime;
   scheduler->getNextState(&nextStateTime);
 
@@ -44,7 +45,7 @@ String getNextTransitionTime() {
     return formattedTime;
 }
 
-String getNextTransitionState() {
+String getNextTransitionState(const FakeGatoScheduler *scheduler) {
   time_t nextStateTime;
   int state = scheduler->getNextState(&nextStateTime);
   
@@ -55,12 +56,11 @@ String getNextTransitionState() {
     return FakeGatoScheduler::getSchedulerState(state);
 }
 
-String getSystemStageName(int idx) {
-    const auto &w = navienSerial.currentState()->water[idx];
-    if (w.stage_shutting_down) return "Shutting Down";
-    if (w.stage_active)        return "Active";
-    if (w.stage_starting)      return "Starting";
-    if (w.stage_idle)          return "Idle";
+String getSystemStageName(const Navien::NAVIEN_STATE_WATER &w) {
+    if (w.stage_shutting_down()) return "Shutting Down";
+    if (w.stage_active())      return "Active";
+    if (w.stage_starting())    return "Starting";
+    if (w.stage_idle())        return "Idle";
     return "Unknown";
 }
 
@@ -92,52 +92,65 @@ String getFormattedTime() {
     return String(timeString);
 }
 
-void navienStatus(String &html) {
-  float setTemp = navienSerial.currentState()->gas.set_temp;
-  float outletTemp = navienSerial.currentState()->gas.outlet_temp;
-  float inletTemp = navienSerial.currentState()->gas.inlet_temp;
+// One heater's cards; the first also carries the unit toggle
+void heaterStatus(String &html, uint8_t bus) {
+  Navien &navien = *navienBuses[bus];
+  FakeGatoScheduler *scheduler = schedulers[bus];
+  NavienLearner *learner = learners[bus];
 
-  uint16_t currentGasUsage = navienSerial.currentState()->gas.current_gas_usage;
-  uint16_t targetGasUsage = navienSerial.currentState()->gas.target_gas_usage;
-  float accumulatedGasUsage = navienSerial.currentState()->gas.accumulated_gas_usage;
-  float accumulatedWaterUsage = navienSerial.currentState()->gas.accumulated_water_usage;
+  float setTemp = navien.currentState()->gas.set_temp;
+  float outletTemp = navien.currentState()->gas.outlet_temp;
+  float inletTemp = navien.currentState()->gas.inlet_temp;
 
-  char buffer[25];
-  float domesticFlowRate = navienSerial.currentState()->water[0].flow_lpm;
+  uint16_t currentGasUsage = navien.currentState()->gas.current_gas_usage;
+  uint16_t targetGasUsage = navien.currentState()->gas.target_gas_usage;
+  float accumulatedGasUsage = navien.currentState()->gas.accumulated_gas_usage;
+  float accumulatedWaterUsage = navien.currentState()->gas.accumulated_water_usage;
 
-  html = "<h3>Controller: "
-    + String(navienSerial.currentState()->gas.controller_version)
+  char buffer[25];
+  // Totals across cascaded units, kept by Navien as packets arrive
+  const Navien::NAVIEN_STATE_CASCADE &cascade = navien.currentState()->cascade;
+  float domesticFlowRate = cascade.flow_lpm();
+
+  if (NAVIEN_BUSES > 1)
+    html += "<h2>Bus " + String(bus) + "</h2>";
+  html += "<h3>Controller: "
+    + String(navien.currentState()->gas.controller_version)
     + " Panel: "
-    + String(navienSerial.currentState()->gas.panel_version)
+    + String(navien.currentState()->gas.panel_version)
     + "</h3>";
 
-  html += "<div class='toggle-container'>"
-    "<label class='switch'>"
-    "<input type='checkbox' id='unitToggle'>"
-    "<span class='slider'></span>"
-    "</label><span class='toggle-label'>Units</span></div>";
+  if (bus == 0)
+    html += "<div class='toggle-container'>"
+      "<label class='switch'>"
+      "<input type='checkbox' id='unitToggle'>"
+      "<span class='slider'></span>"
+      "</label><span class='toggle-label'>Units</span></div>";
 
 
   html += "<div class='status-container'>";
-  for (int i = 0; i <= navienSerial.currentState()->max_water_devices_seen; i++) {
+  for (int i = 0; i <= navien.currentState()->max_water_devices_seen; i++) {
     if (i == 0) {
-      html += statusCard("Hotwater Power", (navienSerial.currentState()->water[i].system_power ? "status-ok" : "status-error"), String(navienSerial.currentState()->water[i].system_power ? "On":"Off" ));
-      html += statusCard("NaviLink Control", navienSerial.currentState()->announce.navilink_present ? "status-warning" : "status-ok", navienSerial.currentState()->announce.navilink_present ? "Present" : "Not Present");
-      html += statusCard("Domestic Consumption", (navienSerial.currentState()->water[i].consumption_active ? "status-warning" :"status-ok"), String(navienSerial.currentState()->water[i].consumption_active ? "Yes":"No"));
-      html += statusCard("System Stage", !navienSerial.currentState()->water[i].stage_idle ? "status-warning" : "status-ok", getSystemStageName(i));
+      html += statusCard("Hotwater Power", (navien.currentState()->water[i].system_power ? "status-ok" : "status-error"), String(navien.currentState()->water[i].system_power ? "On":"Off" ));
+      html += statusCard("NaviLink Control", navien.currentState()->announce.navilink_present ? "status-warning" : "status-ok", navien.currentState()->announce.navilink_present ? "Present" : "Not Present");
+      html += statusCard("Domestic Consumption", (navien.currentState()->water[i].consumption_active ? "status-warning" :"status-ok"), String(navien.currentState()->water[i].consumption_active ? "Yes":"No"));
+      html += statusCard("System Stage", !navien.currentState()->water[i].stage_idle() ? "status-warning" : "status-ok", getSystemStageName(navien.currentState()->water[i]));
     } else {
       sprintf(buffer, "Hotwater Power [%d]", i);
-      html += statusCard(buffer, (navienSerial.currentState()->water[i].system_power ? "status-ok" : "status-error"), String(navienSerial.currentState()->water[i].system_power ? "On":"Off" ));
+      html += statusCard(buffer, (navien.currentState()->water[i].system_power ? "status-ok" : "status-error"), String(navien.currentState()->water[i].system_power ? "On":"Off" ));
       sprintf(buffer, "Domestic Consumption [%d]", i);
-      html += statusCard(buffer, (navienSerial.currentState()->water[i].consumption_active ? "status-warning" :"status-ok"), String(navienSerial.currentState()->water[i].consumption_active ? "Yes":"No"));
+      html += statusCard(buffer, (navien.currentState()->water[i].consumption_active ? "status-warning" :"status-ok"), String(navien.currentState()->water[i].consumption_active ? "Yes":"No"));
       sprintf(buffer, "System Stage [%d]", i);
-      html += statusCard(buffer, !navienSerial.currentState()->water[i].stage_idle ? "status-warning" : "status-ok", getSystemStageName(i));
+      html += statusCard(buffer, !navien.currentState()->water[i].stage_idle() ? "status-warning" : "status-ok", getSystemStageName(navien.currentState()->water[i]));
     }
   }
 
     html += statusCard("Current Gas Usage", currentGasUsage > 0 ? "status-warning" :"status-ok", String(currentGasUsage) + " kcal", String(3.96567 * currentGasUsage) + " BTU" );
     html += statusCard("Target Gas Usage", targetGasUsage > 0 ? "status-warning" : "status-ok", String(targetGasUsage) + " kcal", String(3.96567 * targetGasUsage) + " BTU");
-    html += statusCard("Operating Capacity", navienSerial.currentState()->water[0].operating_capacity > 0 ? "status-warning" : "status-ok", String(navienSerial.currentState()->water[0].operating_capacity) + " %");
+    html += statusCard("Operating Capacity", cascade.mean_capacity() > 0 ? "status-warning" : "status-ok", String(cascade.mean_capacity()) + " %");
+    if (cascade.units > 1) {
+      html += statusCard("Units Firing", cascade.units_firing > 0 ? "status-warning" : "status-ok", String(cascade.units_firing) + " / " + String(cascade.units));
+    }
     html += statusCard("Domestic Flow Rate", domesticFlowRate > 0 ? "status-warning": "status-ok", String(domesticFlowRate) + " lpm", String(domesticFlowRate * 0.264172) + " GPM");
 
     html += statusCard("Domestic Outlet Set Temp",  "status-ok", String(setTemp) + " &deg;C", String((setTemp * 9.0 / 5.0) + 32) + " &deg;F");
@@ -147,40 +160,47 @@ void navienStatus(String &html) {
     html += statusCard("Accumulated Gas", "status-ok", String(accumulatedGasUsage) + " m<sup>3</sup>", String(accumulatedGasUsage * 35315.0 / 100000) + " Therms" );
     html += statusCard("Accumulated Water", "status-ok", String(accumulatedWaterUsage) + " L", String(accumulatedWaterUsage / 3.78541) + " gal");
 
-    html += statusCard("Total Operating Time", "status-ok", (String(navienSerial.currentState()->gas.total_operating_time / 60.0) + " hr"));
-    html += statusCard("Days Since Install", "status-ok", String(navienSerial.currentState()->gas.elapsed_install_days) + " days");
+    html += statusCard("Total Operating Time", "status-ok", (String(navien.currentState()->gas.total_operating_time / 60.0) + " hr"));
+    html += statusCard("Days Since Install", "status-ok", String(navien.currentState()->gas.elapsed_install_days) + " days");
 
-  for (int i = 0; i <= navienSerial.currentState()->max_water_devices_seen; i++) {
+  for (int i = 0; i <= navien.currentState()->max_water_devices_seen; i++) {
     if (i == 0) {
-      html += statusCard("Recirculation Config.", navienSerial.currentState()->water[i].external_recirculation || navienSerial.currentState()->water[i].internal_recirculation ? "status-warning" :"status-ok", navienSerial.currentState()->water[i].external_recirculation || navienSerial.currentState()->water[i].internal_recirculation ? "Active":"Inactive");
-      html += statusCard("Recirculation", navienSerial.currentState()->water[i].recirculation_active ? "status-warning" :"status-ok", navienSerial.currentState()->water[i].recirculation_active ? "Active":"Inactive");
-      html += statusCard("Recirculation Pump", navienSerial.currentState()->water[i].recirculation_running ? "status-warning" :"status-ok", navienSerial.currentState()->water[i].recirculation_running ? "Running":"Stopped");
+      html += statusCard("Recirculation Config.", navien.currentState()->water[i].external_recirculation || navien.currentState()->water[i].internal_recirculation ? "status-warning" :"status-ok", navien.currentState()->water[i].external_recirculation || navien.currentState()->water[i].internal_recirculation ? "Active":"Inactive");
+      html += statusCard("Recirculation", navien.currentState()->water[i].recirculation_active ? "status-warning" :"status-ok", navien.currentState()->water[i].recirculation_active ? "Active":"Inactive");
+      html += statusCard("Recirculation Pump", navien.currentState()->water[i].recirculation_running ? "status-warning" :"status-ok", navien.currentState()->water[i].recirculation_running ? "Running":"Stopped");
     } else {
       sprintf(buffer, "Recirculation Config. [%d]", i);
-      html += statusCard(buffer, navienSerial.currentState()->water[i].external_recirculation || navienSerial.currentState()->water[i].internal_recirculation ? "status-warning" :"status-ok", navienSerial.currentState()->water[i].external_recirculation || navienSerial.currentState()->water[i].internal_recirculation ? "Active":"Inactive");
+      html += statusCard(buffer, navien.currentState()->water[i].external_recirculation || navien.currentState()->water[i].internal_recirculation ? "status-warning" :"status-ok", navien.currentState()->water[i].external_recirculation || navien.currentState()->water[i].internal_recirculation ? "Active":"Inactive");
       sprintf(buffer, "Operating Capacity [%d]", i);
-      html += statusCard(buffer, navienSerial.currentState()->water[i].operating_capacity > 0 ? "status-warning" :"status-ok", (String(navienSerial.currentState()->water[i].operating_capacity) + " %"));
+      html += statusCard(buffer, navien.currentState()->water[i].operating_capacity() > 0 ? "status-warning" :"status-ok", (String(navien.currentState()->water[i].operating_capacity()) + " %"));
 
       sprintf(buffer, "Recirculation [%d]", i);
-      html += statusCard(buffer, navienSerial.currentState()->water[i].recirculation_active ? "status-warning" :"status-ok", navienSerial.currentState()->water[i].recirculation_active ? "Active":"Inactive");
+      html += statusCard(buffer, navien.currentState()->water[i].recirculation_active ? "status-warning" :"status-ok", navien.currentState()->water[i].recirculation_active ? "Active":"Inactive");
       sprintf(buffer, "Recirculation Pump [%d]", i);
-      html += statusCard(buffer, navienSerial.currentState()->water[i].recirculation_running ? "status-warning" :"status-ok", navienSerial.currentState()->water[i].recirculation_running ? "Running":"Stopped");
+      html += statusCard(buffer, navien.currentState()->water[i].recirculation_running ? "status-warning" :"status-ok", navien.currentState()->water[i].recirculation_running ? "Running":"Stopped");
     }
   }
     html += "</div>";
 
-    html += "<h2>Scheduler Status</h2>"
-    "<h3>Device Time: <span id='deviceTime'>" + getFormattedTime() + "</span></h3>"
-    + "<div class='status-container'>"
+    html += "<h2>Scheduler Status</h2>";
+    if (bus == 0)
+      html += "<h3>Device Time: <span id='deviceTime'>" + getFormattedTime() + "</span></h3>";
+    html += String("<div class='status-container'>")
     + statusCard("Scheduler Enabled", scheduler->enabled() ? "status-warning" : "status-ok", scheduler->enabled() ? "Yes" : "No")
     + statusCard("Current State", (scheduler->getCurrentState() == FakeGatoScheduler::Active || scheduler->getCurrentState() == FakeGatoScheduler::Override) ? "status-warning" : "status-ok", FakeGatoScheduler::getSchedulerState(scheduler->getCurrentState()))
-    + statusCard("Next Transition", scheduler->enabled() ? "status-warning" : "status-ok", getNextTransitionTime())
-    + statusCard("Next State", "status-ok", getNextTransitionState())
+    + statusCard("Next Transition", scheduler->enabled() ? "status-warning" : "status-ok", getNextTransitionTime(scheduler))
+    + statusCard("Next State", "status-ok", getNextTransitionState(scheduler))
     + "</div>";
 
     if (learner && !learner->isDisabled()) {
         learner->appendStatusHTML(html);
     }
+}
+
+void navienStatus(String &html) {
+    html = String();
+    for (uint8_t bus = 0; bus < NAVIEN_BUSES; bus++)
+      heaterStatus(html, bus);
 
     html += "<h2>System Log</h2>"
     "<style>.tab2{margin: 0 auto;width:80%;border-collapse:collapse;background:#2a2a3a;color:white;}</style>";
@@ -1,6 +1,7 @@
 #!/usr/bin/python3
 
 import argparse
+import select
 import time
 import json
 from pprint import pprint
@@ -24,12 +25,156 @@ optional arguments:
                         InfluxDb password
   --influxdb_db INFLUXDB_DB
                         InfluxDb database name
+  --binary              also decode binary water/gas datagrams (port 2026)
+  --subscribe HOST      ask the controller at HOST to send the records here
+                        instead of broadcasting them, renewed until exit
+  --types TYPES         with --subscribe: water,gas,command,announce,busstats,learner
+  --interval MS         with --subscribe: at most one record per stream per MS
+  --ttl S               with --subscribe: how long a subscription lasts
   -v, --verbose         verbose output to watch the threads
 """
 
 # ESP32 Navien broadcasts on this port
 ADDRESS = ''
 MYPORT = 2025
+# and water / gas as binary datagrams on this one after Telnet "udpformat"
+BINARY_PORT = 2026
+
+# ###########################################################################
+# Binary datagrams: a 10 byte header, then one LEB128 varint per field in
+# the order of the firmware's field tables (NavienFields.h), in counts of
+# the field's scale.  Deltas hold only some fields, named by a bitmap after
+# the header.  Decoded records are the same as the JSON ones.
+
+BINARY_MAGIC = ord('N')
+BINARY_VERSION = 1
+BINARY_BUSES = 0x01  # flag: the record has a bus
+BINARY_DELTA = 0x02  # flag: a field bitmap follows the header
+
+INT, HALF, TENTH = 0, 1, 2
+
+# BEGIN navien_replay --py-fields
+WATER_FIELDS = [
+    ('device_number', INT),
+    ('system_power', INT),
+    ('set_temp', HALF),
+    ('inlet_temp', HALF),
+    ('outlet_temp', HALF),
+    ('flow_lpm', TENTH),
+    ('flow_state', INT),
+    ('recirculation_active', INT),
+    ('recirculation_running', INT),
+    ('display_metric', INT),
+    ('internal_recirculation', INT),
+    ('external_recirculation', INT),
+    ('operating_capacity', HALF),
+    ('consumption_active', INT),
+    ('system_stage', INT),
+    ('stage_idle', INT),
+    ('stage_starting', INT),
+    ('stage_active', INT),
+    ('stage_shutting_down', INT),
+    ('stage_standby', INT),
+    ('stage_demand', INT),
+    ('stage_pre_purge', INT),
+    ('stage_ignition', INT),
+    ('stage_flame_on', INT),
+    ('stage_ramp_up', INT),
+    ('stage_active_combustion', INT),
+    ('stage_water_adjustment', INT),
+    ('stage_flame_off', INT),
+    ('stage_post_purge_1', INT),
+    ('stage_post_purge_2', INT),
+    ('stage_dhw_wait', INT),
+    ('system_active', INT),
+    ('operation_time', INT),
+]
+GAS_FIELDS = [
+    ('controller_version', TENTH),
+    ('set_temp', HALF),
+    ('inlet_temp', HALF),
+    ('outlet_temp', HALF),
+    ('panel_version', TENTH),
+    ('current_gas_usage', INT),
+    ('target_gas_usage', INT),
+    ('accumulated_gas_usage', TENTH),
+    ('accumulated_water_usage', TENTH),
+    ('total_operating_time', INT),
+    ('elapsed_install_days', INT),
+    ('accumulated_domestic_usage_cnt', INT),
+    ('recirculation_enabled', INT),
+]
+# END navien_replay --py-fields
+
+BINARY_KINDS = {1: ('water', WATER_FIELDS), 2: ('gas', GAS_FIELDS)}
+
+def fields_layout(fields):
+    # FNV-1a of every key and scale, folded to 16 bits, as in NavienFields.h
+    h = 2166136261
+    for key, scale in fields:
+        for c in key.encode() + bytes([0, scale]):
+            h = ((h ^ c) * 16777619) & 0xFFFFFFFF
+    return (h ^ (h >> 16)) & 0xFFFF
+
+def decode_binary(msg, pos=0):
+    """The record at pos and where the next one starts; None, None if bad."""
+    if len(msg) < pos + 10 or msg[pos] != BINARY_MAGIC or msg[pos + 1] != BINARY_VERSION:
+        print(f"Not a binary Navien datagram: {msg[pos:]!r}")
+        return None, None
+    kind, flags, bus, unit, sequence, layout = unpack_from('<BBBBHH', msg, pos + 2)
+    if kind not in BINARY_KINDS:
+        print(f"Unknown binary packet kind {kind}")
+        return None, None
+    name, fields = BINARY_KINDS[kind]
+    if layout != fields_layout(fields):
+        print(f"Binary {name} field layout {layout:04x} is not this listener's; "
+              "update it with host/navien_replay --py-fields")
+        return None, None
+
+    data = {'type': name, 'seq': sequence}
+    if flags & BINARY_BUSES:
+        data['bus'] = bus
+    pos += 10
+    present = (1 << len(fields)) - 1
+    if flags & BINARY_DELTA:
+        size = (len(fields) + 7) // 8
+        present = int.from_bytes(msg[pos:pos + size], 'little')
+        pos += size
+        data['delta'] = 1
+    for i, (field, scale) in enumerate(fields):
+        if not present >> i & 1:
+            continue
+        value = shift = 0
+        while True:
+            if pos >= len(msg):
+                print(f"Binary {name} datagram is truncated")
+                return None, None
+            byte = msg[pos]
+            pos += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        data[field] = value / 2 if scale == HALF else value / 10 if scale == TENTH else value
+    return data, pos
+
+def binary_records(msg):
+    # A batched datagram (Telnet "udpbatch") holds records back to back
+    pos = 0
+    while pos < len(msg):
+        data, pos = decode_binary(msg, pos)
+        if data is None:
+            return
+        yield data
+
+def json_records(msg):
+    # A batched datagram holds one record per line
+    for line in msg.split(b'\n'):
+        try:
+            yield json.loads(line)
+        except json.JSONDecodeError as e:
+            print(f"Bad JSON in message: {line!r}")
+            print(f"Decode error: {e}")
 
 # ###########################################################################
 
@@ -51,6 +196,9 @@ def influxdb_publish(event, data):
         payload['measurement'] = event
 
         payload['time']   = int(data['timestamp'])
+        # Controllers with several heaters tag each record with its bus
+        if 'bus' in data:
+            payload['tags'] = {'bus': str(data.pop('bus'))}
         payload['fields'] = data
 
         if args.verbose:
@@ -64,6 +212,57 @@ def influxdb_publish(event, data):
         print("  Payload was: %s" % payload)
 
 
+# Records with "seq" are numbered per stream: controller, bus, packet type
+# and water unit.  In delta mode (Telnet "udpdelta") those with "delta" hold
+# only the fields that changed, so after a gap the fields the lost updates
+# changed are stale until the next whole record, the keyframe.
+streams = {}
+
+def check_sequence(addr, data):
+    """Takes seq and delta out of the record; False if it was seen already."""
+    if 'seq' not in data:
+        return True
+    seq = data.pop('seq')
+    delta = data.pop('delta', 0)
+    key = (addr[0], data['type'], data.get('bus', 0), data.get('device_number', 0))
+    stream = streams.get(key)
+    stale = bool(delta)  # joined between keyframes
+    if stream is not None:
+        gap = (seq - stream['seq']) & 0xFFFF
+        # The JSON and binary copy of one update, keyframes included, or a
+        # delta from before the last.  An older keyframe means the
+        # controller restarted its sequence, so it is taken.
+        if gap == 0 or (delta and gap >= 0x8000):
+            return False
+        if 1 < gap < 0x8000:
+            print(f"Lost {gap - 1} {data['type']} updates from {key[0]} bus {key[2]} unit {key[3]}"
+                  + (", waiting for the next keyframe" if delta else ""))
+        stale = delta and (stream['stale'] or gap != 1)
+    if not delta and stream is not None and stream['stale'] and args.verbose:
+        print(f"{data['type']} from {key[0]} bus {key[2]} unit {key[3]} is whole again")
+    streams[key] = {'seq': seq, 'stale': stale}
+    return True
+
+# A subscription (POST /subscribe on the controller's port 8080) lasts its
+# TTL, so it is renewed at half of it.  The first subscription brings whole
+# records; a renewal asking for the same changes nothing else.
+def subscribe():
+    import requests
+    options = "&interval=%d&ttl=%d" % (args.interval, args.ttl)
+    types = args.types.split(",") if args.types else []
+    specs = ["format=json" + ("&types=" + ",".join(types) if types else "") + options]
+    binary_types = [t for t in types if t in ("water", "gas")]
+    if args.binary and (binary_types or not types):
+        specs.append("format=binary" + ("&types=" + ",".join(binary_types) if types else "") + options)
+    for spec in specs:
+        try:
+            resp = requests.post("http://%s:%d/subscribe" % (args.subscribe, args.esp32_port), data=spec, timeout=5)
+            if args.verbose or resp.status_code != 200:
+                print("subscribe %s: %d %s" % (spec, resp.status_code, resp.text.strip()))
+        except requests.exceptions.RequestException as e:
+            print("subscribe %s failed: %s" % (spec, e))
+    return time.time() + args.ttl / 2
+
 def process(data):
     data["timestamp"] = time.time()
     if args.raw or args.verbose:
@@ -89,6 +288,14 @@ if __name__ == "__main__":
     parser.add_argument("--influxdb_pass", dest="influxdb_pass", action="store",                                      help="InfluxDB password")
     parser.add_argument("--influxdb_db",   dest="influxdb_db",   action="store",      default="navien",              help="InfluxDB database name")
 
+    parser.add_argument("--binary",        dest="binary",        action="store_true",                                 help="also decode binary water/gas datagrams")
+
+    parser.add_argument("--subscribe",     dest="subscribe",     action="store",                                      help="controller to subscribe to instead of taking broadcasts")
+    parser.add_argument("--esp32_port",    dest="esp32_port",    action="store",      default=8080,         type=int, help="HTTP port of the controller")
+    parser.add_argument("--types",         dest="types",         action="store",                                      help="record types to subscribe to, comma separated")
+    parser.add_argument("--interval",      dest="interval",      action="store",      default=0,            type=int, help="at most one record per stream per this many ms")
+    parser.add_argument("--ttl",           dest="ttl",           action="store",      default=300,          type=int, help="seconds a subscription lasts")
+
     parser.add_argument("-v", "--verbose", dest="verbose", action="store_true", help="verbose mode")
 
     args = parser.parse_args()
@@ -99,19 +306,27 @@ if __name__ == "__main__":
     s.setsockopt(SOL_SOCKET, SO_BROADCAST, 1)
     s.setsockopt(SOL_SOCKET, SO_REUSEADDR, 1)
     s.bind((ADDRESS,MYPORT))
+    sockets = [s]
+    if args.binary:
+        b = socket(AF_INET, SOCK_DGRAM)
+        b.setsockopt(SOL_SOCKET, SO_BROADCAST, 1)
+        b.setsockopt(SOL_SOCKET, SO_REUSEADDR, 1)
+        b.bind((ADDRESS,BINARY_PORT))
+        sockets.append(b)
     if args.verbose:
         print ("done")
         print ("listening for broadcasts..")
 
+    renew = subscribe() if args.subscribe else None
     while 1:
 
-        msg=s.recvfrom(1024)
-        try:
-            data = json.loads(msg[0])
-        except json.JSONDecodeError as e:
-            print(f"Bad JSON in message: {msg[0]!r}")
-            print(f"Decode error: {e}")
-            continue  # or handle as needed
-        
-        process(data)
+        if renew and time.time() >= renew:
+            renew = subscribe()
+        ready, _, _ = select.select(sockets, [], [], renew and max(renew - time.time(), 0))
+        for sock in ready:
+            msg=sock.recvfrom(2048)  # batched datagrams run to 1400 bytes
+            records = json_records(msg[0]) if sock is s else binary_records(msg[0])
+            for data in records:
+                if check_sequence(msg[1], data):
+                    process(data)
 
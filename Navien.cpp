@@ -24,76 +24,642 @@ SOFTWARE.
 #include <Arduino.h>
 #include <cstring>
 #include "Navien.h"
+#include "NavienFields.h"
 
 const uint8_t Navien::COMMAND_HEADER[] = { 0xF7, 0x05, 0x0F, 0x50, 0x10, 0x0C, 0x4F };
 
 const uint8_t Navien::ANNOUNCE_PACKET[] = {
     0xF7, 0x05, 0x0F, 0x50, 0x10, 0x03, 0x4A, 0x00, 0x01, 0x55};
 
-bool Navien::seek_to_marker() {
-  uint8_t byte;
+size_t Navien::fill_rx_buffer() {
+  if (rx_head > 0) {
+    rx_len -= rx_head;
+    memmove(rx_buf, rx_buf + rx_head, rx_len);
+    rx_fill_first = rx_fill_first > rx_head ? rx_fill_first - rx_head : 0;
+    rx_head = 0;
+  }
 
   int availableBytes = available();
-  for (int i = 0; i < availableBytes; i++) {
-    byte = peek();
-    if (byte == PACKET_MARKER)
-      return true;
+  if (availableBytes <= 0)
+    return 0;
+  stats_max(bus_stats.uart_high_water, availableBytes);
+  if (rx_len >= RX_BUF_SIZE)
+    return 0;
+
+  size_t want = RX_BUF_SIZE - rx_len;
+  if ((size_t)availableBytes < want)
+    want = availableBytes;
+
+  size_t got = read(rx_buf + rx_len, want);
+  if (got) {
+    rx_fill_first = rx_len;
+    rx_fill_since_us = rx_empty_us;
+    rx_fill_prev_us = rx_fill_us;
+    rx_fill_us = micros();
+    rx_len += got;
+    last_rx_time = millis();
+    if (!available())
+      rx_empty_us = rx_fill_us;
+  }
+  return got;
+}
+
+size_t Navien::next_frame(const uint8_t **frame, FRAME_TIMES *times) {
+  while (rx_head < rx_len) {
+    const uint8_t *marker = (const uint8_t *)memchr(rx_buf + rx_head, PACKET_MARKER, rx_len - rx_head);
+    if (!marker) {
+      // Nothing but line noise left
+      stats_inc(bus_stats.resyncs);
+      rx_garbage();
+      rx_head = rx_len = 0;
+      return 0;
+    }
+    if (marker != rx_buf + rx_head) {
+      stats_inc(bus_stats.resyncs);
+      rx_garbage();
+      rx_head = marker - rx_buf;
+    }
+
+    // Disable test_mode if we're getting real responses
+    test_mode = false;
+
+    size_t buffered = rx_len - rx_head;
+    if (buffered < HDR_SIZE)
+      return 0;
+
+    const HEADER *hdr = (const HEADER *)marker;
+    if (hdr->len == 0xFF) {
+      stats_inc(bus_stats.invalid_length);
+      frame_error(ERROR_INVALID_LENGTH, 0, 0, marker, HDR_SIZE);
+      rx_head++;
+      continue;
+    }
+
+    // +1 to include the crc value
+    size_t frame_len = HDR_SIZE + hdr->len + 1;
+    if (frame_len > sizeof(PACKET_BUFFER)) {
+      stats_inc(bus_stats.oversize_drops);
+      frame_error(ERROR_OVERSIZE, hdr->len, sizeof(PACKET_BUFFER) - HDR_SIZE - 1, marker, HDR_SIZE);
+      rx_head++;
+      continue;
+    }
+
+    uint16_t seed;
+    if (hdr->direction == PACKET_DIRECTION_STATUS)
+      seed = CHECKSUM_SEED_4B;
+    else if (hdr->direction == PACKET_DIRECTION_CONTROL)
+      seed = CHECKSUM_SEED_62;
+    else {
+      // Not a packet we know how to validate, the marker was part of the noise
+      rx_head++;
+      continue;
+    }
+
+    if (buffered < frame_len)
+      return 0;
+
+    uint8_t crc_c = Navien::checksum(marker, frame_len - 1, seed);
+    uint8_t crc_r = marker[frame_len - 1];
+    if (crc_c != crc_r) {
+      stats_inc(bus_stats.checksum_errors);
+      frame_error(ERROR_CHECKSUM, crc_c, crc_r, marker, frame_len);
+      // Resync: a real packet may start inside the rejected bytes
+      rx_head++;
+      continue;
+    }
+
+    rx_head += frame_len;
+    *frame = marker;
+    // The UART has no timestamps. The last byte arrived no later than the
+    // read minus the bytes queued behind it, and no earlier than the UART was
+    // last seen empty plus the new bytes up to it; take the middle.
+    unsigned long latest = rx_fill_us - (rx_len - rx_head) * BYTE_TIME_US;
+    unsigned long earliest = rx_fill_since_us;
+    if (rx_head > rx_fill_first)
+      earliest += (rx_head - rx_fill_first) * BYTE_TIME_US;
+    if ((long)(earliest - latest) > 0)
+      earliest = latest;
+    times->complete_us = earliest + (latest - earliest) / 2;
+    times->first_byte_us = times->complete_us - frame_len * BYTE_TIME_US;
+    // A packet complete in an earlier read waited in rx_buf since then
+    times->read_us = rx_head > rx_fill_first ? rx_fill_us : rx_fill_prev_us;
+    // Everything consumed; the next fill starts at the front again. The
+    // packet stays in place until then.
+    if (rx_head == rx_len)
+      rx_head = rx_len = 0;
+    return frame_len;
+  }
+
+  return 0;
+}
+
+void Navien::rx_garbage() {
+  // Garbage right after we transmitted: most likely our packet collided
+  portENTER_CRITICAL(&stats_mux);
+  if (tx_echo_pending && millis() - tx_start_ms <= TX_ECHO_WINDOW_MS)
+    tx_echo_corrupt = true;
+  portEXIT_CRITICAL(&stats_mux);
+}
+
+void Navien::tx_echo_wait(bool pending) {
+  portENTER_CRITICAL(&stats_mux);
+  tx_echo_pending = pending;
+  tx_echo_corrupt = false;
+  portEXIT_CRITICAL(&stats_mux);
+}
+
+void Navien::frame_error(ErrorCode code, uint16_t a, uint16_t b, const uint8_t *frame, size_t len) {
+  stats_inc(rx_stats.framing_errors);
+  rx_garbage();
+  // The ring and callbacks belong to the loop() task
+  if (rx_queue) {
+    portENTER_CRITICAL(&stats_mux);
+    error_stats.count[code]++;
+    rx_task_errors++;
+    portEXIT_CRITICAL(&stats_mux);
+    return;
+  }
+  record_error(code, a, b, frame, len);
+}
+
+void Navien::record_error(ErrorCode code, uint16_t a, uint16_t b, const uint8_t *frame, size_t len) {
+  stats_inc(error_stats.count[code]);
+  log_error(code, a, b, frame, len);
+}
+
+void Navien::log_error(ErrorCode code, uint16_t a, uint16_t b, const uint8_t *frame, size_t len) {
+  // A code at its share of the ring gives up its own oldest record; the
+  // newer ones move down so the ring stays in time order
+  size_t same = 0, oldest = 0;
+  for (size_t i = 0; i < error_ring_used; i++) {
+    if (error_ring[(error_ring_head + ERROR_RING_SIZE - error_ring_used + i) % ERROR_RING_SIZE].code == code && !same++)
+      oldest = i;
+  }
+  if (same >= ERROR_RING_PER_CODE) {
+    size_t first = error_ring_head + ERROR_RING_SIZE - error_ring_used;
+    for (size_t i = oldest; i + 1 < error_ring_used; i++)
+      error_ring[(first + i) % ERROR_RING_SIZE] = error_ring[(first + i + 1) % ERROR_RING_SIZE];
+    error_ring_head = (error_ring_head + ERROR_RING_SIZE - 1) % ERROR_RING_SIZE;
+    error_ring_used--;
+  }
+
+  ERROR_RECORD &rec = error_ring[error_ring_head];
+  rec.ms = millis();
+  rec.code = code;
+  rec.len = len > 0xFF ? 0xFF : (uint8_t)len;
+  rec.a = a;
+  rec.b = b;
+  if (len > ERROR_FRAME_BYTES)
+    len = ERROR_FRAME_BYTES;
+  if (len)
+    memcpy(rec.frame, frame, len);
+  error_ring_head = (error_ring_head + 1) % ERROR_RING_SIZE;
+  if (error_ring_used < ERROR_RING_SIZE)
+    error_ring_used++;
+
+  if (!on_error_cb)
+    return;
+  // A burst of noise must not become a burst of formatting and Telnet
+  // writes on a loop() that is already behind
+  uint32_t bit = 1UL << code;
+  if ((error_reported_codes & bit) && rec.ms - error_report_ms[code] < ERROR_REPORT_INTERVAL_MS) {
+    error_stats.suppressed++;
+    if (error_report_held[code] < UINT16_MAX)
+      error_report_held[code]++;
+    error_held_codes |= bit;
+    return;
+  }
+  error_reported_codes |= bit;
+  error_report_ms[code] = rec.ms;
+  error_stats.reported++;
+
+  char msg[112];
+  formatError(rec, msg, sizeof(msg));
+  if (error_report_held[code]) {
+    size_t used = strlen(msg);
+    snprintf(msg + used, sizeof(msg) - used, " (%u more suppressed)", (unsigned)error_report_held[code]);
+    error_report_held[code] = 0;
+    error_held_codes &= ~bit;
+  }
+  on_error_cb(errorCodeName(code), msg, on_error_context);
+  if (len)
+    Navien::print_buffer(rec.frame, len, on_error_cb, on_error_context);
+}
+
+void Navien::flush_error_reports() {
+  uint32_t now = millis();
+  for (size_t code = 0; code < ERROR_CODE_COUNT; code++) {
+    uint32_t bit = 1UL << code;
+    if (!(error_held_codes & bit) || now - error_report_ms[code] < ERROR_REPORT_INTERVAL_MS)
+      continue;
+    // This report opens a new interval, like one carrying an error would
+    error_held_codes &= ~bit;
+    error_report_ms[code] = now;
+    char msg[32];
+    snprintf(msg, sizeof(msg), "%u more suppressed", (unsigned)error_report_held[code]);
+    error_report_held[code] = 0;
+    if (on_error_cb)
+      on_error_cb(errorCodeName((ErrorCode)code), msg, on_error_context);
+  }
+}
+
+const Navien::ERROR_RECORD *Navien::recentError(size_t index) const {
+  if (index >= error_ring_used)
+    return NULL;
+  return &error_ring[(error_ring_head + ERROR_RING_SIZE - 1 - index) % ERROR_RING_SIZE];
+}
+
+void Navien::resetBusStats() {
+  portENTER_CRITICAL(&stats_mux);
+  bus_stats = BUS_STATS{};
+  portEXIT_CRITICAL(&stats_mux);
+  tx_stats = TX_STATS{};
+  command_stats = COMMAND_STATS{};
+}
+
+void Navien::resetErrors() {
+  portENTER_CRITICAL(&stats_mux);
+  error_stats = ERROR_STATS{};
+  portEXIT_CRITICAL(&stats_mux);
+  error_ring_head = error_ring_used = 0;
+  memset(error_report_held, 0, sizeof(error_report_held));
+  error_reported_codes = error_held_codes = 0;
+}
+
+const char *Navien::errorCodeName(ErrorCode code) {
+  switch (code) {
+    case ERROR_INVALID_LENGTH: return "invalid_length";
+    case ERROR_OVERSIZE: return "oversize";
+    case ERROR_CHECKSUM: return "checksum";
+    case ERROR_UNKNOWN_STATUS: return "unknown_status";
+    case ERROR_UNKNOWN_CONTROL: return "unknown_control";
+    case ERROR_UNKNOWN_WATER: return "unknown_water";
+    case ERROR_UNKNOWN_GAS: return "unknown_gas";
+    case ERROR_UNKNOWN_ANNOUNCE: return "unknown_announce";
+    case ERROR_UNKNOWN_COMMAND: return "unknown_command";
+    case ERROR_RX_TASK: return "rx_task";
+    case ERROR_BUS_NOT_CLEAR: return "bus_not_clear";
+    case ERROR_NAVILINK_PRESENT: return "navilink_present";
+    case ERROR_COMMAND_FAILED: return "command_failed";
+    case ERROR_CODE_COUNT: break;
+  }
+  return "unknown";
+}
+
+const char *Navien::formatError(const ERROR_RECORD &rec, char *buf, size_t size) {
+  switch (rec.code) {
+    case ERROR_INVALID_LENGTH:
+      snprintf(buf, size, "Invalid header length, are the 485 wires reversed?");
+      break;
+    case ERROR_OVERSIZE:
+      snprintf(buf, size, "Buffer too small for packet length data, dropping packet. len: %u, size: %u",
+               rec.a, rec.b);
+      break;
+    case ERROR_CHECKSUM:
+      snprintf(buf, size, "%s packet checksum error: 0x%02X (calc) != 0x%02X (recv)",
+               rec.len > 2 && rec.frame[2] == PACKET_DIRECTION_STATUS ? "Status" : "Control", rec.a, rec.b);
+      break;
+    case ERROR_UNKNOWN_STATUS:
+      snprintf(buf, size, "Unknown status packet type 0x%02X received", rec.a);
+      break;
+    case ERROR_UNKNOWN_CONTROL:
+      snprintf(buf, size, "Unknown control packet type 0x%02X received", rec.a);
+      break;
+    case ERROR_UNKNOWN_WATER:
+    case ERROR_UNKNOWN_GAS:
+    case ERROR_UNKNOWN_ANNOUNCE:
+    case ERROR_UNKNOWN_COMMAND: {
+      static const char *const names[] = { "water", "gas", "announce", "command" };
+      snprintf(buf, size, "Unknown %s packet, cmd type 0x%02X", names[rec.code - ERROR_UNKNOWN_WATER], rec.a);
+      break;
+    }
+    case ERROR_RX_TASK:
+      snprintf(buf, size, "%u framing errors on the RX task", rec.a);
+      break;
+    case ERROR_BUS_NOT_CLEAR:
+      snprintf(buf, size, "Bus not clear for transmission, command queued again");
+      break;
+    case ERROR_NAVILINK_PRESENT:
+      snprintf(buf, size, "Failed to send the command (navilink present):");
+      break;
+    case ERROR_COMMAND_FAILED:
+      snprintf(buf, size, "%s command not confirmed by the heater", sendKindName((SendKind)rec.a));
+      break;
+    default:
+      snprintf(buf, size, "Error %u", (unsigned)rec.code);
+      break;
+  }
+  return buf;
+}
+
+void Navien::dispatch_packet(const FRAME_TIMES &times) {
+  recv_times = times;
+  recv_times.dispatch_us = micros();
+  unsigned long complete_us = times.complete_us;
+  size_t frame_len = HDR_SIZE + recv_packet->hdr.len + 1;
+  capture_frame(recv_packet->raw_data, frame_len, 0, millis() - (recv_times.dispatch_us - complete_us) / 1000);
+
+  if (recv_packet->hdr.direction == PACKET_DIRECTION_STATUS) {
+    learn_gap(recv_packet, times.first_byte_us, complete_us);
+  }
+
+  uint32_t latency = recv_times.dispatch_us - complete_us;
+  rx_stats.packets++;
+  rx_stats.latency_total_us += latency;
+  record_duration(rx_stats.latency_hist, &rx_stats.latency_max_us, latency);
+  // The estimates can put the read a little before the estimated complete
+  long uart_wait = (long)(times.read_us - complete_us);
+  record_duration(rx_stats.uart_wait_hist, &rx_stats.uart_wait_max_us, uart_wait > 0 ? uart_wait : 0);
+  record_duration(rx_stats.buffer_wait_hist, &rx_stats.buffer_wait_max_us, recv_times.dispatch_us - times.read_us);
+  if (rx_prev_complete_us) {
+    long gap = (long)(times.first_byte_us - rx_prev_complete_us);
+    record_duration(rx_stats.frame_gap_hist, &rx_stats.frame_gap_max_us, gap > 0 ? gap : 0);
+  }
+  rx_prev_complete_us = complete_us;
+
+  unsigned long start = recv_times.dispatch_us;
+  publish_us = 0;
+  parse_packet();
+  uint32_t parse_us = micros() - start - publish_us;
+  record_duration(bus_stats.parse_hist, &bus_stats.parse_max_us, parse_us);
+  // Track when we complete a packet for collision avoidance
+  last_packet_complete_time = millis();
+}
+
+void Navien::capture_frame(const uint8_t *frame, size_t len, uint8_t flags, uint32_t ms) {
+  size_t need = CAPTURE_RECORD_SIZE + len;
+  while (capture_used + need > CAPTURE_RING_BYTES) {
+    // The oldest record's length is in its frame header
+    size_t len_at = (capture_tail + CAPTURE_RECORD_SIZE + offsetof(HEADER, len)) % CAPTURE_RING_BYTES;
+    size_t oldest = CAPTURE_RECORD_SIZE + HDR_SIZE + capture_ring[len_at] + 1;
+    capture_tail = (capture_tail + oldest) % CAPTURE_RING_BYTES;
+    capture_used -= oldest;
+    capture_count--;
+    capture_evicted++;
+  }
+
+  uint8_t record[CAPTURE_RECORD_SIZE] = { (uint8_t)ms, (uint8_t)(ms >> 8), (uint8_t)(ms >> 16), (uint8_t)(ms >> 24), flags };
+  size_t head = (capture_tail + capture_used) % CAPTURE_RING_BYTES;
+  for (size_t i = 0; i < need; i++) {
+    capture_ring[head] = i < CAPTURE_RECORD_SIZE ? record[i] : frame[i - CAPTURE_RECORD_SIZE];
+    if (++head == CAPTURE_RING_BYTES)
+      head = 0;
+  }
+  capture_used += need;
+  capture_count++;
+}
+
+void Navien::captureExport(CaptureWriteFunction write, void *context) const {
+  uint32_t now = millis();
+  uint8_t header[CAPTURE_HEADER_SIZE] = {
+    'N', 'V', 'C', 'P', CAPTURE_VERSION, 0,
+    (uint8_t)capture_count, (uint8_t)(capture_count >> 8),
+    (uint8_t)capture_evicted, (uint8_t)(capture_evicted >> 8), (uint8_t)(capture_evicted >> 16), (uint8_t)(capture_evicted >> 24),
+    (uint8_t)now, (uint8_t)(now >> 8), (uint8_t)(now >> 16), (uint8_t)(now >> 24)
+  };
+  write(header, sizeof(header), context);
+
+  size_t first = capture_used;
+  if (capture_tail + first > CAPTURE_RING_BYTES)
+    first = CAPTURE_RING_BYTES - capture_tail;
+  if (first)
+    write(capture_ring + capture_tail, first, context);
+  if (capture_used > first)
+    write(capture_ring, capture_used - first, context);
+}
 
-    read();
+bool Navien::beginRxTask(UBaseType_t queue_depth) {
+  if (rx_queue)
+    return true;
+  rx_queue = xQueueCreate(queue_depth, sizeof(RX_FRAME));
+  if (!rx_queue) {
+    if (on_error_cb)
+      on_error_cb(__func__, "Failed to create RX queue, framing stays in loop()", on_error_context);
+    return false;
+  }
+  // The core's UART event task blocks on the driver's event queue and calls
+  // this as soon as data or an RX timeout (end of packet) is signalled.
+  onReceive([this]() { rx_task_receive(); }, false);
+  return true;
+}
+
+void Navien::rx_task_receive() {
+  RX_FRAME rx_frame;
+  const uint8_t *frame;
+
+  // This runs as soon as bytes arrive, so a partial packet older than
+  // BUS_SILENCE_MS is a fragment that will not complete.
+  if (rx_len && millis() - last_rx_time >= BUS_SILENCE_MS)
+    rx_head = rx_len = 0;
+
+  while (fill_rx_buffer() || rx_len) {
+    size_t len;
+    while ((len = next_frame(&frame, &rx_frame.times)) != 0) {
+      rx_frame.len = len;
+      memcpy(rx_frame.data, frame, len);
+      if (xQueueSend(rx_queue, &rx_frame, 0) != pdTRUE) {
+        stats_inc(rx_stats.queue_drops);
+        continue;
+      }
+      stats_max(rx_stats.queue_high_water, uxQueueMessagesWaiting(rx_queue));
+    }
+    if (!available())
+      break;
+  }
+}
+
+int Navien::dispatch_rx_queue() {
+  unsigned long startMillis = millis();
+  int packets = 0;
+  RX_FRAME rx_frame;
+
+  uint32_t errors = rx_task_errors;
+  if (errors != rx_task_errors_reported) {
+    uint32_t delta = errors - rx_task_errors_reported;
+    rx_task_errors_reported = errors;
+    log_error(ERROR_RX_TASK, delta > UINT16_MAX ? UINT16_MAX : delta, 0, NULL, 0);
+  }
+
+  while (packets < MAX_PACKETS_PER_LOOP && xQueueReceive(rx_queue, &rx_frame, 0) == pdTRUE) {
+    memcpy(local_packet.raw_data, rx_frame.data, rx_frame.len);
+    recv_packet = &local_packet;
+    dispatch_packet(rx_frame.times);
+    packets++;
+
+    if (millis() - startMillis > 100) break;
+  }
+  return packets;
+}
+
+bool Navien::subscribe(const char *name, PacketSubscriber fn, void *context, uint8_t kinds,
+                       int8_t priority, bool only_on_change) {
+  if (!fn || subscriber_count >= MAX_SUBSCRIBERS)
+    return false;
+
+  // Keep the table sorted by priority; equal priorities run in the order
+  // they subscribed
+  size_t pos = subscriber_count;
+  while (pos > 0 && subscribers[pos - 1].priority < priority) {
+    subscribers[pos] = subscribers[pos - 1];
+    pos--;
   }
+  subscribers[pos] = SUBSCRIBER{ name, fn, context, kinds, priority, only_on_change, 0, 0, 0 };
+  subscriber_count++;
+  return true;
+}
 
+bool Navien::unsubscribe(PacketSubscriber fn, void *context) {
+  for (size_t i = 0; i < subscriber_count; i++) {
+    if (subscribers[i].fn == fn && subscribers[i].context == context) {
+      memmove(&subscribers[i], &subscribers[i + 1], (subscriber_count - i - 1) * sizeof(SUBSCRIBER));
+      subscriber_count--;
+      return true;
+    }
+  }
   return false;
 }
 
+void Navien::publish(const PACKET_EVENT &event) {
+  for (size_t i = 0; i < subscriber_count; i++) {
+    SUBSCRIBER &sub = subscribers[i];
+    if (!(sub.kinds & event.kind))
+      continue;
+    if (sub.only_on_change && event.changed_fields == 0)
+      continue;
+
+    unsigned long start = micros();
+    sub.fn(&event, sub.context);
+    uint32_t elapsed = micros() - start;
+    publish_us += elapsed;
+    sub.calls++;
+    sub.total_us += elapsed;
+    if (elapsed > sub.max_us)
+      sub.max_us = elapsed;
+  }
+}
+
+uint32_t Navien::histogramPercentile(const uint32_t *hist, uint8_t pct) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < BUS_HIST_BUCKETS; i++)
+    total += hist[i];
+  if (!total)
+    return 0;
+
+  uint64_t want = (total * pct + 99) / 100;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < BUS_HIST_BUCKETS; i++) {
+    seen += hist[i];
+    if (seen >= want)
+      return histogramBucketLimit(i);
+  }
+  return histogramBucketLimit(BUS_HIST_BUCKETS - 1);
+}
+
+bool Navien::payload_changed(const uint8_t *payload, uint8_t len, uint8_t *prev, uint8_t *prev_len, size_t capacity) {
+  if (len > capacity)
+    len = capacity;
+  if (len == *prev_len && memcmp(payload, prev, len) == 0)
+    return false;
+  memcpy(prev, payload, len);
+  *prev_len = len;
+  return true;
+}
+
+void Navien::track_payload(PAYLOAD_STATS *stats, const uint8_t *payload, uint8_t len,
+                           const uint8_t *prev, uint8_t prev_len, bool active) {
+  if (len > stats->capacity)
+    len = stats->capacity;
+  stats->packets++;
+  if (active)
+    stats->active_packets++;
+  for (uint8_t i = 0; i < len; i++) {
+    BYTE_STATS &b = stats->bytes[i];
+    uint8_t v = payload[i];
+    b.last = v;
+    if (active)
+      b.sum_active += v;
+    else
+      b.sum_idle += v;
+    // Most bytes repeat the previous packet, whose value is already counted
+    bool seen = i < stats->len && i < prev_len;
+    if (seen && v == prev[i])
+      continue;
+    if (i >= stats->len) {
+      b.min = b.max = v;
+    } else {
+      if (v < b.min) b.min = v;
+      if (v > b.max) b.max = v;
+    }
+    b.sketch |= 1ULL << ((v * 0x9E3779B1u) >> 26);
+    if (i < prev_len) {
+      uint8_t flipped = v ^ prev[i];
+      if (flipped)
+        b.changes++;
+      for (; flipped; flipped &= flipped - 1)
+        b.bit_flips[__builtin_ctz(flipped)]++;
+    }
+  }
+  if (len > stats->len)
+    stats->len = len;
+}
+
+const Navien::PAYLOAD_STATS *Navien::payloadStats(PacketKind kind) const {
+  if (kind == PACKET_KIND_WATER)
+    return &water_payload_stats;
+  if (kind == PACKET_KIND_GAS)
+    return &gas_payload_stats;
+  return NULL;
+}
+
+void Navien::resetPayloadStats() {
+  for (PAYLOAD_STATS *stats : { &water_payload_stats, &gas_payload_stats }) {
+    memset(stats->bytes, 0, stats->capacity * sizeof(BYTE_STATS));
+    stats->packets = stats->active_packets = 0;
+    stats->len = 0;
+  }
+}
+
+// Linear counting over the 64 sketch bits
+uint16_t Navien::distinctValues(uint64_t sketch) {
+  int empty = 64 - __builtin_popcountll(sketch);
+  if (empty == 0)
+    return 256;
+  uint16_t n = (uint16_t)(-64.0f * logf(empty / 64.0f) + 0.5f);
+  return n > 256 ? 256 : n;
+}
+
 void Navien::parse_water() {
-  if (recv_buffer.water.cmd_type != CMD_TYPE_WATER) {
+  if (recv_packet->water.cmd_type != CMD_TYPE_WATER) {
     // Cascading units, have seen F7 13 50 52 10 03 40 00 04
-    Serial.println("Unknown water packet");
+    record_error(ERROR_UNKNOWN_WATER, recv_packet->water.cmd_type, 0, recv_packet->raw_data,
+                 HDR_SIZE + recv_packet->hdr.len + 1);
     return;
   }
 
-  uint8_t device_number = recv_buffer.hdr.packet_type - PACKET_TYPE_WATER_MIN;
+  uint8_t device_number = recv_packet->hdr.packet_type - PACKET_TYPE_WATER_MIN;
   if (device_number > state.max_water_devices_seen)
     state.max_water_devices_seen = device_number;
 
-  state.water[device_number].device_number = device_number;
-  state.water[device_number].system_power = (recv_buffer.water.system_power & 0x5) ? 0x1 : 0x0;
-  state.water[device_number].flow_state = recv_buffer.water.flow_state;
-  state.water[device_number].consumption_active = (recv_buffer.water.flow_state & 0x20) ? 0x1 : 0x0;
-  state.water[device_number].recirculation_running = (recv_buffer.water.flow_state & 0x08) ? 0x1 : 0x0;
-  state.water[device_number].set_temp = Navien::t2c(recv_buffer.water.set_temp);
-  state.water[device_number].outlet_temp = Navien::t2c(recv_buffer.water.outlet_temp);
-  state.water[device_number].inlet_temp = Navien::t2c(recv_buffer.water.inlet_temp);
-  state.water[device_number].display_metric        = (recv_buffer.water.system_status & 0x08) ? true : false;
-  state.water[device_number].internal_recirculation = (recv_buffer.water.system_status & 0x01) ? true : false;
-  state.water[device_number].external_recirculation = (recv_buffer.water.system_status & 0x02) ? true : false;
-  state.water[device_number].operating_capacity = 0.5 * recv_buffer.water.operating_capacity;  // 0.5 increments
-  state.water[device_number].flow_lpm = Navien::flow2lpm(recv_buffer.water.water_flow);
-  state.water[device_number].recirculation_active = (recv_buffer.water.recirculation_enabled & 0x2) ? true : false;
-  uint8_t stage = recv_buffer.water.system_stage;
-  state.water[device_number].system_stage = stage;
-
-  uint8_t upper_nibble = stage & 0xF0;
-  state.water[device_number].stage_idle          = (upper_nibble == 0x10);
-  state.water[device_number].stage_starting      = (upper_nibble == 0x20);
-  state.water[device_number].stage_active        = (upper_nibble == 0x30);
-  state.water[device_number].stage_shutting_down = (upper_nibble == 0x40);
-
-  state.water[device_number].stage_standby           = (stage == 0x14);
-  state.water[device_number].stage_demand            = (stage == 0x20);
-  state.water[device_number].stage_pre_purge         = (stage == 0x29);
-  state.water[device_number].stage_ignition          = (stage == 0x2B);
-  state.water[device_number].stage_flame_on          = (stage == 0x2C);
-  state.water[device_number].stage_ramp_up           = (stage == 0x2D);
-  state.water[device_number].stage_active_combustion = (stage == 0x33);
-  state.water[device_number].stage_water_adjustment  = (stage == 0x34);
-  state.water[device_number].stage_flame_off         = (stage == 0x3C);
-  state.water[device_number].stage_post_purge_1     = (stage == 0x46);
-  state.water[device_number].stage_post_purge_2     = (stage == 0x47);
-  state.water[device_number].stage_dhw_wait         = (stage == 0x49);
-
-  state.water[device_number].system_active   = recv_buffer.water.system_active ? true : false;
-  state.water[device_number].operation_time = (uint16_t)recv_buffer.water.operation_time_hi << 8 | recv_buffer.water.operation_time_lo;
+  // Layout and conversions are in NAVIEN_WATER_FIELDS
+  NAVIEN_STATE_WATER water{};
+  water.device_number = device_number;
+  navienDecodeFields<NAVIEN_WATER_FIELDS>(water, &recv_packet->water.cmd_type, recv_packet->hdr.len);
+
+  // Work out what changed since the previous packet from this unit
+  NAVIEN_STATE_WATER &prev = state.water[device_number];
+  uint32_t changed = prev.sequence != 0 ? navienDiffFields<NAVIEN_WATER_FIELDS>(water, prev) : WATER_CHANGED_ALL;
+  track_payload(&water_payload_stats, &recv_packet->water.cmd_type, recv_packet->hdr.len,
+                prev_water_raw[device_number], prev_water_len[device_number], water.consumption_active);
+  if (payload_changed(&recv_packet->water.cmd_type, recv_packet->hdr.len, prev_water_raw[device_number],
+                      &prev_water_len[device_number], sizeof(WATER_DATA)))
+    changed |= WATER_CHANGED_RAW;
+
+  water.changed_fields = changed;
+  water.sequence = ++water_sequence;
+  uint32_t cascade_changed = update_cascade(prev, water);
+  prev = water;
+  if (device_number == 0)
+    confirm_commands();
 
   // If we see 10+ water packets since the last navilink packet, assume that 
   // it is no longer present.
@@ -104,59 +670,82 @@ void Navien::parse_water() {
     state.announce.navilink_present = false;
   }
 
-  if (on_water_packet_cb) on_water_packet_cb(&state.water[device_number]);
+  PACKET_EVENT event{ PACKET_KIND_WATER, changed, &state, &state.water[device_number], NULL, NULL, recv_packet, &recv_times, this };
+  publish(event);
+  if (cascade_changed) {
+    PACKET_EVENT cascade_event{ PACKET_KIND_CASCADE, cascade_changed, &state, NULL, NULL, &state.cascade, recv_packet, &recv_times, this };
+    publish(cascade_event);
+  }
+}
+
+uint32_t Navien::update_cascade(const NAVIEN_STATE_WATER &before, const NAVIEN_STATE_WATER &after) {
+  NAVIEN_STATE_CASCADE &cascade = state.cascade;
+  uint32_t changed = 0;
+  uint8_t unit_bit = 1 << after.device_number;
+  if (!(cascade.unit_mask & unit_bit)) {
+    cascade.unit_mask |= unit_bit;
+    cascade.units++;
+    changed |= CASCADE_CHANGED_UNITS;
+  }
+  if (after.flow_raw != before.flow_raw) {
+    cascade.flow_raw += after.flow_raw - before.flow_raw;
+    changed |= CASCADE_CHANGED_FLOW_LPM;
+  }
+  if (after.capacity_raw != before.capacity_raw) {
+    cascade.capacity_raw += after.capacity_raw - before.capacity_raw;
+    changed |= CASCADE_CHANGED_OPERATING_CAPACITY;
+  }
+  // Each count moves by at most one unit per packet
+  int8_t firing = (after.capacity_raw > 0) - (before.capacity_raw > 0);
+  if (firing) {
+    cascade.units_firing += firing;
+    changed |= CASCADE_CHANGED_UNITS_FIRING;
+  }
+  int8_t recirculating = after.recirculation_running - before.recirculation_running;
+  if (recirculating) {
+    cascade.units_recirculating += recirculating;
+    changed |= CASCADE_CHANGED_UNITS_RECIRCULATING;
+  }
+  int8_t consuming = after.consumption_active - before.consumption_active;
+  if (consuming) {
+    cascade.units_consuming += consuming;
+    changed |= CASCADE_CHANGED_UNITS_CONSUMING;
+  }
+  if (changed) {
+    cascade.changed_fields = changed;
+    cascade.sequence++;
+  }
+  return changed;
 }
 
 void Navien::parse_gas() {
-  if (recv_buffer.gas.cmd_type != CMD_TYPE_GAS) {
-    Serial.println("Unknown gas packet");
+  if (recv_packet->gas.cmd_type != CMD_TYPE_GAS) {
+    record_error(ERROR_UNKNOWN_GAS, recv_packet->gas.cmd_type, 0, recv_packet->raw_data,
+                 HDR_SIZE + recv_packet->hdr.len + 1);
     return;
   }
-  state.gas.set_temp = Navien::t2c(recv_buffer.gas.set_temp);
-  state.gas.outlet_temp = Navien::t2c(recv_buffer.gas.outlet_temp);
-  state.gas.inlet_temp = Navien::t2c(recv_buffer.gas.inlet_temp);
-
-  char buffer[10];
-
-  sprintf(buffer, "%d.%d", recv_buffer.gas.controller_version_hi, recv_buffer.gas.controller_version_lo);
-  state.gas.controller_version = atof(buffer);
-  sprintf(buffer, "%d.%d", recv_buffer.gas.panel_version_hi, recv_buffer.gas.panel_version_lo);
-  state.gas.panel_version = atof(buffer);
-
-  uint32_t raw_gas = ((uint32_t)recv_buffer.gas.cumulative_gas_b3 << 24 |
-                      (uint32_t)recv_buffer.gas.cumulative_gas_b2 << 16 |
-                      (uint32_t)recv_buffer.gas.cumulative_gas_hi << 8  |
-                      recv_buffer.gas.cumulative_gas_lo);
-  state.gas.accumulated_gas_usage = 0.1f * raw_gas;
-
-  uint32_t raw_water = ((uint32_t)recv_buffer.gas.cumulative_water_usage_b3 << 24 |
-                        (uint32_t)recv_buffer.gas.cumulative_water_usage_b2 << 16 |
-                        (uint32_t)recv_buffer.gas.cumulative_water_usage_hi << 8  |
-                        recv_buffer.gas.cumulative_water_usage_lo);
-  state.gas.accumulated_water_usage = 0.1f * raw_water;
-
-  state.gas.current_gas_usage = (uint16_t)recv_buffer.gas.current_gas_hi << 8 | recv_buffer.gas.current_gas_lo;
-  state.gas.target_gas_usage = (uint16_t)recv_buffer.gas.target_burner_power_hi << 8 | recv_buffer.gas.target_burner_power_lo;
-
-  uint32_t raw_time = ((uint32_t)recv_buffer.gas.total_operating_time_b3 << 24 |
-                       (uint32_t)recv_buffer.gas.total_operating_time_b2 << 16 |
-                       (uint32_t)recv_buffer.gas.total_operating_time_hi << 8  |
-                       recv_buffer.gas.total_operating_time_lo);
-  state.gas.total_operating_time = 60 * raw_time;  // hours -> minutes
-
-  state.gas.elapsed_install_days = (uint16_t)recv_buffer.gas.elapsed_install_days_hi << 8 | recv_buffer.gas.elapsed_install_days_lo;
-
-  // Convert domestic usage count using 32-bit arithmetic
-  uint32_t raw_usage = ((uint32_t)recv_buffer.gas.cumulative_domestic_usage_cnt_hi << 8 |
-                        recv_buffer.gas.cumulative_domestic_usage_cnt_lo);
-  state.gas.accumulated_domestic_usage_cnt = 10 * raw_usage;
-  state.gas.recirculation_enabled = recv_buffer.gas.recirculation_enabled ? true : false;
-
-  if (on_gas_packet_cb) on_gas_packet_cb(&(state.gas));
+  // Layout and conversions are in NAVIEN_GAS_FIELDS
+  NAVIEN_STATE_GAS gas{};
+  navienDecodeFields<NAVIEN_GAS_FIELDS>(gas, &recv_packet->gas.cmd_type, recv_packet->hdr.len);
+
+  // Work out what changed since the previous gas packet
+  NAVIEN_STATE_GAS &prev = state.gas;
+  uint32_t changed = prev.sequence != 0 ? navienDiffFields<NAVIEN_GAS_FIELDS>(gas, prev) : GAS_CHANGED_ALL;
+  track_payload(&gas_payload_stats, &recv_packet->gas.cmd_type, recv_packet->hdr.len,
+                prev_gas_raw, prev_gas_len, gas.current_gas_usage > 0);
+  if (payload_changed(&recv_packet->gas.cmd_type, recv_packet->hdr.len, prev_gas_raw, &prev_gas_len, sizeof(GAS_DATA)))
+    changed |= GAS_CHANGED_RAW;
+
+  gas.changed_fields = changed;
+  gas.sequence = ++gas_sequence;
+  prev = gas;
+
+  PACKET_EVENT event{ PACKET_KIND_GAS, changed, &state, NULL, &state.gas, NULL, recv_packet, &recv_times, this };
+  publish(event);
 }
 
 void Navien::parse_status_packet() {
-  uint8_t pkt_type = recv_buffer.hdr.packet_type;
+  uint8_t pkt_type = recv_packet->hdr.packet_type;
 
   if (pkt_type >= PACKET_TYPE_WATER_MIN && pkt_type <= PACKET_TYPE_WATER_MAX) {
     parse_water();
@@ -167,25 +756,25 @@ void Navien::parse_status_packet() {
       parse_gas();
       break;
     default:
-      if (on_error_cb)
-        on_error_cb(__func__, "Unknown status packet type received.");
-      Navien::print_buffer(recv_buffer.raw_data, recv_buffer.hdr.len + HDR_SIZE, on_error_cb);
+      record_error(ERROR_UNKNOWN_STATUS, pkt_type, 0, recv_packet->raw_data, HDR_SIZE + recv_packet->hdr.len + 1);
       break;
   }
 }
 
 void Navien::parse_announce(bool from_local_send) {
-  if (recv_buffer.announce.cmd_type != CMD_TYPE_ANNOUNCE) {
-    Serial.println("Unknown announce packet");
+  if (recv_packet->announce.cmd_type != CMD_TYPE_ANNOUNCE) {
+    record_error(ERROR_UNKNOWN_ANNOUNCE, recv_packet->announce.cmd_type, 0, recv_packet->raw_data,
+                 HDR_SIZE + recv_packet->hdr.len + 1);
     return;
   }
-  //Navien::print_buffer(recv_buffer.raw_data, recv_buffer.hdr.len + HDR_SIZE, on_error_cb);
+  //Navien::print_buffer(recv_packet->raw_data, recv_packet->hdr.len + HDR_SIZE, on_error_cb);
 
-  size_t plen = HDR_SIZE + recv_buffer.hdr.len + 1;
+  size_t plen = HDR_SIZE + recv_packet->hdr.len + 1;
   if (last_announced_raw_len == plen && plen <= sizeof(last_announced_raw) &&
       last_announce_callback_ms != 0 &&
       (unsigned long)(millis() - last_announce_callback_ms) <= ANNOUNCE_CALLBACK_DEDUPE_MS &&
-      memcmp(last_announced_raw, recv_buffer.raw_data, plen) == 0) {
+      memcmp(last_announced_raw, recv_packet->raw_data, plen) == 0) {
+    // A repeat, not our echo: echo_suppressed stays a transmit diagnostic
     return;
   }
 
@@ -197,56 +786,69 @@ void Navien::parse_announce(bool from_local_send) {
   }
 
   if (plen <= sizeof(last_announced_raw)) {
-    memcpy(last_announced_raw, recv_buffer.raw_data, plen);
+    memcpy(last_announced_raw, recv_packet->raw_data, plen);
     last_announced_raw_len = (uint8_t)plen;
     last_announce_callback_ms = millis();
   }
 
-  if (on_announce_packet_cb) on_announce_packet_cb(&(state));
+  uint32_t changed = 0;
+  if (payload_changed(&recv_packet->announce.cmd_type, recv_packet->hdr.len, prev_announce_raw,
+                      &prev_announce_len, sizeof(ANNOUNCE_DATA)))
+    changed = CONTROL_CHANGED_RAW;
+
+  PACKET_EVENT event{ PACKET_KIND_ANNOUNCE, changed, &state, NULL, NULL, NULL, recv_packet, &recv_times, this };
+  publish(event);
 }
 
 void Navien::parse_command(bool from_local_send) {
   (void)from_local_send;
-  if (recv_buffer.cmd.cmd_type != CMD_TYPE_CMD) {
-    Serial.println("Unknown command packet");
+  if (recv_packet->cmd.cmd_type != CMD_TYPE_CMD) {
+    record_error(ERROR_UNKNOWN_COMMAND, recv_packet->cmd.cmd_type, 0, recv_packet->raw_data,
+                 HDR_SIZE + recv_packet->hdr.len + 1);
     return;
   }
-  //Navien::print_buffer(recv_buffer.raw_data, recv_buffer.hdr.len + HDR_SIZE, on_error_cb);
+  //Navien::print_buffer(recv_packet->raw_data, recv_packet->hdr.len + HDR_SIZE, on_error_cb);
 
   memset(&(state.command), 0x0, sizeof(state.command));
 
-  if (recv_buffer.cmd.system_power == Navien::SYSTEM_POWER_ON) {
+  if (recv_packet->cmd.system_power == Navien::SYSTEM_POWER_ON) {
     state.command.power_command = true;
     state.command.power_on = true;
-  } else if (recv_buffer.cmd.system_power == Navien::SYSTEM_POWER_OFF) {
+  } else if (recv_packet->cmd.system_power == Navien::SYSTEM_POWER_OFF) {
     state.command.power_command = true;
     state.command.power_on = false;
   }
 
-  if (recv_buffer.cmd.set_temp > 0) {
+  if (recv_packet->cmd.set_temp > 0) {
     state.command.set_temp_command = true;
-    state.command.set_temp = (float)recv_buffer.cmd.set_temp / 2.0;
+    state.command.set_temp = (float)recv_packet->cmd.set_temp / 2.0;
   }
 
-  if (recv_buffer.cmd.hot_button_recirculation & Navien::HOT_BUTTON_DOWN) {
+  if (recv_packet->cmd.hot_button_recirculation & Navien::HOT_BUTTON_DOWN) {
     state.command.hot_button_command = true;
   }
 
-  if (recv_buffer.cmd.hot_button_recirculation & Navien::RECIRCULATION_ON) {
+  if (recv_packet->cmd.hot_button_recirculation & Navien::RECIRCULATION_ON) {
     state.command.recirculation_command = true;
     state.command.recirculation_on = true;
-  } else if (recv_buffer.cmd.hot_button_recirculation & Navien::RECIRCULATION_OFF) {
+  } else if (recv_packet->cmd.hot_button_recirculation & Navien::RECIRCULATION_OFF) {
     state.command.recirculation_command = true;
     state.command.recirculation_on = false;
   }
 
-  state.command.cmd_data = recv_buffer.cmd.cmd_data;
+  state.command.cmd_data = recv_packet->cmd.cmd_data;
+
+  uint32_t changed = 0;
+  if (payload_changed(&recv_packet->cmd.cmd_type, recv_packet->hdr.len, prev_command_raw,
+                      &prev_command_len, sizeof(CMD_DATA)))
+    changed = CONTROL_CHANGED_RAW;
 
-  if (on_command_packet_cb) on_command_packet_cb(&(state));
+  PACKET_EVENT event{ PACKET_KIND_COMMAND, changed, &state, NULL, NULL, NULL, recv_packet, &recv_times, this };
+  publish(event);
 }
 
 void Navien::parse_control_packet(bool from_local_send) {
-  switch (recv_buffer.cmd.cmd_type) {
+  switch (recv_packet->cmd.cmd_type) {
     case Navien::CONTROL_ANNOUNCE:
       parse_announce(from_local_send);
       break;
@@ -254,47 +856,28 @@ void Navien::parse_control_packet(bool from_local_send) {
       parse_command(from_local_send);
       break;
     default:
-      if (on_error_cb)
-        on_error_cb(__func__, "Unknown control packet type received.");
-      Navien::print_buffer(recv_buffer.raw_data, recv_buffer.hdr.len + HDR_SIZE, on_error_cb);
+      record_error(ERROR_UNKNOWN_CONTROL, recv_packet->cmd.cmd_type, 0, recv_packet->raw_data,
+                   HDR_SIZE + recv_packet->hdr.len + 1);
       break;
   }
 }
 
 void Navien::parse_packet() {
-  uint8_t crc_c = 0x00;  // Computed CRC
-  uint8_t crc_r = 0x00;  // Received CRC
-
-  char errBuffer[255];
-
-  //Navien::print_buffer(recv_buffer.raw_data, HDR_SIZE + recv_buffer.hdr.len + 1);
-  crc_r = recv_buffer.raw_data[HDR_SIZE + recv_buffer.hdr.len];
-
-  switch (recv_buffer.hdr.direction) {
+  switch (recv_packet->hdr.direction) {
     case Navien::PACKET_DIRECTION_STATUS:
-      crc_c = Navien::checksum(recv_buffer.raw_data, HDR_SIZE + recv_buffer.hdr.len, CHECKSUM_SEED_4B);
-      if (crc_c != crc_r) {
-        sprintf(errBuffer, "Status Packet checksum error: 0x%02X (calc) != 0x%02X (recv)", crc_c, crc_r);
-        if (on_error_cb)
-          on_error_cb(__func__, errBuffer);
-        Navien::print_buffer(recv_buffer.raw_data, recv_buffer.hdr.len + HDR_SIZE, on_error_cb);
-        break;
-      }
       parse_status_packet();
       break;
-    case Navien::PACKET_DIRECTION_CONTROL:
-      crc_c = Navien::checksum(recv_buffer.raw_data, HDR_SIZE + recv_buffer.hdr.len, CHECKSUM_SEED_62);
-      if (crc_c != crc_r) {
-        sprintf(errBuffer, "Control Packet checksum error: 0x%02X (calc) != 0x%02X (recv)", crc_c, crc_r);
-        if (on_error_cb)
-          on_error_cb(__func__, errBuffer);
-        break;
-      }
-      size_t recv_len = HDR_SIZE + recv_buffer.hdr.len + 1;
+    case Navien::PACKET_DIRECTION_CONTROL: {
+      size_t recv_len = HDR_SIZE + recv_packet->hdr.len + 1;
       // Fixed periodic announce: match raw bytes only (avoid struct/overlay quirks on cmd_type).
       if (last_periodic_announce_time != 0 && recv_len == sizeof(ANNOUNCE_PACKET) &&
-          memcmp(recv_buffer.raw_data, ANNOUNCE_PACKET, recv_len) == 0 &&
+          memcmp(recv_packet->raw_data, ANNOUNCE_PACKET, recv_len) == 0 &&
           (unsigned long)(millis() - last_periodic_announce_time) <= OWN_ANNOUNCE_ECHO_SUPPRESS_MS) {
+        bus_stats.echo_suppressed++;
+        if (tx_echo_pending) {
+          tx_echo_wait(false);
+          tx_stats.echo_matched++;
+        }
         break;
       }
       // Suppress processing of our own command/announce packet echoed back from RS485.
@@ -302,112 +885,89 @@ void Navien::parse_packet() {
         unsigned long elapsed = millis() - last_sent_control_packet_time;
         if (elapsed <= LOCAL_ECHO_FILTER_WINDOW_MS &&
             recv_len == last_sent_control_packet_len &&
-            memcmp(recv_buffer.raw_data, last_sent_control_packet.raw_data, recv_len) == 0) {
+            memcmp(recv_packet->raw_data, last_sent_control_packet.raw_data, recv_len) == 0) {
+          bus_stats.echo_suppressed++;
+          if (tx_echo_pending) {
+            tx_echo_wait(false);
+            tx_stats.echo_matched++;
+          }
           break;
         }
       }
+      // Different bytes where our echo should be: ours did not get through
+      rx_garbage();
       parse_control_packet(false);
       break;
+    }
   }
 }
 
 
 void Navien::loop() {
-  uint8_t byte;
-  char errBuffer[255];
-  int availableBytes = available();
+  unsigned long start = micros();
+  poll_bus();
+  bus_stats.loop_calls++;
+  record_duration(bus_stats.loop_hist, &bus_stats.loop_max_us, micros() - start);
+}
+
+void Navien::poll_bus() {
+  if (tx_echo_pending && tx_echo_corrupt)
+    tx_collided();
+  else if (tx_echo_pending && millis() - tx_start_ms > TX_ECHO_WINDOW_MS)
+    tx_echo_failed();
+  expire_commands();
+  if (error_held_codes)
+    flush_error_reports();
+
+  // With the RX task running, the UART is drained as bytes arrive
+  int availableBytes = rx_queue ? 0 : available();
 
   // Check if we should send a command
-  if (recv_state == INITIAL && can_send(availableBytes)) {
+  if (can_send(availableBytes)) {
     send_cmd();
-    availableBytes = available();
+    availableBytes = rx_queue ? 0 : available();
   }
 
-  if (!availableBytes) {
-    maybe_send_periodic_announce();
+  if (rx_queue) {
+    if (!dispatch_rx_queue())
+      maybe_send_periodic_announce();
     return;
   }
 
-  // Disable test_mode if we're getting real responses
-  if (recv_state != INITIAL && test_mode) {
-    test_mode = false;
+  if (!availableBytes) {
+    rx_empty_us = micros();
+    // A packet is never paused for BUS_SILENCE_MS on the wire, so a partial
+    // packet that old is a fragment that will not complete.
+    if (rx_len && millis() - last_rx_time >= BUS_SILENCE_MS)
+      rx_head = rx_len = 0;
+    if (!rx_len) {
+      maybe_send_periodic_announce();
+      return;
+    }
   }
 
   unsigned long startMillis = millis();
-  int loopIterations = 0;
-  const int MAX_LOOP_ITERATIONS = 100;
-
-  while (availableBytes && loopIterations++ < MAX_LOOP_ITERATIONS) {
-    switch (recv_state) {
-      case INITIAL:
-        if (seek_to_marker()) {
-          recv_state = MARKER_FOUND;
-          break;
-        }
-        // No marker found — wait for more bytes
-        return;
-
-      case MARKER_FOUND:
-        availableBytes = available();
-        if (availableBytes < HDR_SIZE)
-          return;
-
-        if (!read(recv_buffer.raw_data, HDR_SIZE)) {
-          sprintf(errBuffer, "Failed to read header: %d when told %d is available", HDR_SIZE, availableBytes);
-          if (on_error_cb)
-            on_error_cb(__func__, errBuffer);
-          recv_state = INITIAL;
-          return;
-        }
-
-        recv_state = HEADER_PARSED;
-
-        if (recv_buffer.hdr.len == 0xFF || recv_buffer.hdr.len >= sizeof(PACKET_BUFFER)) {
-          if (recv_buffer.hdr.len == 0xFF) {
-            if (on_error_cb)
-              on_error_cb(__func__, "Invalid header length, are the 485 wires reversed?");
-          } else if (on_error_cb) {
-            sprintf(errBuffer, "Buffer too small for packet length data, dropping packet. len: %d, size: %d", recv_buffer.hdr.len, sizeof(PACKET_BUFFER) - 1);
-            on_error_cb(__func__, errBuffer);
-          }
-          recv_state = INITIAL;
-          return;
-        }
-        break;
-
-      case HEADER_PARSED: {
-        availableBytes = available();
-        uint8_t len = recv_buffer.hdr.len + 1;
-
-        if (availableBytes < len)
-          return;
-
-        if (!read(recv_buffer.raw_data + HDR_SIZE, len)) {
-          sprintf(errBuffer, "Failed to read %d bytes when told %d is available", len, availableBytes);
-          if (on_error_cb)
-            on_error_cb(__func__, errBuffer);
-          recv_state = INITIAL;
-          return;
-        }
-
-        parse_packet();
-        availableBytes = available();
-        recv_state = INITIAL;
-        // Track when we complete a packet for collision avoidance
-        last_packet_complete_time = millis();
-        break;
-      }
-
-      default:
-        recv_state = INITIAL;
+  int packets = 0;
+  const uint8_t *frame;
+  FRAME_TIMES times;
+
+  fill_rx_buffer();
+  while (packets < MAX_PACKETS_PER_LOOP) {
+    if (!next_frame(&frame, &times)) {
+      // Buffer holds at most a partial packet, top it up if more has arrived
+      if (!available() || !fill_rx_buffer())
         break;
+      continue;
     }
 
-    // Check elapsed time or max loop iterations
+    recv_packet = (const PACKET_BUFFER *)frame;
+    dispatch_packet(times);
+    packets++;
+
+    // Check elapsed time
     if (millis() - startMillis > 100) break;
 
     yield();  // Let the ESP32 breathe for WDT
-    availableBytes = available(); // refresh at end
   }
 }
 
@@ -424,61 +984,168 @@ float Navien::t2c(uint8_t c) {
 }
 
 
-void Navien::print_buffer(const uint8_t *data, size_t length, ErrorCallbackFunction on_error_cb) {
-  char hex_buffer[100];
-  hex_buffer[(3 * 32) + 1] = 0;
-  for (size_t i = 0; i < length; i++) {
-    snprintf(&hex_buffer[3 * (i % 32)], sizeof(hex_buffer), "%02X ", data[i]);
-    if (i % 32 == 31) {
-      if (on_error_cb)
-        on_error_cb(__func__, hex_buffer);
-    }
+size_t Navien::formatHex(const uint8_t *data, size_t len, char *buf, size_t size) {
+  static const char digits[] = "0123456789ABCDEF";
+  if (size == 0)
+    return 0;
+  size_t n = len < (size - 1) / 3 ? len : (size - 1) / 3;
+  char *p = buf;
+  for (size_t i = 0; i < n; i++) {
+    *p++ = digits[data[i] >> 4];
+    *p++ = digits[data[i] & 0x0F];
+    *p++ = ' ';
   }
-  if (length % 32) {
-    // null terminate if incomplete line
-    hex_buffer[3 * (length % 32) + 2] = 0;
+  *p = 0;
+  return p - buf;
+}
+
+void Navien::print_buffer(const uint8_t *data, size_t length, ErrorCallbackFunction on_error_cb, void *context) {
+  // 32 bytes per line
+  char hex_buffer[3 * 32 + 1];
+  for (size_t i = 0; i < length; i += 32) {
+    formatHex(data + i, length - i < 32 ? length - i : 32, hex_buffer, sizeof(hex_buffer));
     if (on_error_cb)
-      on_error_cb(__func__, hex_buffer);
+      on_error_cb(__func__, hex_buffer, context);
   }
 }
 
-int Navien::enqueue_send_cmd(const PACKET_BUFFER& pkt) {
-  if (send_queue_count >= QUEUE_CAPACITY)
-    return -1;
-  send_array[send_queue_tail] = pkt;
-  send_queue_tail = (send_queue_tail + 1) % QUEUE_CAPACITY;
-  ++send_queue_count;
+int Navien::enqueue_send_job(SendKind kind, uint8_t arg, const PACKET_BUFFER *first, const PACKET_BUFFER *second) {
+  SEND_JOB *job = NULL;
+  // A newer command replaces one of the same kind that is still waiting
+  for (size_t i = 0; i < send_job_count; i++) {
+    if (send_jobs[i].kind == kind && send_jobs[i].next == 0) {
+      job = &send_jobs[i];
+      tx_stats.superseded++;
+      break;
+    }
+  }
+  if (!job) {
+    if (send_job_count >= SEND_QUEUE_CAPACITY) {
+      tx_stats.queue_full_drops++;
+      return -1;
+    }
+    job = &send_jobs[send_job_count++];
+    job->seq = ++send_job_seq;
+    if (send_job_count > tx_stats.queue_high_water)
+      tx_stats.queue_high_water = send_job_count;
+  }
+
+  job->kind = kind;
+  job->arg = arg;
+  job->count = second ? 2 : 1;
+  job->next = 0;
+  job->queued_ms = millis();
+  memcpy(job->raw[0], first->raw_data, SEND_PACKET_MAX);
+  if (second)
+    memcpy(job->raw[1], second->raw_data, SEND_PACKET_MAX);
   return 1;
 }
 
-int Navien::queue_send_cmd(const PACKET_BUFFER& pkt) {
-  if (!test_mode && !navilink_present && last_periodic_announce_time == 0 &&
-      pkt.cmd.cmd_type == CONTROL_COMMAND) {
+int Navien::queue_send_job(SendKind kind, uint8_t arg, const PACKET_BUFFER *first, const PACKET_BUFFER *second) {
+  if (!test_mode && !navilink_present && last_periodic_announce_time == 0)
     return -1;
+
+  // recirculation(on) then recirculation(off) before either is sent, with
+  // the heater still off: nothing needs to go out. Without the heater
+  // agreeing, the newer command supersedes instead.
+  for (size_t i = 0; i < send_job_count; i++) {
+    const SEND_JOB &job = send_jobs[i];
+    if (job.kind == kind && job.next == 0 && job.arg != arg && heater_reports(kind, arg)) {
+      remove_send_job(i);
+      tx_stats.cancelled++;
+      return 0;
+    }
   }
-  return enqueue_send_cmd(pkt);
+  return enqueue_send_job(kind, arg, first, second);
 }
 
-bool Navien::can_send(int curr_available) {
-  static unsigned long last_received = 0;
+bool Navien::heater_reports(SendKind kind, uint8_t arg) const {
+  const NAVIEN_STATE_WATER &water = state.water[0];
+  if (water.sequence == 0)
+    return false;
+  switch (kind) {
+    case SEND_POWER:
+      return water.system_power == (bool)arg;
+    case SEND_SET_TEMP:
+      return water.set_temp_raw == arg;
+    case SEND_RECIRCULATION:
+      return water.recirculation_active == (bool)arg;
+    default:
+      return false;
+  }
+}
+
+int Navien::next_send_job() const {
+  // One packet on the wire at a time, and none during a collision backoff
+  if (tx_echo_pending || (long)(millis() - tx_backoff_until_ms) < 0)
+    return -1;
 
+  // Commands wait for our first announce (bus takeover order), and for
+  // MIN_COMMAND_INTERVAL_MS after the previous command
+  bool takeover_pending = !test_mode && !navilink_present && last_periodic_announce_time == 0;
+  bool rate_limited = last_command_sent_time > 0 &&
+                      last_sent_control_packet.cmd.cmd_type == CONTROL_COMMAND &&
+                      millis() - last_command_sent_time < MIN_COMMAND_INTERVAL_MS;
+
+  int best = -1;
+  for (size_t i = 0; i < send_job_count; i++) {
+    const SEND_JOB &job = send_jobs[i];
+    if (job.kind != SEND_ANNOUNCE && (takeover_pending || rate_limited))
+      continue;
+    if (best < 0) {
+      best = i;
+      continue;
+    }
+    // A started job finishes first, then by kind, then in queue order
+    const SEND_JOB &other = send_jobs[best];
+    if ((job.next > 0) != (other.next > 0)) {
+      if (job.next > 0)
+        best = i;
+    } else if (job.kind != other.kind ? job.kind < other.kind : job.seq < other.seq) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+void Navien::remove_send_job(size_t index) {
+  memmove(&send_jobs[index], &send_jobs[index + 1], (send_job_count - index - 1) * sizeof(SEND_JOB));
+  send_job_count--;
+}
+
+bool Navien::can_send(int curr_available) {
   // If there's data available, we're receiving something - don't send
   if (curr_available > 0) {
-    last_received = millis();
+    last_rx_time = millis();
     return false;
   }
 
-  // Don't send if we're in the middle of parsing a packet
-  // (wait until we're back to INITIAL state)
-  if (recv_state != INITIAL) {
+  // Don't send if we're in the middle of receiving a packet. rx_buf belongs
+  // to the RX task in that mode; the silence check below covers it.
+  if (!rx_queue && rx_len != 0) {
     return false;
   }
 
+  if (millis() - last_rx_time < MIN_TX_SILENCE_MS)
+    return false;
+
+  // Send into the idle window the heater's cadence predicts, if known
+  switch (gap_verdict((SEND_PACKET_MAX * BYTE_TIME_US + 999) / 1000)) {
+    case GAP_CLEAR:
+      return true;
+    case GAP_BUSY:
+      return false;
+    default:
+      return fixed_margins_elapsed();
+  }
+}
+
+bool Navien::fixed_margins_elapsed() const {
   // Wait for sufficient silence after last byte received
   // This ensures we're not in the middle of a packet transmission
   // At 19200 baud, even the longest packets (~55 bytes) take ~29ms to transmit
   // 50ms provides a safe margin to ensure we're between packets
-  unsigned long silence_duration = millis() - last_received;
+  unsigned long silence_duration = millis() - last_rx_time;
   if (silence_duration < BUS_SILENCE_MS) {
     return false;
   }
@@ -495,6 +1162,140 @@ bool Navien::can_send(int curr_available) {
   return true;
 }
 
+Navien::GapVerdict Navien::gap_verdict(unsigned long tx_ms) const {
+  // millis() also guards against micros() wrapping during a long silence
+  if (!gap_prev_valid || millis() - last_packet_complete_time >= GAP_RANGE_MS)
+    return GAP_UNKNOWN;
+  const GAP_MODEL &model = gap_model[gap_prev_gas];
+  if (model.total < GAP_MIN_SAMPLES)
+    return GAP_UNKNOWN;
+
+  unsigned long idle_ms = (micros() - gap_prev_end_us) / 1000;
+  // Longer than any gap learned, the next packet is due any moment
+  if (idle_ms >= GAP_RANGE_MS)
+    return GAP_UNKNOWN;
+
+  // Of the gaps still possible, how many end before we are off the wire
+  unsigned long until_ms = idle_ms + tx_ms + GAP_GUARD_MS;
+  size_t last = until_ms / GAP_BUCKET_MS;
+  uint32_t ahead = 0, inside = 0;
+  for (size_t i = idle_ms / GAP_BUCKET_MS; i <= GAP_BUCKETS; i++) {
+    ahead += model.hist[i];
+    if (i <= last)
+      inside += model.hist[i];
+  }
+  if (!ahead)
+    return GAP_UNKNOWN;
+  return inside * 100 <= ahead * GAP_RISK_PCT ? GAP_CLEAR : GAP_BUSY;
+}
+
+void Navien::learn_gap(const PACKET_BUFFER *pkt, unsigned long start_us, unsigned long end_us) {
+  bool is_gas = pkt->hdr.packet_type == PACKET_TYPE_GAS;
+
+  // A heater packet that started before our own one was off the wire
+  if (tx_end_us && (long)(start_us - tx_end_us) < 0 && (long)(end_us - tx_start_us) > 0)
+    tx_stats.overlaps++;
+
+  if (gap_prev_valid) {
+    // Latency estimates can put the start a little before the previous end
+    long gap_us = (long)(start_us - gap_prev_end_us);
+    unsigned long gap_ms = gap_us > 0 ? gap_us / 1000 : 0;
+    GAP_MODEL &model = gap_model[gap_prev_gas];
+
+    uint32_t predicted_ms = predictedGapMs(gap_prev_gas);
+    if (predicted_ms) {
+      uint32_t error_ms = gap_ms > predicted_ms ? gap_ms - predicted_ms : predicted_ms - gap_ms;
+      tx_stats.gap_predictions++;
+      tx_stats.gap_error_total_ms += error_ms;
+      if (error_ms > tx_stats.gap_error_max_ms)
+        tx_stats.gap_error_max_ms = error_ms;
+    }
+
+    size_t bucket = gap_ms / GAP_BUCKET_MS;
+    model.hist[bucket < GAP_BUCKETS ? bucket : GAP_BUCKETS]++;
+    if (++model.total >= GAP_DECAY_TOTAL) {
+      model.total = 0;
+      for (size_t i = 0; i <= GAP_BUCKETS; i++) {
+        model.hist[i] /= 2;
+        model.total += model.hist[i];
+      }
+    }
+    tx_stats.gap_samples++;
+  }
+
+  gap_prev_valid = true;
+  gap_prev_gas = is_gas;
+  gap_prev_end_us = end_us;
+}
+
+uint32_t Navien::predictedGapMs(bool after_gas) const {
+  const GAP_MODEL &model = gap_model[after_gas];
+  if (model.total < GAP_MIN_SAMPLES)
+    return 0;
+
+  uint32_t seen = 0;
+  for (size_t i = 0; i < GAP_BUCKETS; i++) {
+    seen += model.hist[i];
+    if (seen * 2 >= model.total)
+      return i * GAP_BUCKET_MS + GAP_BUCKET_MS / 2;
+  }
+  return GAP_RANGE_MS;
+}
+
+void Navien::tx_echo_failed() {
+  tx_echo_wait(false);
+  tx_stats.echo_mismatch++;
+}
+
+void Navien::tx_collided() {
+  tx_echo_wait(false);
+  tx_stats.echo_mismatch++;
+  tx_stats.collisions++;
+  // A command is still retried once its confirmation deadline passes
+  if (tx_attempts >= TX_MAX_RETRANSMITS) {
+    tx_stats.retransmit_give_ups++;
+    return;
+  }
+
+  SEND_JOB *job = NULL;
+  for (size_t i = 0; i < send_job_count; i++) {
+    if (send_jobs[i].seq == tx_job_seq) {
+      job = &send_jobs[i];
+      break;
+    }
+  }
+  if (job) {
+    // The follow-up is still queued; send the job again from this packet
+    job->next = tx_job_packet;
+  } else {
+    // A newer command of the kind is waiting and replaces a first packet.
+    // A follow-up (button release, flag clear) always goes out again.
+    for (size_t i = 0; i < send_job_count && tx_job_packet == 0; i++) {
+      if (send_jobs[i].kind == tx_job_kind && send_jobs[i].next == 0)
+        return;
+    }
+    if (send_job_count >= SEND_QUEUE_CAPACITY) {
+      tx_stats.queue_full_drops++;
+      return;
+    }
+    job = &send_jobs[send_job_count++];
+    job->kind = tx_job_kind;
+    job->arg = tx_job_arg;
+    job->seq = tx_job_seq;
+    job->count = tx_job_packet + 1;
+    job->next = tx_job_packet;
+    job->queued_ms = millis();
+    memcpy(job->raw[tx_job_packet], last_sent_control_packet.raw_data, SEND_PACKET_MAX);
+    if (tx_job_kind == SEND_ANNOUNCE)
+      periodic_announce_pending = true;
+  }
+
+  // Randomized exponential backoff, so a second sender that collided with
+  // us is unlikely to pick the same moment again
+  tx_attempts++;
+  tx_backoff_until_ms = millis() + random((long)(TX_BACKOFF_SLOT_MS << tx_attempts));
+}
+
 void Navien::maybe_send_periodic_announce() {
   if (test_mode || navilink_present || periodic_announce_pending)
     return;
@@ -506,117 +1307,118 @@ void Navien::maybe_send_periodic_announce() {
 
   PACKET_BUFFER buf{};
   memcpy(buf.raw_data, ANNOUNCE_PACKET, sizeof(ANNOUNCE_PACKET));
-  if (enqueue_send_cmd(buf) < 0)
+  if (enqueue_send_job(SEND_ANNOUNCE, 0, &buf) < 0)
     return;
   periodic_announce_pending = true;
 }
 
 int Navien::send_cmd() {
-
-  if (send_queue_count == 0)
+  int index = next_send_job();
+  if (index < 0)
     return -1;
-  PACKET_BUFFER send_buffer = send_array[send_queue_head];
-  send_queue_head = (send_queue_head + 1) % QUEUE_CAPACITY;
-  --send_queue_count;
+  SEND_JOB &job = send_jobs[index];
+
+  PACKET_BUFFER send_buffer{};
+  memcpy(send_buffer.raw_data, job.raw[job.next], SEND_PACKET_MAX);
+  unsigned long queued_ms = job.queued_ms;
+  SendKind kind = job.kind;
+  uint8_t arg = job.arg;
+  uint32_t seq = job.seq;
+  uint8_t packet = job.next;
+  bool first = job.next == 0;
+  bool last = job.next + 1 >= job.count;
 
   // +1 to include the crc value
   int len = HDR_SIZE + send_buffer.hdr.len + 1;
 
-  // Defer control commands until we've successfully transmitted an announce (bus takeover order).
-  if (!test_mode && !navilink_present && last_periodic_announce_time == 0 &&
-      send_buffer.cmd.cmd_type == CONTROL_COMMAND) {
-    enqueue_send_cmd(send_buffer);
-    return -1;
-  }
-
-  // Rate limiting: enforce minimum 2 second interval between consecutive
-  // CONTROL_COMMANDs. This is needed for commands like recirculation and
-  // hotButton that send two commands in sequence (command + follow-up).
-  // Does not apply after an announce, only after a prior control command.
-  if (last_command_sent_time > 0 &&
-      send_buffer.cmd.cmd_type == CONTROL_COMMAND &&
-      last_sent_control_packet.cmd.cmd_type == CONTROL_COMMAND) {
-    unsigned long time_since_last = millis() - last_command_sent_time;
-    if (time_since_last < MIN_COMMAND_INTERVAL_MS) {
-      // Not enough time has passed, re-queue the command
-      enqueue_send_cmd(send_buffer);
-      return -1;
-    }
-  }
-
   int sent_len = -1;
   // Allow sending only when NaviLink is not present.
   if (!navilink_present) {
     // Double-check the bus is still clear right before sending
     // This is a final safety check to avoid collisions
     if (can_send(available())) {
+      bool early = !fixed_margins_elapsed();
+      tx_start_us = micros();
       sent_len = write(send_buffer.raw_data, len);
+      // The follow-up of a two packet job stays queued, ahead of the rest
+      if (sent_len != len || ++job.next >= job.count)
+        remove_send_job(index);
       if (sent_len == len) {
+        tx_end_us = tx_start_us + len * BYTE_TIME_US;
+        tx_start_ms = millis();
+        tx_echo_wait(true);
+        if (seq == tx_job_seq && packet == tx_job_packet) {
+          if (tx_attempts)
+            tx_stats.retransmits++;
+        } else {
+          tx_job_seq = seq;
+          tx_job_packet = packet;
+          tx_job_kind = kind;
+          tx_job_arg = arg;
+          tx_attempts = 0;
+        }
+        tx_stats.sends++;
+        if (early)
+          tx_stats.early_sends++;
+        uint32_t wait_ms = tx_start_ms - queued_ms;
+        tx_stats.queue_wait_total_ms += wait_ms;
+        if (wait_ms > tx_stats.queue_wait_max_ms)
+          tx_stats.queue_wait_max_ms = wait_ms;
         last_command_sent_time = millis();
         last_sent_control_packet = send_buffer;
         last_sent_control_packet_len = len;
         last_sent_control_packet_time = millis();
-        recv_buffer = send_buffer;
+        capture_frame(send_buffer.raw_data, len, CAPTURE_TX, tx_start_ms);
+        local_packet = send_buffer;
+        recv_packet = &local_packet;
+        recv_times.first_byte_us = tx_start_us;
+        recv_times.complete_us = tx_end_us;
+        recv_times.read_us = recv_times.dispatch_us = micros();
         if (send_buffer.cmd.cmd_type == CONTROL_ANNOUNCE) {
           periodic_announce_pending = false;
           last_periodic_announce_time = millis();
+        } else {
+          command_on_wire(kind, arg, first, last);
         }
         parse_control_packet(true);
       }
-    } else if (on_error_cb) {
-      on_error_cb(__func__, "Bus not clear for transmission, command queued again");
-      enqueue_send_cmd(send_buffer);
+    } else {
+      // Stays queued for the next loop()
+      bus_stats.bus_not_clear++;
+      record_error(ERROR_BUS_NOT_CLEAR);
       return -1;
     }
-  } else if (on_error_cb) {
-    on_error_cb(__func__, "Failed to send the command (navilink present):");
-    Navien::print_buffer(send_buffer.raw_data, len, on_error_cb);
+  } else {
+    record_error(ERROR_NAVILINK_PRESENT, 0, 0, send_buffer.raw_data, len);
+    remove_send_job(index);
     if (send_buffer.cmd.cmd_type == CONTROL_ANNOUNCE)
       periodic_announce_pending = false;
+    else if (pending_commands[kind].active && pending_commands[kind].arg == arg)
+      complete_command(kind, COMMAND_DROPPED);
   }
 
   return sent_len;
 }
 
 int Navien::power(bool power_on) {
-  PACKET_BUFFER send_buffer{};
-  memcpy(&send_buffer, COMMAND_HEADER, sizeof(COMMAND_HEADER));
-
-  if (power_on) {
-    send_buffer.cmd.system_power = 0x0a;
-  } else {
-    send_buffer.cmd.system_power = 0x0b;
-  }
-  uint8_t crc = Navien::checksum(send_buffer.raw_data, HDR_SIZE + send_buffer.hdr.len, CHECKSUM_SEED_62);
-  send_buffer.raw_data[HDR_SIZE + send_buffer.hdr.len] = crc;
-
   if (test_mode) {
     state.water[0].system_power = power_on;
-    return(HDR_SIZE + send_buffer.hdr.len);
+    return(HDR_SIZE + sizeof(CMD_DATA));
   }
 
-  // Queue the command
-  return queue_send_cmd(send_buffer);
+  return issue_command(SEND_POWER, power_on);
 }
 
 
 int Navien::setTemp(float temp_degC) {
-  PACKET_BUFFER send_buffer{};
-  memcpy(&send_buffer, COMMAND_HEADER, sizeof(COMMAND_HEADER));
-
-  send_buffer.cmd.set_temp = int(temp_degC * 2.0);
-
-  uint8_t crc = Navien::checksum(send_buffer.raw_data, HDR_SIZE + send_buffer.hdr.len, CHECKSUM_SEED_62);
-  send_buffer.raw_data[HDR_SIZE + send_buffer.hdr.len] = crc;
-
   if (test_mode) {
     state.gas.set_temp = temp_degC;
-    state.water[0].set_temp = temp_degC;
-    return(HDR_SIZE + send_buffer.hdr.len);
+    state.water[0].set_temp_raw = int(temp_degC * 2.0);
+    return(HDR_SIZE + sizeof(CMD_DATA));
   }
 
-  // Queue the command
-  return queue_send_cmd(send_buffer);
+  // A newer set point replaces one still waiting
+  return issue_command(SEND_SET_TEMP, int(temp_degC * 2.0));
 }
 
 uint8_t Navien::generateCmdData() {
@@ -626,65 +1428,202 @@ uint8_t Navien::generateCmdData() {
   return (uint8_t)(now / 39);
 }
 
+void Navien::seal_command(PACKET_BUFFER *pkt) {
+  pkt->raw_data[HDR_SIZE + pkt->hdr.len] = Navien::checksum(pkt->raw_data, HDR_SIZE + pkt->hdr.len, CHECKSUM_SEED_62);
+}
+
 int Navien::hotButton() {
+  return issue_command(SEND_HOT_BUTTON, 1);
+}
+
+int Navien::recirculation(bool recirc_on) {
+  if (test_mode) {
+    NAVIEN_STATE_WATER before = state.water[0];
+    state.water[0].recirculation_active = recirc_on;
+    state.water[0].recirculation_running = recirc_on;
+    state.gas.current_gas_usage = recirc_on ? 200 : 0;
+    state.water[0].capacity_raw = recirc_on ? 30 : 0;
+    update_cascade(before, state.water[0]);
+  }
+
+  return issue_command(SEND_RECIRCULATION, recirc_on);
+}
+
+int Navien::build_command(SendKind kind, uint8_t arg, PACKET_BUFFER *first, PACKET_BUFFER *second) {
   uint8_t cmdData = generateCmdData();
-  PACKET_BUFFER send_buffer{};
-  memcpy(&send_buffer, COMMAND_HEADER, sizeof(COMMAND_HEADER));
+  memcpy(first, COMMAND_HEADER, sizeof(COMMAND_HEADER));
+  memcpy(second, COMMAND_HEADER, sizeof(COMMAND_HEADER));
+
+  switch (kind) {
+    case SEND_POWER:
+      first->cmd.system_power = arg ? 0x0a : 0x0b;
+      seal_command(first);
+      return 1;
+
+    case SEND_SET_TEMP:
+      first->cmd.set_temp = arg;
+      seal_command(first);
+      return 1;
+
+    case SEND_HOT_BUTTON:
+      // The press is followed by the button release
+      first->cmd.hot_button_recirculation = Navien::HOT_BUTTON_DOWN;
+      break;
 
-  send_buffer.cmd.hot_button_recirculation = Navien::HOT_BUTTON_DOWN;
-  send_buffer.cmd.cmd_data = cmdData;
+    case SEND_RECIRCULATION:
+      // The follow-up command clears the recirculation command flag, it
+      // is needed for recirculation to work
+      first->cmd.hot_button_recirculation = arg ? Navien::RECIRCULATION_ON : Navien::RECIRCULATION_OFF;
+      break;
 
-  uint8_t crc = Navien::checksum(send_buffer.raw_data, HDR_SIZE + send_buffer.hdr.len, CHECKSUM_SEED_62);
-  send_buffer.raw_data[HDR_SIZE + send_buffer.hdr.len] = crc;
+    default:
+      return 0;
+  }
 
-  // Queue the command
-  int sent_len = queue_send_cmd(send_buffer);
+  first->cmd.cmd_data = cmdData;
+  seal_command(first);
+  second->cmd.hot_button_recirculation = 0x00;
+  second->cmd.cmd_data = cmdData;
+  seal_command(second);
+  return 2;
+}
 
-  // queue up the button release command
-  memcpy(&send_buffer, COMMAND_HEADER, sizeof(COMMAND_HEADER));
-  send_buffer.cmd.hot_button_recirculation = 0x00;
-  send_buffer.cmd.cmd_data = cmdData;
-  crc = Navien::checksum(send_buffer.raw_data, HDR_SIZE + send_buffer.hdr.len, CHECKSUM_SEED_62);
-  send_buffer.raw_data[HDR_SIZE + send_buffer.hdr.len] = crc;
+int Navien::issue_command(SendKind kind, uint8_t arg) {
+  PACKET_BUFFER first{}, second{};
+  int count = build_command(kind, arg, &first, &second);
 
-  return queue_send_cmd(send_buffer);
+  int ret = queue_send_job(kind, arg, &first, count > 1 ? &second : NULL);
+  // Nothing reports test mode commands back
+  if (ret >= 0 && !test_mode)
+    track_command(kind, arg, ret == 0);
+  return ret;
 }
 
-int Navien::recirculation(bool recirc_on) {
-  uint8_t cmdData = generateCmdData();
-  PACKET_BUFFER send_buffer{};
-  memcpy(&send_buffer, COMMAND_HEADER, sizeof(COMMAND_HEADER));
+const char *Navien::sendKindName(SendKind kind) {
+  switch (kind) {
+    case SEND_POWER: return "power";
+    case SEND_SET_TEMP: return "setTemp";
+    case SEND_RECIRCULATION: return "recirculation";
+    case SEND_HOT_BUTTON: return "hotButton";
+    case SEND_ANNOUNCE: return "announce";
+  }
+  return "unknown";
+}
 
-  send_buffer.cmd.hot_button_recirculation = recirc_on ? Navien::RECIRCULATION_ON : Navien::RECIRCULATION_OFF;
-  send_buffer.cmd.cmd_data = cmdData;
+void Navien::track_command(SendKind kind, uint8_t arg, bool already_done) {
+  PENDING_COMMAND &cmd = pending_commands[kind];
+  if (cmd.active)
+    complete_command(kind, COMMAND_SUPERSEDED);
 
-  uint8_t crc = Navien::checksum(send_buffer.raw_data, HDR_SIZE + send_buffer.hdr.len, CHECKSUM_SEED_62);
-  send_buffer.raw_data[HDR_SIZE + send_buffer.hdr.len] = crc;
+  command_stats.issued++;
+  unsigned long now = millis();
+  cmd = PENDING_COMMAND{ true, false, arg, 0, now, 0, now + CONFIRM_QUEUE_TIMEOUT_MS };
+  // The heater already reports it, a queued command to undo was dropped
+  if (already_done)
+    complete_command(kind, COMMAND_CONFIRMED);
+}
 
-  // Queue the first command
-  int sent_len = queue_send_cmd(send_buffer);
+void Navien::command_on_wire(SendKind kind, uint8_t arg, bool first, bool last) {
+  PENDING_COMMAND &cmd = pending_commands[kind];
+  // A job started before a newer command of its kind replaced the tracking
+  if (!cmd.active || cmd.arg != arg)
+    return;
 
-  // queue up the follow-up command (needed for recirculation to work)
-  // This command clears the recirculation command flag
-  PACKET_BUFFER follow_up_buffer{};
-  memcpy(&follow_up_buffer, COMMAND_HEADER, sizeof(COMMAND_HEADER));
-  follow_up_buffer.cmd.hot_button_recirculation = 0x00;
-  follow_up_buffer.cmd.cmd_data = cmdData;
+  unsigned long now = millis();
+  if (first && !cmd.wire_ms) {
+    cmd.wire_ms = now;
+    record_duration(command_stats.queue_wire_hist, &command_stats.queue_wire_max_ms, now - cmd.queued_ms);
+  }
+  if (!last)
+    return;
+  cmd.on_wire = true;
+  cmd.deadline_ms = now + (CONFIRM_TIMEOUT_MS << cmd.retries);
+  // No state reports a button press, the release going out is the best we get
+  if (kind == SEND_HOT_BUTTON)
+    complete_command(kind, COMMAND_CONFIRMED);
+}
 
-  crc = Navien::checksum(follow_up_buffer.raw_data, HDR_SIZE + follow_up_buffer.hdr.len, CHECKSUM_SEED_62);
-  follow_up_buffer.raw_data[HDR_SIZE + follow_up_buffer.hdr.len] = crc;
+void Navien::confirm_commands() {
+  for (size_t k = 0; k < SEND_ANNOUNCE; k++) {
+    PENDING_COMMAND &cmd = pending_commands[k];
+    // Only water packets after the command went out count; one that was
+    // in flight when we sent could be stale
+    if (cmd.active && cmd.on_wire && heater_reports((SendKind)k, cmd.arg))
+      complete_command((SendKind)k, COMMAND_CONFIRMED);
+  }
+}
 
-  if (test_mode) {
-    state.water[0].recirculation_active = recirc_on;
-    state.water[0].recirculation_running = recirc_on;
-    state.gas.current_gas_usage = recirc_on ? 200 : 0;
-    state.water[0].operating_capacity = recirc_on ? 15 : 0;
-    sent_len = HDR_SIZE + follow_up_buffer.hdr.len;
-    // In test mode, send immediately without delay
-    return queue_send_cmd(follow_up_buffer);
+void Navien::expire_commands() {
+  unsigned long now = millis();
+  for (size_t k = 0; k < SEND_ANNOUNCE; k++) {
+    PENDING_COMMAND &cmd = pending_commands[k];
+    if (!cmd.active)
+      continue;
+
+    SendKind kind = (SendKind)k;
+    int job = -1;
+    for (size_t i = 0; i < send_job_count; i++) {
+      if (send_jobs[i].kind == kind && send_jobs[i].arg == cmd.arg) {
+        job = i;
+        break;
+      }
+    }
+    // A job that vanished without reaching the wire (failed write) is
+    // retried straight away
+    if ((long)(now - cmd.deadline_ms) < 0 && (cmd.on_wire || job >= 0))
+      continue;
+
+    // A collided packet still queued for retransmission is replaced by the
+    // retry below
+    if (job >= 0 && !cmd.on_wire) {
+      // Never made it onto the wire, the bus is not ours
+      remove_send_job(job);
+      complete_command(kind, COMMAND_FAILED);
+      continue;
+    }
+    if (heater_reports(kind, cmd.arg)) {
+      complete_command(kind, COMMAND_CONFIRMED);
+      continue;
+    }
+
+    PACKET_BUFFER first{}, second{};
+    int count = build_command(kind, cmd.arg, &first, &second);
+    if (cmd.retries >= CONFIRM_MAX_RETRIES ||
+        enqueue_send_job(kind, cmd.arg, &first, count > 1 ? &second : NULL) < 0) {
+      complete_command(kind, COMMAND_FAILED);
+      continue;
+    }
+    cmd.retries++;
+    cmd.on_wire = false;
+    cmd.deadline_ms = now + CONFIRM_QUEUE_TIMEOUT_MS;
+    command_stats.retries++;
+  }
+}
+
+void Navien::complete_command(SendKind kind, CommandResult result) {
+  PENDING_COMMAND &cmd = pending_commands[kind];
+  cmd.active = false;
+
+  switch (result) {
+    case COMMAND_CONFIRMED:
+      command_stats.confirmed++;
+      if (cmd.wire_ms)
+        record_duration(command_stats.wire_confirm_hist, &command_stats.wire_confirm_max_ms, millis() - cmd.wire_ms);
+      break;
+    case COMMAND_SUPERSEDED:
+      command_stats.superseded++;
+      break;
+    case COMMAND_FAILED:
+      command_stats.failed++;
+      record_error(ERROR_COMMAND_FAILED, kind);
+      break;
+    case COMMAND_DROPPED:
+      command_stats.dropped++;
+      break;
   }
 
-  return queue_send_cmd(follow_up_buffer);
+  if (on_command_complete_cb)
+    on_command_complete_cb(kind, cmd.arg, result, on_command_complete_context);
 }
 
 uint8_t Navien::checksum(const uint8_t *buffer, uint8_t len, uint16_t seed) {
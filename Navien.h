@@ -23,12 +23,19 @@ SOFTWARE.
 
 #include <cstddef>
 #include <cstdint>
-#include <array>
 #include <HardwareSerial.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 
 #ifndef Navien_h
 #define Navien_h
 
+// Heater systems served by one controller, one RS485 bus (UART) each. The
+// ESP32 has two UARTs besides the console, so at most 2.
+#ifndef NAVIEN_BUSES
+#define NAVIEN_BUSES 1
+#endif
+
 /* Navien RS424 / NaviLink interface
 ** Usage:
 * The class inherits from HardwareSerial, so it needs to be constructed with
@@ -40,19 +47,18 @@ SOFTWARE.
 *     #define TXD2 17 
 *     navienSerial.begin(RXD2, TXD2);
 *
-* To be notified of observed data, you need to register for the respective
-* callback. Note that only the structure for the current callback should be
-* considered valid. With Gas Packer callback, only state.gas structure 
-* should be examined. 
-* Callback functions must be defined as:
-*   void onStatePacket(Navien::NAVIEN_STATE *state) {}
+* To be notified of observed data, subscribe to the packet kinds of interest.
+* Up to MAX_SUBSCRIBERS subscribers can be registered; they are called in
+* order of descending priority. Only the part of the event matching its
+* kind should be considered valid, e.g. event->gas for a gas packet.
+* Subscriber functions must be defined as:
+*   void onPacket(const Navien::PACKET_EVENT *event, void *context) {}
 * For example:
-*     navienSerial.onGasPacket(onGasPacket);
-*     navienSerial.onWaterPacket(onWaterPacket);
-*     navienSerial.onCommandPacket(onCommandPacket);
-*     navienSerial.onAnnouncePacket(onAnnouncePacket);
+*     navienSerial.subscribe("udp", onPacket, NULL, Navien::PACKET_KIND_ALL);
+*     navienSerial.subscribe("gas", onGasPacket, NULL, Navien::PACKET_KIND_GAS,
+*                            10, true);  // priority 10, only when changed
 * For errors, the callback function is defined as:
-*   void onError(const char *function, const char *errorMessage) {}
+*   void onError(const char *function, const char *errorMessage, void *context) {}
 * To register call:
 *     navienSerial.onError(onError);
 *
@@ -62,15 +68,27 @@ SOFTWARE.
 *       navienSerial.loop();
 *     }
 *
+* Optionally, after begin(), packets can be framed on the UART event task
+* as the bytes arrive, so a slow loop() no longer overflows the UART buffer.
+* Parsing and callbacks still happen from loop():
+*     navienSerial.beginRxTask();
+*
+* Each heater system is its own Navien on its own UART, with its own state,
+* subscribers and send queue. The second constructor argument is a bus id
+* that travels with every PACKET_EVENT, so subscribers can be shared:
+*     Navien navienSerial1(1, 1);  // Serial Port 1, bus 1
+*
 ** Basic class operation:
 * Observer operation.
-* In the loop() function, the class builds up a recieve packet, PACKET_BUFFER
-* until it is either a full packet (defined by the packet length in the header)
-* or it is too large for the buffer. 
+* In the loop() function, the class drains the UART into a contiguous receive
+* buffer with one bulk read, scans it for the packet marker and validates the
+* header length and checksum in place. A valid packet is parsed directly from
+* the receive buffer; a corrupt one is skipped and scanning resumes at the next
+* marker already in the buffer.
 * Once a full packet is recieved, it determines the type of packet, and then
 * parses it into the correct NAVIEN_STATE object.
-* If a Callback is defined for the packet type, it is called with the 
-* recieved packet. The raw packet is also available while in the callback
+* Each subscriber registered for the packet kind is then called with the
+* recieved packet. The raw packet is also available while in the subscriber
 * function.
 *
 * Publisher operation.
@@ -172,8 +190,12 @@ enum CommandActionHotButton {
   // At 19200 baud, 8N1 format: 10 bits/byte = 0.52ms per byte
   // Typical packets: Water ~48 bytes (~25ms), Gas ~55 bytes (~29ms), Command ~20 bytes (~10ms)
   // We wait for silence to ensure we're between packets, not mid-transmission
+  // Until the gap model below has learned the bus cadence, and once the bus
+  // has been quiet for longer than any gap it has seen:
   static constexpr unsigned long BUS_SILENCE_MS = 50;  // Wait 50ms after last byte received
   static constexpr unsigned long PACKET_GAP_MS = 30;   // Wait 30ms after last complete packet
+  static constexpr unsigned long BYTE_TIME_US = 521;   // 10 bits at 19200 baud
+  static constexpr int MAX_PACKETS_PER_LOOP = 100;     // per loop() call, with a 100ms budget
 
 
   typedef struct {
@@ -302,48 +324,143 @@ enum CommandActionHotButton {
   // connected together.
   #define MAX_DEVICES 8
 
+  // Bits of NAVIEN_STATE_WATER::changed_fields. All stage_* flags are
+  // derived from system_stage and share its bit.
+  enum WaterChangedField : uint32_t {
+    WATER_CHANGED_SYSTEM_POWER           = 1UL << 0,
+    WATER_CHANGED_SET_TEMP               = 1UL << 1,
+    WATER_CHANGED_OUTLET_TEMP            = 1UL << 2,
+    WATER_CHANGED_INLET_TEMP             = 1UL << 3,
+    WATER_CHANGED_FLOW_LPM               = 1UL << 4,
+    WATER_CHANGED_RECIRCULATION_ACTIVE   = 1UL << 5,
+    WATER_CHANGED_RECIRCULATION_RUNNING  = 1UL << 6,
+    WATER_CHANGED_DISPLAY_METRIC         = 1UL << 7,
+    WATER_CHANGED_INTERNAL_RECIRCULATION = 1UL << 8,
+    WATER_CHANGED_EXTERNAL_RECIRCULATION = 1UL << 9,
+    WATER_CHANGED_OPERATING_CAPACITY     = 1UL << 10,
+    WATER_CHANGED_CONSUMPTION_ACTIVE     = 1UL << 11,
+    WATER_CHANGED_FLOW_STATE             = 1UL << 12,
+    WATER_CHANGED_SYSTEM_STAGE           = 1UL << 13,
+    WATER_CHANGED_SYSTEM_ACTIVE          = 1UL << 14,
+    WATER_CHANGED_OPERATION_TIME         = 1UL << 15,
+    WATER_CHANGED_RAW                    = 1UL << 16,  // Any payload byte, decoded or not
+    WATER_CHANGED_ALL                    = (1UL << 17) - 1
+  };
+
+  // Bits of NAVIEN_STATE_GAS::changed_fields
+  enum GasChangedField : uint32_t {
+    GAS_CHANGED_SET_TEMP                 = 1UL << 0,
+    GAS_CHANGED_OUTLET_TEMP              = 1UL << 1,
+    GAS_CHANGED_INLET_TEMP               = 1UL << 2,
+    GAS_CHANGED_CONTROLLER_VERSION       = 1UL << 3,
+    GAS_CHANGED_PANEL_VERSION            = 1UL << 4,
+    GAS_CHANGED_ACCUMULATED_GAS_USAGE    = 1UL << 5,
+    GAS_CHANGED_ACCUMULATED_WATER_USAGE  = 1UL << 6,
+    GAS_CHANGED_CURRENT_GAS_USAGE        = 1UL << 7,
+    GAS_CHANGED_TARGET_GAS_USAGE         = 1UL << 8,
+    GAS_CHANGED_TOTAL_OPERATING_TIME     = 1UL << 9,
+    GAS_CHANGED_ELAPSED_INSTALL_DAYS     = 1UL << 10,
+    GAS_CHANGED_DOMESTIC_USAGE_CNT       = 1UL << 11,
+    GAS_CHANGED_RECIRCULATION_ENABLED    = 1UL << 12,
+    GAS_CHANGED_RAW                      = 1UL << 13,  // Any payload byte, decoded or not
+    GAS_CHANGED_ALL                      = (1UL << 14) - 1
+  };
+
+  // Bits of NAVIEN_STATE_CASCADE::changed_fields. mean_capacity() follows
+  // UNITS and OPERATING_CAPACITY, the any_* flags their unit counts.
+  enum CascadeChangedField : uint32_t {
+    CASCADE_CHANGED_UNITS                = 1UL << 0,
+    CASCADE_CHANGED_FLOW_LPM             = 1UL << 1,
+    CASCADE_CHANGED_OPERATING_CAPACITY   = 1UL << 2,
+    CASCADE_CHANGED_UNITS_FIRING         = 1UL << 3,
+    CASCADE_CHANGED_UNITS_RECIRCULATING  = 1UL << 4,
+    CASCADE_CHANGED_UNITS_CONSUMING      = 1UL << 5,
+    CASCADE_CHANGED_ALL                  = (1UL << 6) - 1
+  };
+
   // Parsed known values from the respective packets
   // Structure is updated before calling the callback functions.
-  typedef struct {
-    bool system_power;
-    float set_temp; // degree C
-    float outlet_temp; // degree C
-    float inlet_temp; // degree C
-    float flow_lpm; // Water flow velocity, via Recirculation or Tap being on
-    bool recirculation_active; // Recirculation mode is current ON
-    bool recirculation_running; // Recirculation pump is currently running
-    bool display_metric; // True == degree C; False == degree F
-    bool internal_recirculation; // Unit configured for internal recirculation
-    bool external_recirculation; // Unit configured for external recirculation
-    float operating_capacity; // Percentage 0.0 - 100.0 %
-    bool consumption_active; // Tap is turned on
+  // changed_fields holds the fields that differ from the previous packet
+  // (from the same unit, for water); all bits are set on the first one.
+  // sequence counts packets of the type, starting at 1; 0 means none yet.
+  // Water state keeps the packet's fixed-point bytes and one bit per flag,
+  // 20 bytes per unit; the accessors convert. The stage_* accessors
+  // decode system_stage when called.
+  struct NAVIEN_STATE_WATER {
+    uint32_t changed_fields;  // WaterChangedField bits
+    uint32_t sequence;        // Water packets seen, across all units
+    uint16_t operation_time;  // hours
+    uint8_t device_number;
+    uint8_t system_stage;     // Raw system operating stage value
     uint8_t flow_state;
-    uint8_t system_stage;  // Raw system operating stage value
+    uint8_t set_temp_raw;     // 0.5 degree C
+    uint8_t outlet_temp_raw;  // 0.5 degree C
+    uint8_t inlet_temp_raw;   // 0.5 degree C
+    uint8_t flow_raw;         // 0.1 L/min
+    uint8_t capacity_raw;     // 0.5 %
+
+    bool system_power : 1;
+    bool recirculation_active : 1;    // Recirculation mode is current ON
+    bool recirculation_running : 1;   // Recirculation pump is currently running
+    bool display_metric : 1;          // True == degree C; False == degree F
+    bool internal_recirculation : 1;  // Unit configured for internal recirculation
+    bool external_recirculation : 1;  // Unit configured for external recirculation
+    bool consumption_active : 1;      // Tap is turned on
+    bool system_active : 1;           // System is actively running
+
+    float set_temp() const { return set_temp_raw / 2.f; }        // degree C
+    float outlet_temp() const { return outlet_temp_raw / 2.f; }  // degree C
+    float inlet_temp() const { return inlet_temp_raw / 2.f; }    // degree C
+    // Water flow velocity, via Recirculation or Tap being on
+    float flow_lpm() const { return flow_raw / 10.f; }
+    // Percentage 0.0 - 100.0 %
+    float operating_capacity() const { return capacity_raw / 2.f; }
 
     // system_stage high-level groups (upper nibble)
-    bool stage_idle;          // 0x1x
-    bool stage_starting;      // 0x2x
-    bool stage_active;        // 0x3x
-    bool stage_shutting_down; // 0x4x
+    bool stage_idle() const { return (system_stage & 0xF0) == 0x10; }
+    bool stage_starting() const { return (system_stage & 0xF0) == 0x20; }
+    bool stage_active() const { return (system_stage & 0xF0) == 0x30; }
+    bool stage_shutting_down() const { return (system_stage & 0xF0) == 0x40; }
 
     // system_stage specific sub-states
-    bool stage_standby;           // 0x14
-    bool stage_demand;            // 0x20
-    bool stage_pre_purge;         // 0x29
-    bool stage_ignition;          // 0x2B
-    bool stage_flame_on;          // 0x2C
-    bool stage_ramp_up;           // 0x2D
-    bool stage_active_combustion; // 0x33
-    bool stage_water_adjustment;  // 0x34
-    bool stage_flame_off;         // 0x3C
-    bool stage_post_purge_1;      // 0x46 post-purge 1/2 (15s)
-    bool stage_post_purge_2;      // 0x47 post-purge 2/2 (15s)
-    bool stage_dhw_wait;          // 0x49 dhw-wait (150s)
-
-    bool system_active;       // System is actively running
-    uint16_t operation_time;  // hours
-    uint8_t device_number;
-  } NAVIEN_STATE_WATER;
+    bool stage_standby() const { return system_stage == 0x14; }
+    bool stage_demand() const { return system_stage == 0x20; }
+    bool stage_pre_purge() const { return system_stage == 0x29; }
+    bool stage_ignition() const { return system_stage == 0x2B; }
+    bool stage_flame_on() const { return system_stage == 0x2C; }
+    bool stage_ramp_up() const { return system_stage == 0x2D; }
+    bool stage_active_combustion() const { return system_stage == 0x33; }
+    bool stage_water_adjustment() const { return system_stage == 0x34; }
+    bool stage_flame_off() const { return system_stage == 0x3C; }
+    bool stage_post_purge_1() const { return system_stage == 0x46; }  // post-purge 1/2 (15s)
+    bool stage_post_purge_2() const { return system_stage == 0x47; }  // post-purge 2/2 (15s)
+    bool stage_dhw_wait() const { return system_stage == 0x49; }      // dhw-wait (150s)
+  };
+  static_assert(sizeof(NAVIEN_STATE_WATER) == 20, "NAVIEN_STATE_WATER is packed to 20 bytes");
+
+  // Totals over every water unit seen. Each water packet takes its unit's
+  // previous contribution out and adds the new one, so reading it costs
+  // the same for 1 or 8 units. changed_fields holds what the last update
+  // changed; sequence counts the updates that changed something.
+  struct NAVIEN_STATE_CASCADE {
+    uint32_t changed_fields;       // CascadeChangedField bits
+    uint32_t sequence;
+    uint16_t flow_raw;             // Sum over units, 0.1 L/min
+    uint16_t capacity_raw;         // Sum over units, 0.5 %
+    uint8_t unit_mask;             // Bit per device_number seen
+    uint8_t units;                 // Units seen
+    uint8_t units_firing;          // Units with operating capacity > 0
+    uint8_t units_recirculating;   // Units with the recirculation pump running
+    uint8_t units_consuming;       // Units with a tap open
+
+    float flow_lpm() const { return flow_raw / 10.f; }
+    // Sum over units, 0.0 - units * 100.0 %
+    float operating_capacity() const { return capacity_raw / 2.f; }
+    // Percentage 0.0 - 100.0 %, per unit seen
+    float mean_capacity() const { return units ? capacity_raw / 2.f / units : 0.f; }
+    bool any_recirculating() const { return units_recirculating != 0; }
+    bool any_consuming() const { return units_consuming != 0; }
+  };
 
   typedef struct {
     float set_temp;  // degree C
@@ -353,12 +470,19 @@ enum CommandActionHotButton {
     float panel_version;
     float accumulated_gas_usage;    // m^3 (ccf = m^3 / 2.832, Therms = m^3 / 2.832 * 1.02845 )
     float accumulated_water_usage;  // L (gal = L / 3.78541)
+    // The counts the totals were decoded from, 0.1 m^3 and 0.1 L. A float
+    // cannot hold every count above 2^24; JSON and binary UDP use these.
+    uint32_t accumulated_gas_raw;
+    uint32_t accumulated_water_raw;
     uint16_t current_gas_usage;     // kcal (btu == kcal * 3.965667)
     uint16_t target_gas_usage;      // kcal (btu == kcal * 3.965667)
     uint32_t total_operating_time;  // minutes
     uint16_t elapsed_install_days;  // days since install
     uint32_t accumulated_domestic_usage_cnt;  // Counter for domestic usage, increments every 10 usages
     bool recirculation_enabled;     // recirculation is configured/enabled
+
+    uint32_t changed_fields;  // GasChangedField bits
+    uint32_t sequence;        // Gas packets seen
   } NAVIEN_STATE_GAS;
 
   typedef struct {
@@ -384,6 +508,7 @@ enum CommandActionHotButton {
 
     NAVIEN_STATE_WATER water[MAX_DEVICES];
     uint8_t max_water_devices_seen = 0;  // Count of unique water device IDs seen
+    NAVIEN_STATE_CASCADE cascade;
 
     NAVIEN_STATE_GAS gas;
     NAVIEN_STATE_COMMAND command;
@@ -391,49 +516,350 @@ enum CommandActionHotButton {
 
   } NAVIEN_STATE;
 
-  typedef enum {
-    INITIAL,
-    MARKER_FOUND,
-    HEADER_PARSED
-  } READ_STATE;
-
   // Navien 240A has temperature range for domestic hot water (DHW) of 37degC to 60degC
   static constexpr float TEMPERATURE_MIN = 37.0f;
   static constexpr float TEMPERATURE_MAX = 60.0f;
 
-  typedef void (*NavienWaterCallback)(NAVIEN_STATE_WATER *water);
-  typedef void (*NavienGasCallback)(NAVIEN_STATE_GAS *gas);
-  typedef void (*PacketCallbackFunction)(NAVIEN_STATE *state);
-  typedef void (*ErrorCallbackFunction)(const char* functionName, const char* error);
+  // Histograms in RX_STATS, BUS_STATS and COMMAND_STATS are log2 buckets
+  // of microseconds: bucket 0 counts 0 us, bucket i counts [2^(i-1), 2^i) us
+  // and the last bucket everything above.
+  static constexpr size_t BUS_HIST_BUCKETS = 20;
+
+  // When a received packet passed each stage, in micros() (esp_timer on
+  // the ESP32). The UART does not timestamp bytes, so the two wire times
+  // are estimates; see next_frame().
+  typedef struct {
+    unsigned long first_byte_us;  // first byte started on the wire
+    unsigned long complete_us;    // last byte came off the wire
+    unsigned long read_us;        // the read that took its last byte from the UART driver
+    unsigned long dispatch_us;    // handed to parse_packet(); subscribers follow
+  } FRAME_TIMES;
+
+  // Receive path counters, see rxStats(). The histograms split the
+  // latency by FRAME_TIMES stage.
+  typedef struct {
+    uint32_t packets;           // packets handed to parse_packet()
+    uint64_t latency_total_us;  // sum of last byte on the wire -> parse_packet()
+    uint32_t latency_max_us;
+    uint32_t uart_overflows;    // UART FIFO / buffer full events reported by the driver
+    uint32_t queue_drops;       // RX task: packets lost because the queue was full
+    uint32_t queue_high_water;  // RX task: deepest the queue has been
+    uint32_t framing_errors;    // packets rejected by next_frame()
+    uint32_t uart_wait_max_us;
+    uint32_t buffer_wait_max_us;
+    uint32_t frame_gap_max_us;
+    uint32_t latency_hist[BUS_HIST_BUCKETS];      // complete -> dispatch
+    uint32_t uart_wait_hist[BUS_HIST_BUCKETS];    // complete -> read, waiting in the UART driver
+    uint32_t buffer_wait_hist[BUS_HIST_BUCKETS];  // read -> dispatch, in rx_buf or the RX queue
+    uint32_t frame_gap_hist[BUS_HIST_BUCKETS];    // previous packet's complete -> first byte
+  } RX_STATS;
+
+  // Bus health counters, see busStats().
+  typedef struct {
+    uint32_t checksum_errors;
+    uint32_t resyncs;           // times the scan skipped bytes to reach the next marker
+    uint32_t oversize_drops;    // headers with a length beyond PACKET_BUFFER
+    uint32_t invalid_length;    // headers with length 0xFF
+    uint32_t bus_not_clear;     // sends requeued because a packet was arriving
+    uint32_t echo_suppressed;   // our own control packets seen again on the bus
+    uint32_t uart_high_water;   // most bytes waiting in the UART driver at a read
+    uint32_t loop_calls;
+    uint32_t loop_max_us;
+    uint32_t parse_max_us;      // parse_packet() without subscriber time
+    uint32_t loop_hist[BUS_HIST_BUCKETS];
+    uint32_t parse_hist[BUS_HIST_BUCKETS];
+  } BUS_STATS;
+
+  // Transmit scheduling counters, see txStats()
+  typedef struct {
+    uint32_t gap_samples;          // idle gaps between status packets learned
+    uint32_t gap_predictions;      // gaps predicted before they were learned
+    uint32_t gap_error_total_ms;   // |predicted - actual| over gap_predictions
+    uint32_t gap_error_max_ms;
+    uint32_t sends;                // packets written to the bus
+    uint32_t early_sends;          // sends the fixed silence margins would have held back
+    uint32_t echo_matched;         // sends whose echo came back intact
+    uint32_t echo_mismatch;        // sends followed by a framing error, or no echo
+    uint32_t collisions;           // sends whose echo came back corrupted
+    uint32_t retransmits;          // collided packets sent again after a backoff
+    uint32_t retransmit_give_ups;  // packets left after TX_MAX_RETRANSMITS collisions
+    uint32_t overlaps;             // status packets that started before our send ended
+    uint32_t queue_wait_total_ms;  // queued -> written, over sends
+    uint32_t queue_wait_max_ms;
+    uint32_t queue_high_water;     // deepest the send queue has been
+    uint32_t superseded;           // queued commands replaced by a newer one of the same kind
+    uint32_t cancelled;            // queued commands undone by a newer one, neither sent
+    uint32_t queue_full_drops;     // jobs refused because the send queue was full
+  } TX_STATS;
+
+  // Errors are kept as a code with up to two arguments and the start of
+  // the offending frame; see errorStats() and recentError(). Text is only
+  // made by formatError(), for on_error_cb and whoever else asks.
+  enum ErrorCode : uint8_t {
+    ERROR_INVALID_LENGTH,    // header length 0xFF, reversed 485 wires?
+    ERROR_OVERSIZE,          // a: header length, b: largest that fits PACKET_BUFFER
+    ERROR_CHECKSUM,          // a: calculated, b: received
+    ERROR_UNKNOWN_STATUS,    // a: packet type
+    ERROR_UNKNOWN_CONTROL,   // a: control packet type
+    ERROR_UNKNOWN_WATER,     // a: cmd type
+    ERROR_UNKNOWN_GAS,       // a: cmd type
+    ERROR_UNKNOWN_ANNOUNCE,  // a: cmd type
+    ERROR_UNKNOWN_COMMAND,   // a: cmd type
+    ERROR_RX_TASK,           // a: frames rejected on the RX task since the last one
+    ERROR_BUS_NOT_CLEAR,     // send requeued
+    ERROR_NAVILINK_PRESENT,  // command not sent, the frame is the command
+    ERROR_COMMAND_FAILED,    // a: SendKind
+    ERROR_CODE_COUNT
+  };
+  static constexpr size_t ERROR_FRAME_BYTES = 32;
+  static constexpr size_t ERROR_RING_SIZE = 8;
+  // Most records one code keeps in the ring, so a burst leaves the others
+  static constexpr size_t ERROR_RING_PER_CODE = 4;
+  // Each code reaches on_error_cb at most once per interval
+  static constexpr unsigned long ERROR_REPORT_INTERVAL_MS = 1000;
+  typedef struct {
+    uint32_t ms;
+    ErrorCode code;
+    uint8_t len;  // frame length, only the first ERROR_FRAME_BYTES are kept
+    uint16_t a;
+    uint16_t b;
+    uint8_t frame[ERROR_FRAME_BYTES];
+  } ERROR_RECORD;
+  typedef struct {
+    // By code. Frames rejected on the RX task are counted under their own
+    // code but not kept in the ring, so ERROR_RX_TASK is never counted.
+    uint32_t count[ERROR_CODE_COUNT];
+    uint32_t reported;    // passed to on_error_cb
+    uint32_t suppressed;  // held back by the per-code rate limit
+  } ERROR_STATS;
+
+  // Send queue job kinds, in priority order. An announce only goes when no
+  // command is ready, but commands wait for the first announce.
+  enum SendKind : uint8_t {
+    SEND_POWER,
+    SEND_SET_TEMP,
+    SEND_RECIRCULATION,
+    SEND_HOT_BUTTON,
+    SEND_ANNOUNCE
+  };
+
+  // How a tracked command ended, see onCommandComplete()
+  enum CommandResult : uint8_t {
+    COMMAND_CONFIRMED,   // water packets show the requested state
+    COMMAND_SUPERSEDED,  // a newer command of the same kind took over
+    COMMAND_FAILED,      // not confirmed after CONFIRM_MAX_RETRIES retries
+    COMMAND_DROPPED      // not sent, a NaviLink took over the bus
+  };
+
+  // Command confirmation counters, see commandStats(). The histograms use
+  // the BUS_STATS buckets, in milliseconds.
+  typedef struct {
+    uint32_t issued;
+    uint32_t confirmed;
+    uint32_t superseded;
+    uint32_t failed;
+    uint32_t dropped;
+    uint32_t retries;
+    uint32_t queue_wire_max_ms;     // queued -> first packet on the wire
+    uint32_t wire_confirm_max_ms;   // first packet on the wire -> confirmed, retries included
+    uint32_t queue_wire_hist[BUS_HIST_BUCKETS];
+    uint32_t wire_confirm_hist[BUS_HIST_BUCKETS];
+  } COMMAND_STATS;
+
+  // Per payload byte statistics for protocol research, see payloadStats().
+  // Water units are pooled; changes and bit_flips compare a packet with
+  // the previous one from the same unit. The sums are split by a known
+  // reference field, so a byte that follows it shows different means.
+  typedef struct {
+    uint8_t min;
+    uint8_t max;
+    uint8_t last;
+    uint32_t changes;        // packets where the byte differed from the previous one
+    uint32_t bit_flips[8];   // changes of each bit, bit 0 first
+    uint64_t sketch;         // one bit per hashed value, see distinctValues()
+    uint32_t sum_active;     // over packets with the reference field set
+    uint32_t sum_idle;       // over the others
+  } BYTE_STATS;
+
+  typedef struct {
+    uint32_t packets;
+    uint32_t active_packets;  // with the reference field set
+    uint8_t len;              // longest payload seen, bytes from cmd_type
+    uint8_t capacity;         // entries in bytes[]
+    const char *reference;    // JSON key of the reference field
+    BYTE_STATS *bytes;
+  } PAYLOAD_STATS;
+
+  // Exclusive upper bound of a histogram bucket, in the histogram's unit.
+  // The last bucket is open ended; its limit is only a label.
+  static uint32_t histogramBucketLimit(size_t bucket) { return 1UL << bucket; }
+  // Upper bound of the bucket holding the pct'th percentile, 0 with no
+  // samples
+  static uint32_t histogramPercentile(const uint32_t *hist, uint8_t pct);
+
+  // Packet kinds, combined into a subscriber's filter
+  enum PacketKind : uint8_t {
+    PACKET_KIND_WATER    = 1 << 0,
+    PACKET_KIND_GAS      = 1 << 1,
+    PACKET_KIND_COMMAND  = 1 << 2,
+    PACKET_KIND_ANNOUNCE = 1 << 3,
+    PACKET_KIND_CASCADE  = 1 << 4,  // After a water packet that changed state.cascade
+    PACKET_KIND_ALL      = 0x1F
+  };
+
+  // Bit of PACKET_EVENT::changed_fields for command and announce packets,
+  // which have no per-field mask
+  static constexpr uint32_t CONTROL_CHANGED_RAW = 1UL << 0;
+
+  // Handed to subscribers; only valid for the duration of the call.
+  // water/gas/cascade are set for their packet kind, NULL otherwise; a
+  // cascade event's raw and times are the water packet that changed it.
+  typedef struct {
+    PacketKind kind;
+    uint32_t changed_fields;  // Water-, Gas-, CascadeChangedField or CONTROL_CHANGED_RAW bits
+    const NAVIEN_STATE *state;
+    const NAVIEN_STATE_WATER *water;
+    const NAVIEN_STATE_GAS *gas;
+    const NAVIEN_STATE_CASCADE *cascade;
+    const PACKET_BUFFER *raw;
+    const FRAME_TIMES *times;
+    Navien *bus;  // the instance that parsed it, see busId()
+  } PACKET_EVENT;
+
+  typedef void (*PacketSubscriber)(const PACKET_EVENT *event, void *context);
+
+  // A registered subscriber and its cumulative cost, see subscriberInfo()
+  typedef struct {
+    const char *name;
+    PacketSubscriber fn;
+    void *context;
+    uint8_t kinds;          // PacketKind bits
+    int8_t priority;        // Higher runs first
+    bool only_on_change;    // Skip packets with changed_fields == 0
+    uint32_t calls;
+    uint64_t total_us;
+    uint32_t max_us;
+  } SUBSCRIBER;
+
+  static constexpr size_t MAX_SUBSCRIBERS = 8;
+
+  typedef void (*CaptureWriteFunction)(const uint8_t *data, size_t len, void *context);
+  typedef void (*CommandCompleteFunction)(SendKind kind, uint8_t arg, CommandResult result, void *context);
+  typedef void (*ErrorCallbackFunction)(const char* functionName, const char* error, void *context);
 
 public:
-  Navien(uint8_t uart_nr)
-    : HardwareSerial(uart_nr), navilink_present(false), test_mode(true), recv_state(INITIAL) {}
+  Navien(uint8_t uart_nr, uint8_t bus_id = 0)
+    : HardwareSerial(uart_nr), navilink_present(false), test_mode(true), bus_id(bus_id) {}
+
+  // Which heater system this is, 0 .. NAVIEN_BUSES - 1
+  uint8_t busId() const { return bus_id; }
   
   /* Navien is 19200 baud, 8 bit, no parity, 1 stop bit */
-  void begin(int8_t rxPin, int8_t txPin) { HardwareSerial::begin(19200, SERIAL_8N1, rxPin, txPin); }
+  void begin(int8_t rxPin, int8_t txPin) {
+    HardwareSerial::begin(19200, SERIAL_8N1, rxPin, txPin);
+    // Count bytes lost in the UART driver so drops show up in rxStats()
+    onReceiveError([this](hardwareSerial_error_t err) {
+      if (err == UART_BUFFER_FULL_ERROR || err == UART_FIFO_OVF_ERROR)
+        stats_inc(rx_stats.uart_overflows);
+    });
+  }
+
+  // Frame packets on the UART event task instead of in loop(). Call after
+  // begin(). Returns false if the packet queue could not be allocated.
+  bool beginRxTask(UBaseType_t queue_depth = RX_QUEUE_DEPTH);
+  bool rxTaskActive() const { return rx_queue != NULL; }
 
   // Call this in the loop function
   void loop();
 
-  // Set the callback functions, called when packet is processed
-  void onGasPacket(NavienGasCallback f) {
-    on_gas_packet_cb = f;
-  }
-  void onWaterPacket(NavienWaterCallback f) {
-    on_water_packet_cb = f;
-  }
-  void onCommandPacket(PacketCallbackFunction f) {
-    on_command_packet_cb = f;
-  }
-
-  void onAnnouncePacket(PacketCallbackFunction f) {
-    on_announce_packet_cb = f;
+  const RX_STATS *rxStats() const { return &rx_stats; }
+  const BUS_STATS *busStats() const { return &bus_stats; }
+  void resetBusStats();
+  const TX_STATS *txStats() const { return &tx_stats; }
+  size_t sendQueueDepth() const { return send_job_count; }
+  const COMMAND_STATS *commandStats() const { return &command_stats; }
+
+  // Payload byte statistics of PACKET_KIND_WATER or PACKET_KIND_GAS
+  // packets, NULL for other kinds. The reference field is
+  // consumption_active for water and gas burning (current_gas_usage > 0)
+  // for gas.
+  const PAYLOAD_STATS *payloadStats(PacketKind kind) const;
+  void resetPayloadStats();
+  // Estimated number of distinct values behind a BYTE_STATS sketch, 256
+  // once it is full
+  static uint16_t distinctValues(uint64_t sketch);
+  static const char *sendKindName(SendKind kind);
+
+  // Learned idle gap after a water or gas packet. gapModelSamples() is the
+  // (decayed) sample count; the model is used once it reaches
+  // GAP_MIN_SAMPLES. predictedGapMs() is the median gap, or 0 if unknown.
+  uint16_t gapModelSamples(bool after_gas) const { return gap_model[after_gas].total; }
+  uint32_t predictedGapMs(bool after_gas) const;
+
+  // Raw frame capture. Every valid frame received, and every frame we
+  // send, is kept in a CAPTURE_RING_BYTES ring, oldest evicted first.
+  // Frames that fail the checksum are not kept.
+  //
+  // Export format, little endian:
+  //   header  "NVCP", u8 version (CAPTURE_VERSION), u8 0, u16 record
+  //           count, u32 records evicted, u32 millis() at export
+  //   record  u32 millis() the frame completed, u8 CAPTURE_* flags,
+  //           the frame (its length is in its header)
+  static constexpr size_t CAPTURE_RING_BYTES = 8192;
+  static constexpr size_t CAPTURE_HEADER_SIZE = 16;
+  static constexpr size_t CAPTURE_RECORD_SIZE = 5;  // before the frame
+  static constexpr uint8_t CAPTURE_VERSION = 1;
+  static constexpr uint8_t CAPTURE_TX = 0x01;       // sent by us, else received
+  size_t captureCount() const { return capture_count; }
+  uint32_t captureEvicted() const { return capture_evicted; }
+  // Bytes captureExport() writes
+  size_t captureExportSize() const { return CAPTURE_HEADER_SIZE + capture_used; }
+  // Write the capture, in at most three calls to write. Must be called
+  // from the loop() task.
+  void captureExport(CaptureWriteFunction write, void *context) const;
+  void captureClear() { capture_tail = capture_used = capture_count = 0; capture_evicted = 0; }
+
+  // Register fn for the packet kinds in the kinds mask. name must outlive
+  // the subscription. Returns false if fn is NULL or all MAX_SUBSCRIBERS
+  // slots are in use.
+  bool subscribe(const char *name, PacketSubscriber fn, void *context, uint8_t kinds,
+                 int8_t priority = 0, bool only_on_change = false);
+  // Remove the subscription registered with fn and context. Must not be
+  // called from inside a subscriber. Returns false if it was not found.
+  bool unsubscribe(PacketSubscriber fn, void *context);
+
+  size_t subscriberCount() const { return subscriber_count; }
+  // Subscribers in call order, NULL past subscriberCount()
+  const SUBSCRIBER *subscriberInfo(size_t index) const {
+    return index < subscriber_count ? &subscribers[index] : NULL;
   }
 
   // Set the error callback function
-  void onError(ErrorCallbackFunction f) {
+  void onError(ErrorCallbackFunction f, void *context = NULL) {
     on_error_cb = f;
+    on_error_context = context;
+  }
+
+  const ERROR_STATS *errorStats() const { return &error_stats; }
+  // Recent errors, 0 the newest, NULL past the ones kept
+  const ERROR_RECORD *recentError(size_t index) const;
+  void resetErrors();
+  // One line of text for rec, without the frame. Returns buf.
+  static const char *formatError(const ERROR_RECORD &rec, char *buf, size_t size);
+  static const char *errorCodeName(ErrorCode code);
+
+  // data as "AA BB CC " (uppercase, a space after every byte), the form of
+  // the UDP "debug" field. Stops at whole bytes that fit; returns the
+  // characters written, not counting the NUL. Needs 3 * len + 1 bytes.
+  static size_t formatHex(const uint8_t *data, size_t len, char *buf, size_t size);
+
+  // Called once for every command queued by power(), setTemp(),
+  // recirculation() or hotButton() when it completes. arg is the on/off
+  // state, or the set point in 0.5 degC steps. A hot button press has no
+  // state to confirm, it is confirmed when the release is sent.
+  void onCommandComplete(CommandCompleteFunction f, void *context = NULL) {
+    on_command_complete_cb = f;
+    on_command_complete_context = context;
   }
 
   // Get the current state
@@ -441,9 +867,25 @@ public:
     return &state;
   }
 
-  // Only valid while inside a packet callback function
+  // Only valid while inside a subscriber function
   const PACKET_BUFFER *rawPacketData() {
-    return &recv_buffer;
+    return recv_packet;
+  }
+  // Timestamps of rawPacketData(). For our own transmissions, the wire
+  // times are the send and read_us / dispatch_us when it was parsed.
+  const FRAME_TIMES *rawPacketTimes() {
+    return &recv_times;
+  }
+
+  // Last payload (from cmd_type) of a water unit or of the gas packet, as
+  // the state was decoded from; *len is 0 before the first one.
+  const uint8_t *waterPayload(uint8_t device_number, uint8_t *len) const {
+    *len = device_number < MAX_DEVICES ? prev_water_len[device_number] : 0;
+    return *len ? prev_water_raw[device_number] : NULL;
+  }
+  const uint8_t *gasPayload(uint8_t *len) const {
+    *len = prev_gas_len;
+    return *len ? prev_gas_raw : NULL;
   }
 
 // Control functions
@@ -454,35 +896,98 @@ public:
     return !navilink_present && (test_mode || last_periodic_announce_time != 0);
   }
 
+  // Commands are queued, then tracked until the heater's water packets
+  // show them, and retried if they don't; see onCommandComplete().
+  // Each returns -1 on failure, 0 if the heater already reports the
+  // requested state and a queued command to undo was dropped, otherwise
+  // a positive value (bytes in test mode).
+
   // Turn on or off the unit
-  // Return number of bytes sent, -1 on failure
   int power(bool on);
 
   // Change the set point. Value specified in degC, 
   // rounded to nearest 0.5 degree
-  // Return number of bytes sent, -1 on failure
   int setTemp(float temp_degC);
 
   // Press the hot button
-  // Return number of bytes sent, -1 on failure
   int hotButton();
 
   // Turn on or off Recirculation
-  // Return number of bytes sent, -1 on failure
   int recirculation(bool on);
 
+  // A command for this state is queued or waiting for its confirmation.
+  // Issuing it again would supersede it and restart its retries.
+  bool commandPending(SendKind kind, uint8_t arg) const {
+    return kind < SEND_ANNOUNCE && pending_commands[kind].active && pending_commands[kind].arg == arg;
+  }
+
 
 protected:
   // Debug helper to print hex buffers
-  static void print_buffer(const uint8_t *data, size_t length, ErrorCallbackFunction on_error_cb);
+  static void print_buffer(const uint8_t *data, size_t length, ErrorCallbackFunction on_error_cb, void *context);
 
   // Can I send a command now - avoid collisions on RS485 line
   bool can_send(int curr_available);
+
+  // Whether the learned gap model expects the bus to stay idle for tx_ms
+  // from now. GAP_UNKNOWN leaves the decision to the fixed margins.
+  enum GapVerdict { GAP_UNKNOWN, GAP_BUSY, GAP_CLEAR };
+  GapVerdict gap_verdict(unsigned long tx_ms) const;
+  // The fixed BUS_SILENCE_MS / PACKET_GAP_MS margins have elapsed
+  bool fixed_margins_elapsed() const;
+  // Learn the idle gap before a status packet that arrived [start_us, end_us]
+  void learn_gap(const PACKET_BUFFER *pkt, unsigned long start_us, unsigned long end_us);
+  // Our packet did not come back at all: count it once
+  void tx_echo_failed();
+  // Our packet came back corrupted: count it and put it back in the send
+  // queue behind a random backoff
+  void tx_collided();
   void maybe_send_periodic_announce();
-  /** Enqueue without policy checks (periodic announce, TX retries). */
-  int enqueue_send_cmd(const PACKET_BUFFER& pkt);
-  /** User-facing queue: defers CONTROL_COMMAND until we've transmitted an announce. */
-  int queue_send_cmd(const PACKET_BUFFER& pkt);
+  /** Queue a job of one or two packets without policy checks (periodic
+   *  announce). A queued, unsent job of the same kind is superseded.
+   *  Returns 1, or -1 if the queue is full. */
+  int enqueue_send_job(SendKind kind, uint8_t arg, const PACKET_BUFFER *first, const PACKET_BUFFER *second = NULL);
+  /** User-facing queue: refuses commands until we've transmitted an announce,
+   *  and cancels a queued command that a newer one undoes. */
+  int queue_send_job(SendKind kind, uint8_t arg, const PACKET_BUFFER *first, const PACKET_BUFFER *second = NULL);
+  // Index of the job send_cmd() should transmit from next, or -1 while
+  // the previous packet's echo or a collision backoff is outstanding
+  int next_send_job() const;
+  void remove_send_job(size_t index);
+  // Finish the checksum of a command built from COMMAND_HEADER
+  static void seal_command(PACKET_BUFFER *pkt);
+  // The last water packet already reports the state a kind/arg command asks for
+  bool heater_reports(SendKind kind, uint8_t arg) const;
+  // Build the one or two packets of a command job. Returns the count.
+  int build_command(SendKind kind, uint8_t arg, PACKET_BUFFER *first, PACKET_BUFFER *second);
+  // Build, queue and track a command. Returns as the control functions do.
+  int issue_command(SendKind kind, uint8_t arg);
+
+  // Command confirmation. One command per kind is tracked: queued, then on
+  // the wire, then confirmed by a water packet or retried when its
+  // deadline passes, waiting CONFIRM_TIMEOUT_MS << retries each time.
+  static constexpr unsigned long CONFIRM_TIMEOUT_MS = 5000;
+  static constexpr unsigned long CONFIRM_QUEUE_TIMEOUT_MS = 30000;  // to reach the wire
+  static constexpr uint8_t CONFIRM_MAX_RETRIES = 3;
+  typedef struct {
+    bool active;
+    bool on_wire;              // the current attempt has been sent
+    uint8_t arg;
+    uint8_t retries;
+    unsigned long queued_ms;
+    unsigned long wire_ms;     // first attempt on the wire, 0 until then
+    unsigned long deadline_ms;
+  } PENDING_COMMAND;
+  PENDING_COMMAND pending_commands[SEND_ANNOUNCE]{};
+
+  void track_command(SendKind kind, uint8_t arg, bool already_done);
+  // A job's packet went out; last is true for its final packet
+  void command_on_wire(SendKind kind, uint8_t arg, bool first, bool last);
+  // Confirm commands against a new water packet from unit 0
+  void confirm_commands();
+  // Retry or fail commands past their deadline
+  void expire_commands();
+  void complete_command(SendKind kind, CommandResult result);
 
   // Generate the cmd_data field for the command packet
   uint8_t generateCmdData();
@@ -491,6 +996,11 @@ protected:
   // Returns number of bytes sent, or -1 for failure
   int send_cmd();
 
+  // Compare a payload with the copy kept from the previous packet of the
+  // same kind (at most capacity bytes) and keep the new one. Returns true if
+  // it differs.
+  static bool payload_changed(const uint8_t *payload, uint8_t len, uint8_t *prev, uint8_t *prev_len, size_t capacity);
+
   static float t2c(uint8_t);         // Temperature to degC
   static float flow2lpm(uint8_t f);  // Flow to LPM
 
@@ -499,18 +1009,91 @@ protected:
    */
   static uint8_t checksum(const uint8_t *buffer, uint8_t len, uint16_t seed);
 
-  // Callback functions that will be called when packets are received
-  NavienGasCallback on_gas_packet_cb = NULL;
-  NavienWaterCallback on_water_packet_cb = NULL;
-  PacketCallbackFunction on_command_packet_cb = NULL;
-  PacketCallbackFunction on_announce_packet_cb = NULL;
+  // Call every subscriber whose filter matches the event, timing each one
+  void publish(const PACKET_EVENT &event);
+
+  // Add a status payload to its PAYLOAD_STATS. prev is the previous
+  // payload from the same unit, prev_len 0 if none.
+  static void track_payload(PAYLOAD_STATS *stats, const uint8_t *payload, uint8_t len,
+                            const uint8_t *prev, uint8_t prev_len, bool active);
+
+  // Count a duration in a BUS_STATS histogram and its maximum
+  static void record_duration(uint32_t *hist, uint32_t *max_us, uint32_t us) {
+    size_t bucket = us ? 32 - __builtin_clz(us) : 0;
+    if (bucket >= BUS_HIST_BUCKETS)
+      bucket = BUS_HIST_BUCKETS - 1;
+    hist[bucket]++;
+    if (us > *max_us)
+      *max_us = us;
+  }
+
+  // Subscribers, sorted by descending priority
+  SUBSCRIBER subscribers[MAX_SUBSCRIBERS]{};
+  size_t subscriber_count = 0;
 
   // General error callback function to call if an error is encountered.
   ErrorCallbackFunction on_error_cb = NULL;
+  void *on_error_context = NULL;
+
+  CommandCompleteFunction on_command_complete_cb = NULL;
+  void *on_command_complete_context = NULL;
   
 
 protected:
-  bool seek_to_marker();
+  // Move unconsumed bytes to the front of rx_buf and append whatever the
+  // UART has buffered in a single read. Returns the number of bytes read.
+  size_t fill_rx_buffer();
+
+  // Scan rx_buf for the next complete, checksum-valid packet. Returns its
+  // length with *frame pointing at it inside rx_buf and the wire and read
+  // times filled in, or 0 if more bytes are needed. Invalid packets are
+  // reported and skipped, and the scan resumes at the byte after their
+  // marker.
+  size_t next_frame(const uint8_t **frame, FRAME_TIMES *times);
+
+  // Counters written on the UART event task, and the resets that clear
+  // them, go through stats_mux; the rest have loop() as their only writer
+  void stats_inc(uint32_t &counter) {
+    portENTER_CRITICAL(&stats_mux);
+    counter++;
+    portEXIT_CRITICAL(&stats_mux);
+  }
+  void stats_max(uint32_t &high_water, uint32_t value) {
+    portENTER_CRITICAL(&stats_mux);
+    if (value > high_water)
+      high_water = value;
+    portEXIT_CRITICAL(&stats_mux);
+  }
+  // Bytes that did not frame arrived; right after our send, that was its
+  // echo colliding. Safe on the RX task.
+  void rx_garbage();
+  // Start or end waiting for our echo. Clears a corruption the RX task
+  // noticed for the previous send.
+  void tx_echo_wait(bool pending);
+  // Record a framing error. On the RX task it is only counted, and
+  // reported from loop() as ERROR_RX_TASK.
+  void frame_error(ErrorCode code, uint16_t a, uint16_t b, const uint8_t *frame, size_t len);
+  // Count an error, then log_error() it. loop() task only.
+  void record_error(ErrorCode code, uint16_t a = 0, uint16_t b = 0, const uint8_t *frame = NULL, size_t len = 0);
+  // Keep an error in the ring and pass it to on_error_cb, rate limited
+  void log_error(ErrorCode code, uint16_t a, uint16_t b, const uint8_t *frame, size_t len);
+  // Report the count held back for each code whose interval has passed
+  // with no further error to carry it
+  void flush_error_reports();
+
+  // Stamp dispatch_us and hand recv_packet to parse_packet(), recording
+  // its latencies
+  void dispatch_packet(const FRAME_TIMES &times);
+  // Append a frame to the capture ring, evicting the oldest as needed
+  void capture_frame(const uint8_t *frame, size_t len, uint8_t flags, uint32_t ms);
+
+  // Body of loop(), which times it
+  void poll_bus();
+
+  // RX task mode: runs on the UART event task whenever bytes arrive
+  void rx_task_receive();
+  // RX task mode: parse queued packets from loop(). Returns packets parsed.
+  int dispatch_rx_queue();
 
 
   /**
@@ -520,6 +1103,7 @@ protected:
    */
 
   // Common entry point that is always called upon receipt of a valid packet
+  // (checksum already verified by next_frame())
   // calls parse_water/gas depending on the paket type
   void parse_packet();
 
@@ -534,6 +1118,10 @@ protected:
   // and type field is PACKET_TYPE_WATER
   void parse_water();
 
+  // Move state.cascade from one unit's old water state to its new one.
+  // Returns the CascadeChangedField bits, 0 if the totals did not move.
+  uint32_t update_cascade(const NAVIEN_STATE_WATER &before, const NAVIEN_STATE_WATER &after);
+
   // Called when the direction is from Navien to reporting device
   // and the type field is PACKET_TYPE_GAS
   void parse_gas();
@@ -549,25 +1137,108 @@ protected:
   void parse_command(bool from_local_send = false);
 
 protected:
-  // Keeps track of the state machine and iterates through
-  // initialized -> marker found -> header parsed -> data parsed -> initialized
-  READ_STATE recv_state;
-
-  // Data received off the wire
-  PACKET_BUFFER recv_buffer;
-
-
-  // Use an array to build a list of commands to be sent
-  // They will be sent when the wire is clear
-  static constexpr size_t QUEUE_CAPACITY = 5;
-  std::array<PACKET_BUFFER, QUEUE_CAPACITY> send_array;
-  size_t send_queue_head = 0;
-  size_t send_queue_tail = 0;
-  size_t send_queue_count = 0;
+  // Bytes received off the wire. rx_buf[rx_head, rx_len) is not yet framed.
+  // The extra sizeof(PACKET_BUFFER) bytes keep a PACKET_BUFFER overlay of
+  // any packet in the buffer inside the array.
+  static constexpr size_t RX_BUF_SIZE = 256;
+  uint8_t rx_buf[RX_BUF_SIZE + sizeof(PACKET_BUFFER)]{};
+  size_t rx_head = 0;
+  size_t rx_len = 0;
+  // millis() of the last byte seen
+  volatile unsigned long last_rx_time = 0;
+  // For latency estimates: micros() of the last bulk read, of the read or
+  // poll before it that left the UART empty, and where the new bytes start
+  unsigned long rx_fill_us = 0;
+  unsigned long rx_fill_prev_us = 0;   // the read before rx_fill_us
+  unsigned long rx_fill_since_us = 0;
+  unsigned long rx_empty_us = 0;
+  size_t rx_fill_first = 0;
+
+  // RX task mode: validated packets on their way from the UART event task
+  // to loop(). NULL when packets are framed in loop().
+  typedef struct {
+    FRAME_TIMES times;
+    uint8_t len;
+    uint8_t data[sizeof(PACKET_BUFFER)];
+  } RX_FRAME;
+  static constexpr UBaseType_t RX_QUEUE_DEPTH = 16;
+  QueueHandle_t rx_queue = NULL;
+  volatile uint32_t rx_task_errors = 0;
+  uint32_t rx_task_errors_reported = 0;
+  portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+  ERROR_STATS error_stats{};
+  ERROR_RECORD error_ring[ERROR_RING_SIZE]{};
+  size_t error_ring_head = 0;  // next slot written
+  size_t error_ring_used = 0;
+  unsigned long error_report_ms[ERROR_CODE_COUNT]{};
+  uint16_t error_report_held[ERROR_CODE_COUNT]{};  // suppressed since the last report
+  uint32_t error_reported_codes = 0;               // bit per code reported at least once
+  uint32_t error_held_codes = 0;                   // bit per code with error_report_held
+
+  RX_STATS rx_stats{};
+  BUS_STATS bus_stats{};
+  TX_STATS tx_stats{};
+  COMMAND_STATS command_stats{};
+
+  // Capture ring. Records are stored in export format, so an export is
+  // the header and at most two slices of the ring.
+  uint8_t capture_ring[CAPTURE_RING_BYTES];
+  size_t capture_tail = 0;    // oldest record
+  size_t capture_used = 0;
+  uint16_t capture_count = 0;
+  uint32_t capture_evicted = 0;
+  // Subscriber time inside the current parse_packet(), kept out of parse_hist
+  uint32_t publish_us = 0;
+
+  // Packet being parsed: points into rx_buf for received packets, or at
+  // local_packet for packets we transmitted ourselves.
+  PACKET_BUFFER local_packet{};
+  const PACKET_BUFFER *recv_packet = &local_packet;
+  FRAME_TIMES recv_times{};
+  // complete_us of the previous received packet, 0 before the first
+  unsigned long rx_prev_complete_us = 0;
+
+
+  // Jobs waiting to be sent when the wire is clear. A job is a command
+  // and its follow-up (button release, flag clear), or a single packet.
+  // At most one unsent job per kind is queued; a job that has started
+  // keeps the bus until its follow-up is out.
+  static constexpr size_t SEND_QUEUE_CAPACITY = 6;
+  static constexpr size_t SEND_PACKET_MAX = HDR_SIZE + sizeof(CMD_DATA) + 1;
+  typedef struct {
+    SendKind kind;
+    uint8_t arg;             // on/off or set point, to supersede or cancel
+    uint8_t count;           // packets in the job
+    uint8_t next;            // next packet to send
+    uint32_t seq;            // queue order
+    unsigned long queued_ms;
+    uint8_t raw[2][SEND_PACKET_MAX];
+  } SEND_JOB;
+  SEND_JOB send_jobs[SEND_QUEUE_CAPACITY]{};
+  size_t send_job_count = 0;
+  uint32_t send_job_seq = 0;
 
   // Data, extracted from gas and water packers and stored
   NAVIEN_STATE state;
 
+  // Previous payload of each packet type, for the *_CHANGED_RAW bits
+  uint8_t prev_water_raw[MAX_DEVICES][sizeof(WATER_DATA)]{};
+  uint8_t prev_water_len[MAX_DEVICES]{};
+  uint8_t prev_gas_raw[sizeof(GAS_DATA)]{};
+  uint8_t prev_gas_len = 0;
+  uint8_t prev_command_raw[sizeof(CMD_DATA)]{};
+  uint8_t prev_command_len = 0;
+  uint8_t prev_announce_raw[sizeof(ANNOUNCE_DATA)]{};
+  uint8_t prev_announce_len = 0;
+  uint32_t water_sequence = 0;
+  uint32_t gas_sequence = 0;
+
+  BYTE_STATS water_byte_stats[sizeof(WATER_DATA)]{};
+  BYTE_STATS gas_byte_stats[sizeof(GAS_DATA)]{};
+  PAYLOAD_STATS water_payload_stats{ 0, 0, 0, sizeof(WATER_DATA), "consumption_active", water_byte_stats };
+  PAYLOAD_STATS gas_payload_stats{ 0, 0, 0, sizeof(GAS_DATA), "gas_burning", gas_byte_stats };
+
   // Control available
   bool navilink_present;
   // If we see 10 water packets and no announce packet
@@ -577,6 +1248,48 @@ protected:
   // Track timing for collision avoidance
   unsigned long last_packet_complete_time = 0;
 
+  // Learned idle gaps between status packets, one model for the gap after
+  // a water packet and one for after a gas packet. Buckets are
+  // GAP_BUCKET_MS wide and the last one holds everything longer. Counts
+  // are halved when the total reaches GAP_DECAY_TOTAL, so the model
+  // follows changes in the heater's cadence.
+  static constexpr unsigned long GAP_BUCKET_MS = 4;
+  static constexpr size_t GAP_BUCKETS = 64;
+  static constexpr unsigned long GAP_RANGE_MS = GAP_BUCKET_MS * GAP_BUCKETS;
+  static constexpr uint16_t GAP_DECAY_TOTAL = 512;
+  static constexpr uint16_t GAP_MIN_SAMPLES = 32;
+  static constexpr unsigned long GAP_GUARD_MS = 5;      // margin after our packet leaves the wire
+  static constexpr uint8_t GAP_RISK_PCT = 1;            // share of gaps allowed to end inside our send
+  static constexpr unsigned long MIN_TX_SILENCE_MS = 3; // never closer than this to the last byte
+  static constexpr unsigned long TX_ECHO_WINDOW_MS = 100;
+  // A collided packet waits a random 0 .. (TX_BACKOFF_SLOT_MS << attempt)
+  // ms before going out again, up to TX_MAX_RETRANSMITS times
+  static constexpr unsigned long TX_BACKOFF_SLOT_MS = 10;  // about one command on the wire
+  static constexpr uint8_t TX_MAX_RETRANSMITS = 4;
+  typedef struct {
+    uint16_t hist[GAP_BUCKETS + 1];
+    uint16_t total;
+  } GAP_MODEL;
+  GAP_MODEL gap_model[2]{};
+  bool gap_prev_valid = false;
+  bool gap_prev_gas = false;
+  unsigned long gap_prev_end_us = 0;
+
+  // Our last transmission, until its echo is seen. A corrupted echo can
+  // be noticed on the RX task; the collision is handled in loop().
+  bool tx_echo_pending = false;
+  bool tx_echo_corrupt = false;
+  unsigned long tx_start_us = 0;
+  unsigned long tx_end_us = 0;
+  unsigned long tx_start_ms = 0;
+  // Where that packet came from, to put it back after a collision
+  uint32_t tx_job_seq = 0;
+  uint8_t tx_job_packet = 0;
+  SendKind tx_job_kind = SEND_ANNOUNCE;
+  uint8_t tx_job_arg = 0;
+  uint8_t tx_attempts = 0;         // collisions of this packet so far
+  unsigned long tx_backoff_until_ms = 0;
+
   // Track recently transmitted control packet to suppress local RS485 echo.
   PACKET_BUFFER last_sent_control_packet{};
   size_t last_sent_control_packet_len = 0;
@@ -602,6 +1315,8 @@ protected:
 
   // Assume running in test mode *until* we see a packet
   bool test_mode;
+
+  const uint8_t bus_id;
 };
 
 #endif  // Navien_h
\ No newline at end of file
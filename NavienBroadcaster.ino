@@ -24,36 +24,108 @@ SOFTWARE.
 
 #include <ESPTelnet.h>
 #include <AsyncUDP.h>
-#include <ArduinoJson.h>
 #include "Navien.h"
+#include "NavienFields.h"
 #include "NavienLearner.h"
+#include "TelemetryWriter.h"
+#include "UdpBatch.h"
+#include "UdpSubscribers.h"
 
 const unsigned long broadcastDuplicatePacketThrottle = 5000;  // 5 seconds in milliseconds (5000 ms)
 const int udpBroadcastPort = 2025;
+const int udpBinaryPort = 2026;
+const unsigned long busStatsBroadcastInterval = 60000;  // 1 minute in milliseconds
 
-extern Navien navienSerial;
+extern Navien *const navienBuses[NAVIEN_BUSES];
 extern ESPTelnet telnet;
 extern String trace;
-extern NavienLearner *learner;
+extern NavienLearner *learners[NAVIEN_BUSES];
 
 AsyncUDP udp;
 
-// Previous packets recieved, use to check for duplicate broadcasts
-char previousWater[385];
-char previousGas[385];
-char previousCommand[385];
-char previousAnnounce[385];
+void broadcastDatagram(const uint8_t *data, size_t len, void *context) {
+  udp.broadcastTo((uint8_t *)data, len, *(const int *)context);
+}
+
+void subscriberDatagram(const uint8_t address[4], uint16_t port, const uint8_t *data, size_t len) {
+  udp.writeTo(data, len, IPAddress(address[0], address[1], address[2], address[3]), port);
+}
+
+// Listeners that asked for the telemetry, see the udpsubscribe Telnet
+// command and POST /subscribe. While there are none, records are broadcast
+// to the whole LAN as before.
+UdpSubscribers subscribers(subscriberDatagram);
+
+// Broadcast records go out through these, one per port; see the udpbatch
+// Telnet command. Batched JSON records are separated by newlines. The
+// learner packet is sent from its own task and bypasses them.
+UdpBatch jsonBatch(broadcastDatagram, (void *)&udpBroadcastPort, '\n');
+UdpBatch binaryBatch(broadcastDatagram, (void *)&udpBinaryPort);
+// Water edges a listener should see without waiting out the batch window
+const uint32_t batchFlushFields = Navien::WATER_CHANGED_CONSUMPTION_ACTIVE | Navien::WATER_CHANGED_RECIRCULATION_ACTIVE |
+                                  Navien::WATER_CHANGED_RECIRCULATION_RUNNING | Navien::WATER_CHANGED_SYSTEM_POWER;
+
+// Every JSON record on the main loop is written here: UDP, trace, the
+// Telnet water/gas commands and GET /state. A record is gone once the next
+// one is begun, so it is sent or printed straight away.
+char telemetryBuffer[1536];
+TelemetryWriter telemetry(telemetryBuffer, sizeof(telemetryBuffer));
+
+// Packets carry a change mask from the parser; these force the next
+// packet to be broadcast even if nothing changed. One set per bus.
+bool forceWater[NAVIEN_BUSES][MAX_DEVICES];
+bool forceGas[NAVIEN_BUSES];
+bool forceCommand[NAVIEN_BUSES];
+bool forceAnnounce[NAVIEN_BUSES];
 unsigned long previousMillis = 0;
+unsigned long busStatsMillis = 0;
+// The raw packet hex ("debug") costs up to 385 bytes per datagram, and
+// payloadStats() now answers what it was kept for, so it is opt-in; see
+// the rawhex Telnet command. trace always shows it.
+bool udpRawHex = false;
+// Water and gas are broadcast as JSON, binary datagrams (NavienFields.h) or
+// both; see the udpformat Telnet command. JSON stays the default for
+// existing listeners. Subscribers pick their own format.
+bool udpJson = true;
+bool udpBinary = false;
+const uint8_t binaryFlags = NAVIEN_BUSES > 1 ? NAVIEN_BINARY_BUSES : 0;
+// Delta mode, see the udpdelta Telnet command: water and gas send only the
+// fields that changed since their last update, and every packet type goes
+// out whole once per keyframe interval instead of every 5 seconds. 0 is off.
+unsigned long udpKeyframeMs = 0;
+// Per stream (bus, packet type and water unit): the field values last sent
+// in delta mode, and the sequence number of the next update
+uint32_t lastWater[NAVIEN_BUSES][MAX_DEVICES][std::size(NAVIEN_WATER_FIELDS)];
+uint32_t lastGas[NAVIEN_BUSES][std::size(NAVIEN_GAS_FIELDS)];
+uint16_t waterSequence[NAVIEN_BUSES][MAX_DEVICES];
+uint16_t gasSequence[NAVIEN_BUSES];
+
+// Whether anyone takes a record type in this format: the subscribers that
+// asked for it or, while there are none, the broadcast, where udpformat
+// picks the format of water and gas and the rest is always JSON
+bool sendsRecord(uint8_t record, bool binary) {
+  if (subscribers.count())
+    return subscribers.wants(record, binary);
+  if (record & UdpSubscribers::RECORD_BINARY)
+    return binary ? udpBinary : udpJson;
+  return !binary;
+}
 
-#define JSON_ASSIGN_WATER(field) doc[#field] = water->field;
-#define JSON_ASSIGN_WATER_BOOL_TO_INT(field) doc[#field] = (int)(water->field);
-#define JSON_ASSIGN_WATER_FLOAT(field) doc[#field] = serialized(String(water->field, 1))
-#define JSON_ASSIGN_GAS(field) doc[#field] = gas->field;
-#define JSON_ASSIGN_GAS_FLOAT(field) doc[#field] = serialized(String(gas->field, 1))
-#define JSON_ASSIGN_GAS_BOOL_TO_INT(field) doc[#field] = (int)(gas->field)
-#define JSON_ASSIGN_COMMAND(field) doc[#field] = state->command.field;
-#define JSON_ASSIGN_COMMAND_BOOL_TO_INT(field) doc[#field] = (int)(state->command.field);
-#define JSON_ASSIGN_ANNOUNCE_BOOL_TO_INT(field) doc[#field] = (int)(state->announce.field);
+// unit is the water unit, for the subscribers' rate limits
+void sendJSON(uint8_t record, uint8_t bus, uint8_t unit, const TelemetryWriter &json, bool flush = false) {
+  if (subscribers.count())
+    subscribers.add(record, bus, unit, false, (const uint8_t *)json.c_str(), json.length(), millis(), flush);
+  else
+    jsonBatch.add((const uint8_t *)json.c_str(), json.length(), millis(), flush);
+}
+
+void sendBinary(uint8_t record, uint8_t bus, uint8_t unit, const uint8_t *datagram, size_t len,
+                bool flush = false) {
+  if (subscribers.count())
+    subscribers.add(record, bus, unit, true, datagram, len, millis(), flush);
+  else
+    binaryBatch.add(datagram, len, millis(), flush);
+}
 
   /* Each broadcast routine checks to see if the new packet is different to 
   * the previous packet. Only if it is different does it broadcast it. This
@@ -61,220 +133,349 @@ unsigned long previousMillis = 0;
   * broadcasted.
   */
 
+void forceKeyframes() {
+  for (int bus = 0; bus < NAVIEN_BUSES; bus++) {
+    for (int i = 0; i < MAX_DEVICES; i++)
+      forceWater[bus][i] = true;
+    forceGas[bus] = true;
+    forceCommand[bus] = true;
+    forceAnnounce[bus] = true;
+  }
+  previousMillis = millis();  // Reset the last time to the current time
+}
+
 void resetPreviousValues() {
   unsigned long currentMillis = millis();
-  if (currentMillis - previousMillis >= broadcastDuplicatePacketThrottle) {
-    previousWater[0] = '\0';
-    previousGas[0] = '\0';
-    previousCommand[0] = '\0';
-    previousAnnounce[0] = '\0';
-    previousMillis = currentMillis;  // Reset the last time to the current time
+  if (currentMillis - previousMillis >= (udpKeyframeMs ? udpKeyframeMs : broadcastDuplicatePacketThrottle))
+    forceKeyframes();
+}
+
+/* Handle Water packets */
+void broadcastWater(const Navien::PACKET_EVENT *event) {
+  const Navien::NAVIEN_STATE_WATER *water = event->water;
+  uint8_t bus = event->bus->busId(), unit = water->device_number;
+  bool &force = forceWater[bus][unit];
+  bool json = sendsRecord(UdpSubscribers::RECORD_WATER, false);
+  bool binary = sendsRecord(UdpSubscribers::RECORD_WATER, true);
+
+  // Same bytes as this unit's previous packet, or nobody listening for it
+  if ((!(event->changed_fields & Navien::WATER_CHANGED_RAW) && !force) || (!json && !binary))
+    return;
+
+  uint8_t len;
+  const uint8_t *payload = event->bus->waterPayload(unit, &len);
+  NavienFieldSet set = navienFieldsAll(NAVIEN_WATER_FIELDS);
+  if (udpKeyframeMs) {
+    NavienFieldSet changed = navienFieldsUpdate<NAVIEN_WATER_FIELDS>(*water, payload, len, lastWater[bus][unit]);
+    // Deltas name their unit; bytes no field reads are not worth one
+    if (!force) {
+      if (!changed)
+        return;
+      set = changed | navienFieldBit(NAVIEN_WATER_FIELDS, "device_number");
+    }
+  }
+  force = false;
+  uint16_t sequence = waterSequence[bus][unit]++;
+  bool flush = event->changed_fields & batchFlushFields;
+
+  if (json) {
+    writeWaterJSON(telemetry, event->bus, water, udpRawHex ? event->raw : nullptr, set, udpKeyframeMs ? sequence : -1);
+    sendJSON(UdpSubscribers::RECORD_WATER, bus, unit, telemetry, flush);
+  }
+  if (binary) {
+    uint8_t datagram[navienBinarySize(NAVIEN_WATER_FIELDS)];
+    size_t n = navienFieldsToBinary<NAVIEN_WATER_FIELDS>(Navien::PACKET_KIND_WATER, binaryFlags, bus, unit, sequence,
+                                                         *water, payload, len, datagram, sizeof(datagram), set);
+    sendBinary(UdpSubscribers::RECORD_WATER, bus, unit, datagram, n, flush);
   }
 }
 
-String buffer_to_hex_string(const uint8_t *data, size_t length) {
-  String hexString = "";
+/* Handle Gas packets */
 
-  for (size_t i = 0; i < length; ++i) {
-    if (data[i] < 0x10) {
-      hexString += "0";
+void broadcastGas(const Navien::PACKET_EVENT *event) {
+  uint8_t bus = event->bus->busId();
+  bool &force = forceGas[bus];
+  bool json = sendsRecord(UdpSubscribers::RECORD_GAS, false);
+  bool binary = sendsRecord(UdpSubscribers::RECORD_GAS, true);
+
+  // Same bytes as the previous gas packet, or nobody listening for it
+  if ((!(event->changed_fields & Navien::GAS_CHANGED_RAW) && !force) || (!json && !binary))
+    return;
+
+  uint8_t len;
+  const uint8_t *payload = event->bus->gasPayload(&len);
+  NavienFieldSet set = navienFieldsAll(NAVIEN_GAS_FIELDS);
+  if (udpKeyframeMs) {
+    NavienFieldSet changed = navienFieldsUpdate<NAVIEN_GAS_FIELDS>(*event->gas, payload, len, lastGas[bus]);
+    if (!force) {
+      if (!changed)
+        return;
+      set = changed;
     }
-    hexString += String(data[i], HEX);
-    hexString += " ";
   }
+  force = false;
+  uint16_t sequence = gasSequence[bus]++;
 
-  hexString.toUpperCase();  // Convert to uppercase if desired.
-  return hexString;
+  if (json) {
+    writeGasJSON(telemetry, event->bus, event->gas, udpRawHex ? event->raw : nullptr, set,
+                 udpKeyframeMs ? sequence : -1);
+    sendJSON(UdpSubscribers::RECORD_GAS, bus, 0, telemetry);
+  }
+  if (binary) {
+    uint8_t datagram[navienBinarySize(NAVIEN_GAS_FIELDS)];
+    size_t n = navienFieldsToBinary<NAVIEN_GAS_FIELDS>(Navien::PACKET_KIND_GAS, binaryFlags, bus, 0, sequence,
+                                                       *event->gas, payload, len, datagram, sizeof(datagram), set);
+    sendBinary(UdpSubscribers::RECORD_GAS, bus, 0, datagram, n);
+  }
 }
 
-/* Handle Water packets */
-String waterToJSON(const Navien::NAVIEN_STATE_WATER *water, String rawhexstring = "") {
-  JsonDocument doc;
-  doc["type"] = "water";
-  
-  JSON_ASSIGN_WATER(device_number);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(system_power);
-  JSON_ASSIGN_WATER_FLOAT(set_temp);
-  JSON_ASSIGN_WATER_FLOAT(inlet_temp);
-  JSON_ASSIGN_WATER_FLOAT(outlet_temp);
-  JSON_ASSIGN_WATER_FLOAT(flow_lpm);
-  JSON_ASSIGN_WATER(flow_state);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(recirculation_active);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(recirculation_running);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(display_metric);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(internal_recirculation);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(external_recirculation);
-  JSON_ASSIGN_WATER_FLOAT(operating_capacity);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(consumption_active);
-  JSON_ASSIGN_WATER(system_stage);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_idle);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_starting);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_active);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_shutting_down);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_standby);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_demand);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_pre_purge);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_ignition);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_flame_on);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_ramp_up);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_active_combustion);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_water_adjustment);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_flame_off);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_post_purge_1);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_post_purge_2);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(stage_dhw_wait);
-  JSON_ASSIGN_WATER_BOOL_TO_INT(system_active);
-  JSON_ASSIGN_WATER(operation_time);
-  doc["debug"] = rawhexstring;
-  doc["unknown_30"] = navienSerial.rawPacketData()->water.unknown_30;
-  doc["unknown_31"] = navienSerial.rawPacketData()->water.unknown_31;
-
-  String json;
-  serializeJson(doc, json);
-  return json;
-}
+/* Handle Command packets */
 
-void onWaterPacket(Navien::NAVIEN_STATE_WATER *water) {
-  if (learner) {
-    learner->onNavienState(water->consumption_active,
-                           water->recirculation_active,
-                           time(nullptr));
-  }
+void broadcastCommand(const Navien::PACKET_EVENT *event) {
+  uint8_t bus = event->bus->busId();
+  bool &force = forceCommand[bus];
+  if ((!event->changed_fields && !force) || !sendsRecord(UdpSubscribers::RECORD_COMMAND, false))
+    return;
+  force = false;
 
-  resetPreviousValues();
+  writeCommandJSON(telemetry, event->bus, event->state, udpRawHex ? event->raw : nullptr);
+  sendJSON(UdpSubscribers::RECORD_COMMAND, bus, 0, telemetry);
+}
 
-  const Navien::PACKET_BUFFER *recv_buffer = navienSerial.rawPacketData();
-  String rawhexstring = buffer_to_hex_string(recv_buffer->raw_data, Navien::HDR_SIZE + recv_buffer->hdr.len + 1);
-  if (strcmp(rawhexstring.c_str(), previousWater) != 0) {
-    String json = waterToJSON(water, rawhexstring);
-    udp.broadcastTo(json.c_str(), 2025);
+/* Handle Announce packets */
 
-    if (trace == "water" || trace == "all")
-      telnet.println(json);
-  }
-  strncpy(previousWater, rawhexstring.c_str(), sizeof(previousWater) - 1);
+void broadcastAnnounce(const Navien::PACKET_EVENT *event) {
+  uint8_t bus = event->bus->busId();
+  bool &force = forceAnnounce[bus];
+  if ((!event->changed_fields && !force) || !sendsRecord(UdpSubscribers::RECORD_ANNOUNCE, false))
+    return;
+  force = false;
+
+  writeAnnounceJSON(telemetry, event->bus, event->state, udpRawHex ? event->raw : nullptr);
+  sendJSON(UdpSubscribers::RECORD_ANNOUNCE, bus, 0, telemetry);
 }
 
-/* Handle Gas packets */
+/* Packet subscribers */
 
-String gasToJSON(const Navien::NAVIEN_STATE_GAS *gas, String rawhexstring = "") {
-  JsonDocument doc;
-  doc["type"] = "gas";
-
-  JSON_ASSIGN_GAS_FLOAT(controller_version);
-  JSON_ASSIGN_GAS_FLOAT(set_temp);
-  JSON_ASSIGN_GAS_FLOAT(inlet_temp);
-  JSON_ASSIGN_GAS_FLOAT(outlet_temp);
-  JSON_ASSIGN_GAS_FLOAT(panel_version);
-  JSON_ASSIGN_GAS(current_gas_usage);
-  JSON_ASSIGN_GAS(target_gas_usage);
-  JSON_ASSIGN_GAS_FLOAT(accumulated_gas_usage);
-  JSON_ASSIGN_GAS_FLOAT(accumulated_water_usage);
-  JSON_ASSIGN_GAS(total_operating_time);
-  JSON_ASSIGN_GAS(elapsed_install_days);
-  JSON_ASSIGN_GAS(accumulated_domestic_usage_cnt);
-  JSON_ASSIGN_GAS_BOOL_TO_INT(recirculation_enabled);
-  doc["debug"] = rawhexstring;
-
-  String json;
-  serializeJson(doc, json);
-  return json;
+// Feed the schedule learner first, it only needs two flags. context is
+// the learner for the bus the subscriber was registered on.
+void onLearnerPacket(const Navien::PACKET_EVENT *event, void *context) {
+  NavienLearner *learner = (NavienLearner *)context;
+  if (learner) {
+    learner->onNavienState(event->water->consumption_active,
+                           event->water->recirculation_active,
+                           time(nullptr));
+  }
 }
 
-void onGasPacket(Navien::NAVIEN_STATE_GAS *gas) {
+void onUdpPacket(const Navien::PACKET_EVENT *event, void *context) {
   resetPreviousValues();
 
-  const Navien::PACKET_BUFFER *recv_buffer = navienSerial.rawPacketData();
-  String rawhexstring = buffer_to_hex_string(recv_buffer->raw_data, Navien::HDR_SIZE + recv_buffer->hdr.len + 1);
-  if (strcmp(rawhexstring.c_str(), previousGas) != 0) {
-    String json = gasToJSON(gas, rawhexstring);
-    udp.broadcastTo(json.c_str(), 2025);
-
-    if (trace == "gas" || trace == "all")
-      telnet.println(json);
+  switch (event->kind) {
+    case Navien::PACKET_KIND_WATER:
+      broadcastWater(event);
+      break;
+    case Navien::PACKET_KIND_GAS:
+      broadcastGas(event);
+      break;
+    case Navien::PACKET_KIND_COMMAND:
+      broadcastCommand(event);
+      break;
+    case Navien::PACKET_KIND_ANNOUNCE:
+      broadcastAnnounce(event);
+      break;
+    default:
+      break;
   }
-  strncpy(previousGas, rawhexstring.c_str(), sizeof(previousGas) - 1);
 }
 
-/* Handle Command packets */
-
-String commandToJSON(const Navien::NAVIEN_STATE *state, String rawhexstring = "") {
-  JsonDocument doc;
-  doc["type"] = "command";
-
-  JSON_ASSIGN_COMMAND_BOOL_TO_INT(power_command);
-  JSON_ASSIGN_COMMAND_BOOL_TO_INT(power_on);
-  JSON_ASSIGN_COMMAND_BOOL_TO_INT(set_temp_command);
-  JSON_ASSIGN_COMMAND(set_temp);
-  JSON_ASSIGN_COMMAND_BOOL_TO_INT(hot_button_command);
-  JSON_ASSIGN_COMMAND_BOOL_TO_INT(recirculation_command);
-  JSON_ASSIGN_COMMAND_BOOL_TO_INT(recirculation_on);
-  JSON_ASSIGN_COMMAND(cmd_data);
-  doc["debug"] = rawhexstring;
-
-  String json;
-  serializeJson(doc, json);
-  return json;
+// Echo changed packets to the Telnet session selected by the trace command
+void onTracePacket(const Navien::PACKET_EVENT *event, void *context) {
+  if (trace.isEmpty())
+    return;
+
+  const char *json = nullptr;
+  switch (event->kind) {
+    case Navien::PACKET_KIND_WATER:
+      if (trace == "water" || trace == "all")
+        json = writeWaterJSON(telemetry, event->bus, event->water, event->raw);
+      break;
+    case Navien::PACKET_KIND_GAS:
+      if (trace == "gas" || trace == "all")
+        json = writeGasJSON(telemetry, event->bus, event->gas, event->raw);
+      break;
+    case Navien::PACKET_KIND_COMMAND:
+      if (trace == "command" || trace == "all")
+        json = writeCommandJSON(telemetry, event->bus, event->state, event->raw);
+      break;
+    case Navien::PACKET_KIND_ANNOUNCE:
+      if (trace == "announce" || trace == "all")
+        json = writeAnnounceJSON(telemetry, event->bus, event->state, event->raw);
+      break;
+    case Navien::PACKET_KIND_CASCADE:
+      if (trace == "cascade" || trace == "all")
+        json = writeCascadeJSON(telemetry, event->bus, event->cascade);
+      break;
+    default:
+      break;
+  }
+  if (json)
+    telnet.println(json);
 }
 
-void onCommandPacket(Navien::NAVIEN_STATE *state) {
-  resetPreviousValues();
+/* Payload byte statistics, for GET /unknowns */
+
+// Streamed, as both packet types together run to ~12 KB
+void writePayloadStatsJSON(Print &out, const Navien &navien) {
+  const Navien::PacketKind kinds[] = { Navien::PACKET_KIND_WATER, Navien::PACKET_KIND_GAS };
+  out.print("{");
+  for (Navien::PacketKind kind : kinds) {
+    const Navien::PAYLOAD_STATS *stats = navien.payloadStats(kind);
+    uint32_t idle_packets = stats->packets - stats->active_packets;
+    out.printf("%s\"%s\":{\"packets\":%u,\"active_packets\":%u,\"reference\":\"%s\",\"bytes\":[",
+               kind == Navien::PACKET_KIND_WATER ? "" : ",", kind == Navien::PACKET_KIND_WATER ? "water" : "gas",
+               stats->packets, stats->active_packets, stats->reference);
+    for (uint8_t i = 0; i < stats->len; i++) {
+      const Navien::BYTE_STATS &b = stats->bytes[i];
+      const char *field = kind == Navien::PACKET_KIND_WATER ? navienFieldAt(NAVIEN_WATER_FIELDS, i)
+                                                            : navienFieldAt(NAVIEN_GAS_FIELDS, i);
+      out.printf("%s{\"byte\":%u,", i ? "," : "", Navien::HDR_SIZE + i);
+      if (field)
+        out.printf("\"field\":\"%s\",", field);
+      out.printf("\"min\":%u,\"max\":%u,\"last\":%u,\"distinct\":%u,\"changes\":%u,\"bit_flips\":[",
+                 b.min, b.max, b.last, Navien::distinctValues(b.sketch), b.changes);
+      for (int bit = 0; bit < 8; bit++)
+        out.printf("%s%u", bit ? "," : "", b.bit_flips[bit]);
+      out.printf("],\"mean_active\":%.1f,\"mean_idle\":%.1f}",
+                 stats->active_packets ? (double)b.sum_active / stats->active_packets : 0.0,
+                 idle_packets ? (double)b.sum_idle / idle_packets : 0.0);
+    }
+    out.print("]}");
+  }
+  out.print("}");
+}
 
-  const Navien::PACKET_BUFFER *recv_buffer = navienSerial.rawPacketData();
-  String rawhexstring = buffer_to_hex_string(recv_buffer->raw_data, Navien::HDR_SIZE + recv_buffer->hdr.len + 1);
-  if (strcmp(rawhexstring.c_str(), previousCommand) != 0) {
-    String json = commandToJSON(state, rawhexstring);
-    udp.broadcastTo(json.c_str(), 2025);
+/* Current state, for GET /state */
 
-    if (trace == "command" || trace == "all")
-      telnet.println(json);
+// The records the broadcast sends, whole and without the raw hex: every
+// water unit seen, gas, and the cascade totals with more than one unit
+void writeStateJSON(Print &out, Navien &navien) {
+  const Navien::NAVIEN_STATE *state = navien.currentState();
+  out.print("[");
+  for (int i = 0; i <= state->max_water_devices_seen; i++) {
+    out.print(writeWaterJSON(telemetry, &navien, &state->water[i]));
+    out.print(",");
+  }
+  out.print(writeGasJSON(telemetry, &navien, &state->gas));
+  if (state->max_water_devices_seen > 0) {
+    out.print(",");
+    out.print(writeCascadeJSON(telemetry, &navien, &state->cascade));
   }
-  strncpy(previousCommand, rawhexstring.c_str(), sizeof(previousCommand) - 1);
+  out.print("]");
 }
 
-/* Handle Announce packets */
+/* Subscribers */
+
+// The learner sends from its own task on the other core, so it reads a
+// copy of its targets that the main loop updates under this lock
+portMUX_TYPE learnerTargetsLock = portMUX_INITIALIZER_UNLOCKED;
+UdpSubscribers::REQUEST learnerTargets[UdpSubscribers::MAX_SUBSCRIBERS];
+size_t learnerTargetCount = 0;
+bool learnerBroadcast = true;
+
+// After every change to the table. A listener that subscribes, renews or
+// restarts gets whole records straight away instead of at the next
+// keyframe, and leftover broadcast records go out before subscribers
+// take over.
+void subscribersChanged() {
+  UdpSubscribers::REQUEST targets[UdpSubscribers::MAX_SUBSCRIBERS];
+  size_t n = subscribers.targets(UdpSubscribers::RECORD_LEARNER, false, targets);
+  portENTER_CRITICAL(&learnerTargetsLock);
+  memcpy(learnerTargets, targets, n * sizeof(targets[0]));
+  learnerTargetCount = n;
+  learnerBroadcast = subscribers.count() == 0;
+  portEXIT_CRITICAL(&learnerTargetsLock);
+
+  jsonBatch.flush();
+  binaryBatch.flush();
+  forceKeyframes();
+}
 
-String announceToJSON(const Navien::NAVIEN_STATE *state, String rawhexstring = "") {
-  JsonDocument doc;
-  doc["type"] = "announce";
-  JSON_ASSIGN_ANNOUNCE_BOOL_TO_INT(navilink_present);
-  doc["debug"] = rawhexstring;
+// Adds or renews a subscriber; -1 when the table is full
+int subscribeTelemetry(const UdpSubscribers::REQUEST &request) {
+  bool changed;
+  int i = subscribers.subscribe(request, millis(), &changed);
+  // A listener renewing what it has needs no flush and no whole records
+  if (i >= 0 && changed)
+    subscribersChanged();
+  return i;
+}
 
-  String json;
-  serializeJson(doc, json);
-  return json;
+// Port 0 removes every subscription of the address
+bool unsubscribeTelemetry(const uint8_t address[4], uint16_t port) {
+  if (!subscribers.unsubscribe(address, port))
+    return false;
+  subscribersChanged();
+  return true;
 }
 
-void onAnnouncePacket(Navien::NAVIEN_STATE *state) {
-  resetPreviousValues();
+// For NavienLearner, from its own task
+void sendLearnerJSON(const char *json, size_t len) {
+  UdpSubscribers::REQUEST targets[UdpSubscribers::MAX_SUBSCRIBERS];
+  portENTER_CRITICAL(&learnerTargetsLock);
+  size_t n = learnerTargetCount;
+  memcpy(targets, learnerTargets, n * sizeof(targets[0]));
+  bool broadcast = learnerBroadcast;
+  portEXIT_CRITICAL(&learnerTargetsLock);
+
+  if (broadcast)
+    udp.broadcastTo((uint8_t *)json, len, udpBroadcastPort);
+  for (size_t i = 0; i < n; i++)
+    subscriberDatagram(targets[i].address, targets[i].port, (const uint8_t *)json, len);
+}
 
-  const Navien::PACKET_BUFFER *recv_buffer = navienSerial.rawPacketData();
-  String rawhexstring = buffer_to_hex_string(recv_buffer->raw_data, Navien::HDR_SIZE + recv_buffer->hdr.len + 1);
-  if (strcmp(rawhexstring.c_str(), previousAnnounce) != 0) {
-    String json = announceToJSON(state, rawhexstring);
-    udp.broadcastTo(json.c_str(), 2025);
+/* Periodic bus health record, batches whose window has passed and expired
+ * subscribers */
 
-    if (trace == "announce" || trace == "all")
-      telnet.println(json);
+void loopNavienBroadcaster() {
+  unsigned long currentMillis = millis();
+  jsonBatch.poll(currentMillis);
+  binaryBatch.poll(currentMillis);
+  if (subscribers.poll(currentMillis))
+    subscribersChanged();
+  if (currentMillis - busStatsMillis < busStatsBroadcastInterval)
+    return;
+  busStatsMillis = currentMillis;
+  if (!sendsRecord(UdpSubscribers::RECORD_BUSSTATS, false))
+    return;
+
+  for (const Navien *navien : navienBuses) {
+    writeBusStatsJSON(telemetry, navien);
+    sendJSON(UdpSubscribers::RECORD_BUSSTATS, navien->busId(), 0, telemetry);
   }
-  strncpy(previousAnnounce, rawhexstring.c_str(), sizeof(previousAnnounce) - 1);
 }
 
 /* Report any errors that occurred */
 
-void onError(const char *function, const char *errorMessage) {
+void onError(const char *function, const char *errorMessage, void *context) {
   telnet.print(F("Error "));
+#if NAVIEN_BUSES > 1
+  telnet.printf("bus %u ", ((Navien *)context)->busId());
+#endif
   telnet.print(function);
   telnet.print(F(" "));
   telnet.println(errorMessage);
 }
 
 void setupNavienBroadcaster() {
-  navienSerial.onGasPacket(onGasPacket);
-  navienSerial.onWaterPacket(onWaterPacket);
-  navienSerial.onCommandPacket(onCommandPacket);
-  navienSerial.onAnnouncePacket(onAnnouncePacket);
-  navienSerial.onError(onError);
+  // The same subscribers serve every bus, events carry the bus they came from
+  for (uint8_t bus = 0; bus < NAVIEN_BUSES; bus++) {
+    Navien *navien = navienBuses[bus];
+    navien->subscribe("learner", onLearnerPacket, learners[bus], Navien::PACKET_KIND_WATER, 10);
+    navien->subscribe("udp", onUdpPacket, NULL, Navien::PACKET_KIND_ALL);
+    navien->subscribe("trace", onTracePacket, NULL, Navien::PACKET_KIND_ALL, -10, true);
+    navien->onError(onError, navien);
+  }
 
   Serial.println(F("UDP Broadcast started"));
 }
\ No newline at end of file
@@ -0,0 +1,466 @@
+/*
+Copyright (c) 2025 David Carson (dacarson)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Field descriptor tables for the water and gas status packets.
+//
+// Each table is the single description of its packet: where a field sits in
+// the payload, how it is decoded into the state struct, what one count of
+// its value means, and its JSON key.  parse_water() / parse_gas() decode and
+// diff through it, and the UDP / Telnet JSON and the binary UDP datagrams are
+// written from it, all with templates unrolled at compile time over the
+// constexpr table.
+//
+// JSON keys are written in table order.  Navien::payloadStats() shows which
+// undecoded bytes move; one can then be published with one line:
+//   { "unknown_30", WATER_AT(unknown_30), 1, FIELD_INT, 0, "", Navien::WATER_CHANGED_RAW, nullptr, nullptr },
+// Entries without load() are written from the unit's last payload, and are
+// covered by *_CHANGED_RAW rather than a bit of their own.
+
+#ifndef NavienFields_h
+#define NavienFields_h
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <utility>
+#include "Navien.h"
+
+// What one count of a field's value is, and how JSON prints it
+enum NavienFieldScale : uint8_t {
+  FIELD_INT,    // integer
+  FIELD_HALF,   // 0.5, printed with one decimal
+  FIELD_TENTH   // 0.1, printed with one decimal
+};
+
+template <typename STATE>
+struct NAVIEN_FIELD {
+  const char *key;         // JSON key
+  uint8_t offset;          // payload byte, counted from cmd_type
+  uint8_t width;           // bytes, little endian; 0 for fields not in the payload
+  NavienFieldScale scale;  // of the value load() returns
+  uint8_t mask;            // non-zero: the field is 1 when any of these bits is set
+  const char *unit;
+  uint32_t changed;        // *ChangedField bit
+  uint32_t (*load)(const STATE &);       // value from the state; nullptr reads the payload
+  void (*store)(STATE &, uint32_t raw);  // decode into the state; nullptr for derived fields
+};
+
+template <typename STATE>
+constexpr uint32_t navien_field_value(const NAVIEN_FIELD<STATE> &f, const uint8_t *payload) {
+  uint32_t v = 0;
+  for (int i = f.width - 1; i >= 0; i--)
+    v = v << 8 | payload[f.offset + i];
+  return f.mask ? (v & f.mask) != 0 : v;
+}
+
+// Payload value of a field, 0 when the packet is too short for it
+template <typename STATE>
+inline uint32_t navienFieldRaw(const NAVIEN_FIELD<STATE> &f, const uint8_t *payload, size_t len) {
+  if (f.width == 0 || f.offset + f.width > len)
+    return 0;
+  return navien_field_value(f, payload);
+}
+
+// Payload bytes a table reads
+template <typename STATE, size_t N>
+constexpr size_t navienFieldsExtent(const NAVIEN_FIELD<STATE> (&fields)[N]) {
+  size_t extent = 0;
+  for (const auto &f : fields)
+    if (f.offset + f.width > extent)
+      extent = f.offset + f.width;
+  return extent;
+}
+
+// Key of the decoded field that reads a payload byte, NULL if none does
+template <typename STATE, size_t N>
+constexpr const char *navienFieldAt(const NAVIEN_FIELD<STATE> (&fields)[N], size_t offset) {
+  for (const auto &f : fields)
+    if (f.store && offset >= f.offset && offset < (size_t)f.offset + f.width)
+      return f.key;
+  return nullptr;
+}
+
+// Binary datagrams (UDP port 2026) identify the table they were written from
+// by this hash of its keys and scales; a decoder with a different field list
+// must not guess.  FNV-1a, folded to 16 bits.
+template <typename STATE, size_t N>
+constexpr uint16_t navienFieldsLayout(const NAVIEN_FIELD<STATE> (&fields)[N]) {
+  uint32_t h = 2166136261u;
+  for (const auto &f : fields) {
+    for (const char *k = f.key; *k; k++)
+      h = (h ^ (uint8_t)*k) * 16777619u;
+    h = (h ^ 0) * 16777619u;
+    h = (h ^ f.scale) * 16777619u;
+  }
+  return (uint16_t)(h ^ h >> 16);
+}
+
+// A set of fields of one table, bit I for FIELDS[I]; water has more than 32
+typedef uint64_t NavienFieldSet;
+
+template <typename STATE, size_t N>
+constexpr NavienFieldSet navienFieldsAll(const NAVIEN_FIELD<STATE> (&)[N]) {
+  static_assert(N <= 64, "NavienFieldSet holds 64 fields");
+  return N == 64 ? ~(NavienFieldSet)0 : ((NavienFieldSet)1 << N) - 1;
+}
+
+// The bit of the field with this key, 0 if there is none
+template <typename STATE, size_t N>
+constexpr NavienFieldSet navienFieldBit(const NAVIEN_FIELD<STATE> (&fields)[N], const char *key) {
+  for (size_t i = 0; i < N; i++) {
+    const char *a = fields[i].key, *b = key;
+    while (*a && *a == *b)
+      a++, b++;
+    if (*a == *b)
+      return (NavienFieldSet)1 << i;
+  }
+  return 0;
+}
+
+// Binary datagram: a fixed header, then the fields in table order as
+// unsigned LEB128 varints of the value JSON prints, in counts of its scale.
+//   0 'N'  1 version  2 PacketKind  3 flags  4 bus  5 unit  6-7 sequence  8-9 layout
+// Multi-byte header fields are little endian.  A delta holds only some
+// fields: a bitmap of them, one bit per field from bit 0 of its first byte,
+// comes before the varints.
+constexpr uint8_t NAVIEN_BINARY_MAGIC = 'N';
+constexpr uint8_t NAVIEN_BINARY_VERSION = 1;
+constexpr size_t NAVIEN_BINARY_HEADER = 10;
+constexpr uint8_t NAVIEN_BINARY_BUSES = 0x01;  // flag: the JSON of this packet has "bus"
+constexpr uint8_t NAVIEN_BINARY_DELTA = 0x02;  // flag: a field bitmap follows the header
+
+// Largest datagram a table can produce, 5 bytes per 32-bit varint
+template <typename STATE, size_t N>
+constexpr size_t navienBinarySize(const NAVIEN_FIELD<STATE> (&fields)[N]) {
+  return NAVIEN_BINARY_HEADER + (N + 7) / 8 + 5 * N;
+}
+
+// Firmware versions are sent as hi.lo and read as that decimal, so 2.5 and 2.10
+inline float navienVersion(uint32_t raw) {
+  uint8_t hi = raw >> 8, lo = raw & 0xFF;
+  return (float)(hi + lo / (lo < 10 ? 10.0 : lo < 100 ? 100.0 : 1000.0));
+}
+
+inline uint32_t navienFixed(float value, float count) {
+  return value > 0 ? (uint32_t)(value / count + 0.5f) : 0;
+}
+
+#define WATER_AT(member) offsetof(Navien::WATER_DATA, member)
+#define WATER_LOAD(expr) [](const Navien::NAVIEN_STATE_WATER &w) -> uint32_t { return expr; }
+#define WATER_STORE(stmt) [](Navien::NAVIEN_STATE_WATER &w, uint32_t v) { stmt; }
+#define WATER_STAGE(name) WATER_AT(system_stage), 1, FIELD_INT, 0, "", Navien::WATER_CHANGED_SYSTEM_STAGE, \
+                          WATER_LOAD(w.name()), nullptr
+
+inline constexpr NAVIEN_FIELD<Navien::NAVIEN_STATE_WATER> NAVIEN_WATER_FIELDS[] = {
+  { "device_number", 0, 0, FIELD_INT, 0, "", 0, WATER_LOAD(w.device_number), nullptr },
+  { "system_power", WATER_AT(system_power), 1, FIELD_INT, 0x05, "", Navien::WATER_CHANGED_SYSTEM_POWER,
+    WATER_LOAD(w.system_power), WATER_STORE(w.system_power = v) },
+  { "set_temp", WATER_AT(set_temp), 1, FIELD_HALF, 0, "C", Navien::WATER_CHANGED_SET_TEMP,
+    WATER_LOAD(w.set_temp_raw), WATER_STORE(w.set_temp_raw = v) },
+  { "inlet_temp", WATER_AT(inlet_temp), 1, FIELD_HALF, 0, "C", Navien::WATER_CHANGED_INLET_TEMP,
+    WATER_LOAD(w.inlet_temp_raw), WATER_STORE(w.inlet_temp_raw = v) },
+  { "outlet_temp", WATER_AT(outlet_temp), 1, FIELD_HALF, 0, "C", Navien::WATER_CHANGED_OUTLET_TEMP,
+    WATER_LOAD(w.outlet_temp_raw), WATER_STORE(w.outlet_temp_raw = v) },
+  { "flow_lpm", WATER_AT(water_flow), 1, FIELD_TENTH, 0, "L/min", Navien::WATER_CHANGED_FLOW_LPM,
+    WATER_LOAD(w.flow_raw), WATER_STORE(w.flow_raw = v) },
+  { "flow_state", WATER_AT(flow_state), 1, FIELD_INT, 0, "", Navien::WATER_CHANGED_FLOW_STATE,
+    WATER_LOAD(w.flow_state), WATER_STORE(w.flow_state = v) },
+  { "recirculation_active", WATER_AT(recirculation_enabled), 1, FIELD_INT, 0x02, "",
+    Navien::WATER_CHANGED_RECIRCULATION_ACTIVE,
+    WATER_LOAD(w.recirculation_active), WATER_STORE(w.recirculation_active = v) },
+  { "recirculation_running", WATER_AT(flow_state), 1, FIELD_INT, 0x08, "", Navien::WATER_CHANGED_RECIRCULATION_RUNNING,
+    WATER_LOAD(w.recirculation_running), WATER_STORE(w.recirculation_running = v) },
+  { "display_metric", WATER_AT(system_status), 1, FIELD_INT, 0x08, "", Navien::WATER_CHANGED_DISPLAY_METRIC,
+    WATER_LOAD(w.display_metric), WATER_STORE(w.display_metric = v) },
+  { "internal_recirculation", WATER_AT(system_status), 1, FIELD_INT, 0x01, "",
+    Navien::WATER_CHANGED_INTERNAL_RECIRCULATION,
+    WATER_LOAD(w.internal_recirculation), WATER_STORE(w.internal_recirculation = v) },
+  { "external_recirculation", WATER_AT(system_status), 1, FIELD_INT, 0x02, "",
+    Navien::WATER_CHANGED_EXTERNAL_RECIRCULATION,
+    WATER_LOAD(w.external_recirculation), WATER_STORE(w.external_recirculation = v) },
+  { "operating_capacity", WATER_AT(operating_capacity), 1, FIELD_HALF, 0, "%", Navien::WATER_CHANGED_OPERATING_CAPACITY,
+    WATER_LOAD(w.capacity_raw), WATER_STORE(w.capacity_raw = v) },
+  { "consumption_active", WATER_AT(flow_state), 1, FIELD_INT, 0x20, "", Navien::WATER_CHANGED_CONSUMPTION_ACTIVE,
+    WATER_LOAD(w.consumption_active), WATER_STORE(w.consumption_active = v) },
+  { "system_stage", WATER_AT(system_stage), 1, FIELD_INT, 0, "", Navien::WATER_CHANGED_SYSTEM_STAGE,
+    WATER_LOAD(w.system_stage), WATER_STORE(w.system_stage = v) },
+  { "stage_idle", WATER_STAGE(stage_idle) },
+  { "stage_starting", WATER_STAGE(stage_starting) },
+  { "stage_active", WATER_STAGE(stage_active) },
+  { "stage_shutting_down", WATER_STAGE(stage_shutting_down) },
+  { "stage_standby", WATER_STAGE(stage_standby) },
+  { "stage_demand", WATER_STAGE(stage_demand) },
+  { "stage_pre_purge", WATER_STAGE(stage_pre_purge) },
+  { "stage_ignition", WATER_STAGE(stage_ignition) },
+  { "stage_flame_on", WATER_STAGE(stage_flame_on) },
+  { "stage_ramp_up", WATER_STAGE(stage_ramp_up) },
+  { "stage_active_combustion", WATER_STAGE(stage_active_combustion) },
+  { "stage_water_adjustment", WATER_STAGE(stage_water_adjustment) },
+  { "stage_flame_off", WATER_STAGE(stage_flame_off) },
+  { "stage_post_purge_1", WATER_STAGE(stage_post_purge_1) },
+  { "stage_post_purge_2", WATER_STAGE(stage_post_purge_2) },
+  { "stage_dhw_wait", WATER_STAGE(stage_dhw_wait) },
+  { "system_active", WATER_AT(system_active), 1, FIELD_INT, 0xFF, "", Navien::WATER_CHANGED_SYSTEM_ACTIVE,
+    WATER_LOAD(w.system_active), WATER_STORE(w.system_active = v) },
+  { "operation_time", WATER_AT(operation_time_lo), 2, FIELD_INT, 0, "h", Navien::WATER_CHANGED_OPERATION_TIME,
+    WATER_LOAD(w.operation_time), WATER_STORE(w.operation_time = v) },
+};
+
+#define GAS_AT(member) offsetof(Navien::GAS_DATA, member)
+#define GAS_LOAD(expr) [](const Navien::NAVIEN_STATE_GAS &g) -> uint32_t { return expr; }
+#define GAS_STORE(stmt) [](Navien::NAVIEN_STATE_GAS &g, uint32_t v) { stmt; }
+
+inline constexpr NAVIEN_FIELD<Navien::NAVIEN_STATE_GAS> NAVIEN_GAS_FIELDS[] = {
+  { "controller_version", GAS_AT(controller_version_lo), 2, FIELD_TENTH, 0, "", Navien::GAS_CHANGED_CONTROLLER_VERSION,
+    GAS_LOAD(navienFixed(g.controller_version, 0.1f)), GAS_STORE(g.controller_version = navienVersion(v)) },
+  { "set_temp", GAS_AT(set_temp), 1, FIELD_HALF, 0, "C", Navien::GAS_CHANGED_SET_TEMP,
+    GAS_LOAD(navienFixed(g.set_temp, 0.5f)), GAS_STORE(g.set_temp = v / 2.f) },
+  { "inlet_temp", GAS_AT(inlet_temp), 1, FIELD_HALF, 0, "C", Navien::GAS_CHANGED_INLET_TEMP,
+    GAS_LOAD(navienFixed(g.inlet_temp, 0.5f)), GAS_STORE(g.inlet_temp = v / 2.f) },
+  { "outlet_temp", GAS_AT(outlet_temp), 1, FIELD_HALF, 0, "C", Navien::GAS_CHANGED_OUTLET_TEMP,
+    GAS_LOAD(navienFixed(g.outlet_temp, 0.5f)), GAS_STORE(g.outlet_temp = v / 2.f) },
+  { "panel_version", GAS_AT(panel_version_lo), 2, FIELD_TENTH, 0, "", Navien::GAS_CHANGED_PANEL_VERSION,
+    GAS_LOAD(navienFixed(g.panel_version, 0.1f)), GAS_STORE(g.panel_version = navienVersion(v)) },
+  { "current_gas_usage", GAS_AT(current_gas_lo), 2, FIELD_INT, 0, "kcal", Navien::GAS_CHANGED_CURRENT_GAS_USAGE,
+    GAS_LOAD(g.current_gas_usage), GAS_STORE(g.current_gas_usage = v) },
+  { "target_gas_usage", GAS_AT(target_burner_power_lo), 2, FIELD_INT, 0, "kcal", Navien::GAS_CHANGED_TARGET_GAS_USAGE,
+    GAS_LOAD(g.target_gas_usage), GAS_STORE(g.target_gas_usage = v) },
+  { "accumulated_gas_usage", GAS_AT(cumulative_gas_lo), 4, FIELD_TENTH, 0, "m3",
+    Navien::GAS_CHANGED_ACCUMULATED_GAS_USAGE,
+    GAS_LOAD(g.accumulated_gas_raw), GAS_STORE(g.accumulated_gas_raw = v; g.accumulated_gas_usage = 0.1f * v) },
+  { "accumulated_water_usage", GAS_AT(cumulative_water_usage_lo), 4, FIELD_TENTH, 0, "L",
+    Navien::GAS_CHANGED_ACCUMULATED_WATER_USAGE,
+    GAS_LOAD(g.accumulated_water_raw), GAS_STORE(g.accumulated_water_raw = v; g.accumulated_water_usage = 0.1f * v) },
+  { "total_operating_time", GAS_AT(total_operating_time_lo), 4, FIELD_INT, 0, "min",
+    Navien::GAS_CHANGED_TOTAL_OPERATING_TIME,
+    GAS_LOAD(g.total_operating_time), GAS_STORE(g.total_operating_time = 60 * v) },  // sent in hours
+  { "elapsed_install_days", GAS_AT(elapsed_install_days_lo), 2, FIELD_INT, 0, "days",
+    Navien::GAS_CHANGED_ELAPSED_INSTALL_DAYS,
+    GAS_LOAD(g.elapsed_install_days), GAS_STORE(g.elapsed_install_days = v) },
+  { "accumulated_domestic_usage_cnt", GAS_AT(cumulative_domestic_usage_cnt_lo), 2, FIELD_INT, 0, "",
+    Navien::GAS_CHANGED_DOMESTIC_USAGE_CNT,
+    GAS_LOAD(g.accumulated_domestic_usage_cnt), GAS_STORE(g.accumulated_domestic_usage_cnt = 10 * v) },  // sent in 10s
+  { "recirculation_enabled", GAS_AT(recirculation_enabled), 1, FIELD_INT, 0xFF, "",
+    Navien::GAS_CHANGED_RECIRCULATION_ENABLED,
+    GAS_LOAD(g.recirculation_enabled), GAS_STORE(g.recirculation_enabled = v) },
+};
+
+// One field at a time, so each load / store is a known function and inlines
+
+template <const auto &FIELDS, size_t I, typename STATE>
+inline void navien_decode_field(STATE &s, const uint8_t *payload) {
+  constexpr auto &f = FIELDS[I];
+  if constexpr (f.store != nullptr)
+    f.store(s, navien_field_value(f, payload));
+}
+
+// Derived fields change with the field they are derived from, so only
+// decoded ones are compared
+template <const auto &FIELDS, size_t I, typename STATE>
+inline uint32_t navien_diff_field(const STATE &a, const STATE &b) {
+  constexpr auto &f = FIELDS[I];
+  if constexpr (f.load != nullptr && f.store != nullptr && f.changed != 0)
+    return f.load(a) != f.load(b) ? f.changed : 0;
+  return 0;
+}
+
+// The value written for a field, in counts of its scale
+template <const auto &FIELDS, size_t I, typename STATE>
+inline uint32_t navien_field_load(const STATE &s, const uint8_t *payload, size_t len) {
+  constexpr auto &f = FIELDS[I];
+  if constexpr (f.load != nullptr)
+    return f.load(s);
+  else
+    return navienFieldRaw(f, payload, len);
+}
+
+// Bit of the field when its value differs from last[I], which takes it
+template <const auto &FIELDS, size_t I, typename STATE>
+inline NavienFieldSet navien_field_update(const STATE &s, const uint8_t *payload, size_t len, uint32_t *last) {
+  uint32_t v = navien_field_load<FIELDS, I>(s, payload, len);
+  if (v == last[I])
+    return 0;
+  last[I] = v;
+  return (NavienFieldSet)1 << I;
+}
+
+// Appends `"key":value,` if the field is in the set; returns false once out
+// of room
+template <const auto &FIELDS, size_t I, typename STATE>
+inline bool navien_field_json(const STATE &s, const uint8_t *payload, size_t len, NavienFieldSet set, char *out,
+                              size_t cap, size_t &pos) {
+  constexpr auto &f = FIELDS[I];
+  if (!(set >> I & 1))
+    return true;
+  uint32_t v = navien_field_load<FIELDS, I>(s, payload, len);
+
+  char num[16];
+  char *p = num + sizeof(num);
+  uint32_t whole = v;
+  if (f.scale != FIELD_INT) {
+    uint32_t tenths = f.scale == FIELD_HALF ? (v & 1) * 5 : v % 10;
+    whole = f.scale == FIELD_HALF ? v / 2 : v / 10;
+    *--p = '0' + tenths;
+    *--p = '.';
+  }
+  do {
+    *--p = '0' + whole % 10;
+    whole /= 10;
+  } while (whole);
+
+  constexpr size_t key_len = std::char_traits<char>::length(f.key);
+  size_t num_len = num + sizeof(num) - p;
+  if (pos + key_len + num_len + 4 >= cap)
+    return false;
+  out[pos++] = '"';
+  memcpy(out + pos, f.key, key_len);
+  pos += key_len;
+  out[pos++] = '"';
+  out[pos++] = ':';
+  memcpy(out + pos, p, num_len);
+  pos += num_len;
+  out[pos++] = ',';
+  return true;
+}
+
+// Appends the value as a varint if the field is in the set; the caller has
+// checked for room
+template <const auto &FIELDS, size_t I, typename STATE>
+inline void navien_field_binary(const STATE &s, const uint8_t *payload, size_t len, NavienFieldSet set, uint8_t *out,
+                                size_t &pos) {
+  if (!(set >> I & 1))
+    return;
+  uint32_t v = navien_field_load<FIELDS, I>(s, payload, len);
+  while (v > 0x7F) {
+    out[pos++] = 0x80 | (v & 0x7F);
+    v >>= 7;
+  }
+  out[pos++] = v;
+}
+
+template <const auto &FIELDS, typename STATE, size_t... I>
+inline void navien_decode_fields(STATE &s, const uint8_t *payload, std::index_sequence<I...>) {
+  (navien_decode_field<FIELDS, I>(s, payload), ...);
+}
+
+template <const auto &FIELDS, typename STATE, size_t... I>
+inline uint32_t navien_diff_fields(const STATE &a, const STATE &b, std::index_sequence<I...>) {
+  return (navien_diff_field<FIELDS, I>(a, b) | ... | 0);
+}
+
+template <const auto &FIELDS, typename STATE, size_t... I>
+inline NavienFieldSet navien_fields_update(const STATE &s, const uint8_t *payload, size_t len, uint32_t *last,
+                                           std::index_sequence<I...>) {
+  return (navien_field_update<FIELDS, I>(s, payload, len, last) | ... | 0);
+}
+
+template <const auto &FIELDS, typename STATE, size_t... I>
+inline void navien_fields_json(const STATE &s, const uint8_t *payload, size_t len, NavienFieldSet set, char *out,
+                               size_t cap, size_t &pos, std::index_sequence<I...>) {
+  (navien_field_json<FIELDS, I>(s, payload, len, set, out, cap, pos) && ...);
+}
+
+template <const auto &FIELDS, typename STATE, size_t... I>
+inline void navien_fields_binary(const STATE &s, const uint8_t *payload, size_t len, NavienFieldSet set,
+                                 uint8_t *out, size_t &pos, std::index_sequence<I...>) {
+  (navien_field_binary<FIELDS, I>(s, payload, len, set, out, pos), ...);
+}
+
+// Decode every field with a store() from a status payload (from cmd_type).
+// A short payload is decoded as if zero padded.
+template <const auto &FIELDS, typename STATE>
+inline void navienDecodeFields(STATE &s, const uint8_t *payload, size_t len) {
+  constexpr size_t extent = navienFieldsExtent(FIELDS);
+  if (len < extent) {
+    uint8_t padded[extent] = {};
+    memcpy(padded, payload, len);
+    navien_decode_fields<FIELDS>(s, padded, std::make_index_sequence<std::size(FIELDS)>{});
+    return;
+  }
+  navien_decode_fields<FIELDS>(s, payload, std::make_index_sequence<std::size(FIELDS)>{});
+}
+
+// *ChangedField bits of the fields whose values differ
+template <const auto &FIELDS, typename STATE>
+inline uint32_t navienDiffFields(const STATE &a, const STATE &b) {
+  return navien_diff_fields<FIELDS>(a, b, std::make_index_sequence<std::size(FIELDS)>{});
+}
+
+// Fields whose value differs from last[], which is updated to the state.
+// last holds one value per field; payload as for navienFieldsToJSON().
+template <const auto &FIELDS, typename STATE>
+inline NavienFieldSet navienFieldsUpdate(const STATE &s, const uint8_t *payload, size_t len, uint32_t *last) {
+  return navien_fields_update<FIELDS>(s, payload, payload ? len : 0, last, std::make_index_sequence<std::size(FIELDS)>{});
+}
+
+// Writes `"key":value,` for every field in the set, in table order, NUL
+// terminated.  payload is the packet the state was decoded from, for fields
+// without load(); they read as 0 when it is NULL.  Returns the length
+// written, stopping before the first field that does not fit.
+template <const auto &FIELDS, typename STATE>
+inline size_t navienFieldsToJSON(const STATE &s, const uint8_t *payload, size_t len, char *out, size_t cap,
+                                 NavienFieldSet set = navienFieldsAll(FIELDS)) {
+  size_t pos = 0;
+  if (cap == 0)
+    return 0;
+  navien_fields_json<FIELDS>(s, payload, payload ? len : 0, set, out, cap, pos,
+                             std::make_index_sequence<std::size(FIELDS)>{});
+  out[pos] = 0;
+  return pos;
+}
+
+// Writes the binary datagram of a water or gas state: header, then the
+// fields in the set in table order, as a delta unless that is all of them.
+// payload as for navienFieldsToJSON().  Returns its length, 0 when cap is
+// below navienBinarySize(FIELDS).
+template <const auto &FIELDS, typename STATE>
+inline size_t navienFieldsToBinary(uint8_t kind, uint8_t flags, uint8_t bus, uint8_t unit, uint16_t sequence,
+                                   const STATE &s, const uint8_t *payload, size_t len, uint8_t *out, size_t cap,
+                                   NavienFieldSet set = navienFieldsAll(FIELDS)) {
+  constexpr uint16_t layout = navienFieldsLayout(FIELDS);
+  if (cap < navienBinarySize(FIELDS))
+    return 0;
+  set &= navienFieldsAll(FIELDS);
+  if (set != navienFieldsAll(FIELDS))
+    flags |= NAVIEN_BINARY_DELTA;
+  out[0] = NAVIEN_BINARY_MAGIC;
+  out[1] = NAVIEN_BINARY_VERSION;
+  out[2] = kind;
+  out[3] = flags;
+  out[4] = bus;
+  out[5] = unit;
+  out[6] = sequence & 0xFF;
+  out[7] = sequence >> 8;
+  out[8] = layout & 0xFF;
+  out[9] = layout >> 8;
+  size_t pos = NAVIEN_BINARY_HEADER;
+  if (flags & NAVIEN_BINARY_DELTA)
+    for (size_t i = 0; i < std::size(FIELDS); i += 8)
+      out[pos++] = set >> i & 0xFF;
+  navien_fields_binary<FIELDS>(s, payload, payload ? len : 0, set, out, pos,
+                               std::make_index_sequence<std::size(FIELDS)>{});
+  return pos;
+}
+
+#endif
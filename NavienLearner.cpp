@@ -24,11 +24,14 @@ SOFTWARE.
 #include <Arduino.h>
 #include <LittleFS.h>
 #include <stdarg.h>
-#include <AsyncUDP.h>
 #include <ArduinoJson.h>
+#include "Navien.h"
+#include "TelemetryWriter.h"
+#include "UdpBatch.h"
 
-extern AsyncUDP udp;  // defined in NavienBroadcaster.ino
-static constexpr int UDP_BROADCAST_PORT = 2025;
+// Defined in NavienBroadcaster.ino: to the telemetry subscribers that want
+// learner records, or broadcast while there are none
+extern void sendLearnerJSON(const char *json, size_t len);
 
 // ---------------------------------------------------------------------------
 // safeAppend() — file-private snprintf helper with truncation protection.
@@ -61,7 +64,7 @@ static bool safeAppend(char *buf, int bufSize, int *pos, const char *fmt, ...) {
 // Constructor
 // ---------------------------------------------------------------------------
 
-NavienLearner::NavienLearner()
+NavienLearner::NavienLearner(uint8_t bus)
     : _lastActiveTime(0),
       _inRun(false),
       _runStart(0),
@@ -81,8 +84,13 @@ NavienLearner::NavienLearner()
       _scheduleHandoffMutex(nullptr),
       _newScheduleReady(false),
       _measuredHead(0),
-      _learnerDisabled(false)
+      _learnerDisabled(false),
+      _bus(bus)
 {
+    if (bus == 0)
+        strcpy(_dir, BUCKET_DIR);
+    else
+        snprintf(_dir, sizeof(_dir), BUCKET_DIR "%u", bus);
     memset(_measured,            0, sizeof(_measured));
     memset(_weekSlots,           0, sizeof(_weekSlots));
     memset(_weekSlotCount,       0, sizeof(_weekSlotCount));
@@ -115,7 +123,7 @@ bool NavienLearner::begin() {
         return false;
     }
 
-    if (!_store.begin()) {
+    if (!_store.begin(_dir)) {
         Serial.println("NavienLearner: BucketStore init failed — learner disabled");
         _learnerDisabled = true;
         // Queue and mutex were created above but are left live; same intentional
@@ -127,9 +135,11 @@ bool NavienLearner::begin() {
     // starts from zero if the file is absent (first boot) or corrupt.
     loadMeasured();
 
+    char taskName[configMAX_TASK_NAME_LEN];
+    snprintf(taskName, sizeof(taskName), _bus ? "NavienLearner%u" : "NavienLearner", _bus);
     BaseType_t taskRet = xTaskCreatePinnedToCore(
         NavienLearner::learnerTask,
-        "NavienLearner",
+        taskName,
         8192,   // stack: headroom for LittleFS internals during file writes
         this,
         1,      // priority 1 on Core 0 — yields readily to higher-priority tasks
@@ -250,10 +260,14 @@ struct MeasuredFile {
 
 static constexpr uint32_t MEASURED_MAGIC          = 0x4D454153u;
 static constexpr uint8_t  MEASURED_SCHEMA_VERSION = 2;
-static constexpr char     MEASURED_FILE[]         = "/navien/measured.bin";
-static constexpr char     MEASURED_TMP_FILE[]     = "/navien/measured.tmp";
+static constexpr char     MEASURED_FILE[]         = "measured.bin";
+static constexpr char     MEASURED_TMP_FILE[]     = "measured.tmp";
 
 bool NavienLearner::saveMeasured() {
+    char path[32], tmpPath[32];
+    snprintf(path, sizeof(path), "%s/%s", _dir, MEASURED_FILE);
+    snprintf(tmpPath, sizeof(tmpPath), "%s/%s", _dir, MEASURED_TMP_FILE);
+
     MeasuredFile mf;
     mf.magic              = MEASURED_MAGIC;
     mf.schema_version     = MEASURED_SCHEMA_VERSION;
@@ -263,7 +277,7 @@ bool NavienLearner::saveMeasured() {
     memcpy(mf.measured, _measured, sizeof(_measured));
     mf.last_recompute_24h = (int64_t)_lastRecomputeTime24h;
 
-    File f = LittleFS.open(MEASURED_TMP_FILE, "w");
+    File f = LittleFS.open(tmpPath, "w");
     if (!f) {
         Serial.println("NavienLearner: failed to open measured.tmp for writing");
         return false;
@@ -274,13 +288,13 @@ bool NavienLearner::saveMeasured() {
     if (written != sizeof(mf)) {
         Serial.printf("NavienLearner: short write to measured.tmp (%u/%u)\n",
                       (unsigned)written, (unsigned)sizeof(mf));
-        LittleFS.remove(MEASURED_TMP_FILE);
+        LittleFS.remove(tmpPath);
         return false;
     }
 
-    if (!LittleFS.rename(MEASURED_TMP_FILE, MEASURED_FILE)) {
+    if (!LittleFS.rename(tmpPath, path)) {
         Serial.println("NavienLearner: rename measured.tmp -> measured.bin failed");
-        LittleFS.remove(MEASURED_TMP_FILE);
+        LittleFS.remove(tmpPath);
         return false;
     }
 
@@ -289,11 +303,13 @@ bool NavienLearner::saveMeasured() {
 }
 
 bool NavienLearner::loadMeasured() {
-    if (!LittleFS.exists(MEASURED_FILE)) {
+    char path[32];
+    snprintf(path, sizeof(path), "%s/%s", _dir, MEASURED_FILE);
+    if (!LittleFS.exists(path)) {
         return false;   // first boot — silently start from zero
     }
 
-    File f = LittleFS.open(MEASURED_FILE, "r");
+    File f = LittleFS.open(path, "r");
     if (!f) {
         Serial.println("NavienLearner: failed to open measured.bin for reading");
         return false;
@@ -711,9 +727,11 @@ int NavienLearner::ingestBucketPayload(const char *json, bool &replaced) {
 }
 
 // ---------------------------------------------------------------------------
-// broadcastUDP() — private; emits a "type":"learner" JSON packet over UDP.
+// broadcastUDP() — private; emits a "type":"learner" JSON packet over UDP,
+// through sendLearnerJSON() to the telemetry subscribers or the broadcast.
 // Called from recomputeWrite() on Core 0 after mutex handoff.
-// Uses ArduinoJson (same pattern as NavienBroadcaster.ino).
+// Written by TelemetryWriter into a stack buffer of this task, since the
+// broadcaster's shared one belongs to the main loop on Core 1.
 // ---------------------------------------------------------------------------
 
 void NavienLearner::broadcastUDP() {
@@ -725,11 +743,13 @@ void NavienLearner::broadcastUDP() {
         "sun","mon","tue","wed","thu","fri","sat"
     };
 
-    JsonDocument doc;
-    doc["type"] = "learner";
-    doc["last_recompute"] = (long)_lastRecomputeTime;
-    doc["bucket_fill_pct"] = serialized(
-        String(_store.nonZeroCount() * 100.0f / (BUCKET_DAYS * BUCKET_PER_DAY), 1));
+    // ~160 bytes per day at most, one datagram in all
+    char json[UdpBatch::MAX_DATAGRAM];
+    TelemetryWriter out(json, sizeof(json));
+    out.begin("learner", _bus);
+    out.field(TELEMETRY_KEY("last_recompute"), (long)_lastRecomputeTime);
+    out.key(TELEMETRY_KEY("bucket_fill_pct"));
+    out.fixed1(_store.nonZeroCount() * 100.0f / (BUCKET_DAYS * BUCKET_PER_DAY));
 
     char key[32];
     for (int dow = 0; dow < BUCKET_DAYS; dow++) {
@@ -746,12 +766,14 @@ void NavienLearner::broadcastUDP() {
                              _weekSlots[dow][s].end_min   % 60);
         }
         snprintf(key, sizeof(key), "%s_slots", dayPfx[dow]);
-        doc[key] = slotStr;  // ArduinoJson v7 copies both key and value
+        out.member(key);
+        out.string(slotStr);
 
         float pred = _predictedEfficiency[dow];
         if (!isnan(pred)) {
             snprintf(key, sizeof(key), "%s_predicted_pct", dayPfx[dow]);
-            doc[key] = serialized(String(pred, 1));
+            out.member(key);
+            out.fixed1(pred);
         }
 
         uint32_t measTotal = 0, measCovered = 0;
@@ -762,22 +784,23 @@ void NavienLearner::broadcastUDP() {
         if (measTotal > 0) {
             float meas = measCovered * 100.0f / measTotal;
             snprintf(key, sizeof(key), "%s_measured_pct", dayPfx[dow]);
-            doc[key] = serialized(String(meas, 1));
+            out.member(key);
+            out.fixed1(meas);
             if (!isnan(pred)) {
                 snprintf(key, sizeof(key), "%s_gap_pct", dayPfx[dow]);
-                doc[key] = serialized(String(pred - meas, 1));
+                out.member(key);
+                out.fixed1(pred - meas);
             }
         }
 
         snprintf(key, sizeof(key), "%s_cold_starts_4wk", dayPfx[dow]);
-        doc[key] = (int)measTotal;
+        out.member(key);
+        out.integer((int32_t)measTotal);
     }
 
-    doc["debug"] = "";
-
-    String json;
-    serializeJson(doc, json);
-    udp.broadcastTo(json.c_str(), UDP_BROADCAST_PORT);
+    out.field(TELEMETRY_KEY("debug"), "");
+    out.end();
+    sendLearnerJSON(out.c_str(), out.length());
 }
 
 // ---------------------------------------------------------------------------
@@ -63,7 +63,9 @@ struct WeekMeasured {
 
 class NavienLearner {
 public:
-    NavienLearner();
+    // bus selects the data directory: /navien for bus 0, /navien<bus>
+    // otherwise, so each heater learns its own schedule.
+    NavienLearner(uint8_t bus = 0);
 
     // Initialise: create FreeRTOS queue and BucketStore.
     // Returns false if queue allocation fails; the learner is then silently
@@ -108,12 +110,12 @@ public:
     // Returns true and fills out_json with the schedule JSON if ready.
     bool checkNewSchedule(String &out_json);
 
-    // Persist _measured[] and _measuredHead to /navien/measured.bin.
+    // Persist _measured[] and _measuredHead to <dir>/measured.bin.
     // Safe to call from any core (coarse stats, no lock taken).
     // Returns true on success.
     bool saveMeasured();
 
-    // Load _measured[] and _measuredHead from /navien/measured.bin.
+    // Load _measured[] and _measuredHead from <dir>/measured.bin.
     // Called during begin(); silently succeeds (leaves zeroed RAM) if the
     // file is absent or corrupt.
     bool loadMeasured();
@@ -205,4 +207,7 @@ private:
     BucketStore _store;
 
     bool _learnerDisabled;
+
+    uint8_t _bus;
+    char    _dir[12];   // LittleFS data directory, see constructor
 };
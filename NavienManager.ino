@@ -28,14 +28,35 @@ SOFTWARE.
 
 #include "Navien.h"
 #include "NavienLearner.h"
+// For the prototypes the IDE generates of NavienBroadcaster.ino's functions
+#include "TelemetryWriter.h"
+#include "UdpSubscribers.h"
 
 bool wifiConnected = false;
 bool timeInit = false;
 
+// NAVIEN_BUSES (Navien.h) heater systems, each on its own UART with its
+// own learner, scheduler and HomeKit accessories.
 Navien navienSerial(2);
-NavienLearner *learner = nullptr;
 #define RXD2 16
 #define TXD2 17
+#if NAVIEN_BUSES > 1
+Navien navienSerial1(1, 1);
+#define RXD1 25
+#define TXD1 26
+#endif
+static_assert(NAVIEN_BUSES >= 1 && NAVIEN_BUSES <= 2, "one bus per spare UART");
+
+Navien *const navienBuses[NAVIEN_BUSES] = {
+  &navienSerial,
+#if NAVIEN_BUSES > 1
+  &navienSerial1,
+#endif
+};
+NavienLearner *learners[NAVIEN_BUSES];
+// Frame RS485 packets on the UART event task as the bytes arrive instead of
+// in loop(), so a long homeSpan.poll() cannot overflow the UART buffer.
+#define NAVIEN_RX_TASK 0
 
 extern ESPTelnet telnet;
 extern void setupTelnetCommands();   // TelnetCommands.ino
@@ -44,6 +65,7 @@ extern void setupHomeSpanWeb(); // HomeSpanWeb.ino
 extern void setupHomeSpanAccessories();
 extern void setupScheduleEndpoint(); // ScheduleEndpoint.ino
 extern void loopScheduleEndpoint();
+extern void loopNavienBroadcaster(); // NavienBroadcaster.ino
 
 void myWiFiBegin(const char *s, const char *p) {
   WiFi.begin(s, p);
@@ -76,14 +98,33 @@ void onWifiConnected(int connection) {
 void setup() {
   Serial.begin(115200);
 
-  // Start Serial 2 for Navien
-  navienSerial.setRxBufferSize(1024);  // Expand the receive buffer size to 1024 bytes
-  navienSerial.begin(RXD2, TXD2);
+  // Start Serial 2 (and 1) for Navien
+  static const int8_t rxPins[NAVIEN_BUSES] = {
+    RXD2,
+#if NAVIEN_BUSES > 1
+    RXD1,
+#endif
+  };
+  static const int8_t txPins[NAVIEN_BUSES] = {
+    TXD2,
+#if NAVIEN_BUSES > 1
+    TXD1,
+#endif
+  };
+  for (uint8_t bus = 0; bus < NAVIEN_BUSES; bus++) {
+    navienBuses[bus]->setRxBufferSize(1024);  // Expand the receive buffer size to 1024 bytes
+    navienBuses[bus]->begin(rxPins[bus], txPins[bus]);
+#if NAVIEN_RX_TASK
+    navienBuses[bus]->beginRxTask();
+#endif
+  }
   Serial.println(F("Navien Serial Started"));
 
-  // Learner is independent of HomeSpan/HomeKit and starts unconditionally.
-  learner = new NavienLearner();
-  learner->begin();
+  // Learners are independent of HomeSpan/HomeKit and start unconditionally.
+  for (uint8_t bus = 0; bus < NAVIEN_BUSES; bus++) {
+    learners[bus] = new NavienLearner(bus);
+    learners[bus]->begin();
+  }
 
   // setup HomeSpan. It needs to own WiFi setup so
   // that it can do the pairing.
@@ -94,8 +135,10 @@ void setup() {
   homeSpan.begin(Category::Thermostats,"Navien Manager");
   homeSpan.enableOTA(false, false);
   homeSpan.setStatusCallback([](HS_STATUS status) {
-    if (status == HS_OTA_STARTED && learner && !learner->isDisabled()) {
-      learner->saveMeasured();
+    if (status == HS_OTA_STARTED) {
+      for (NavienLearner *learner : learners)
+        if (learner && !learner->isDisabled())
+          learner->saveMeasured();
     }
   });
 
@@ -109,6 +152,7 @@ void loop() {
   if (wifiConnected) {
     telnet.loop();
     loopScheduleEndpoint();
+    loopNavienBroadcaster();
   }
 
   // Gate HomeSpan time on a plausible NTP-synced epoch; TZ is no longer required.
@@ -119,6 +163,7 @@ void loop() {
     }
   }
 
-  navienSerial.loop();
+  for (Navien *navien : navienBuses)
+    navien->loop();
   homeSpan.poll();
 }
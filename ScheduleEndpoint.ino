@@ -37,12 +37,50 @@ SOFTWARE.
 //   Body: {"schema_version":1,"current_year":2025,"replace":false,
 //          "days":[{"dow":0,"buckets":[{"b":72,"raw":5,"score":12.0},...]},...]}
 //   Returns 200 OK with JSON body on success, 400 Bad Request on error.
+//
+// GET /capture
+//   Returns the raw RS485 frame capture ring as application/octet-stream
+//   (format in Navien.h, readable by host/navien_replay).
+//
+// GET /unknowns
+//   Returns Navien::payloadStats() for water and gas packets as JSON, one
+//   entry per payload byte: min/max/last, distinct values, changes, bit
+//   flips and its mean with the reference field set and clear.
+//
+// GET /state
+//   Returns the current water record of every unit, the gas record and,
+//   with more than one unit, the cascade totals as a JSON array, in the
+//   format of the UDP broadcast.
+//
+// POST /subscribe
+//   Body: to=A.B.C.D[:PORT]&format=json|binary&types=water,gas,...&interval=MS&ttl=S
+//   (every key optional, see UdpSubscribers::parse(); "to" defaults to the
+//   caller).  Sends the UDP records there instead of broadcasting them,
+//   until the TTL runs out; post again to renew.  Returns 200 OK with the
+//   subscription as taken, 400 for a bad body, 503 when the table is full.
+//
+// POST /unsubscribe
+//   Body: optional to=A.B.C.D[:PORT], default the caller on every port.
+//   Returns 200 OK, or 404 if there was no such subscriber.
+//
+// Every path takes an optional "?bus=N" query selecting the heater
+// (default 0). A bus this controller does not have returns 404.
 
 #include "FakeGatoScheduler.h"
 #include "NavienLearner.h"
+#include "Navien.h"
+#include "UdpSubscribers.h"
+
+extern FakeGatoScheduler *schedulers[NAVIEN_BUSES];
+extern NavienLearner     *learners[NAVIEN_BUSES];
+extern Navien *const     navienBuses[NAVIEN_BUSES];
 
-extern FakeGatoScheduler *scheduler;
-extern NavienLearner     *learner;
+// In NavienBroadcaster.ino
+extern void writePayloadStatsJSON(Print &out, const Navien &navien);
+extern void writeStateJSON(Print &out, Navien &navien);
+extern UdpSubscribers subscribers;
+extern int subscribeTelemetry(const UdpSubscribers::REQUEST &request);
+extern bool unsubscribeTelemetry(const uint8_t address[4], uint16_t port);
 
 // Schedule body buffer: 7 days × 4 slots × ~60 chars/slot ≈ 1700 bytes; 2 KB is ample.
 #define SCHEDULE_BODY_MAX 2048
@@ -58,8 +96,8 @@ static WiFiServer scheduleServer(8080);
 // ---------------------------------------------------------------------------
 // readHttpHeaders() — read HTTP request line and headers from the client.
 // Extracts the request path (e.g. "/schedule") into pathBuf and the
-// Content-Length into *contentLen.  Returns true if headers were read
-// successfully with a positive Content-Length.
+// Content-Length into *contentLen (-1 if absent, e.g. for a GET).
+// Returns true if the headers were read successfully.
 // ---------------------------------------------------------------------------
 static bool readHttpHeaders(WiFiClient &client,
                             char *pathBuf, int pathBufSize,
@@ -102,7 +140,7 @@ static bool readHttpHeaders(WiFiClient &client,
     if (!pastHeaders) delay(1);
   }
 
-  return pastHeaders && *contentLen > 0;
+  return pastHeaders;
 }
 
 // ---------------------------------------------------------------------------
@@ -114,7 +152,7 @@ static bool readHttpBody(WiFiClient &client,
                          int contentLen, int *bodyLen) {
   const unsigned long deadline = millis() + 1000;
   *bodyLen = 0;
-  if (contentLen > bufMax) return false;
+  if (contentLen <= 0 || contentLen > bufMax) return false;
 
   while (*bodyLen < contentLen && millis() < deadline) {
     while (client.available() && *bodyLen < contentLen)
@@ -125,6 +163,21 @@ static bool readHttpBody(WiFiClient &client,
   return *bodyLen == contentLen;
 }
 
+// ---------------------------------------------------------------------------
+// splitBusQuery() — strip a "?bus=N" query from path and return N; 0 if
+// there is no query, -1 if it does not name one of the NAVIEN_BUSES buses.
+// ---------------------------------------------------------------------------
+static int splitBusQuery(char *path) {
+  char *query = strchr(path, '?');
+  if (!query) return 0;
+  *query++ = '\0';
+  if (strncmp(query, "bus=", 4) != 0) return -1;
+  char *end;
+  long bus = strtol(query + 4, &end, 10);
+  if (end == query + 4 || *end != '\0' || bus < 0 || bus >= NAVIEN_BUSES) return -1;
+  return (int)bus;
+}
+
 void setupScheduleEndpoint() {
   scheduleServer.begin();
   Serial.println(F("Schedule endpoint listening on navien.local:8080"));
@@ -143,7 +196,79 @@ void loopScheduleEndpoint() {
     return;
   }
 
-  if (strcmp(path, "/schedule") == 0) {
+  int bus = splitBusQuery(path);
+  if (bus < 0) {
+    client.print(F("HTTP/1.1 404 Not Found\r\nContent-Length: 12\r\nConnection: close\r\n\r\nUnknown bus\n"));
+    client.stop();
+    return;
+  }
+  Navien            &navien    = *navienBuses[bus];
+  FakeGatoScheduler *scheduler = schedulers[bus];
+  NavienLearner     *learner   = learners[bus];
+
+  if (strcmp(path, "/capture") == 0) {
+    // GET /capture — stream the capture ring straight from RAM
+    char hdr[160];
+    snprintf(hdr, sizeof(hdr),
+             "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+             "Content-Disposition: attachment; filename=\"navien.ncap\"\r\n"
+             "Content-Length: %u\r\nConnection: close\r\n\r\n",
+             (unsigned)navien.captureExportSize());
+    client.print(hdr);
+    navien.captureExport([](const uint8_t *data, size_t len, void *context) {
+      ((WiFiClient *)context)->write(data, len);
+    }, &client);
+
+  } else if (strcmp(path, "/unknowns") == 0) {
+    // GET /unknowns — streamed, so no Content-Length; the close ends it
+    client.print(F("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nConnection: close\r\n\r\n"));
+    writePayloadStatsJSON(client, navien);
+
+  } else if (strcmp(path, "/state") == 0) {
+    // GET /state — streamed like /unknowns, a record at a time
+    client.print(F("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nConnection: close\r\n\r\n"));
+    writeStateJSON(client, navien);
+
+  } else if (strcmp(path, "/subscribe") == 0 || strcmp(path, "/unsubscribe") == 0) {
+    // POST /subscribe, /unsubscribe — the caller unless the body names a target
+    char body[160] = "";
+    int  bodyLen = 0;
+    if (contentLen > 0 && !readHttpBody(client, body, sizeof(body) - 1, contentLen, &bodyLen)) {
+      client.print(F("HTTP/1.1 400 Bad Request\r\nContent-Length: 12\r\nConnection: close\r\n\r\nBad request\n"));
+      client.stop();
+      return;
+    }
+    UdpSubscribers::REQUEST request = {};
+    IPAddress caller = client.remoteIP();
+    for (int i = 0; i < 4; i++)
+      request.address[i] = caller[i];
+    const char *error = nullptr;
+    char resp[160];
+    int status = 200;
+    if (!UdpSubscribers::parse(body, &request, &error)) {
+      status = 400;
+      snprintf(resp, sizeof(resp), "%s\n", error);
+    } else if (path[1] == 'u') {
+      status = unsubscribeTelemetry(request.address, request.port) ? 200 : 404;
+      strcpy(resp, status == 200 ? "Unsubscribed\n" : "No such subscriber\n");
+    } else {
+      int i = subscribeTelemetry(request);
+      if (i < 0) {
+        status = 503;
+        snprintf(resp, sizeof(resp), "All %u subscribers are taken\n", (unsigned)UdpSubscribers::MAX_SUBSCRIBERS);
+      } else {
+        UdpSubscribers::describe(subscribers.subscriber(i)->request, resp, sizeof(resp) - 1);
+        strcat(resp, "\n");
+      }
+    }
+    char hdr[120];
+    snprintf(hdr, sizeof(hdr), "HTTP/1.1 %d %s\r\nContent-Length: %u\r\nConnection: close\r\n\r\n", status,
+             status == 200 ? "OK" : status == 400 ? "Bad Request" : status == 404 ? "Not Found" : "Service Unavailable",
+             (unsigned)strlen(resp));
+    client.print(hdr);
+    client.print(resp);
+
+  } else if (strcmp(path, "/schedule") == 0) {
     // POST /schedule — accept a finished schedule from navien_bootstrap.py
     int  bodyLen = 0;
     bool ok = readHttpBody(client, scheduleBodyBuf, SCHEDULE_BODY_MAX, contentLen, &bodyLen)
@@ -0,0 +1,353 @@
+/*
+Copyright (c) 2026 David Carson (dacarson)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "TelemetryWriter.h"
+#include <math.h>
+
+TelemetryWriter::TelemetryWriter(char *buf, size_t cap) : _buf(buf), _cap(cap) {
+    if (_cap)
+        _buf[0] = 0;
+}
+
+void TelemetryWriter::begin(const char *type, uint8_t bus) {
+    _len = 0;
+    _first = true;
+    _overflow = _cap == 0;
+    put('{');
+    field(TELEMETRY_KEY("type"), type);
+#if NAVIEN_BUSES > 1
+    field(TELEMETRY_KEY("bus"), bus);
+#else
+    (void)bus;
+#endif
+}
+
+const char *TelemetryWriter::end() {
+    put('}');
+    if (_cap)
+        _buf[_len] = 0;
+    return _buf;
+}
+
+void TelemetryWriter::put(char c) {
+    if (_len + 1 < _cap)
+        _buf[_len++] = c;
+    else
+        _overflow = true;
+}
+
+void TelemetryWriter::raw(const char *text, size_t len) {
+    size_t n = len < remaining() ? len : remaining();
+    memcpy(_buf + _len, text, n);
+    _len += n;
+    if (n < len)
+        _overflow = true;
+}
+
+void TelemetryWriter::raw(const char *text) {
+    raw(text, strlen(text));
+}
+
+void TelemetryWriter::advance(size_t n) {
+    _len += n < remaining() ? n : remaining();
+}
+
+void TelemetryWriter::key(const char *fragment, size_t len) {
+    if (!_first)
+        put(',');
+    _first = false;
+    raw(fragment, len);
+}
+
+void TelemetryWriter::member(const char *name) {
+    if (!_first)
+        put(',');
+    _first = false;
+    string(name);
+    put(':');
+}
+
+void TelemetryWriter::unsignedDigits(uint32_t value) {
+    char digits[10];
+    char *p = digits + sizeof(digits);
+    do {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    raw(p, digits + sizeof(digits) - p);
+}
+
+void TelemetryWriter::integer(uint32_t value) {
+    unsignedDigits(value);
+}
+
+void TelemetryWriter::integer(int32_t value) {
+    if (value < 0) {
+        put('-');
+        unsignedDigits(0u - (uint32_t)value);
+    } else {
+        unsignedDigits(value);
+    }
+}
+
+// Halves and tenths print as ArduinoJson prints the float they make, which
+// drops a zero fraction: every such float is within its rounding of the
+// decimal
+void TelemetryWriter::half(uint32_t raw) {
+    unsignedDigits(raw / 2);
+    if (raw & 1)
+        this->raw(".5", 2);
+}
+
+void TelemetryWriter::tenth(uint32_t raw) {
+    unsignedDigits(raw / 10);
+    if (raw % 10) {
+        put('.');
+        put('0' + raw % 10);
+    }
+}
+
+// ArduinoJson 7's writeFloat() for a float: six decimals less one per
+// integral digit past the first, rounded half up in double, trailing zeros
+// dropped, NaN and infinity as null. It switches to an exponent from 1e7
+// and below 1e-5, which nothing a heater reports comes near.
+void TelemetryWriter::number(float value) {
+    double v = value;
+    if (isnan(v) || isinf(v)) {
+        raw("null", 4);
+        return;
+    }
+    if (v < 0.0) {
+        put('-');
+        v = -v;
+    }
+    uint32_t maxDecimal = 1000000;
+    int8_t places = 6;
+    uint32_t integral = (uint32_t)v;
+    for (uint32_t tmp = integral; tmp >= 10; tmp /= 10) {
+        maxDecimal /= 10;
+        places--;
+    }
+    double remainder = (v - (double)integral) * maxDecimal;
+    uint32_t decimal = (uint32_t)remainder;
+    remainder -= decimal;
+    decimal += (uint32_t)(remainder * 2);
+    if (decimal >= maxDecimal) {
+        decimal = 0;
+        integral++;
+    }
+    while (decimal % 10 == 0 && places > 0) {
+        decimal /= 10;
+        places--;
+    }
+    unsignedDigits(integral);
+    if (places > 0) {
+        char digits[8];
+        char *p = digits + sizeof(digits);
+        for (int8_t i = 0; i < places; i++) {
+            *--p = '0' + decimal % 10;
+            decimal /= 10;
+        }
+        *--p = '.';
+        raw(p, digits + sizeof(digits) - p);
+    }
+}
+
+// The ESP32 core's dtostrf() with one decimal, which String(value, 1) calls
+void TelemetryWriter::fixed1(float value) {
+    double v = value;
+    if (isnan(v)) {
+        raw("nan", 3);
+        return;
+    }
+    if (isinf(v)) {
+        raw("inf", 3);
+        return;
+    }
+    if (v < 0.0) {
+        put('-');
+        v = -v;
+    }
+    v += 0.05;
+    double tenpow = 1.0;
+    int digits = 1;
+    while (v >= 10.0 * tenpow) {
+        tenpow *= 10.0;
+        digits++;
+    }
+    v /= tenpow;
+    for (digits += 1; digits-- > 0;) {
+        int digit = (int)v;
+        if (digit > 9)
+            digit = 9;
+        put('0' + digit);
+        if (digits == 1)
+            put('.');
+        v = (v - digit) * 10.0;
+    }
+}
+
+// Escaped as ArduinoJson does
+void TelemetryWriter::string(const char *value) {
+    put('"');
+    for (const char *p = value; *p; p++) {
+        char escape = 0;
+        switch (*p) {
+            case '"': escape = '"'; break;
+            case '\\': escape = '\\'; break;
+            case '\b': escape = 'b'; break;
+            case '\f': escape = 'f'; break;
+            case '\n': escape = 'n'; break;
+            case '\r': escape = 'r'; break;
+            case '\t': escape = 't'; break;
+        }
+        if (escape)
+            put('\\');
+        put(escape ? escape : *p);
+    }
+    put('"');
+}
+
+void TelemetryWriter::hex(const uint8_t *data, size_t len) {
+    put('"');
+    size_t n = Navien::formatHex(data, len, cursor(), remaining() + 1);
+    _len += n;
+    if (n < 3 * len)
+        _overflow = true;
+    put('"');
+}
+
+/* Navien records */
+
+#define TELEMETRY_COMMAND(name) out.field(TELEMETRY_KEY(#name), (int)state->command.name)
+
+static void writeDebug(TelemetryWriter &out, const Navien::PACKET_BUFFER *raw) {
+    if (!raw)
+        return;
+    out.key(TELEMETRY_KEY("debug"));
+    out.hex(raw->raw_data, Navien::HDR_SIZE + raw->hdr.len + 1);
+}
+
+// {"type":..., "bus":..., "seq":..., "delta":1, <fields in table order>,
+// "debug":...}: bus only with NAVIEN_BUSES > 1, seq only when given (delta
+// mode) and delta only when not all fields are there
+template <const auto &FIELDS, typename STATE>
+static const char *writeFieldsJSON(TelemetryWriter &out, const char *type, const Navien *navien, const STATE &s,
+                                   const uint8_t *payload, uint8_t len, const Navien::PACKET_BUFFER *raw,
+                                   NavienFieldSet set, int32_t sequence) {
+    out.begin(type, navien->busId());
+    if (sequence >= 0)
+        out.field(TELEMETRY_KEY("seq"), sequence);
+    if ((set & navienFieldsAll(FIELDS)) != navienFieldsAll(FIELDS))
+        out.field(TELEMETRY_KEY("delta"), 1);
+    // The fields come with a comma after each; write one before them and
+    // keep all but the last
+    size_t room = out.remaining();
+    size_t n = room ? navienFieldsToJSON<FIELDS>(s, payload, len, out.cursor() + 1, room - 1, set) : 0;
+    if (n) {
+        *out.cursor() = ',';
+        out.advance(n);
+    }
+    writeDebug(out, raw);
+    return out.end();
+}
+
+const char *writeWaterJSON(TelemetryWriter &out, const Navien *navien, const Navien::NAVIEN_STATE_WATER *water,
+                           const Navien::PACKET_BUFFER *raw, NavienFieldSet set, int32_t sequence) {
+    uint8_t len;
+    const uint8_t *payload = navien->waterPayload(water->device_number, &len);
+    return writeFieldsJSON<NAVIEN_WATER_FIELDS>(out, "water", navien, *water, payload, len, raw, set, sequence);
+}
+
+const char *writeGasJSON(TelemetryWriter &out, const Navien *navien, const Navien::NAVIEN_STATE_GAS *gas,
+                         const Navien::PACKET_BUFFER *raw, NavienFieldSet set, int32_t sequence) {
+    uint8_t len;
+    const uint8_t *payload = navien->gasPayload(&len);
+    return writeFieldsJSON<NAVIEN_GAS_FIELDS>(out, "gas", navien, *gas, payload, len, raw, set, sequence);
+}
+
+const char *writeCommandJSON(TelemetryWriter &out, const Navien *navien, const Navien::NAVIEN_STATE *state,
+                             const Navien::PACKET_BUFFER *raw) {
+    out.begin("command", navien->busId());
+    TELEMETRY_COMMAND(power_command);
+    TELEMETRY_COMMAND(power_on);
+    TELEMETRY_COMMAND(set_temp_command);
+    out.field(TELEMETRY_KEY("set_temp"), state->command.set_temp);
+    TELEMETRY_COMMAND(hot_button_command);
+    TELEMETRY_COMMAND(recirculation_command);
+    TELEMETRY_COMMAND(recirculation_on);
+    TELEMETRY_COMMAND(cmd_data);
+    writeDebug(out, raw);
+    return out.end();
+}
+
+const char *writeAnnounceJSON(TelemetryWriter &out, const Navien *navien, const Navien::NAVIEN_STATE *state,
+                              const Navien::PACKET_BUFFER *raw) {
+    out.begin("announce", navien->busId());
+    out.field(TELEMETRY_KEY("navilink_present"), (int)state->announce.navilink_present);
+    writeDebug(out, raw);
+    return out.end();
+}
+
+const char *writeCascadeJSON(TelemetryWriter &out, const Navien *navien, const Navien::NAVIEN_STATE_CASCADE *cascade) {
+    out.begin("cascade", navien->busId());
+    out.field(TELEMETRY_KEY("units"), cascade->units);
+    out.field(TELEMETRY_KEY("units_firing"), cascade->units_firing);
+    out.key(TELEMETRY_KEY("flow_lpm"));
+    out.tenth(cascade->flow_raw);
+    out.key(TELEMETRY_KEY("operating_capacity"));
+    out.half(cascade->capacity_raw);
+    out.field(TELEMETRY_KEY("mean_capacity"), cascade->mean_capacity());
+    out.field(TELEMETRY_KEY("units_recirculating"), cascade->units_recirculating);
+    out.field(TELEMETRY_KEY("units_consuming"), cascade->units_consuming);
+    return out.end();
+}
+
+const char *writeBusStatsJSON(TelemetryWriter &out, const Navien *navien) {
+    const Navien::BUS_STATS *stats = navien->busStats();
+    const Navien::TX_STATS *tx = navien->txStats();
+    out.begin("busstats", navien->busId());
+    out.field(TELEMETRY_KEY("checksum_errors"), stats->checksum_errors);
+    out.field(TELEMETRY_KEY("resyncs"), stats->resyncs);
+    out.field(TELEMETRY_KEY("oversize_drops"), stats->oversize_drops);
+    out.field(TELEMETRY_KEY("invalid_length"), stats->invalid_length);
+    out.field(TELEMETRY_KEY("bus_not_clear"), stats->bus_not_clear);
+    out.field(TELEMETRY_KEY("echo_suppressed"), stats->echo_suppressed);
+    out.field(TELEMETRY_KEY("uart_high_water"), stats->uart_high_water);
+    out.field(TELEMETRY_KEY("loop_calls"), stats->loop_calls);
+    out.field(TELEMETRY_KEY("loop_p50_us"), Navien::histogramPercentile(stats->loop_hist, 50));
+    out.field(TELEMETRY_KEY("loop_p99_us"), Navien::histogramPercentile(stats->loop_hist, 99));
+    out.field(TELEMETRY_KEY("loop_max_us"), stats->loop_max_us);
+    out.field(TELEMETRY_KEY("parse_p50_us"), Navien::histogramPercentile(stats->parse_hist, 50));
+    out.field(TELEMETRY_KEY("parse_p99_us"), Navien::histogramPercentile(stats->parse_hist, 99));
+    out.field(TELEMETRY_KEY("parse_max_us"), stats->parse_max_us);
+    out.key(TELEMETRY_KEY("gap_error_avg_ms"));
+    out.fixed1(tx->gap_predictions ? (float)tx->gap_error_total_ms / tx->gap_predictions : 0.0f);
+    out.field(TELEMETRY_KEY("sends"), tx->sends);
+    out.field(TELEMETRY_KEY("early_sends"), tx->early_sends);
+    out.field(TELEMETRY_KEY("queue_wait_max_ms"), tx->queue_wait_max_ms);
+    out.field(TELEMETRY_KEY("echo_mismatch"), tx->echo_mismatch);
+    out.field(TELEMETRY_KEY("collisions"), tx->collisions);
+    out.field(TELEMETRY_KEY("retransmits"), tx->retransmits);
+    out.field(TELEMETRY_KEY("overlaps"), tx->overlaps);
+    return out.end();
+}
@@ -0,0 +1,123 @@
+/*
+Copyright (c) 2026 David Carson (dacarson)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include "Navien.h"
+#include "NavienFields.h"
+
+// A JSON key and its colon, joined at compile time: TELEMETRY_KEY("units")
+// is "\"units\":"
+#define TELEMETRY_KEY(key) "\"" key "\":"
+
+// Writes one flat JSON object into a caller's buffer, with no heap use.
+// The output is what ArduinoJson's serializeJson() wrote for the same
+// values: keys in the order given, integers as is, bools as true/false and
+// floats as ArduinoJson 7 prints a float. Fixed-point values should go
+// through half()/tenth() instead, which format them from the integer.
+// When the buffer runs out the record is cut short and ok() is false.
+class TelemetryWriter {
+public:
+    TelemetryWriter(char *buf, size_t cap);
+
+    // Starts a record: {"type":"<type>" and "bus" with NAVIEN_BUSES > 1
+    void begin(const char *type, uint8_t bus);
+    // Closes the record; returns it, NUL terminated
+    const char *end();
+
+    // One member: key is a TELEMETRY_KEY() fragment
+    template <size_t N, typename T>
+    void field(const char (&key)[N], T value) {
+        this->key(key);
+        if constexpr (std::is_same_v<T, bool>)
+            raw(value ? "true" : "false");
+        else if constexpr (std::is_floating_point_v<T>)
+            number((float)value);
+        else if constexpr (std::is_signed_v<T>)
+            integer((int32_t)value);
+        else
+            integer((uint32_t)value);
+    }
+    template <size_t N>
+    void field(const char (&key)[N], const char *value) {
+        this->key(key);
+        string(value);
+    }
+
+    // Writes the key; the value follows with one of the calls below
+    template <size_t N>
+    void key(const char (&fragment)[N]) {
+        key(fragment, N - 1);
+    }
+    void key(const char *fragment, size_t len);
+    void member(const char *name);  // a key made at run time
+    void integer(uint32_t value);
+    void integer(int32_t value);
+    void half(uint32_t raw);        // raw / 2, e.g. 95 is 47.5 and 94 is 47
+    void tenth(uint32_t raw);       // raw / 10, e.g. 42 is 4.2 and 40 is 4
+    void number(float value);       // as ArduinoJson 7 prints a float
+    void fixed1(float value);       // as Arduino's String(value, 1)
+    void string(const char *value);
+    void hex(const uint8_t *data, size_t len);  // a string, as Navien::formatHex()
+    void raw(const char *text);
+    void raw(const char *text, size_t len);
+
+    // Room left for a caller writing in place, then how much it wrote
+    char *cursor() { return _buf + _len; }
+    size_t remaining() const { return _len + 1 < _cap ? _cap - _len - 1 : 0; }
+    void advance(size_t n);
+
+    const char *c_str() const { return _buf; }
+    size_t length() const { return _len; }
+    bool ok() const { return !_overflow; }
+
+private:
+    void put(char c);
+    void unsignedDigits(uint32_t value);
+
+    char *_buf;
+    size_t _cap;
+    size_t _len = 0;
+    bool _first = true;
+    bool _overflow = false;
+};
+
+// The records of the UDP broadcast, trace and GET /state, written from the
+// state with the frame's raw hex as "debug" when raw is given. Water and
+// gas take the fields and sequence number of a delta as in
+// NavienBroadcaster.ino; the sequence is left out when negative.
+const char *writeWaterJSON(TelemetryWriter &out, const Navien *navien, const Navien::NAVIEN_STATE_WATER *water,
+                           const Navien::PACKET_BUFFER *raw = nullptr,
+                           NavienFieldSet set = navienFieldsAll(NAVIEN_WATER_FIELDS), int32_t sequence = -1);
+const char *writeGasJSON(TelemetryWriter &out, const Navien *navien, const Navien::NAVIEN_STATE_GAS *gas,
+                         const Navien::PACKET_BUFFER *raw = nullptr,
+                         NavienFieldSet set = navienFieldsAll(NAVIEN_GAS_FIELDS), int32_t sequence = -1);
+const char *writeCommandJSON(TelemetryWriter &out, const Navien *navien, const Navien::NAVIEN_STATE *state,
+                             const Navien::PACKET_BUFFER *raw = nullptr);
+const char *writeAnnounceJSON(TelemetryWriter &out, const Navien *navien, const Navien::NAVIEN_STATE *state,
+                              const Navien::PACKET_BUFFER *raw = nullptr);
+const char *writeCascadeJSON(TelemetryWriter &out, const Navien *navien, const Navien::NAVIEN_STATE_CASCADE *cascade);
+const char *writeBusStatsJSON(TelemetryWriter &out, const Navien *navien);
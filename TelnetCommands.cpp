@@ -26,22 +26,41 @@ SOFTWARE.
 #include <vector>
 #include <ESPTelnet.h>
 #include "Navien.h"
+#include "NavienFields.h"
 #include "nvs.h"
 #include "FakeGatoHistoryService.h"
 #include "FakeGatoScheduler.h"
 #include "NavienLearner.h"
+#include "TelemetryWriter.h"
 #include "TimeUtils.h"
+#include "UdpBatch.h"
+#include "UdpSubscribers.h"
 
 ESPTelnet telnet;
-extern Navien navienSerial;
-extern FakeGatoHistoryService *historyService;
-extern FakeGatoScheduler *scheduler;
-extern NavienLearner *learner;
+extern Navien *const navienBuses[NAVIEN_BUSES];
+extern FakeGatoHistoryService *historyServices[NAVIEN_BUSES];
+extern FakeGatoScheduler *schedulers[NAVIEN_BUSES];
+extern NavienLearner *learners[NAVIEN_BUSES];
 String trace;
-
-// Functions in NavienBroadcaster.ino
-extern String waterToJSON(const Navien::NAVIEN_STATE_WATER *water, String rawhexstring = "");
-extern String gasToJSON(const Navien::NAVIEN_STATE_GAS *gas, String rawhexstring = "");
+extern bool udpRawHex;
+extern bool udpJson;
+extern bool udpBinary;
+extern unsigned long udpKeyframeMs;
+extern void forceKeyframes();
+extern UdpBatch jsonBatch;
+extern UdpBatch binaryBatch;
+extern UdpSubscribers subscribers;
+extern int subscribeTelemetry(const UdpSubscribers::REQUEST &request);
+extern bool unsubscribeTelemetry(const uint8_t address[4], uint16_t port);
+extern TelemetryWriter telemetry;
+
+// Heater the commands below act on, chosen with the bus command
+uint8_t telnetBus = 0;
+
+Navien &navien() { return *navienBuses[telnetBus]; }
+FakeGatoScheduler *scheduler() { return schedulers[telnetBus]; }
+FakeGatoHistoryService *historyService() { return historyServices[telnetBus]; }
+NavienLearner *learner() { return learners[telnetBus]; }
 
 
 // Define the type for the command callback as a function pointer
@@ -129,7 +148,8 @@ void commandMemory(const String& params) {
 }
 
 void commandTrace(const String& params) {
-  if (params == F("gas") || params == F("water") || params == F("command") || params == F("announce")) {
+  if (params == F("gas") || params == F("water") || params == F("command") || params == F("announce") ||
+      params == F("cascade")) {
     trace = params;
     telnet.print(F("Tracing only "));
     telnet.print(params);
@@ -145,18 +165,30 @@ void commandStop(const String& params) {
   telnet.println(F("Tracing stopped."));
 }
 
+void commandBus(const String& params) {
+  if (params.length() > 0) {
+    int bus = params.toInt();
+    if (bus < 0 || bus >= NAVIEN_BUSES || (bus == 0 && params != "0")) {
+      telnet.printf("Unknown bus: %s (0-%d)\n", params.c_str(), NAVIEN_BUSES - 1);
+      return;
+    }
+    telnetBus = bus;
+  }
+  telnet.printf("Bus %u of %d selected\n", telnetBus, NAVIEN_BUSES);
+}
+
 void commandGas(const String& params) {
-  telnet.println(gasToJSON(&navienSerial.currentState()->gas));
+  telnet.println(writeGasJSON(telemetry, &navien(), &navien().currentState()->gas));
 }
 
 void commandWater(const String& params) {
-  bool createArray = navienSerial.currentState()->max_water_devices_seen > 0 ? true:false;
+  bool createArray = navien().currentState()->max_water_devices_seen > 0 ? true:false;
   if (createArray) {
     telnet.println(F("["));
   }
-  for (int i = 0; i <= navienSerial.currentState()->max_water_devices_seen; i++) {
-    telnet.print(waterToJSON(&navienSerial.currentState()->water[i]));
-    if (i != navienSerial.currentState()->max_water_devices_seen) {
+  for (int i = 0; i <= navien().currentState()->max_water_devices_seen; i++) {
+    telnet.print(writeWaterJSON(telemetry, &navien(), &navien().currentState()->water[i]));
+    if (i != navien().currentState()->max_water_devices_seen) {
       telnet.println(F(","));
     } else {
       telnet.println();
@@ -167,8 +199,327 @@ void commandWater(const String& params) {
   }
 }
 
+void printHistogram(const char *label, const uint32_t *hist, uint32_t max, const char *unit = "us") {
+  telnet.printf("  %s p50/p99/max: <%u / <%u / %u %s\n", label,
+                Navien::histogramPercentile(hist, 50), Navien::histogramPercentile(hist, 99), max, unit);
+  for (size_t i = 0; i < Navien::BUS_HIST_BUCKETS; i++) {
+    if (!hist[i])
+      continue;
+    if (i + 1 < Navien::BUS_HIST_BUCKETS)
+      telnet.printf("    <%7u %s: %u\n", Navien::histogramBucketLimit(i), unit, hist[i]);
+    else
+      telnet.printf("    >=%6u %s: %u\n", Navien::histogramBucketLimit(i - 1), unit, hist[i]);
+  }
+}
+
+void commandRxStats(const String& params) {
+  const Navien::RX_STATS *stats = navien().rxStats();
+  telnet.printf("RS485 receive (%s)\n", navien().rxTaskActive() ? "UART event task" : "loop");
+  telnet.printf("  Packets:         %u\n", stats->packets);
+  telnet.printf("  Latency avg/max: %.1f / %.1f ms\n",
+                stats->packets ? stats->latency_total_us / 1000.0 / stats->packets : 0.0,
+                stats->latency_max_us / 1000.0);
+  telnet.printf("  Framing errors:  %u\n", stats->framing_errors);
+  telnet.printf("  UART overflows:  %u\n", stats->uart_overflows);
+  if (navien().rxTaskActive()) {
+    telnet.printf("  Queue drops:     %u\n", stats->queue_drops);
+    telnet.printf("  Queue high water: %u\n", stats->queue_high_water);
+  }
+  // Where the latency goes: a slow loop() shows up as UART wait when
+  // framing in loop(), as buffer wait with the RX task
+  printHistogram("UART wait", stats->uart_wait_hist, stats->uart_wait_max_us);
+  printHistogram("buffer wait", stats->buffer_wait_hist, stats->buffer_wait_max_us);
+  printHistogram("complete->dispatch", stats->latency_hist, stats->latency_max_us);
+  printHistogram("frame gap", stats->frame_gap_hist, stats->frame_gap_max_us);
+}
+
+void commandBusStats(const String& params) {
+  if (params == "reset") {
+    navien().resetBusStats();
+    telnet.println(F("Bus statistics reset."));
+    return;
+  }
+
+  const Navien::BUS_STATS *stats = navien().busStats();
+  telnet.println(F("RS485 bus health"));
+  telnet.printf("  Checksum errors:   %u\n", stats->checksum_errors);
+  telnet.printf("  Marker resyncs:    %u\n", stats->resyncs);
+  telnet.printf("  Oversize drops:    %u\n", stats->oversize_drops);
+  telnet.printf("  Invalid lengths:   %u\n", stats->invalid_length);
+  telnet.printf("  Bus not clear:     %u\n", stats->bus_not_clear);
+  telnet.printf("  Echo suppressed:   %u\n", stats->echo_suppressed);
+  telnet.printf("  UART high water:   %u bytes\n", stats->uart_high_water);
+  telnet.printf("  loop() calls:      %u\n", stats->loop_calls);
+  printHistogram("loop()", stats->loop_hist, stats->loop_max_us);
+  printHistogram("parse", stats->parse_hist, stats->parse_max_us);
+
+  const Navien::TX_STATS *tx = navien().txStats();
+  telnet.println(F("Transmit scheduling"));
+  telnet.printf("  Gap after water:   %u ms (%u samples)\n",
+                navien().predictedGapMs(false), navien().gapModelSamples(false));
+  telnet.printf("  Gap after gas:     %u ms (%u samples)\n",
+                navien().predictedGapMs(true), navien().gapModelSamples(true));
+  telnet.printf("  Gap error avg/max: %.1f / %u ms\n",
+                tx->gap_predictions ? (double)tx->gap_error_total_ms / tx->gap_predictions : 0.0,
+                tx->gap_error_max_ms);
+  telnet.printf("  Sends (early):     %u (%u)\n", tx->sends, tx->early_sends);
+  telnet.printf("  Queue wait avg/max: %.1f / %u ms\n",
+                tx->sends ? (double)tx->queue_wait_total_ms / tx->sends : 0.0, tx->queue_wait_max_ms);
+  telnet.printf("  Echo ok/mismatch:  %u / %u\n", tx->echo_matched, tx->echo_mismatch);
+  telnet.printf("  Collisions:        %u (%u retransmitted, %u given up)\n",
+                tx->collisions, tx->retransmits, tx->retransmit_give_ups);
+  telnet.printf("  Overlaps:          %u\n", tx->overlaps);
+  telnet.printf("  Send queue:        %u (high water %u)\n", (unsigned)navien().sendQueueDepth(), tx->queue_high_water);
+  telnet.printf("  Superseded/cancelled/dropped: %u / %u / %u\n", tx->superseded, tx->cancelled, tx->queue_full_drops);
+}
+
+void commandErrors(const String& params) {
+  if (params == "reset") {
+    navien().resetErrors();
+    telnet.println(F("Error log reset."));
+    return;
+  }
+
+  const Navien::ERROR_STATS *stats = navien().errorStats();
+  telnet.println(F("Errors by code"));
+  bool any = false;
+  for (int code = 0; code < Navien::ERROR_CODE_COUNT; code++) {
+    if (!stats->count[code])
+      continue;
+    telnet.printf("  %-18s %u\n", Navien::errorCodeName((Navien::ErrorCode)code), stats->count[code]);
+    any = true;
+  }
+  if (!any)
+    telnet.println(F("  none"));
+  telnet.printf("  Passed on/limited: %u / %u\n", stats->reported, stats->suppressed);
+
+  const Navien::ERROR_RECORD *rec = navien().recentError(0);
+  if (!rec)
+    return;
+  telnet.println(F("Recent errors, newest first"));
+  char msg[112];
+  char hex[3 * Navien::ERROR_FRAME_BYTES + 1];
+  for (size_t i = 0; (rec = navien().recentError(i)) != NULL; i++) {
+    telnet.printf("  %6.1f s ago  %s\n", (millis() - rec->ms) / 1000.0, Navien::formatError(*rec, msg, sizeof(msg)));
+    if (!rec->len)
+      continue;
+    size_t kept = rec->len < Navien::ERROR_FRAME_BYTES ? rec->len : Navien::ERROR_FRAME_BYTES;
+    Navien::formatHex(rec->frame, kept, hex, sizeof(hex));
+    telnet.print(F("    "));
+    telnet.print(hex);
+    if (kept < rec->len)
+      telnet.printf("... (%u bytes)", rec->len);
+    telnet.println();
+  }
+}
+
+void commandCommandStats(const String& params) {
+  const Navien::COMMAND_STATS *stats = navien().commandStats();
+  telnet.println(F("Command confirmation"));
+  telnet.printf("  Issued:            %u\n", stats->issued);
+  telnet.printf("  Confirmed:         %u\n", stats->confirmed);
+  telnet.printf("  Superseded:        %u\n", stats->superseded);
+  telnet.printf("  Failed:            %u\n", stats->failed);
+  telnet.printf("  Dropped:           %u\n", stats->dropped);
+  telnet.printf("  Retries:           %u\n", stats->retries);
+  printHistogram("queue->wire", stats->queue_wire_hist, stats->queue_wire_max_ms, "ms");
+  printHistogram("wire->confirmed", stats->wire_confirm_hist, stats->wire_confirm_max_ms, "ms");
+}
+
+// One row per payload byte; decoded bytes only with "all"
+void printPayloadStats(Navien::PacketKind kind, bool all) {
+  const Navien::PAYLOAD_STATS *stats = navien().payloadStats(kind);
+  uint32_t idle_packets = stats->packets - stats->active_packets;
+  telnet.printf("%s payload: %u packets, %u with %s\n", kind == Navien::PACKET_KIND_WATER ? "Water" : "Gas",
+                stats->packets, stats->active_packets, stats->reference);
+  telnet.printf("  %4s %-24s %3s %3s %4s %5s %8s %5s %11s\n",
+                "Byte", "Field", "Min", "Max", "Last", "Dist", "Changes", "Flips", "Mean on/off");
+  for (uint8_t i = 0; i < stats->len; i++) {
+    const char *field = kind == Navien::PACKET_KIND_WATER ? navienFieldAt(NAVIEN_WATER_FIELDS, i)
+                                                          : navienFieldAt(NAVIEN_GAS_FIELDS, i);
+    if (field && !all)
+      continue;
+    const Navien::BYTE_STATS &b = stats->bytes[i];
+    uint8_t flipped = 0;  // bits that have ever changed
+    for (int bit = 0; bit < 8; bit++)
+      if (b.bit_flips[bit])
+        flipped |= 1 << bit;
+    telnet.printf("  %4u %-24s %3u %3u %4u %5u %8u  0x%02X %5.1f/%-5.1f\n",
+                  Navien::HDR_SIZE + i, field ? field : "", b.min, b.max, b.last,
+                  Navien::distinctValues(b.sketch), b.changes, flipped,
+                  stats->active_packets ? (double)b.sum_active / stats->active_packets : 0.0,
+                  idle_packets ? (double)b.sum_idle / idle_packets : 0.0);
+  }
+}
+
+void commandUnknowns(const String& params) {
+  if (params == "reset") {
+    navien().resetPayloadStats();
+    telnet.println(F("Payload statistics reset."));
+    return;
+  }
+  bool all = params.indexOf("all") >= 0;
+  if (params.indexOf("gas") < 0)
+    printPayloadStats(Navien::PACKET_KIND_WATER, all);
+  if (params.indexOf("water") < 0)
+    printPayloadStats(Navien::PACKET_KIND_GAS, all);
+}
+
+void commandRawHex(const String& params) {
+  if (params == "on")
+    udpRawHex = true;
+  else if (params == "off")
+    udpRawHex = false;
+  telnet.printf("Raw hex in UDP packets: %s\n", udpRawHex ? "on" : "off");
+}
+
+void commandUdpFormat(const String& params) {
+  if (params == "json" || params == "binary" || params == "both") {
+    udpJson = params != "binary";
+    udpBinary = params != "json";
+  } else if (!params.isEmpty()) {
+    telnet.printf("Unknown format: %s (json, binary or both)\n", params.c_str());
+    return;
+  }
+  telnet.printf("Water and gas UDP packets: %s\n",
+                udpJson && udpBinary ? "JSON (port 2025) and binary (port 2026)"
+                : udpBinary          ? "binary (port 2026)"
+                                     : "JSON (port 2025)");
+  if (subscribers.count())
+    telnet.println(F("Only while there are no subscribers; they pick their own format, see udpsubscribe"));
+}
+
+void commandUdpDelta(const String& params) {
+  if (params == "off") {
+    udpKeyframeMs = 0;
+  } else if (params.toInt() > 0) {
+    udpKeyframeMs = params.toInt() * 1000UL;
+    forceKeyframes();  // deltas start from a whole packet
+  } else if (!params.isEmpty()) {
+    telnet.printf("Unknown keyframe interval: %s (seconds or off)\n", params.c_str());
+    return;
+  }
+  if (udpKeyframeMs)
+    telnet.printf("UDP deltas on, whole packets every %lu s\n", udpKeyframeMs / 1000);
+  else
+    telnet.println(F("UDP deltas off, whole packets on every change and every 5 s"));
+}
+
+void printBatchStats(const char *name, const UdpBatch &batch) {
+  const UdpBatch::STATS *stats = batch.stats();
+  float seconds = (millis() - stats->since_ms) / 1000.0f;
+  if (seconds <= 0)
+    seconds = 1;
+  telnet.printf("  %-6s %u records in %u datagrams (%u sent early), %.2f datagrams/s, %.0f bytes/s\n", name,
+                (unsigned)stats->records, (unsigned)stats->datagrams, (unsigned)stats->flushes,
+                stats->datagrams / seconds, stats->bytes / seconds);
+}
+
+void commandUdpBatch(const String& params) {
+  uint32_t now = millis();
+  if (params == "off" || params.toInt() > 0) {
+    uint32_t ms = params == "off" ? 0 : params.toInt();
+    jsonBatch.setWindow(ms, now);
+    binaryBatch.setWindow(ms, now);
+    subscribers.setWindow(ms, now);
+  } else if (params == "reset") {
+    jsonBatch.resetStats(now);
+    binaryBatch.resetStats(now);
+  } else if (!params.isEmpty()) {
+    telnet.printf("Unknown batch window: %s (ms, off or reset)\n", params.c_str());
+    return;
+  }
+  if (jsonBatch.window())
+    telnet.printf("UDP batch window %u ms, up to %u bytes per datagram\n", (unsigned)jsonBatch.window(),
+                  (unsigned)UdpBatch::MAX_DATAGRAM);
+  else
+    telnet.println(F("UDP batching off, one datagram per record"));
+  telnet.printf("Since %lu s ago:\n", (unsigned long)(now - jsonBatch.stats()->since_ms) / 1000);
+  printBatchStats("JSON", jsonBatch);
+  printBatchStats("binary", binaryBatch);
+}
+
+void printTelemetrySubscribers() {
+  uint32_t now = millis();
+  if (!subscribers.count()) {
+    telnet.println(F("No UDP subscribers, records are broadcast to the LAN"));
+    return;
+  }
+  telnet.printf("UDP subscribers (%u of %u), nothing is broadcast:\n", (unsigned)subscribers.count(),
+                (unsigned)UdpSubscribers::MAX_SUBSCRIBERS);
+  for (size_t i = 0; i < UdpSubscribers::MAX_SUBSCRIBERS; i++) {
+    const UdpSubscribers::SUBSCRIBER *sub = subscribers.subscriber(i);
+    if (!sub)
+      continue;
+    char spec[128];
+    UdpSubscribers::describe(sub->request, spec, sizeof(spec));
+    const UdpBatch::STATS *stats = subscribers.batchStats(i);
+    telnet.printf("  %s\n    expires in %u s; %u records sent, %u held back, in %u datagrams, %u bytes\n", spec,
+                  (unsigned)(sub->request.ttl_s - (now - sub->renewed_ms) / 1000), (unsigned)sub->sent,
+                  (unsigned)sub->dropped, (unsigned)stats->datagrams, (unsigned)stats->bytes);
+  }
+}
+
+// The Telnet client's address when the command does not name one
+void telnetClientAddress(uint8_t address[4]) {
+  IPAddress ip;
+  ip.fromString(telnet.getIP());
+  for (int i = 0; i < 4; i++)
+    address[i] = ip[i];
+}
+
+void commandUdpSubscribe(const String& params) {
+  if (!params.isEmpty()) {
+    UdpSubscribers::REQUEST request = {};
+    telnetClientAddress(request.address);
+    const char *error;
+    if (!UdpSubscribers::parse(params.c_str(), &request, &error)) {
+      telnet.printf("%s\n", error);
+      return;
+    }
+    if (subscribeTelemetry(request) < 0) {
+      telnet.printf("All %u subscribers are taken, unsubscribe one first\n",
+                    (unsigned)UdpSubscribers::MAX_SUBSCRIBERS);
+      return;
+    }
+  }
+  printTelemetrySubscribers();
+}
+
+void commandUdpUnsubscribe(const String& params) {
+  UdpSubscribers::REQUEST request = {};
+  telnetClientAddress(request.address);
+  const char *error;
+  if (!UdpSubscribers::parse(params.c_str(), &request, &error)) {
+    telnet.printf("%s\n", error);
+    return;
+  }
+  if (!unsubscribeTelemetry(request.address, request.port))
+    telnet.println(F("No such subscriber"));
+  printTelemetrySubscribers();
+}
+
+void commandSubscribers(const String& params) {
+  telnet.printf("%-10s %-6s %4s %-7s %8s %10s %8s %8s\n",
+                "Name", "Kinds", "Prio", "Change", "Calls", "Total ms", "Avg us", "Max us");
+  for (size_t i = 0; i < navien().subscriberCount(); i++) {
+    const Navien::SUBSCRIBER *sub = navien().subscriberInfo(i);
+    char kinds[6];
+    kinds[0] = (sub->kinds & Navien::PACKET_KIND_WATER) ? 'W' : '-';
+    kinds[1] = (sub->kinds & Navien::PACKET_KIND_GAS) ? 'G' : '-';
+    kinds[2] = (sub->kinds & Navien::PACKET_KIND_COMMAND) ? 'C' : '-';
+    kinds[3] = (sub->kinds & Navien::PACKET_KIND_ANNOUNCE) ? 'A' : '-';
+    kinds[4] = (sub->kinds & Navien::PACKET_KIND_CASCADE) ? 'S' : '-';
+    kinds[5] = '\0';
+    telnet.printf("%-10s %-6s %4d %-7s %8u %10.1f %8.1f %8u\n",
+                  sub->name, kinds, sub->priority, sub->only_on_change ? "yes" : "no",
+                  sub->calls, sub->total_us / 1000.0,
+                  sub->calls ? (double)sub->total_us / sub->calls : 0.0, sub->max_us);
+  }
+}
+
 void commandControl(const String& params) {
-  if (navienSerial.controlAvailable()) {
+  if (navien().controlAvailable()) {
     telnet.println(F("Commands can be sent."));
   } else {
     telnet.println(F("Commands cannot be sent."));  // Also fixed typo in message
@@ -178,13 +529,13 @@ void commandControl(const String& params) {
 void commandSetTemp(const String& params) {
   float temp;
   if (params.isEmpty()) {
-    temp = navienSerial.currentState()->gas.set_temp;
+    temp = navien().currentState()->gas.set_temp;
     telnet.printf("Current set temperature: %0.1f°C\n", temp);
   } else {
     temp = params.toFloat();
     int success = -1;
     if (temp > 20.0 || temp < 60.0) {
-      success = navienSerial.setTemp(temp);
+      success = navien().setTemp(temp);
     }
     if (success < 0) {
       telnet.printf("Failed setting temperature to: %0.1f°C Return code: %d\n", temp, success);
@@ -197,8 +548,8 @@ void commandSetTemp(const String& params) {
 void commandPower(const String& params) {
   if (params.isEmpty()) {
     telnet.print(F("Current Power is: "));
-    for (int i = 0; i <= navienSerial.currentState()->max_water_devices_seen; i++) {
-      if (navienSerial.currentState()->water[i].system_power) {
+    for (int i = 0; i <= navien().currentState()->max_water_devices_seen; i++) {
+      if (navien().currentState()->water[i].system_power) {
         telnet.print(F("ON"));
       } else {
         telnet.print(F("OFF"));
@@ -209,13 +560,13 @@ void commandPower(const String& params) {
     }
     telnet.println();
   } else if (params.equalsIgnoreCase("on")) {
-    if (navienSerial.power(true) != -1) {
+    if (navien().power(true) != -1) {
       telnet.println(F("Powering on."));
     } else {
       telnet.println(F("Failed to power on."));
     }
   } else if (params.equalsIgnoreCase("off")) {
-    if (navienSerial.power(false) != -1) {
+    if (navien().power(false) != -1) {
       telnet.println(F("Powering off."));
     } else {
       telnet.println(F("Failed to power off."));
@@ -228,8 +579,8 @@ void commandPower(const String& params) {
 void commandRecirc(const String& params) {
   if (params.isEmpty()) {
     telnet.print(F("Recirculation is: "));
-    for (int i = 0; i <= navienSerial.currentState()->max_water_devices_seen; i++) {
-      if (navienSerial.currentState()->water[i].recirculation_running) {
+    for (int i = 0; i <= navien().currentState()->max_water_devices_seen; i++) {
+      if (navien().currentState()->water[i].recirculation_running) {
         telnet.print(F("ON"));
       } else {
         telnet.print(F("OFF"));
@@ -240,13 +591,13 @@ void commandRecirc(const String& params) {
     }
     telnet.println();
   } else if (params.equalsIgnoreCase("on")) {
-    if (navienSerial.recirculation(true) != -1) {
+    if (navien().recirculation(true) != -1) {
       telnet.println(F("Turning recirculation on."));
     } else {
       telnet.println(F("Failed to turning recirculation on."));
     }
   } else if (params.equalsIgnoreCase("off")) {
-    if (navienSerial.recirculation(false) != -1) {
+    if (navien().recirculation(false) != -1) {
       telnet.println(F("Turning recirculation off."));
     } else {
       telnet.println(F("Failed to turning recirculation off."));
@@ -257,7 +608,7 @@ void commandRecirc(const String& params) {
 }
 
 void commandHotButton(const String& params) {
-  if (navienSerial.hotButton() != -1)
+  if (navien().hotButton() != -1)
     telnet.println(F("Hot button command sent."));
   else
     telnet.println(F("Hot button command failed."));
@@ -266,7 +617,9 @@ void commandHotButton(const String& params) {
 void commandEraseEve(const String& params) {
     telnet.println("Erasing Eve Program Data...");
     nvs_handle_t savedData;
-    esp_err_t err = nvs_open("SAVED_DATA", NVS_READWRITE, &savedData);
+    char nvsName[16];
+    FakeGatoScheduler::savedDataNamespace(telnetBus, nvsName, sizeof(nvsName));
+    esp_err_t err = nvs_open(nvsName, NVS_READWRITE, &savedData);
 
     if (err != ESP_OK) {
         telnet.printf("❌ Failed to open NVS: %s\n", esp_err_to_name(err));
@@ -298,18 +651,18 @@ void commandEraseEve(const String& params) {
 void commandTimezone(const String& params) {
     nvs_handle_t nvsStorageHandle;  
     if (params.equalsIgnoreCase("clear")) {
-        scheduler->eraseTz();
+        scheduler()->eraseTz();
         telnet.println(F("Time Zone erased"));
     } else if (params.length() == 0) {
         // Print current time zone
-        String tz = scheduler->getTz();
+        String tz = scheduler()->getTz();
         if (tz && !tz.isEmpty()) {
             telnet.printf("Current Time Zone: %s\n", tz.c_str());
         } else {
             telnet.println("No Time Zone is set!");
         }
     } else {
-        scheduler->setTz(params);
+        scheduler()->setTz(params);
         telnet.printf("Time Zone set to: %s\n", params.c_str());
     }
 }
@@ -328,11 +681,11 @@ void commandScheduler(const String& params) {
   static const char *dayNames[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
 
   if (params.equalsIgnoreCase("on")) {
-    scheduler->setEnabled(true);
+    scheduler()->setEnabled(true);
     telnet.println(F("Scheduler enabled."));
     return;
   } else if (params.equalsIgnoreCase("off")) {
-    scheduler->setEnabled(false);
+    scheduler()->setEnabled(false);
     telnet.println(F("Scheduler disabled."));
     return;
   } else if (!params.isEmpty()) {
@@ -343,15 +696,15 @@ void commandScheduler(const String& params) {
   time_t now = time(nullptr);
   struct tm *localTime = localtime(&now);
   telnet.printf("Current time:     %s", asctime(localTime));
-  telnet.printf("Schedule enabled: %s\n", scheduler->enabled() ? "Yes" : "No");
-  telnet.printf("Current state:    %s\n", FakeGatoScheduler::getSchedulerState(scheduler->getCurrentState()).c_str());
+  telnet.printf("Schedule enabled: %s\n", scheduler()->enabled() ? "Yes" : "No");
+  telnet.printf("Current state:    %s\n", FakeGatoScheduler::getSchedulerState(scheduler()->getCurrentState()).c_str());
 
-  if (scheduler->isOverrideActive()) {
-    telnet.printf("Override expires: %s\n", getFormattedTimeForValue(scheduler->getOverrideEndTime()).c_str());
+  if (scheduler()->isOverrideActive()) {
+    telnet.printf("Override expires: %s\n", getFormattedTimeForValue(scheduler()->getOverrideEndTime()).c_str());
   }
 
   time_t nextTime;
-  SchedulerBase::State nextState = scheduler->getNextState(&nextTime);
+  SchedulerBase::State nextState = scheduler()->getNextState(&nextTime);
   if (nextTime > 0) {
     telnet.printf("Next transition:  %s -> %s\n",
       getFormattedTimeForValue(nextTime).c_str(),
@@ -374,7 +727,7 @@ void commandScheduler(const String& params) {
 
     for (int slot = 0; slot < 3; slot++) {
       uint8_t sh, sm, eh, em;
-      if (!scheduler->getTimeSlot(day, slot, sh, sm, eh, em)) continue;
+      if (!scheduler()->getTimeSlot(day, slot, sh, sm, eh, em)) continue;
       SlotDisplay &s = slots[slotCount++];
       s.sh = sh; s.sm = sm; s.eh = eh; s.em = em;
       s.dayShift = 0;
@@ -427,25 +780,25 @@ void commandScheduler(const String& params) {
 }
 
 void commandHistory(const String& params) {
-  if (!historyService) {
+  if (!historyService()) {
     telnet.println(F("Error: History service not available"));
     return;
   }
   // Parse length parameter (default to all entries if not specified)
-  int length = historyService->store.usedMemory;
+  int length = historyService()->store.usedMemory;
   if (params.length() > 0) {
-    length = min((int)params.toInt(), (int)historyService->store.usedMemory);
+    length = min((int)params.toInt(), (int)historyService()->store.usedMemory);
   }
   telnet.println(F("Time,CurrentTemp,TargetTemp,ValvePercent,ThermoTarget,OpenWindow"));
   
   // Calculate starting entry based on length
-  int firstEntry = historyService->store.firstEntry;
-  int lastEntry = historyService->store.lastEntry;
+  int firstEntry = historyService()->store.firstEntry;
+  int lastEntry = historyService()->store.lastEntry;
   int startEntry = max(lastEntry - length, firstEntry);
   
   // Output entries in CSV format
   for (int i = startEntry; i <= lastEntry; i++) {
-    auto entry = historyService->store.history[i % historyService->store.historySize];
+    auto entry = historyService()->store.history[i % historyService()->store.historySize];
     telnet.printf("%s, %.2f,%.2f,%d,%d,%d\n",
       getFormattedTimeForValue(entry.time).c_str(),
       entry.currentTemp / 100.0,
@@ -458,12 +811,12 @@ void commandHistory(const String& params) {
 }
 
 void commandEraseHistory(const String& params) {
-    if (!historyService) {
+    if (!historyService()) {
     telnet.println(F("Error: History service not available"));
     return;
   }
 
-  historyService->eraseHistory();
+  historyService()->eraseHistory();
   telnet.println(F("History erased"));
 }
 
@@ -494,7 +847,7 @@ void commandLearnerStatus(const String& params) {
     "Sunday","Monday","Tuesday","Wednesday","Thursday","Friday","Saturday"
   };
 
-  if (!learner || learner->isDisabled()) {
+  if (!learner() || learner()->isDisabled()) {
     telnet.println(F("Learner is disabled or not initialized."));
     return;
   }
@@ -502,7 +855,7 @@ void commandLearnerStatus(const String& params) {
   telnet.println(F("Learner Status"));
 
   // Last recompute time and age.
-  time_t lastRecompute = learner->lastRecomputeTime();
+  time_t lastRecompute = learner()->lastRecomputeTime();
   if (lastRecompute > 0) {
     char tbuf[32];
     struct tm  tm_buf;
@@ -519,7 +872,7 @@ void commandLearnerStatus(const String& params) {
   }
 
   // Bucket fill.
-  int nonZero = learner->bucketStore().nonZeroCount();
+  int nonZero = learner()->bucketStore().nonZeroCount();
   int total   = BUCKET_DAYS * BUCKET_PER_DAY;
   telnet.printf("  Bucket fill:     %d / %d non-zero (%.1f%%)\n\n",
                 nonZero, total, nonZero * 100.0f / total);
@@ -528,8 +881,8 @@ void commandLearnerStatus(const String& params) {
   telnet.println(F("  Day         Predicted  Measured   Gap      Cold-starts (4wk)"));
   telnet.println(F("  -----------------------------------------------------------------"));
 
-  const float       *pred = learner->predictedEfficiency();
-  const WeekMeasured *mw  = learner->measuredWindow();
+  const float       *pred = learner()->predictedEfficiency();
+  const WeekMeasured *mw  = learner()->measuredWindow();
 
   float sumPred = 0.0f, sumMeas = 0.0f;
   int   cntPred = 0,    cntMeas = 0;
@@ -579,13 +932,13 @@ void commandLearnerStatus(const String& params) {
   telnet.println(F("  Day         Slot  UTC Range       Score"));
   telnet.println(F("  ----------------------------------------------"));
   bool printedAny = false;
-  if (scheduler) {
+  if (scheduler()) {
     for (int day = 0; day < 7; day++) {
       for (int slot = 0; slot < 3; slot++) {
         uint8_t sh, sm, eh, em;
-        if (!scheduler->getTimeSlot(day, slot, sh, sm, eh, em)) continue;
+        if (!scheduler()->getTimeSlot(day, slot, sh, sm, eh, em)) continue;
         float score = NAN;
-        bool hasScore = scheduler->getSlotScoreUtc(day, slot, score);
+        bool hasScore = scheduler()->getSlotScoreUtc(day, slot, score);
         char scoreStr[16];
         if (hasScore) {
           snprintf(scoreStr, sizeof(scoreStr), "%.3f", score);
@@ -604,11 +957,11 @@ void commandLearnerStatus(const String& params) {
 }
 
 void commandSaveLearner(const String& params) {
-  if (!learner || learner->isDisabled()) {
+  if (!learner() || learner()->isDisabled()) {
     telnet.println(F("Learner is disabled or not initialized."));
     return;
   }
-  if (learner->saveMeasured()) {
+  if (learner()->saveMeasured()) {
     telnet.println(F("Measured efficiency window saved."));
   } else {
     telnet.println(F("Failed to save measured efficiency window."));
@@ -634,12 +987,25 @@ void setupTelnetCommands() {
   registerCommand(F("wifi"), F("Print WiFi status"), commandWiFi);
   registerCommand(F("memory"), F("Print available memory"), commandMemory);
 
-  registerCommand(F("trace"), F("Dump interactions (options: gas/water/command/announce)"), commandTrace);
+  registerCommand(F("trace"), F("Dump interactions (options: gas/water/command/announce/cascade)"), commandTrace);
   registerCommand(F("stop"), F("Stop tracing"), commandStop);
 
+  registerCommand(F("bus"), F("Select the heater the other commands act on (optional: bus number)"), commandBus);
   registerCommand(F("gas"), F("Print current gas state as JSON"), commandGas);
   registerCommand(F("water"), F("Print current water state as JSON"), commandWater);
   registerCommand(F("control"), F("Check if control commands are available"), commandControl);
+  registerCommand(F("rxStats"), F("Print RS485 receive latency and drop counters"), commandRxStats);
+  registerCommand(F("busstats"), F("Print RS485 bus health counters and loop/parse time histograms (optional: reset)"), commandBusStats);
+  registerCommand(F("errors"), F("Print parser and send error counts and the recent errors (optional: reset)"), commandErrors);
+  registerCommand(F("commandStats"), F("Print command confirmation counters and latency histograms"), commandCommandStats);
+  registerCommand(F("unknowns"), F("Print payload byte statistics (optional: water/gas, all, reset)"), commandUnknowns);
+  registerCommand(F("rawhex"), F("Add the raw packet hex to UDP packets (on/off)"), commandRawHex);
+  registerCommand(F("udpformat"), F("Send water and gas UDP packets as JSON, binary or both"), commandUdpFormat);
+  registerCommand(F("udpdelta"), F("Send only changed water and gas fields, whole packets every N seconds (N/off)"), commandUdpDelta);
+  registerCommand(F("udpbatch"), F("Pack UDP records into one datagram per window (ms/off/reset) and show the rates"), commandUdpBatch);
+  registerCommand(F("udpsubscribe"), F("Send UDP records to an address instead of broadcasting (to=A.B.C.D[:PORT] format= types= interval=ms ttl=s) or list subscribers"), commandUdpSubscribe);
+  registerCommand(F("udpunsubscribe"), F("Stop sending UDP records to an address (optional: to=A.B.C.D[:PORT], default this client on every port)"), commandUdpUnsubscribe);
+  registerCommand(F("subscribers"), F("Print packet subscribers and their execution time"), commandSubscribers);
 
   registerCommand(F("setTemp"), F("Set or get set point temperature"), commandSetTemp);
   registerCommand(F("power"), F("Set or get power state (on/off)"), commandPower);
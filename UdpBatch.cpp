@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2026 David Carson (dacarson)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "UdpBatch.h"
+#include <string.h>
+
+UdpBatch::UdpBatch(SendFunction send, void *context, char separator)
+    : _send(send), _context(context), _separator(separator) {}
+
+void UdpBatch::setWindow(uint32_t ms, uint32_t now_ms) {
+    flush();
+    _window_ms = ms < MAX_WINDOW_MS ? ms : MAX_WINDOW_MS;
+    resetStats(now_ms);
+}
+
+void UdpBatch::setSeparator(char separator) {
+    flush();
+    _separator = separator;
+}
+
+void UdpBatch::add(const uint8_t *record, size_t len, uint32_t now_ms, bool flush_now) {
+    _stats.records++;
+    size_t sep = _len && _separator ? 1 : 0;
+    if (_window_ms == 0 || len > MAX_DATAGRAM) {
+        flush();
+        send(record, len);
+        return;
+    }
+    if (_len + sep + len > MAX_DATAGRAM) {
+        flush();
+        sep = 0;
+    }
+    if (_len == 0)
+        _started_ms = now_ms;
+    if (sep)
+        _buf[_len++] = _separator;
+    memcpy(_buf + _len, record, len);
+    _len += len;
+    if (flush_now) {
+        _stats.flushes++;
+        flush();
+    }
+}
+
+void UdpBatch::poll(uint32_t now_ms) {
+    if (_len && now_ms - _started_ms >= _window_ms)
+        flush();
+}
+
+void UdpBatch::flush() {
+    if (_len == 0)
+        return;
+    send(_buf, _len);
+    _len = 0;
+}
+
+void UdpBatch::resetStats(uint32_t now_ms) {
+    _stats = {};
+    _stats.since_ms = now_ms;
+}
+
+void UdpBatch::send(const uint8_t *data, size_t len) {
+    _stats.datagrams++;
+    _stats.bytes += len;
+    _send(data, len, _context);
+}
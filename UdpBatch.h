@@ -0,0 +1,91 @@
+/*
+Copyright (c) 2026 David Carson (dacarson)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// UdpBatch packs UDP records into MTU-sized datagrams.
+//
+// Without a window every record goes out by itself as soon as it is added.
+// With one, records are appended to one datagram, which is sent when the
+// next record no longer fits, when the window since its first record has
+// passed (poll()), or at once when a record asks for it, e.g. on a state
+// edge a listener should see without delay.  JSON records are joined with a
+// separator ('\n'); binary ones delimit themselves and are concatenated.
+//
+// Plain C++ with no Arduino dependency, so the host simulator can measure
+// the datagram rate.  Not thread safe: add() and poll() from the one loop.
+class UdpBatch {
+public:
+    // Payload bytes per datagram; a 1500 byte Ethernet MTU less the IP and
+    // UDP headers is 1472, and WiFi adds nothing that needs more room
+    static const size_t MAX_DATAGRAM = 1400;
+    // Longest window accepted by setWindow()
+    static const uint32_t MAX_WINDOW_MS = 10000;
+
+    typedef void (*SendFunction)(const uint8_t *data, size_t len, void *context);
+
+    typedef struct {
+        uint32_t records;    // added
+        uint32_t datagrams;  // sent
+        uint32_t bytes;      // sent, payload only
+        uint32_t flushes;    // datagrams sent early for a record that asked
+        uint32_t since_ms;   // when the counters were last reset
+    } STATS;
+
+    UdpBatch(SendFunction send, void *context, char separator = 0);
+
+    // ms == 0 sends every record by itself.  Sends what is batched, and
+    // resets the counters so the rate before and after can be compared.
+    void setWindow(uint32_t ms, uint32_t now_ms);
+    uint32_t window() const { return _window_ms; }
+
+    // Sends what is batched, then joins later records with this separator
+    void setSeparator(char separator);
+
+    // Queues a record; with flush, sends it and anything before it now.
+    // A record longer than MAX_DATAGRAM goes out alone.
+    void add(const uint8_t *record, size_t len, uint32_t now_ms, bool flush = false);
+
+    // Sends the datagram once its window has passed
+    void poll(uint32_t now_ms);
+
+    // Sends what is batched, if anything
+    void flush();
+
+    const STATS *stats() const { return &_stats; }
+    void resetStats(uint32_t now_ms);
+
+private:
+    void send(const uint8_t *data, size_t len);
+
+    SendFunction _send;
+    void *_context;
+    char _separator;
+    uint32_t _window_ms = 0;
+    uint32_t _started_ms = 0;  // first record of the pending datagram
+    size_t _len = 0;
+    STATS _stats = {};
+    uint8_t _buf[MAX_DATAGRAM];
+};
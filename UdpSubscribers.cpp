@@ -0,0 +1,332 @@
+/*
+Copyright (c) 2026 David Carson (dacarson)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "UdpSubscribers.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+const struct {
+    const char *name;
+    uint8_t record;
+} RECORD_NAMES[] = {
+    { "water", UdpSubscribers::RECORD_WATER },
+    { "gas", UdpSubscribers::RECORD_GAS },
+    { "command", UdpSubscribers::RECORD_COMMAND },
+    { "announce", UdpSubscribers::RECORD_ANNOUNCE },
+    { "busstats", UdpSubscribers::RECORD_BUSSTATS },
+    { "learner", UdpSubscribers::RECORD_LEARNER },
+};
+
+// A whole decimal number up to max
+bool parseNumber(const char *text, uint32_t max, uint32_t *value) {
+    char *end;
+    unsigned long n = strtoul(text, &end, 10);
+    if (end == text || *end != '\0' || n > max)
+        return false;
+    *value = (uint32_t)n;
+    return true;
+}
+
+// A.B.C.D with an optional :PORT, 0 when there is none
+bool parseAddress(const char *text, uint8_t address[4], uint16_t *port) {
+    const char *p = text;
+    for (int i = 0; i < 4; i++) {
+        if (!isdigit((unsigned char)*p))
+            return false;
+        char *end;
+        unsigned long octet = strtoul(p, &end, 10);
+        if (octet > 255)
+            return false;
+        address[i] = (uint8_t)octet;
+        p = end;
+        if (i < 3 && *p++ != '.')
+            return false;
+    }
+    uint32_t n = 0;
+    if (*p == ':' && (!parseNumber(p + 1, 65535, &n) || n == 0))
+        return false;
+    if (*p != '\0' && *p != ':')
+        return false;
+    *port = (uint16_t)n;
+    return true;
+}
+
+bool parseRecords(char *list, uint8_t *records) {
+    char *rest;
+    *records = 0;
+    for (char *name = strtok_r(list, ",", &rest); name; name = strtok_r(nullptr, ",", &rest)) {
+        if (strcmp(name, "all") == 0) {
+            *records = UdpSubscribers::RECORD_ALL;
+            continue;
+        }
+        uint8_t record = 0;
+        for (const auto &r : RECORD_NAMES)
+            if (strcmp(name, r.name) == 0)
+                record = r.record;
+        if (!record)
+            return false;
+        *records |= record;
+    }
+    return *records != 0;
+}
+
+}  // namespace
+
+UdpSubscribers::Entry::Entry() : batch(send, this) {}
+
+void UdpSubscribers::Entry::send(const uint8_t *data, size_t len, void *context) {
+    Entry *entry = (Entry *)context;
+    entry->owner->_send(entry->info.request.address, entry->info.request.port, data, len);
+}
+
+UdpSubscribers::UdpSubscribers(SendFunction send) : _send(send) {
+    for (Entry &entry : _entries)
+        entry.owner = this;
+}
+
+bool UdpSubscribers::parse(const char *spec, REQUEST *request, const char **error) {
+    request->port = 0;
+    request->binary = false;
+    request->records = 0;
+    request->interval_ms = 0;
+    request->ttl_s = DEFAULT_TTL_S;
+
+    const char *p = spec;
+    while (*p) {
+        size_t len = strcspn(p, " &\r\n");
+        if (len == 0) {
+            p++;
+            continue;
+        }
+        char token[64];
+        if (len >= sizeof(token)) {
+            *error = "option too long";
+            return false;
+        }
+        memcpy(token, p, len);
+        token[len] = '\0';
+        p += len;
+
+        char *value = strchr(token, '=');
+        if (!value) {
+            *error = "expected key=value";
+            return false;
+        }
+        *value++ = '\0';
+        bool ok;
+        if (strcmp(token, "to") == 0) {
+            ok = parseAddress(value, request->address, &request->port);
+            *error = "bad address, expected A.B.C.D[:PORT]";
+        } else if (strcmp(token, "format") == 0) {
+            ok = strcmp(value, "json") == 0 || strcmp(value, "binary") == 0;
+            request->binary = strcmp(value, "binary") == 0;
+            *error = "format is json or binary";
+        } else if (strcmp(token, "types") == 0) {
+            ok = parseRecords(value, &request->records);
+            *error = "types are water,gas,command,announce,busstats,learner or all";
+        } else if (strcmp(token, "interval") == 0) {
+            ok = parseNumber(value, 3600000, &request->interval_ms);
+            *error = "interval is 0 to 3600000 ms";
+        } else if (strcmp(token, "ttl") == 0) {
+            ok = parseNumber(value, MAX_TTL_S, &request->ttl_s) && request->ttl_s > 0;
+            *error = "ttl is 1 to 86400 s";
+        } else {
+            ok = false;
+            *error = "unknown option, expected to, format, types, interval or ttl";
+        }
+        if (!ok)
+            return false;
+    }
+
+    uint8_t formatRecords = request->binary ? RECORD_BINARY : RECORD_ALL;
+    if (!request->records || request->records == RECORD_ALL)
+        request->records = formatRecords;
+    if (request->records & ~formatRecords) {
+        *error = "binary carries water and gas only";
+        return false;
+    }
+    const uint8_t *a = request->address;
+    if (!a[0] && !a[1] && !a[2] && !a[3]) {
+        *error = "no address, give to=A.B.C.D";
+        return false;
+    }
+    return true;
+}
+
+void UdpSubscribers::describe(const REQUEST &request, char *buf, size_t cap) {
+    const uint8_t *a = request.address;
+    int n = snprintf(buf, cap, "to=%u.%u.%u.%u:%u format=%s types=", a[0], a[1], a[2], a[3], request.port,
+                     request.binary ? "binary" : "json");
+    bool first = true;
+    for (const auto &r : RECORD_NAMES) {
+        if (!(request.records & r.record) || n < 0 || (size_t)n >= cap)
+            continue;
+        n += snprintf(buf + n, cap - n, "%s%s", first ? "" : ",", r.name);
+        first = false;
+    }
+    if (n >= 0 && (size_t)n < cap)
+        snprintf(buf + n, cap - n, " interval=%u ttl=%u", (unsigned)request.interval_ms, (unsigned)request.ttl_s);
+}
+
+int UdpSubscribers::subscribe(const REQUEST &asked, uint32_t now_ms, bool *changed) {
+    REQUEST request = asked;
+    if (!request.port)
+        request.port = request.binary ? BINARY_PORT : JSON_PORT;
+    Entry *entry = nullptr;
+    for (Entry &e : _entries) {
+        if (e.used && e.info.request.port == request.port && !memcmp(e.info.request.address, request.address, 4)) {
+            entry = &e;
+            break;
+        }
+    }
+    bool renewal = entry != nullptr;
+    for (Entry &e : _entries) {
+        if (!entry && !e.used)
+            entry = &e;
+    }
+    if (!entry)
+        return -1;
+
+    const REQUEST &was = entry->info.request;
+    bool same = renewal && was.binary == request.binary && was.records == request.records &&
+                was.interval_ms == request.interval_ms;
+    if (changed)
+        *changed = !same;
+    if (!renewal) {
+        entry->used = true;
+        entry->info = {};
+        entry->batch.setWindow(_window_ms, now_ms);
+        _count++;
+    }
+    // The first record of every stream goes out straight away
+    if (!renewal || entry->info.request.interval_ms != request.interval_ms) {
+        for (uint32_t &last : entry->last_ms)
+            last = now_ms - request.interval_ms;
+    }
+    if (!renewal || was.binary != request.binary)
+        entry->batch.setSeparator(request.binary ? 0 : '\n');
+    entry->info.request = request;
+    entry->info.renewed_ms = now_ms;
+    return (int)(entry - _entries);
+}
+
+bool UdpSubscribers::unsubscribe(const uint8_t address[4], uint16_t port) {
+    bool found = false;
+    for (Entry &e : _entries) {
+        if (e.used && (!port || e.info.request.port == port) && !memcmp(e.info.request.address, address, 4)) {
+            remove(e);
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool UdpSubscribers::wants(uint8_t record, bool binary) const {
+    for (const Entry &e : _entries) {
+        if (e.used && e.info.request.binary == binary && (e.info.request.records & record))
+            return true;
+    }
+    return false;
+}
+
+size_t UdpSubscribers::targets(uint8_t record, bool binary, REQUEST *out) const {
+    size_t n = 0;
+    for (const Entry &e : _entries) {
+        if (e.used && e.info.request.binary == binary && (e.info.request.records & record))
+            out[n++] = e.info.request;
+    }
+    return n;
+}
+
+void UdpSubscribers::add(uint8_t record, uint8_t bus, uint8_t unit, bool binary, const uint8_t *data, size_t len,
+                         uint32_t now_ms, bool flush) {
+    int s = stream(record, bus, unit);
+    for (Entry &e : _entries) {
+        const REQUEST &request = e.info.request;
+        if (!e.used || request.binary != binary || !(request.records & record))
+            continue;
+        if (s >= 0 && request.interval_ms && !flush && now_ms - e.last_ms[s] < request.interval_ms) {
+            e.info.dropped++;
+            continue;
+        }
+        if (s >= 0)
+            e.last_ms[s] = now_ms;
+        e.info.sent++;
+        e.batch.add(data, len, now_ms, flush);
+    }
+}
+
+size_t UdpSubscribers::poll(uint32_t now_ms) {
+    size_t expired = 0;
+    for (Entry &e : _entries) {
+        if (!e.used)
+            continue;
+        if (now_ms - e.info.renewed_ms >= e.info.request.ttl_s * 1000) {
+            remove(e);
+            expired++;
+        } else {
+            e.batch.poll(now_ms);
+        }
+    }
+    return expired;
+}
+
+void UdpSubscribers::flush() {
+    for (Entry &e : _entries) {
+        if (e.used)
+            e.batch.flush();
+    }
+}
+
+void UdpSubscribers::setWindow(uint32_t ms, uint32_t now_ms) {
+    _window_ms = ms < UdpBatch::MAX_WINDOW_MS ? ms : UdpBatch::MAX_WINDOW_MS;
+    for (Entry &e : _entries)
+        e.batch.setWindow(_window_ms, now_ms);
+}
+
+const UdpSubscribers::SUBSCRIBER *UdpSubscribers::subscriber(size_t i) const {
+    return i < MAX_SUBSCRIBERS && _entries[i].used ? &_entries[i].info : nullptr;
+}
+
+int UdpSubscribers::stream(uint8_t record, uint8_t bus, uint8_t unit) {
+    if (bus >= NAVIEN_BUSES)
+        return -1;
+    int first = bus * STREAMS_PER_BUS;
+    switch (record) {
+        case RECORD_WATER:    return first + (unit < MAX_DEVICES ? unit : 0);
+        case RECORD_GAS:      return first + MAX_DEVICES;
+        case RECORD_COMMAND:  return first + MAX_DEVICES + 1;
+        case RECORD_ANNOUNCE: return first + MAX_DEVICES + 2;
+        default:              return -1;  // rare enough to go out whenever they come
+    }
+}
+
+void UdpSubscribers::remove(Entry &entry) {
+    entry.batch.flush();
+    entry.used = false;
+    _count--;
+}
@@ -0,0 +1,159 @@
+/*
+Copyright (c) 2026 David Carson (dacarson)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Navien.h"
+#include "UdpBatch.h"
+
+// UdpSubscribers is the table of listeners that asked for UDP telemetry.
+//
+// Each subscriber names a unicast or multicast address and port, whether it
+// wants JSON or binary records, which record types, and the shortest
+// interval between two records of one stream (bus, packet type and water
+// unit).  A subscription lasts its TTL and is renewed by subscribing again,
+// so a listener that goes away stops costing airtime.  The broadcaster only
+// broadcasts to the LAN while the table is empty.
+//
+// A record inside a subscriber's interval is dropped, not queued: the next
+// one after the interval carries the state, and the broadcaster's periodic
+// re-send of unchanged packets bounds how stale it gets.  Records that ask
+// to be flushed, the state edges, are never held back.  In delta mode a
+// limited subscriber sees sequence gaps and waits for the next keyframe.
+//
+// Every subscriber batches its own datagrams with the window set here.
+// Plain C++ with no Arduino dependency, like UdpBatch, so the host
+// simulator can run it.  Not thread safe: everything from the one loop.
+class UdpSubscribers {
+public:
+    static const size_t MAX_SUBSCRIBERS = 4;
+    static const uint16_t JSON_PORT = 2025;
+    static const uint16_t BINARY_PORT = 2026;
+    static const uint32_t DEFAULT_TTL_S = 300;
+    static const uint32_t MAX_TTL_S = 86400;
+
+    // Record types; the packet types keep their Navien::PacketKind bits
+    enum : uint8_t {
+        RECORD_WATER    = Navien::PACKET_KIND_WATER,
+        RECORD_GAS      = Navien::PACKET_KIND_GAS,
+        RECORD_COMMAND  = Navien::PACKET_KIND_COMMAND,
+        RECORD_ANNOUNCE = Navien::PACKET_KIND_ANNOUNCE,
+        RECORD_BUSSTATS = 1 << 5,
+        RECORD_LEARNER  = 1 << 6,
+        RECORD_ALL      = RECORD_WATER | RECORD_GAS | RECORD_COMMAND | RECORD_ANNOUNCE | RECORD_BUSSTATS |
+                          RECORD_LEARNER,
+        RECORD_BINARY   = RECORD_WATER | RECORD_GAS  // the types with a binary form
+    };
+
+    // What a listener asks for, as parse() reads it
+    typedef struct {
+        uint8_t address[4];    // IPv4, unicast or multicast
+        uint16_t port;         // 0 for the format's port
+        bool binary;
+        uint8_t records;       // RECORD_* bits
+        uint32_t interval_ms;  // per stream; 0 sends every record
+        uint32_t ttl_s;
+    } REQUEST;
+
+    typedef struct {
+        REQUEST request;
+        uint32_t renewed_ms;
+        uint32_t sent;     // records
+        uint32_t dropped;  // inside the interval
+    } SUBSCRIBER;
+
+    typedef void (*SendFunction)(const uint8_t address[4], uint16_t port, const uint8_t *data, size_t len);
+
+    explicit UdpSubscribers(SendFunction send);
+
+    // Reads "to=A.B.C.D[:PORT] format=json|binary types=water,gas,...|all
+    // interval=MS ttl=S", every key optional and in any order, separated by
+    // spaces or '&'.  Without "to" the address in request is kept, so set it
+    // to the caller's first; the rest starts from the defaults: port 0, the
+    // format's types, no interval and DEFAULT_TTL_S.  On failure returns
+    // false with the reason in *error.
+    static bool parse(const char *spec, REQUEST *request, const char **error);
+    // The request in the form parse() reads
+    static void describe(const REQUEST &request, char *buf, size_t cap);
+
+    // Adds a subscriber, or renews and updates the one with the same
+    // address and port; port 0 is the format's.  Returns its index, or -1
+    // when the table is full.  *changed is set for a new subscriber or one
+    // that asks for something else; a plain renewal only restarts its TTL
+    // and leaves its batch alone.
+    int subscribe(const REQUEST &request, uint32_t now_ms, bool *changed = nullptr);
+    // Sends what is batched for the subscriber and removes it; port 0
+    // removes the address on every port
+    bool unsubscribe(const uint8_t address[4], uint16_t port);
+
+    size_t count() const { return _count; }
+    // Whether a subscriber takes this record type in this format
+    bool wants(uint8_t record, bool binary) const;
+    // Up to MAX_SUBSCRIBERS requests that take this type and format
+    size_t targets(uint8_t record, bool binary, REQUEST *out) const;
+
+    // Offers a record to every subscriber that wants it; unit is the water
+    // unit, ignored for other types
+    void add(uint8_t record, uint8_t bus, uint8_t unit, bool binary, const uint8_t *data, size_t len,
+             uint32_t now_ms, bool flush = false);
+
+    // Sends batches whose window has passed and removes expired
+    // subscribers; returns how many expired
+    size_t poll(uint32_t now_ms);
+    // Sends every subscriber's batch
+    void flush();
+
+    // The batch window of every subscriber, as UdpBatch::setWindow()
+    void setWindow(uint32_t ms, uint32_t now_ms);
+    uint32_t window() const { return _window_ms; }
+
+    // i < MAX_SUBSCRIBERS; nullptr for a free slot
+    const SUBSCRIBER *subscriber(size_t i) const;
+    const UdpBatch::STATS *batchStats(size_t i) const { return _entries[i].batch.stats(); }
+
+private:
+    // Water units, then gas, command and announce, for each bus
+    static const size_t STREAMS_PER_BUS = MAX_DEVICES + 3;
+    static const size_t STREAMS = NAVIEN_BUSES * STREAMS_PER_BUS;
+
+    struct Entry {
+        Entry();
+        static void send(const uint8_t *data, size_t len, void *context);
+
+        UdpSubscribers *owner = nullptr;
+        bool used = false;
+        SUBSCRIBER info = {};
+        uint32_t last_ms[STREAMS] = {};  // last record sent per stream
+        UdpBatch batch;
+    };
+
+    static int stream(uint8_t record, uint8_t bus, uint8_t unit);
+    void remove(Entry &entry);
+
+    SendFunction _send;
+    size_t _count = 0;
+    uint32_t _window_ms = 0;
+    Entry _entries[MAX_SUBSCRIBERS];
+};
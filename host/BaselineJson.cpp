@@ -0,0 +1,201 @@
+// The record functions of NavienBroadcaster.ino as they were before
+// TelemetryWriter replaced them, unchanged but for the broadcast code around
+// them and the default arguments, which are in BaselineJson.h.  Water and
+// gas are the JsonDocument functions the field tables replaced, with the
+// accessors of the packed water state, "bus", "debug" only when given and
+// without unknown_30/31, which moved to GET /unknowns.
+
+#include "BaselineJson.h"
+
+#define JSON_ASSIGN_WATER(field) doc[#field] = water->field;
+#define JSON_ASSIGN_WATER_BOOL_TO_INT(field) doc[#field] = (int)(water->field);
+#define JSON_ASSIGN_WATER_FLOAT(field) doc[#field] = serialized(String(water->field(), 1))
+#define JSON_ASSIGN_WATER_STAGE(field) doc[#field] = (int)(water->field())
+#define JSON_ASSIGN_GAS(field) doc[#field] = gas->field;
+#define JSON_ASSIGN_GAS_FLOAT(field) doc[#field] = serialized(String(gas->field, 1))
+#define JSON_ASSIGN_GAS_BOOL_TO_INT(field) doc[#field] = (int)(gas->field)
+#define JSON_ASSIGN_COMMAND(field) doc[#field] = state->command.field;
+#define JSON_ASSIGN_COMMAND_BOOL_TO_INT(field) doc[#field] = (int)(state->command.field);
+#define JSON_ASSIGN_ANNOUNCE_BOOL_TO_INT(field) doc[#field] = (int)(state->announce.field);
+// Records name the heater they came from once there is more than one
+#if NAVIEN_BUSES > 1
+#define JSON_ASSIGN_BUS(navien) doc["bus"] = (navien)->busId();
+#else
+#define JSON_ASSIGN_BUS(navien)
+#endif
+
+// Only called once a packet is going out; duplicates are dropped on the
+// parser's raw-byte change mask first. One allocation, for the String.
+String rawHexString(const Navien::PACKET_EVENT *event) {
+  char hex[3 * sizeof(event->raw->raw_data) + 1];
+  Navien::formatHex(event->raw->raw_data, Navien::HDR_SIZE + event->raw->hdr.len + 1, hex, sizeof(hex));
+  return String(hex);
+}
+
+/* Handle Water packets */
+String waterToJSON(const Navien *navien, const Navien::NAVIEN_STATE_WATER *water, String rawhexstring) {
+  JsonDocument doc;
+  doc["type"] = "water";
+  JSON_ASSIGN_BUS(navien);
+
+  JSON_ASSIGN_WATER(device_number);
+  JSON_ASSIGN_WATER_BOOL_TO_INT(system_power);
+  JSON_ASSIGN_WATER_FLOAT(set_temp);
+  JSON_ASSIGN_WATER_FLOAT(inlet_temp);
+  JSON_ASSIGN_WATER_FLOAT(outlet_temp);
+  JSON_ASSIGN_WATER_FLOAT(flow_lpm);
+  JSON_ASSIGN_WATER(flow_state);
+  JSON_ASSIGN_WATER_BOOL_TO_INT(recirculation_active);
+  JSON_ASSIGN_WATER_BOOL_TO_INT(recirculation_running);
+  JSON_ASSIGN_WATER_BOOL_TO_INT(display_metric);
+  JSON_ASSIGN_WATER_BOOL_TO_INT(internal_recirculation);
+  JSON_ASSIGN_WATER_BOOL_TO_INT(external_recirculation);
+  JSON_ASSIGN_WATER_FLOAT(operating_capacity);
+  JSON_ASSIGN_WATER_BOOL_TO_INT(consumption_active);
+  JSON_ASSIGN_WATER(system_stage);
+  JSON_ASSIGN_WATER_STAGE(stage_idle);
+  JSON_ASSIGN_WATER_STAGE(stage_starting);
+  JSON_ASSIGN_WATER_STAGE(stage_active);
+  JSON_ASSIGN_WATER_STAGE(stage_shutting_down);
+  JSON_ASSIGN_WATER_STAGE(stage_standby);
+  JSON_ASSIGN_WATER_STAGE(stage_demand);
+  JSON_ASSIGN_WATER_STAGE(stage_pre_purge);
+  JSON_ASSIGN_WATER_STAGE(stage_ignition);
+  JSON_ASSIGN_WATER_STAGE(stage_flame_on);
+  JSON_ASSIGN_WATER_STAGE(stage_ramp_up);
+  JSON_ASSIGN_WATER_STAGE(stage_active_combustion);
+  JSON_ASSIGN_WATER_STAGE(stage_water_adjustment);
+  JSON_ASSIGN_WATER_STAGE(stage_flame_off);
+  JSON_ASSIGN_WATER_STAGE(stage_post_purge_1);
+  JSON_ASSIGN_WATER_STAGE(stage_post_purge_2);
+  JSON_ASSIGN_WATER_STAGE(stage_dhw_wait);
+  JSON_ASSIGN_WATER_BOOL_TO_INT(system_active);
+  JSON_ASSIGN_WATER(operation_time);
+  if (!rawhexstring.isEmpty())
+    doc["debug"] = rawhexstring;
+
+  String json;
+  serializeJson(doc, json);
+  return json;
+}
+
+/* Handle Gas packets */
+
+String gasToJSON(const Navien *navien, const Navien::NAVIEN_STATE_GAS *gas, String rawhexstring) {
+  JsonDocument doc;
+  doc["type"] = "gas";
+  JSON_ASSIGN_BUS(navien);
+
+  JSON_ASSIGN_GAS_FLOAT(controller_version);
+  JSON_ASSIGN_GAS_FLOAT(set_temp);
+  JSON_ASSIGN_GAS_FLOAT(inlet_temp);
+  JSON_ASSIGN_GAS_FLOAT(outlet_temp);
+  JSON_ASSIGN_GAS_FLOAT(panel_version);
+  JSON_ASSIGN_GAS(current_gas_usage);
+  JSON_ASSIGN_GAS(target_gas_usage);
+  JSON_ASSIGN_GAS_FLOAT(accumulated_gas_usage);
+  JSON_ASSIGN_GAS_FLOAT(accumulated_water_usage);
+  JSON_ASSIGN_GAS(total_operating_time);
+  JSON_ASSIGN_GAS(elapsed_install_days);
+  JSON_ASSIGN_GAS(accumulated_domestic_usage_cnt);
+  JSON_ASSIGN_GAS_BOOL_TO_INT(recirculation_enabled);
+  if (!rawhexstring.isEmpty())
+    doc["debug"] = rawhexstring;
+
+  String json;
+  serializeJson(doc, json);
+  return json;
+}
+
+/* Handle Command packets */
+
+String commandToJSON(const Navien *navien, const Navien::NAVIEN_STATE *state, String rawhexstring) {
+  JsonDocument doc;
+  doc["type"] = "command";
+  JSON_ASSIGN_BUS(navien);
+
+  JSON_ASSIGN_COMMAND_BOOL_TO_INT(power_command);
+  JSON_ASSIGN_COMMAND_BOOL_TO_INT(power_on);
+  JSON_ASSIGN_COMMAND_BOOL_TO_INT(set_temp_command);
+  JSON_ASSIGN_COMMAND(set_temp);
+  JSON_ASSIGN_COMMAND_BOOL_TO_INT(hot_button_command);
+  JSON_ASSIGN_COMMAND_BOOL_TO_INT(recirculation_command);
+  JSON_ASSIGN_COMMAND_BOOL_TO_INT(recirculation_on);
+  JSON_ASSIGN_COMMAND(cmd_data);
+  if (!rawhexstring.isEmpty())
+    doc["debug"] = rawhexstring;
+
+  String json;
+  serializeJson(doc, json);
+  return json;
+}
+
+/* Handle Announce packets */
+
+String announceToJSON(const Navien *navien, const Navien::NAVIEN_STATE *state, String rawhexstring) {
+  JsonDocument doc;
+  doc["type"] = "announce";
+  JSON_ASSIGN_BUS(navien);
+  JSON_ASSIGN_ANNOUNCE_BOOL_TO_INT(navilink_present);
+  if (!rawhexstring.isEmpty())
+    doc["debug"] = rawhexstring;
+
+  String json;
+  serializeJson(doc, json);
+  return json;
+}
+
+/* Cascade totals, published after the water packet that moved them */
+
+String cascadeToJSON(const Navien *navien, const Navien::NAVIEN_STATE_CASCADE *cascade) {
+  JsonDocument doc;
+  doc["type"] = "cascade";
+  JSON_ASSIGN_BUS(navien);
+  doc["units"] = cascade->units;
+  doc["units_firing"] = cascade->units_firing;
+  doc["flow_lpm"] = cascade->flow_lpm();
+  doc["operating_capacity"] = cascade->operating_capacity();
+  doc["mean_capacity"] = cascade->mean_capacity();
+  doc["units_recirculating"] = cascade->units_recirculating;
+  doc["units_consuming"] = cascade->units_consuming;
+
+  String json;
+  serializeJson(doc, json);
+  return json;
+}
+
+/* Periodic bus health record */
+
+String busStatsToJSON(const Navien *navien) {
+  const Navien::BUS_STATS *stats = navien->busStats();
+  const Navien::TX_STATS *tx = navien->txStats();
+  JsonDocument doc;
+  doc["type"] = "busstats";
+  JSON_ASSIGN_BUS(navien);
+  doc["checksum_errors"] = stats->checksum_errors;
+  doc["resyncs"] = stats->resyncs;
+  doc["oversize_drops"] = stats->oversize_drops;
+  doc["invalid_length"] = stats->invalid_length;
+  doc["bus_not_clear"] = stats->bus_not_clear;
+  doc["echo_suppressed"] = stats->echo_suppressed;
+  doc["uart_high_water"] = stats->uart_high_water;
+  doc["loop_calls"] = stats->loop_calls;
+  doc["loop_p50_us"] = Navien::histogramPercentile(stats->loop_hist, 50);
+  doc["loop_p99_us"] = Navien::histogramPercentile(stats->loop_hist, 99);
+  doc["loop_max_us"] = stats->loop_max_us;
+  doc["parse_p50_us"] = Navien::histogramPercentile(stats->parse_hist, 50);
+  doc["parse_p99_us"] = Navien::histogramPercentile(stats->parse_hist, 99);
+  doc["parse_max_us"] = stats->parse_max_us;
+  doc["gap_error_avg_ms"] = serialized(String(tx->gap_predictions ? (float)tx->gap_error_total_ms / tx->gap_predictions : 0.0f, 1));
+  doc["sends"] = tx->sends;
+  doc["early_sends"] = tx->early_sends;
+  doc["queue_wait_max_ms"] = tx->queue_wait_max_ms;
+  doc["echo_mismatch"] = tx->echo_mismatch;
+  doc["collisions"] = tx->collisions;
+  doc["retransmits"] = tx->retransmits;
+  doc["overlaps"] = tx->overlaps;
+
+  String json;
+  serializeJson(doc, json);
+  return json;
+}
@@ -0,0 +1,17 @@
+// The JSON records as NavienBroadcaster.ino wrote them before TelemetryWriter,
+// with JsonDocument and String, for navien_replay to check TelemetryWriter's
+// output against.  Built against the ArduinoJson and String stand-ins in
+// host/mock.
+
+#pragma once
+
+#include <ArduinoJson.h>
+#include "Navien.h"
+
+String rawHexString(const Navien::PACKET_EVENT *event);
+String waterToJSON(const Navien *navien, const Navien::NAVIEN_STATE_WATER *water, String rawhexstring = "");
+String gasToJSON(const Navien *navien, const Navien::NAVIEN_STATE_GAS *gas, String rawhexstring = "");
+String commandToJSON(const Navien *navien, const Navien::NAVIEN_STATE *state, String rawhexstring = "");
+String announceToJSON(const Navien *navien, const Navien::NAVIEN_STATE *state, String rawhexstring = "");
+String cascadeToJSON(const Navien *navien, const Navien::NAVIEN_STATE_CASCADE *cascade);
+String busStatsToJSON(const Navien *navien);
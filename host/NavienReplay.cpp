@@ -0,0 +1,1107 @@
+// Host-side RS485 replay harness and parser benchmark for Navien.cpp.
+//
+// Compiles the real Navien.cpp against the mock HardwareSerial in host/mock,
+// replays a captured byte stream through Navien::loop() on a virtual clock,
+// and reports throughput and per-stage parse cost.  Every published packet is
+// rendered as one line of decoded state; --golden compares those lines to a
+// reference file so parser changes cannot silently alter decoded values.
+//
+// Build and run (from host/):
+//   make
+//   ./navien_replay captures/sample.hex
+//   ./navien_replay --golden captures/sample.golden captures/sample.hex
+//   ./navien_replay --bench 2000 captures/sample.hex
+//   ./navien_replay --rx-task --loop-ms 50 --stall-ms 300 captures/sample.hex
+//   ./navien_replay --fields    the JSON field tables of BEHAVIOR_SPEC.md
+//   ./navien_replay --py-fields the field lists of Logger/navien_listener.py
+//   ./navien_replay --unknowns captures/sample.hex
+//   ./navien_replay --json captures/sample.hex
+//   ./navien_replay --json-baseline --golden captures/sample.json.golden captures/sample.hex
+//   curl -o field.ncap http://navien.local:8080/capture
+//   ./navien_replay field.ncap
+//
+// Every water and gas packet is also written as a binary datagram, whole and
+// as a delta, and decoded back the way navien_listener.py does; the result
+// must equal the JSON.  With --json the recorded lines are the JSON records
+// of the UDP broadcast and trace, as TelemetryWriter writes them, then a
+// busstats record and records holding values the capture does not.  Each
+// must equal the record the JsonDocument code TelemetryWriter replaced
+// writes (BaselineJson.cpp, against the ArduinoJson stand-in in host/mock),
+// except for gas accumulated totals, which TelemetryWriter prints exactly
+// from the counts where String(float, 1) rounded them.  number() and
+// fixed1() are checked against it over a sweep of values.  --json-baseline
+// records that code's output instead; the golden file holds it.
+//
+// Capture format: one chunk of bytes per line as space-separated hex, i.e. the
+// "debug" field of the UDP stream.  Lines starting with '#' are comments.  A
+// line holding a UDP JSON datagram is accepted too; its "debug" value is used.
+// A binary capture ring export (GET /capture, see Navien::captureExport()) is
+// also accepted; its received frames are replayed with their recorded gaps,
+// and the frames we sent are skipped since their echoes were captured too.
+
+#include <Arduino.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Navien.h"
+#include "NavienFields.h"
+#include "TelemetryWriter.h"
+#include "BaselineJson.h"
+
+namespace {
+
+// 19200 baud, 8N1: 10 bits per byte.
+constexpr uint64_t BYTE_TIME_US = 10 * 1000000ULL / 19200;
+
+struct Options {
+  std::string capture;
+  std::string golden;
+  std::string writeGolden;
+  std::string writeCapture;
+  int benchPasses = 0;
+  size_t rxBuffer = 1024;     // matches setRxBufferSize() in NavienManager.ino
+  unsigned loopMs = 5;        // interval between Navien::loop() calls
+  unsigned stallMs = 0;       // one stall of this length per second, first at 250 ms
+  unsigned gapMs = 20;        // bus idle time between chunks
+  bool rxTask = false;        // frame on the (emulated) UART event task
+  bool fields = false;
+  bool pyFields = false;
+  bool unknowns = false;
+  bool json = false;
+  bool jsonBaseline = false;  // record the baseline serializer's JSON
+  bool verbose = false;
+};
+
+class ReplayNavien : public Navien {
+public:
+  ReplayNavien() : Navien(2) {}
+
+  using Navien::fill_rx_buffer;
+  using Navien::next_frame;
+  using Navien::parse_packet;
+  using Navien::parse_water;
+  using Navien::parse_gas;
+
+  void load_frame(const std::vector<uint8_t> &frame) {
+    size_t n = std::min(frame.size(), sizeof(local_packet.raw_data));
+    memcpy(local_packet.raw_data, frame.data(), n);
+    recv_packet = &local_packet;
+  }
+};
+
+ReplayNavien navien;
+std::vector<std::string> stateLines;
+size_t errorCount = 0;
+size_t localTxSeen = 0;  // host_tx bytes already attributed to a subscriber
+size_t binaryPackets = 0, binaryBytes = 0, jsonBytes = 0, binaryMismatches = 0;
+bool recording = true;
+bool jsonLines = false;     // --json
+bool jsonBaseline = false;  // --json-baseline
+char jsonBuffer[1536];      // as NavienBroadcaster.ino's
+TelemetryWriter telemetry(jsonBuffer, sizeof(jsonBuffer));
+size_t jsonRecords = 0, jsonMismatches = 0, jsonExactTotals = 0;
+
+using Clock = std::chrono::steady_clock;
+
+double nsSince(Clock::time_point t0) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+}
+
+// Packets published by send_cmd() for our own transmissions are not part of the
+// replayed stream; they depend on control-mode timing, so keep them out of
+// the golden output.
+bool isLocalTx() {
+  if (navien.host_tx.size() == localTxSeen)
+    return false;
+  localTxSeen = navien.host_tx.size();
+  return true;
+}
+
+void record(const char *line) {
+  stateLines.emplace_back(line);
+}
+
+// Decodes a binary datagram the way navien_listener.py does: values[i]
+// becomes the JSON text of field i, and is left alone for fields a delta
+// does not hold.  False if it is not one of this table's.
+template <typename STATE, size_t N>
+bool binaryDecode(const NAVIEN_FIELD<STATE> (&fields)[N], const uint8_t *d, size_t n,
+                  std::vector<std::string> &values) {
+  if (n < NAVIEN_BINARY_HEADER || d[0] != NAVIEN_BINARY_MAGIC || d[1] != NAVIEN_BINARY_VERSION ||
+      (d[8] | d[9] << 8) != navienFieldsLayout(fields))
+    return false;
+  size_t pos = NAVIEN_BINARY_HEADER;
+  NavienFieldSet set = navienFieldsAll(fields);
+  if (d[3] & NAVIEN_BINARY_DELTA) {
+    set = 0;
+    for (size_t i = 0; i < N; i += 8, pos++)
+      set |= pos < n ? (NavienFieldSet)d[pos] << i : 0;
+  }
+  values.resize(N);
+  for (size_t i = 0; i < N; i++) {
+    if (!(set >> i & 1))
+      continue;
+    uint32_t v = 0;
+    int shift = 0;
+    do {
+      if (pos >= n)
+        return false;
+      v |= (uint32_t)(d[pos] & 0x7F) << shift;
+      shift += 7;
+    } while (d[pos++] & 0x80);
+    char text[32];
+    if (fields[i].scale == FIELD_HALF)
+      snprintf(text, sizeof(text), "%u.%u", (unsigned)(v / 2), (unsigned)(v & 1) * 5);
+    else if (fields[i].scale == FIELD_TENTH)
+      snprintf(text, sizeof(text), "%u.%u", (unsigned)(v / 10), (unsigned)(v % 10));
+    else
+      snprintf(text, sizeof(text), "%u", (unsigned)v);
+    values[i] = text;
+  }
+  return pos == n;
+}
+
+// The decoded values as navienFieldsToJSON() writes them
+template <typename STATE, size_t N>
+std::string fieldsText(const NAVIEN_FIELD<STATE> (&fields)[N], const std::vector<std::string> &values) {
+  std::string out;
+  for (size_t i = 0; i < N && i < values.size(); i++)
+    if (!values[i].empty())
+      out += std::string("\"") + fields[i].key + "\":" + values[i] + ",";
+  return out;
+}
+
+// Delta mode as the broadcaster runs it, one stream per packet type and
+// unit: the first update is whole, later ones hold the fields that changed.
+struct DeltaStream {
+  bool started = false;
+  uint32_t last[64] = {};
+  std::vector<std::string> record;  // as the listener has it
+};
+std::map<int, DeltaStream> deltaStreams;
+size_t deltaPackets = 0, deltaBytes = 0, deltaJsonBytes = 0;
+
+template <const auto &FIELDS, typename STATE>
+void checkBinary(uint8_t kind, uint8_t unit, const STATE &s, const uint8_t *payload, uint8_t len) {
+  char json[1024];
+  size_t jsonLen = navienFieldsToJSON<FIELDS>(s, payload, len, json, sizeof(json));
+  uint8_t datagram[navienBinarySize(FIELDS)];
+  size_t n = navienFieldsToBinary<FIELDS>(kind, 0, 0, unit, binaryPackets, s, payload, len,
+                                          datagram, sizeof(datagram));
+  std::vector<std::string> values;
+  if (!binaryDecode(FIELDS, datagram, n, values) || fieldsText(FIELDS, values) != json) {
+    binaryMismatches++;
+    printf("BINARY MISMATCH\n  json:   %s\n  binary: %s\n", json, fieldsText(FIELDS, values).c_str());
+  }
+  binaryPackets++;
+  binaryBytes += n;
+  jsonBytes += jsonLen;
+
+  // Applied to the record so far, the delta must give the whole packet again
+  DeltaStream &stream = deltaStreams[kind << 8 | unit];
+  NavienFieldSet set = navienFieldsUpdate<FIELDS>(s, payload, len, stream.last);
+  if (!stream.started)
+    set = navienFieldsAll(FIELDS);
+  stream.started = true;
+  if (set) {
+    char delta[1024];
+    n = navienFieldsToBinary<FIELDS>(kind, 0, 0, unit, deltaPackets, s, payload, len,
+                                     datagram, sizeof(datagram), set);
+    deltaPackets++;
+    deltaBytes += n;
+    deltaJsonBytes += navienFieldsToJSON<FIELDS>(s, payload, len, delta, sizeof(delta), set);
+    if (!binaryDecode(FIELDS, datagram, n, stream.record))
+      stream.record.clear();
+  }
+  if (fieldsText(FIELDS, stream.record) != json) {
+    binaryMismatches++;
+    printf("DELTA MISMATCH\n  json:  %s\n  delta: %s\n", json, fieldsText(FIELDS, stream.record).c_str());
+  }
+}
+
+void onWater(const Navien::NAVIEN_STATE_WATER *w) {
+  char line[512];
+  snprintf(line, sizeof(line),
+           "water dev=%u power=%d set=%.1f out=%.1f in=%.1f flow=%.1f fs=0x%02X stage=0x%02X "
+           "cap=%.1f recirc_active=%d recirc_running=%d metric=%d int_recirc=%d ext_recirc=%d "
+           "consumption=%d active=%d optime=%u stages=%d%d%d%d.%d%d%d%d%d%d%d%d%d%d%d%d "
+           "changed=0x%05X seq=%u",
+           (unsigned)w->device_number, (int)w->system_power, (double)w->set_temp(),
+           (double)w->outlet_temp(), (double)w->inlet_temp(), (double)w->flow_lpm(),
+           (unsigned)w->flow_state, (unsigned)w->system_stage, (double)w->operating_capacity(),
+           (int)w->recirculation_active, (int)w->recirculation_running, (int)w->display_metric,
+           (int)w->internal_recirculation, (int)w->external_recirculation,
+           (int)w->consumption_active, (int)w->system_active, (unsigned)w->operation_time,
+           (int)w->stage_idle(), (int)w->stage_starting(), (int)w->stage_active(),
+           (int)w->stage_shutting_down(), (int)w->stage_standby(), (int)w->stage_demand(),
+           (int)w->stage_pre_purge(), (int)w->stage_ignition(), (int)w->stage_flame_on(),
+           (int)w->stage_ramp_up(), (int)w->stage_active_combustion(),
+           (int)w->stage_water_adjustment(), (int)w->stage_flame_off(),
+           (int)w->stage_post_purge_1(), (int)w->stage_post_purge_2(), (int)w->stage_dhw_wait(),
+           (unsigned)w->changed_fields, (unsigned)w->sequence);
+  record(line);
+}
+
+void onGas(const Navien::NAVIEN_STATE_GAS *g) {
+  char line[512];
+  snprintf(line, sizeof(line),
+           "gas set=%.1f out=%.1f in=%.1f ctrl=%.2f panel=%.2f gas_m3=%u.%u water_l=%u.%u "
+           "cur=%u target=%u optime=%u days=%u domestic=%u recirc=%d changed=0x%04X seq=%u",
+           (double)g->set_temp, (double)g->outlet_temp, (double)g->inlet_temp,
+           (double)g->controller_version, (double)g->panel_version,
+           (unsigned)(g->accumulated_gas_raw / 10), (unsigned)(g->accumulated_gas_raw % 10),
+           (unsigned)(g->accumulated_water_raw / 10), (unsigned)(g->accumulated_water_raw % 10),
+           (unsigned)g->current_gas_usage, (unsigned)g->target_gas_usage,
+           (unsigned)g->total_operating_time, (unsigned)g->elapsed_install_days,
+           (unsigned)g->accumulated_domestic_usage_cnt, (int)g->recirculation_enabled,
+           (unsigned)g->changed_fields, (unsigned)g->sequence);
+  record(line);
+}
+
+void onCommand(const Navien::NAVIEN_STATE *s) {
+  char line[256];
+  snprintf(line, sizeof(line),
+           "command power_cmd=%d on=%d set_temp_cmd=%d set_temp=%.1f hot=%d recirc_cmd=%d "
+           "recirc_on=%d data=0x%02X",
+           (int)s->command.power_command, (int)s->command.power_on,
+           (int)s->command.set_temp_command, (double)s->command.set_temp,
+           (int)s->command.hot_button_command, (int)s->command.recirculation_command,
+           (int)s->command.recirculation_on, (unsigned)s->command.cmd_data);
+  record(line);
+}
+
+void onAnnounce(const Navien::NAVIEN_STATE *s) {
+  char line[64];
+  snprintf(line, sizeof(line), "announce navilink=%d", (int)s->announce.navilink_present);
+  record(line);
+}
+
+// A record as TelemetryWriter wrote it, checked against the baseline
+// serializer's.  exact, when given, is the baseline's with the accumulated
+// totals written from the counts, which the writer may differ in.
+void recordJSON(const char *written, const String &baseline, const String *exact = nullptr) {
+  jsonRecords++;
+  if (exact && baseline != written && *exact == written) {
+    jsonExactTotals++;
+  } else if (baseline != written) {
+    jsonMismatches++;
+    printf("JSON MISMATCH\n  baseline: %s\n  writer:   %s\n", baseline.c_str(), written);
+  }
+  record(jsonBaseline ? baseline.c_str() : written);
+}
+
+// The gas record with the two accumulated totals printed from their 0.1
+// counts.  The baseline's String(float, 1) of the float state differs from
+// count 10485762 (1048576.2) on.
+String exactTotals(const String &baseline, const Navien::NAVIEN_STATE_GAS *gas) {
+  std::string json = baseline.c_str();
+  const std::pair<const char *, uint32_t> totals[] = {
+    { "\"accumulated_gas_usage\":", gas->accumulated_gas_raw },
+    { "\"accumulated_water_usage\":", gas->accumulated_water_raw },
+  };
+  for (const auto &t : totals) {
+    size_t start = json.find(t.first);
+    if (start == std::string::npos)
+      continue;
+    start += strlen(t.first);
+    char value[16];
+    snprintf(value, sizeof(value), "%u.%u", (unsigned)(t.second / 10), (unsigned)(t.second % 10));
+    json.replace(start, json.find(',', start) - start, value);
+  }
+  return String(json.c_str());
+}
+
+// The record trace prints for a packet, with its raw hex
+void onPacketJSON(const Navien::PACKET_EVENT *event) {
+  switch (event->kind) {
+    case Navien::PACKET_KIND_WATER:
+      recordJSON(writeWaterJSON(telemetry, &navien, event->water, event->raw),
+                 waterToJSON(&navien, event->water, rawHexString(event)));
+      break;
+    case Navien::PACKET_KIND_GAS: {
+      String baseline = gasToJSON(&navien, event->gas, rawHexString(event));
+      String exact = exactTotals(baseline, event->gas);
+      recordJSON(writeGasJSON(telemetry, &navien, event->gas, event->raw), baseline, &exact);
+      break;
+    }
+    case Navien::PACKET_KIND_COMMAND:
+      if (!isLocalTx())
+        recordJSON(writeCommandJSON(telemetry, &navien, event->state, event->raw),
+                   commandToJSON(&navien, event->state, rawHexString(event)));
+      break;
+    case Navien::PACKET_KIND_ANNOUNCE:
+      if (!isLocalTx())
+        recordJSON(writeAnnounceJSON(telemetry, &navien, event->state, event->raw),
+                   announceToJSON(&navien, event->state, rawHexString(event)));
+      break;
+    case Navien::PACKET_KIND_CASCADE:
+      recordJSON(writeCascadeJSON(telemetry, &navien, event->cascade), cascadeToJSON(&navien, event->cascade));
+      break;
+    default: break;
+  }
+}
+
+// After the capture: the bus health record, and values no frame of it
+// holds, a set temperature and a mean capacity whose fractions do not end
+void recordJSONCases() {
+  recordJSON(writeBusStatsJSON(telemetry, &navien), busStatsToJSON(&navien));
+  Navien::NAVIEN_STATE state = *navien.currentState();
+  state.command.set_temp = 121.0f / 3;
+  recordJSON(writeCommandJSON(telemetry, &navien, &state), commandToJSON(&navien, &state));
+  state.cascade.units = 3;
+  state.cascade.capacity_raw = 164;
+  recordJSON(writeCascadeJSON(telemetry, &navien, &state.cascade), cascadeToJSON(&navien, &state.cascade));
+}
+
+// number() against a float as ArduinoJson prints it and fixed1() against
+// String(value, 1), over values that end in few decimals, ones that do not
+// and a seeded sweep from 1e-4 to 1e7, below which and from which
+// ArduinoJson writes an exponent.  Returns the mismatches.
+size_t checkJSONNumbers() {
+  std::vector<float> values = { 0.0f, 0.5f, 2.5f, 47.5f, 55.25f, 0.1f, 1.0f / 3, 2.0f / 3, 82.0f / 3, 121.0f / 3,
+                                0.04f, 0.05f, 0.95f, 99.95f, 9999999.0f };
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> mantissa(1.0f, 10.0f);
+  std::uniform_int_distribution<int> exponent(-4, 6);
+  for (int i = 0; i < 100000; i++) {
+    float v = mantissa(rng) * powf(10.0f, exponent(rng));
+    if (v < 1e7f)
+      values.push_back(v);
+  }
+  for (size_t i = 0, n = values.size(); i < n; i++)
+    values.push_back(-values[i]);
+
+  size_t mismatches = 0;
+  auto check = [&](const char *what, float v, const std::string &expected, void (TelemetryWriter::*write)(float)) {
+    telemetry.begin("number", 0);
+    telemetry.key(TELEMETRY_KEY("value"));
+    size_t start = telemetry.length();
+    (telemetry.*write)(v);
+    std::string got(telemetry.c_str() + start, telemetry.length() - start);
+    if (got != expected) {
+      if (mismatches++ < 10)
+        printf("NUMBER MISMATCH %s(%.9g): expected %s, wrote %s\n", what, (double)v, expected.c_str(), got.c_str());
+    }
+  };
+  for (float v : values) {
+    JsonDocument doc;
+    doc["value"] = v;
+    String json;
+    serializeJson(doc, json);
+    std::string text = json.c_str();
+    check("number", v, text.substr(strlen("{\"value\":"), text.size() - strlen("{\"value\":}")),
+          &TelemetryWriter::number);
+    check("fixed1", v, String(v, 1).c_str(), &TelemetryWriter::fixed1);
+  }
+  // dtostrf() prints the sign before rounding
+  check("fixed1", -0.04f, "-0.0", &TelemetryWriter::fixed1);
+  if (!mismatches)
+    printf("PASSED  TelemetryWriter number() and fixed1() over %zu values\n", values.size());
+  return mismatches;
+}
+
+// Records every packet as a golden line
+void onPacket(const Navien::PACKET_EVENT *event, void *) {
+  if (!recording)
+    return;
+  if (jsonLines) {
+    onPacketJSON(event);
+    return;
+  }
+  switch (event->kind) {
+    case Navien::PACKET_KIND_WATER: {
+      uint8_t len;
+      const uint8_t *payload = navien.waterPayload(event->water->device_number, &len);
+      onWater(event->water);
+      checkBinary<NAVIEN_WATER_FIELDS>(Navien::PACKET_KIND_WATER, event->water->device_number, *event->water,
+                                       payload, len);
+      break;
+    }
+    case Navien::PACKET_KIND_GAS: {
+      uint8_t len;
+      const uint8_t *payload = navien.gasPayload(&len);
+      onGas(event->gas);
+      checkBinary<NAVIEN_GAS_FIELDS>(Navien::PACKET_KIND_GAS, 0, *event->gas, payload, len);
+      break;
+    }
+    case Navien::PACKET_KIND_COMMAND: if (!isLocalTx()) onCommand(event->state); break;
+    case Navien::PACKET_KIND_ANNOUNCE: if (!isLocalTx()) onAnnounce(event->state); break;
+    default: break;
+  }
+}
+
+// Only-on-change subscriber, to show how many packets a change filter skips
+void onChangedPacket(const Navien::PACKET_EVENT *, void *) {}
+
+void onError(const char *function, const char *message, void *) {
+  errorCount++;
+  if (recording && host_serial_echo)
+    fprintf(stderr, "error %s: %s\n", function, message);
+}
+
+bool parseHexLine(const std::string &text, std::vector<uint8_t> &out) {
+  std::string hex = text;
+  size_t key = text.find("\"debug\"");
+  if (key != std::string::npos) {
+    size_t open = text.find('"', text.find(':', key) + 1);
+    size_t close = open == std::string::npos ? open : text.find('"', open + 1);
+    if (close == std::string::npos)
+      return false;
+    hex = text.substr(open + 1, close - open - 1);
+  }
+  std::istringstream in(hex);
+  std::string tok;
+  while (in >> tok) {
+    char *end = nullptr;
+    unsigned long v = strtoul(tok.c_str(), &end, 16);
+    if (*end != '\0' || v > 0xFF)
+      return false;
+    out.push_back((uint8_t)v);
+  }
+  return !out.empty();
+}
+
+uint32_t le32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Binary capture ring export. chunkMs gets each frame's recorded millis().
+bool loadBinaryCapture(const std::string &path, const std::string &data,
+                       std::vector<std::vector<uint8_t>> &chunks, std::vector<uint32_t> &chunkMs) {
+  const uint8_t *p = (const uint8_t *)data.data();
+  size_t size = data.size();
+  if (size < Navien::CAPTURE_HEADER_SIZE || p[4] != Navien::CAPTURE_VERSION) {
+    fprintf(stderr, "%s: unsupported capture version\n", path.c_str());
+    return false;
+  }
+  unsigned count = p[6] | p[7] << 8;
+  unsigned sent = 0;
+  size_t pos = Navien::CAPTURE_HEADER_SIZE;
+  for (unsigned i = 0; i < count; i++) {
+    size_t frame = pos + Navien::CAPTURE_RECORD_SIZE;
+    if (frame + Navien::HDR_SIZE > size ||
+        frame + Navien::HDR_SIZE + p[frame + offsetof(Navien::HEADER, len)] + 1 > size) {
+      fprintf(stderr, "%s: truncated at record %u\n", path.c_str(), i);
+      return false;
+    }
+    size_t len = Navien::HDR_SIZE + p[frame + offsetof(Navien::HEADER, len)] + 1;
+    if (p[pos + 4] & Navien::CAPTURE_TX) {
+      sent++;
+    } else {
+      chunks.emplace_back(p + frame, p + frame + len);
+      chunkMs.push_back(le32(p + pos));
+    }
+    pos = frame + len;
+  }
+  printf("Capture %s: %u records (%u sent by the device skipped), %u evicted before export\n",
+         path.c_str(), count, sent, (unsigned)le32(p + 8));
+  return !chunks.empty();
+}
+
+bool loadCapture(const std::string &path, std::vector<std::vector<uint8_t>> &chunks,
+                 std::vector<uint32_t> &chunkMs) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    fprintf(stderr, "Cannot open capture %s\n", path.c_str());
+    return false;
+  }
+  char magic[4] = {};
+  if (in.read(magic, sizeof(magic)) && memcmp(magic, "NVCP", 4) == 0) {
+    std::string data(magic, sizeof(magic));
+    data.append(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return loadBinaryCapture(path, data, chunks, chunkMs);
+  }
+  in.clear();
+  in.seekg(0);
+  std::string line;
+  int lineNo = 0;
+  while (std::getline(in, line)) {
+    lineNo++;
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos || line[first] == '#')
+      continue;
+    std::vector<uint8_t> bytes;
+    if (!parseHexLine(line, bytes)) {
+      fprintf(stderr, "%s:%d: not a hex byte line, skipped\n", path.c_str(), lineNo);
+      continue;
+    }
+    chunks.push_back(bytes);
+  }
+  return !chunks.empty();
+}
+
+// A chunk is a frame if it starts with the marker and its header length
+// accounts for every byte in the chunk.
+bool isFrame(const std::vector<uint8_t> &c) {
+  return c.size() > Navien::HDR_SIZE && c[0] == Navien::PACKET_MARKER &&
+         c.size() == (size_t)Navien::HDR_SIZE + c[5] + 1;
+}
+
+// Replays the capture with wire timing on the virtual clock.  Chunks go out
+// opt.gapMs apart, or at their recorded times if chunkMs has them.  Returns
+// the worst single Navien::loop() wall time in ns.
+double replay(const std::vector<std::vector<uint8_t>> &chunks, const std::vector<uint32_t> &chunkMs,
+              const Options &opt, size_t &loopCalls) {
+  struct Timed { uint64_t at_us; uint8_t b; };
+  std::vector<Timed> wire;
+  uint64_t t = 1000000;  // start one second in so millis()-based timers are non-zero
+  for (size_t i = 0; i < chunks.size(); i++) {
+    const auto &c = chunks[i];
+    if (i < chunkMs.size()) {
+      // Recorded at the last byte; never earlier than the previous frame ended
+      uint64_t at = 1000000 + (uint64_t)(uint32_t)(chunkMs[i] - chunkMs[0]) * 1000;
+      t = std::max(t, at > c.size() * BYTE_TIME_US ? at - c.size() * BYTE_TIME_US : 0);
+    }
+    for (uint8_t b : c) {
+      wire.push_back({ t, b });
+      t += BYTE_TIME_US;
+    }
+    t += (uint64_t)opt.gapMs * 1000;
+  }
+  const uint64_t end_us = t + 500000;
+
+  navien.setRxBufferSize(opt.rxBuffer);
+  host_clock_us = 1000000;
+  uint64_t nextLoop = host_clock_us;
+  uint64_t nextStall = host_clock_us + 250000;
+  size_t next = 0;
+  double worstNs = 0;
+  loopCalls = 0;
+
+  // Bytes land in the UART buffer at their wire time, loop() runs on its own
+  // schedule in between.
+  while (nextLoop < end_us) {
+    while (next < wire.size() && wire[next].at_us <= nextLoop) {
+      host_clock_us = std::max(host_clock_us, wire[next].at_us);
+      navien.host_inject(&wire[next].b, 1);
+      next++;
+    }
+    host_clock_us = nextLoop;
+    auto t0 = Clock::now();
+    navien.loop();
+    worstNs = std::max(worstNs, nsSince(t0));
+    loopCalls++;
+
+    nextLoop = host_clock_us + (uint64_t)opt.loopMs * 1000;
+    if (opt.stallMs && nextLoop >= nextStall) {
+      nextLoop += (uint64_t)opt.stallMs * 1000;
+      nextStall += 1000000;
+    }
+  }
+  return worstNs;
+}
+
+double percentile(std::vector<double> v, double p) {
+  if (v.empty())
+    return 0;
+  std::sort(v.begin(), v.end());
+  size_t idx = (size_t)(p * (v.size() - 1) + 0.5);
+  return v[idx];
+}
+
+void bench(const std::vector<std::vector<uint8_t>> &chunks, int passes) {
+  std::vector<const std::vector<uint8_t> *> frames, water, gas;
+  size_t frameBytes = 0;
+  for (const auto &c : chunks) {
+    if (!isFrame(c))
+      continue;
+    frames.push_back(&c);
+    frameBytes += c.size();
+    if (c[2] == Navien::PACKET_DIRECTION_STATUS && c[3] >= Navien::PACKET_TYPE_WATER_MIN &&
+        c[3] <= Navien::PACKET_TYPE_WATER_MAX)
+      water.push_back(&c);
+    else if (c[2] == Navien::PACKET_DIRECTION_STATUS && c[3] == Navien::PACKET_TYPE_GAS)
+      gas.push_back(&c);
+  }
+  if (frames.empty()) {
+    printf("bench: capture holds no complete frames\n");
+    return;
+  }
+
+  recording = false;
+  navien.setRxBufferSize(SIZE_MAX);
+  printf("\nParser benchmark: %d passes, %zu frames (%zu water, %zu gas), %zu frame bytes\n",
+         passes, frames.size(), water.size(), gas.size(), frameBytes);
+
+  // Whole-pipeline throughput: everything buffered, drained by loop().
+  std::vector<uint8_t> stream;
+  for (const auto &c : chunks)
+    stream.insert(stream.end(), c.begin(), c.end());
+  double loopNs = 0;
+  for (int p = 0; p < passes; p++) {
+    navien.host_inject(stream.data(), stream.size());
+    auto t0 = Clock::now();
+    while (navien.available()) {
+      navien.loop();
+      host_clock_us += 1000;
+    }
+    loopNs += nsSince(t0);
+  }
+  double streamFrames = (double)passes * frames.size();
+  printf("  loop():          %10.0f frames/s  %10.0f bytes/s\n",
+         streamFrames / (loopNs * 1e-9), (double)passes * stream.size() / (loopNs * 1e-9));
+
+  // Framing: bulk read + marker scan + length/checksum validation of every
+  // chunk, including line noise and corrupt frames.
+  double frameNs = 0;
+  for (int p = 0; p < passes; p++) {
+    for (const auto &c : chunks) {
+      navien.host_inject(c.data(), c.size());
+      auto t0 = Clock::now();
+      const uint8_t *frame;
+      Navien::FRAME_TIMES times;
+      navien.fill_rx_buffer();
+      while (navien.next_frame(&frame, &times))
+        ;
+      frameNs += nsSince(t0);
+    }
+  }
+  printf("  fill+next_frame: %10.1f ns/chunk\n", frameNs / ((double)passes * chunks.size()));
+
+  // parse_packet(): echo filter + dispatch, individually timed for percentiles.
+  std::vector<double> samples;
+  samples.reserve((size_t)passes * frames.size());
+  for (int p = 0; p < passes; p++) {
+    for (const auto *f : frames) {
+      navien.load_frame(*f);
+      auto t0 = Clock::now();
+      navien.parse_packet();
+      samples.push_back(nsSince(t0));
+    }
+  }
+  double sum = 0;
+  for (double s : samples) sum += s;
+  printf("  parse_packet:    %10.1f ns/frame  (p50 %.0f, p99 %.0f, max %.0f ns)\n",
+         sum / samples.size(), percentile(samples, 0.50), percentile(samples, 0.99),
+         percentile(samples, 1.0));
+
+  auto timeParser = [&](const char *name, const std::vector<const std::vector<uint8_t> *> &set,
+                        void (ReplayNavien::*fn)()) {
+    if (set.empty())
+      return;
+    auto t0 = Clock::now();
+    for (int p = 0; p < passes; p++) {
+      for (const auto *f : set) {
+        navien.load_frame(*f);
+        (navien.*fn)();
+      }
+    }
+    printf("  %-16s %10.1f ns/frame\n", name, nsSince(t0) / ((double)passes * set.size()));
+  };
+  timeParser("parse_water:", water, &ReplayNavien::parse_water);
+  timeParser("parse_gas:", gas, &ReplayNavien::parse_gas);
+
+  // What a subscriber pays to keep a snapshot of the state
+  static Navien::NAVIEN_STATE snapshot;
+  auto t0 = Clock::now();
+  for (int p = 0; p < passes * 100; p++) {
+    snapshot = *navien.currentState();
+    __asm__ __volatile__("" : : "r"(&snapshot) : "memory");
+  }
+  printf("  state copy:      %10.1f ns  (NAVIEN_STATE %zu bytes, per unit water %zu bytes)\n",
+         nsSince(t0) / (passes * 100.0), sizeof(Navien::NAVIEN_STATE), sizeof(Navien::NAVIEN_STATE_WATER));
+
+  // The field part of the UDP / Telnet JSON
+  char json[1024];
+  uint8_t len;
+  const uint8_t *payload = navien.waterPayload(0, &len);
+  t0 = Clock::now();
+  for (int p = 0; p < passes * 100; p++) {
+    navienFieldsToJSON<NAVIEN_WATER_FIELDS>(navien.currentState()->water[0], payload, len, json, sizeof(json));
+    __asm__ __volatile__("" : : "r"(json) : "memory");
+  }
+  double waterJsonNs = nsSince(t0) / (passes * 100.0);
+  size_t waterJsonLen = strlen(json);
+  payload = navien.gasPayload(&len);
+  t0 = Clock::now();
+  for (int p = 0; p < passes * 100; p++) {
+    navienFieldsToJSON<NAVIEN_GAS_FIELDS>(navien.currentState()->gas, payload, len, json, sizeof(json));
+    __asm__ __volatile__("" : : "r"(json) : "memory");
+  }
+  printf("  JSON fields:     %10.1f ns water (%zu bytes), %.1f ns gas (%zu bytes)\n",
+         waterJsonNs, waterJsonLen, nsSince(t0) / (passes * 100.0), strlen(json));
+
+  // Whole records as broadcast, through the one fixed buffer
+  const Navien::NAVIEN_STATE *state = navien.currentState();
+  double recordNs[4];
+  const char *names[4] = {"water", "command", "cascade", "busstats"};
+  for (int r = 0; r < 4; r++) {
+    t0 = Clock::now();
+    for (int p = 0; p < passes * 100; p++) {
+      switch (r) {
+        case 0: writeWaterJSON(telemetry, &navien, &state->water[0]); break;
+        case 1: writeCommandJSON(telemetry, &navien, state); break;
+        case 2: writeCascadeJSON(telemetry, &navien, &state->cascade); break;
+        case 3: writeBusStatsJSON(telemetry, &navien); break;
+      }
+      __asm__ __volatile__("" : : "r"(jsonBuffer) : "memory");
+    }
+    recordNs[r] = nsSince(t0) / (passes * 100.0);
+  }
+  printf("  JSON records:   ");
+  for (int r = 0; r < 4; r++)
+    printf("%s %.1f ns %s", r ? "," : "", recordNs[r], names[r]);
+  printf(", no heap\n");
+
+  // The whole binary datagram of the same packets
+  uint8_t datagram[navienBinarySize(NAVIEN_WATER_FIELDS)];
+  size_t datagramLen = 0;
+  payload = navien.waterPayload(0, &len);
+  t0 = Clock::now();
+  for (int p = 0; p < passes * 100; p++) {
+    datagramLen = navienFieldsToBinary<NAVIEN_WATER_FIELDS>(Navien::PACKET_KIND_WATER, 0, 0, 0, p,
+                                                            navien.currentState()->water[0], payload, len,
+                                                            datagram, sizeof(datagram));
+    __asm__ __volatile__("" : : "r"(datagram) : "memory");
+  }
+  double waterBinaryNs = nsSince(t0) / (passes * 100.0);
+  size_t waterBinaryLen = datagramLen;
+  payload = navien.gasPayload(&len);
+  t0 = Clock::now();
+  for (int p = 0; p < passes * 100; p++) {
+    datagramLen = navienFieldsToBinary<NAVIEN_GAS_FIELDS>(Navien::PACKET_KIND_GAS, 0, 0, 0, p,
+                                                          navien.currentState()->gas, payload, len,
+                                                          datagram, sizeof(datagram));
+    __asm__ __volatile__("" : : "r"(datagram) : "memory");
+  }
+  printf("  binary datagram: %10.1f ns water (%zu bytes), %.1f ns gas (%zu bytes)\n",
+         waterBinaryNs, waterBinaryLen, nsSince(t0) / (passes * 100.0), datagramLen);
+
+  // UDP duplicate check per status packet.  Before: the broadcaster hex-
+  // formatted every packet into a String, strcmp()ed it against the last one
+  // of its type and copied it back.  The String is modelled on Arduino's,
+  // which reallocates to the exact length on every append past its inline
+  // buffer.  After: the parser's change mask decides, and the hex is built
+  // once, with formatHex() straight into the record, for packets that go out
+  // with udpRawHex on.
+  std::vector<bool> changed;
+  {
+    std::vector<std::vector<uint8_t>> last(512);
+    for (const auto *f : frames) {
+      auto &prev = last[((*f)[2] & 1) << 8 | (*f)[3]];
+      changed.push_back(prev != *f);
+      prev = *f;
+    }
+  }
+  static char prevHex[512][3 * sizeof(Navien::PACKET_BUFFER::raw_data) + 1];
+  size_t allocs = 0, sent = 0;
+  t0 = Clock::now();
+  for (int p = 0; p < passes; p++) {
+    for (const auto *f : frames) {
+      char inlineBuf[16];
+      char *s = inlineBuf;
+      size_t slen = 0, cap = sizeof(inlineBuf) - 1;
+      auto append = [&](const char *t, size_t n) {
+        if (slen + n > cap) {
+          char *grown = (char *)realloc(s == inlineBuf ? NULL : s, slen + n + 1);
+          if (s == inlineBuf)
+            memcpy(grown, inlineBuf, slen);
+          s = grown;
+          cap = slen + n;
+          allocs++;
+        }
+        memcpy(s + slen, t, n);
+        s[slen += n] = 0;
+      };
+      for (uint8_t b : *f) {
+        char digits[3];
+        if (b < 0x10)
+          append("0", 1);
+        append(digits, snprintf(digits, sizeof(digits), "%x", b));
+        append(" ", 1);
+      }
+      for (size_t i = 0; i < slen; i++)
+        s[i] = toupper((unsigned char)s[i]);
+      char *prev = prevHex[((*f)[2] & 1) << 8 | (*f)[3]];
+      if (strcmp(s, prev) != 0) {
+        strncpy(prev, s, sizeof(prevHex[0]) - 1);
+        sent++;
+      }
+      if (s != inlineBuf)
+        free(s);
+    }
+  }
+  double beforeNs = nsSince(t0) / ((double)passes * frames.size());
+  double beforeAllocs = (double)allocs / ((double)passes * frames.size());
+  double dupPct = 100.0 - 100.0 * sent / ((double)passes * frames.size());
+
+  t0 = Clock::now();
+  for (int p = 0; p < passes; p++) {
+    for (size_t i = 0; i < frames.size(); i++) {
+      if (!changed[i])
+        continue;
+      telemetry.begin("water", 0);
+      telemetry.hex(frames[i]->data(), frames[i]->size());
+      __asm__ __volatile__("" : : "r"(jsonBuffer) : "memory");
+    }
+  }
+  printf("  UDP dedup:       %10.1f ns/frame, %.1f allocs/frame before; %.1f ns/frame, no allocations after"
+         " (%.0f%% duplicates)\n",
+         beforeNs, beforeAllocs, nsSince(t0) / ((double)passes * frames.size()), dupPct);
+  recording = true;
+}
+
+int compareGolden(const std::string &path) {
+  std::ifstream in(path);
+  if (!in) {
+    fprintf(stderr, "Cannot open golden file %s\n", path.c_str());
+    return 1;
+  }
+  std::vector<std::string> expected;
+  std::string line;
+  while (std::getline(in, line))
+    expected.push_back(line);
+
+  int mismatches = 0;
+  size_t n = std::max(expected.size(), stateLines.size());
+  for (size_t i = 0; i < n; i++) {
+    const std::string &want = i < expected.size() ? expected[i] : std::string("<missing>");
+    const std::string &got = i < stateLines.size() ? stateLines[i] : std::string("<missing>");
+    if (want != got) {
+      if (mismatches++ < 10)
+        printf("MISMATCH line %zu\n  expected: %s\n  got:      %s\n", i + 1, want.c_str(), got.c_str());
+    }
+  }
+  printf("%s  golden %s (%zu lines, %d mismatch%s)\n", mismatches ? "FAILED" : "PASSED",
+         path.c_str(), expected.size(), mismatches, mismatches == 1 ? "" : "es");
+  return mismatches ? 1 : 0;
+}
+
+// One BEHAVIOR_SPEC row per descriptor, bytes counted from the packet marker
+template <typename STATE, size_t N>
+void printFields(const char *title, const NAVIEN_FIELD<STATE> (&fields)[N]) {
+  printf("**%s**\n\n| Field | Byte | Type | Unit |\n|---|---|---|---|\n", title);
+  for (const auto &f : fields) {
+    char bytes[16] = "—";
+    if (f.width == 1)
+      snprintf(bytes, sizeof(bytes), "%u", (unsigned)(Navien::HDR_SIZE + f.offset));
+    else if (f.width > 1)
+      snprintf(bytes, sizeof(bytes), "%u–%u", (unsigned)(Navien::HDR_SIZE + f.offset),
+               (unsigned)(Navien::HDR_SIZE + f.offset + f.width - 1));
+    char type[32];
+    if (f.scale != FIELD_INT)
+      snprintf(type, sizeof(type), "float (1 dp)");
+    else if (f.mask && f.mask != 0xFF)
+      snprintf(type, sizeof(type), "int (0/1), mask `0x%02X`", f.mask);
+    else if (f.mask || (!f.store && f.load && f.width))
+      snprintf(type, sizeof(type), "int (0/1)");
+    else
+      snprintf(type, sizeof(type), "int");
+    printf("| `%s` | %s | %s | %s |\n", f.key, bytes, type, *f.unit ? f.unit : "");
+  }
+  printf("\n");
+}
+
+// The field lists navien_listener.py decodes binary datagrams with, between
+// the markers it keeps them in; make test checks that they match.
+template <typename STATE, size_t N>
+void printPyFields(const char *name, const NAVIEN_FIELD<STATE> (&fields)[N]) {
+  printf("%s = [\n", name);
+  for (const auto &f : fields)
+    printf("    ('%s', %s),\n", f.key, f.scale == FIELD_HALF ? "HALF" : f.scale == FIELD_TENTH ? "TENTH" : "INT");
+  printf("]\n");
+}
+
+// Same columns as the Telnet unknowns command, decoded bytes included
+template <typename STATE, size_t N>
+void printPayloadStats(Navien::PacketKind kind, const NAVIEN_FIELD<STATE> (&fields)[N]) {
+  const Navien::PAYLOAD_STATS *stats = navien.payloadStats(kind);
+  uint32_t idle = stats->packets - stats->active_packets;
+  printf("%s payload: %u packets, %u with %s\n", kind == Navien::PACKET_KIND_WATER ? "Water" : "Gas",
+         (unsigned)stats->packets, (unsigned)stats->active_packets, stats->reference);
+  printf("  %4s %-30s %3s %3s %4s %5s %8s %5s %11s\n",
+         "Byte", "Field", "Min", "Max", "Last", "Dist", "Changes", "Flips", "Mean on/off");
+  for (uint8_t i = 0; i < stats->len; i++) {
+    const Navien::BYTE_STATS &b = stats->bytes[i];
+    const char *field = navienFieldAt(fields, i);
+    unsigned flipped = 0;
+    for (int bit = 0; bit < 8; bit++)
+      flipped |= b.bit_flips[bit] ? 1 << bit : 0;
+    printf("  %4u %-30s %3u %3u %4u %5u %8u  0x%02X %5.1f/%-5.1f\n", (unsigned)(Navien::HDR_SIZE + i),
+           field ? field : "", b.min, b.max, b.last, Navien::distinctValues(b.sketch), (unsigned)b.changes,
+           flipped, stats->active_packets ? (double)b.sum_active / stats->active_packets : 0.0,
+           idle ? (double)b.sum_idle / idle : 0.0);
+  }
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: navien_replay [options] <capture>\n"
+          "  --golden FILE        compare decoded state lines with FILE\n"
+          "  --write-golden FILE  write decoded state lines to FILE\n"
+          "  --write-capture FILE write the capture ring export to FILE after the replay\n"
+          "  --bench N            run the parser benchmark with N passes\n"
+          "  --rx-buffer BYTES    simulated UART RX buffer size (default 1024)\n"
+          "  --loop-ms MS         interval between loop() calls (default 5)\n"
+          "  --stall-ms MS        one stall of MS per second, like a slow homeSpan.poll()\n"
+          "  --gap-ms MS          bus idle time between capture lines (default 20)\n"
+          "  --rx-task            frame packets on the UART event task (beginRxTask())\n"
+          "  --fields             print the water and gas JSON field tables and exit\n"
+          "  --py-fields          print the field lists of navien_listener.py and exit\n"
+          "  --unknowns           print payload byte statistics after the replay\n"
+          "  --json               record the JSON records the device sends instead of state lines\n"
+          "  --json-baseline      as --json, recording the baseline serializer's records\n"
+          "  -v                   print decoded state lines and errors\n");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    auto value = [&]() -> const char * {
+      if (i + 1 >= argc) {
+        usage();
+        exit(2);
+      }
+      return argv[++i];
+    };
+    if (a == "--golden") opt.golden = value();
+    else if (a == "--write-golden") opt.writeGolden = value();
+    else if (a == "--write-capture") opt.writeCapture = value();
+    else if (a == "--bench") opt.benchPasses = atoi(value());
+    else if (a == "--rx-buffer") opt.rxBuffer = (size_t)atol(value());
+    else if (a == "--loop-ms") opt.loopMs = (unsigned)atoi(value());
+    else if (a == "--stall-ms") opt.stallMs = (unsigned)atoi(value());
+    else if (a == "--gap-ms") opt.gapMs = (unsigned)atoi(value());
+    else if (a == "--rx-task") opt.rxTask = true;
+    else if (a == "--fields") opt.fields = true;
+    else if (a == "--py-fields") opt.pyFields = true;
+    else if (a == "--unknowns") opt.unknowns = true;
+    else if (a == "--json") opt.json = true;
+    else if (a == "--json-baseline") opt.json = opt.jsonBaseline = true;
+    else if (a == "-v") opt.verbose = true;
+    else if (!a.empty() && a[0] == '-') { usage(); return 2; }
+    else opt.capture = a;
+  }
+  if (opt.fields) {
+    printFields("Water packet", NAVIEN_WATER_FIELDS);
+    printFields("Gas packet", NAVIEN_GAS_FIELDS);
+    return 0;
+  }
+  if (opt.pyFields) {
+    printf("# BEGIN navien_replay --py-fields\n");
+    printPyFields("WATER_FIELDS", NAVIEN_WATER_FIELDS);
+    printPyFields("GAS_FIELDS", NAVIEN_GAS_FIELDS);
+    printf("# END navien_replay --py-fields\n");
+    return 0;
+  }
+  if (opt.capture.empty()) {
+    usage();
+    return 2;
+  }
+
+  std::vector<std::vector<uint8_t>> chunks;
+  std::vector<uint32_t> chunkMs;
+  if (!loadCapture(opt.capture, chunks, chunkMs))
+    return 2;
+  host_serial_echo = opt.verbose;
+  jsonLines = opt.json;
+  jsonBaseline = opt.jsonBaseline;
+
+  // Registered lowest priority first so the table has to sort them
+  navien.subscribe("changed", onChangedPacket, NULL, Navien::PACKET_KIND_WATER | Navien::PACKET_KIND_GAS, -1, true);
+  navien.subscribe("golden", onPacket, NULL, Navien::PACKET_KIND_ALL);
+  navien.onError(onError);
+  navien.begin(16, 17);
+  if (opt.rxTask)
+    navien.beginRxTask();
+
+  size_t bytes = 0, frames = 0;
+  for (const auto &c : chunks) {
+    bytes += c.size();
+    frames += isFrame(c) ? 1 : 0;
+  }
+
+  size_t loopCalls = 0;
+  double worstLoopNs = replay(chunks, chunkMs, opt, loopCalls);
+  size_t numberMismatches = 0;
+  if (jsonLines) {
+    recordJSONCases();
+    numberMismatches = checkJSONNumbers();
+  }
+  if (opt.verbose)
+    for (const auto &l : stateLines)
+      printf("%s\n", l.c_str());
+
+  printf("Replayed %s: %zu chunks, %zu frames, %zu bytes\n", opt.capture.c_str(), chunks.size(),
+         frames, bytes);
+  printf("  recorded: %zu  errors: %zu  loop() calls: %zu  worst loop(): %.0f ns\n",
+         stateLines.size(), errorCount, loopCalls, worstLoopNs);
+  printf("  RX buffer: %zu bytes, %zu bytes dropped on overflow (loop %u ms, stall %u ms/s)\n",
+         opt.rxBuffer, navien.host_rx_overflow, opt.loopMs, opt.stallMs);
+  const Navien::RX_STATS *rx = navien.rxStats();
+  printf("  %s: %u packets, latency avg %.1f ms max %.1f ms, %u framing errors, %u UART overflows",
+         opt.rxTask ? "RX task" : "RX in loop()", (unsigned)rx->packets,
+         rx->packets ? rx->latency_total_us / 1000.0 / rx->packets : 0.0,
+         rx->latency_max_us / 1000.0, (unsigned)rx->framing_errors, (unsigned)rx->uart_overflows);
+  if (opt.rxTask)
+    printf(", queue drops %u high water %u", (unsigned)rx->queue_drops, (unsigned)rx->queue_high_water);
+  printf("\n");
+  printf("  frame times p99: UART wait <%u us, buffer wait <%u us, complete->dispatch <%u us, gap <%u us\n",
+         (unsigned)Navien::histogramPercentile(rx->uart_wait_hist, 99),
+         (unsigned)Navien::histogramPercentile(rx->buffer_wait_hist, 99),
+         (unsigned)Navien::histogramPercentile(rx->latency_hist, 99),
+         (unsigned)Navien::histogramPercentile(rx->frame_gap_hist, 99));
+  const Navien::BUS_STATS *bus = navien.busStats();
+  printf("  bus: %u checksum errors, %u resyncs, %u oversize, %u invalid length, %u echo suppressed, "
+         "UART high water %u bytes, parse p99 <%u us\n",
+         (unsigned)bus->checksum_errors, (unsigned)bus->resyncs, (unsigned)bus->oversize_drops,
+         (unsigned)bus->invalid_length, (unsigned)bus->echo_suppressed, (unsigned)bus->uart_high_water,
+         (unsigned)Navien::histogramPercentile(bus->parse_hist, 99));
+  const Navien::ERROR_STATS *es = navien.errorStats();
+  printf("  error reports: %u passed on, %u rate limited\n", (unsigned)es->reported, (unsigned)es->suppressed);
+  const Navien::TX_STATS *tx = navien.txStats();
+  printf("  gap model: %u samples, after water %u ms after gas %u ms, error avg %.1f ms over %u predictions\n",
+         (unsigned)tx->gap_samples, (unsigned)navien.predictedGapMs(false), (unsigned)navien.predictedGapMs(true),
+         tx->gap_predictions ? (double)tx->gap_error_total_ms / tx->gap_predictions : 0.0,
+         (unsigned)tx->gap_predictions);
+  printf("  binary: %zu datagrams, %zu bytes against %zu bytes of JSON fields, %zu mismatches; "
+         "deltas: %zu datagrams, %zu bytes, %zu bytes of JSON fields\n",
+         binaryPackets, binaryBytes, jsonBytes, binaryMismatches, deltaPackets, deltaBytes, deltaJsonBytes);
+  if (jsonLines)
+    printf("  JSON: %zu records, %zu differ from the baseline serializer's, %zu in the exact accumulated totals only\n",
+           jsonRecords, jsonMismatches, jsonExactTotals);
+  printf("  subscribers:");
+  for (size_t i = 0; i < navien.subscriberCount(); i++)
+    printf(" %s %u calls", navien.subscriberInfo(i)->name, (unsigned)navien.subscriberInfo(i)->calls);
+  printf("\n");
+
+  if (opt.unknowns) {
+    printPayloadStats(Navien::PACKET_KIND_WATER, NAVIEN_WATER_FIELDS);
+    printPayloadStats(Navien::PACKET_KIND_GAS, NAVIEN_GAS_FIELDS);
+  }
+
+  int rc = 0;
+  if (!opt.writeGolden.empty()) {
+    std::ofstream out(opt.writeGolden);
+    for (const auto &l : stateLines)
+      out << l << "\n";
+    printf("Wrote %zu lines to %s\n", stateLines.size(), opt.writeGolden.c_str());
+  }
+  if (!opt.writeCapture.empty()) {
+    std::ofstream out(opt.writeCapture, std::ios::binary);
+    navien.captureExport([](const uint8_t *data, size_t len, void *context) {
+      ((std::ofstream *)context)->write((const char *)data, len);
+    }, &out);
+    printf("Wrote %zu capture records (%zu bytes) to %s\n", navien.captureCount(),
+           navien.captureExportSize(), opt.writeCapture.c_str());
+  }
+  if (!opt.golden.empty())
+    rc = compareGolden(opt.golden);
+  if (binaryMismatches || jsonMismatches || numberMismatches)
+    rc = 1;
+
+  if (opt.benchPasses > 0)
+    bench(chunks, opt.benchPasses);
+
+  return rc;
+}
@@ -0,0 +1,815 @@
+// Host-side virtual Navien heater for end-to-end control-mode tests.
+//
+// Runs the real Navien.cpp (as NavienManager does, without a NaviLink) on a
+// simulated RS485 bus shared with a heater model:
+//   - the heater sends water packets for 1-8 cascaded units and a gas packet
+//     on a fixed cadence, with the same framing and checksums as a real unit,
+//     and applies the CONTROL_COMMAND packets it receives intact;
+//   - an optional fake NaviLink announces for the first seconds of the run,
+//     so Navien has to detect it leaving and take the bus over;
+//   - transmissions that overlap in time garble each other, and optional
+//     noise corrupts heater frames and drops junk bytes between them.
+// Every cascade event is checked against totals recomputed from water[].
+// Navien hears everything on the wire, its own bytes included, like the
+// half-duplex transceiver.  A driver issues power / set point /
+// recirculation / hot button commands and times them to onCommandComplete(),
+// so the run doubles as a command latency and throughput benchmark.
+// With --buses, independent heaters each get their own bus and Navien
+// instance, all served from one loop as NavienManager does, and the host
+// CPU time spent in each loop() is reported.  --draw adds hot water use,
+// so the water packets change the way they do with flow.  --batch-ms runs
+// the UDP broadcaster's throttle over the packets and reports its datagram
+// and byte rate with and without a UdpBatch window.  --subscribe offers the
+// same records to a UdpSubscribers table instead and reports what each
+// subscriber receives.
+//
+// Build and run (from host/):
+//   make navien_sim
+//   ./navien_sim --seconds 120
+//   ./navien_sim --units 8 --gap-ms 20 --noise-pct 5 --navilink-s 10
+//   ./navien_sim --buses 2 --gap-ms 10
+//   ./navien_sim --units 4 --gap-ms 30 --draw --batch-ms 500
+//   ./navien_sim --draw --subscribe to=10.0.0.2 --subscribe "to=10.0.0.3 interval=10000"
+//   ./navien_sim --check      exit 1 unless every command was confirmed
+
+#include <Arduino.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Navien.h"
+#include "NavienFields.h"
+#include "UdpBatch.h"
+#include "UdpSubscribers.h"
+
+namespace {
+
+constexpr uint64_t BYTE_TIME_US = Navien::BYTE_TIME_US;
+constexpr unsigned MAX_BUSES = 4;
+
+struct Options {
+  unsigned seconds = 120;
+  unsigned units = 1;           // cascaded units, 1-8
+  unsigned gapMs = 60;          // heater idle time between its packets
+  unsigned jitterMs = 6;        // +/- on every gap
+  unsigned loopMs = 1;          // interval between Navien::loop() calls
+  unsigned noisePct = 0;        // heater frames corrupted, and gaps with junk bytes
+  unsigned navilinkS = 0;       // fake NaviLink announces for this long
+  unsigned navilinkMs = 500;    // between its announces
+  unsigned commandMs = 3000;    // between driver commands
+  unsigned reactMs = 20;        // heater delay before a command shows in its packets
+  unsigned buses = 1;           // independent heater systems, 1-MAX_BUSES
+  bool draw = false;            // hot water use, 20 s in every minute
+  unsigned batchMs = 0;         // UDP batch window to compare; 0 for no UDP model
+  std::vector<UdpSubscribers::REQUEST> subscribe;  // UDP subscribers to model
+  uint32_t seed = 1;
+  bool check = false;
+  bool verbose = false;
+};
+
+enum Source : uint8_t { SRC_HEATER, SRC_NAVILINK, SRC_NAVIEN, SRC_NOISE };
+const char *const SOURCE_NAMES[] = { "heater", "navilink", "navien", "noise" };
+
+// One transmission on the bus
+struct Frame {
+  Source src;
+  uint64_t start_us;
+  std::vector<uint8_t> bytes;
+  bool collided = false;
+  uint64_t end_us() const { return start_us + bytes.size() * BYTE_TIME_US; }
+};
+
+// Heater state for one unit, as raw protocol bytes
+struct Unit {
+  bool power = true;
+  uint8_t set_temp = 0x5E;       // 47.0 C
+  bool recirc_active = false;
+  uint64_t recirc_running_until_us = 0;
+};
+
+// Navien.cpp is the code under test; checksum() is needed to build frames
+class SimNavien : public Navien {
+public:
+  SimNavien(uint8_t uart_nr, uint8_t bus_id) : Navien(uart_nr, bus_id) {}
+  using Navien::checksum;
+};
+
+Options opt;
+uint32_t rng;
+
+uint32_t random32() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+unsigned randomBelow(unsigned n) { return n ? random32() % n : 0; }
+
+// Idle water and gas frames from captures/sample.hex, used as templates
+const uint8_t WATER_TEMPLATE[] = {
+  0xF7, 0x05, 0x50, 0x50, 0x90, 0x22, 0x42, 0x00, 0x00, 0x05, 0x14, 0x5E, 0x5A, 0x28, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0xA0, 0xBE, 0x00, 0x20, 0x0A, 0x00, 0x00, 0x00, 0x12, 0x03, 0x00, 0x01, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x22
+};
+const uint8_t GAS_TEMPLATE[] = {
+  0xF7, 0x05, 0x50, 0x0F, 0x90, 0x2A, 0x45, 0x00, 0x0B, 0x01, 0x05, 0x02, 0x03, 0x01, 0x5E, 0x5A, 0x28,
+  0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x40, 0xE2, 0x01, 0x00, 0x4C, 0x04, 0xE1, 0x10, 0x3F, 0xB4,
+  0x96, 0x00, 0xEE, 0x0C, 0x00, 0x00, 0x00, 0x00, 0xAA, 0x48, 0x00, 0x00, 0x01, 0x00, 0xD0
+};
+
+class Heater {
+public:
+  Unit units[MAX_DEVICES];
+  // Commands received intact, applied once reactMs has passed
+  struct Pending { uint64_t at_us; Navien::CMD_DATA cmd; };
+  std::deque<Pending> pending;
+  size_t nextPacket = 0;        // 0..units-1 water, then gas
+  uint64_t nextAt_us = 0;
+  uint32_t commandsApplied = 0;
+
+  // Build the next status frame in the cycle
+  std::vector<uint8_t> next(uint64_t now_us) {
+    Navien::PACKET_BUFFER pkt{};
+    size_t len;
+    if (nextPacket < opt.units) {
+      const Unit &u = units[nextPacket];
+      bool running = now_us < u.recirc_running_until_us || u.recirc_active;
+      memcpy(pkt.raw_data, WATER_TEMPLATE, sizeof(WATER_TEMPLATE));
+      pkt.hdr.packet_type = Navien::PACKET_TYPE_WATER_MIN + nextPacket;
+      pkt.water.system_power = u.power ? 0x05 : 0x00;
+      pkt.water.set_temp = u.set_temp;
+      pkt.water.flow_state = running ? 0x08 : 0x00;
+      pkt.water.system_stage = running ? 0x33 : 0x14;
+      // Later units in the cascade fire harder, so the totals differ per unit
+      pkt.water.operating_capacity = running ? 40 + 10 * nextPacket : 0;
+      pkt.water.water_flow = running ? 25 : 0;
+      pkt.water.recirculation_enabled = u.recirc_active ? 0x02 : 0x00;
+      // A tap is open: flow, outlet temperature and firing rate wander
+      if (opt.draw && u.power && now_us / 1000000 % 60 < 20) {
+        pkt.water.flow_state |= 0x20;
+        pkt.water.system_stage = 0x33;
+        pkt.water.water_flow = 40 + randomBelow(20);
+        pkt.water.outlet_temp = u.set_temp - randomBelow(3);
+        pkt.water.operating_capacity = 30 + randomBelow(40);
+      }
+      len = sizeof(WATER_TEMPLATE);
+    } else {
+      memcpy(pkt.raw_data, GAS_TEMPLATE, sizeof(GAS_TEMPLATE));
+      pkt.gas.set_temp = units[0].set_temp;
+      len = sizeof(GAS_TEMPLATE);
+    }
+    pkt.raw_data[len - 1] = SimNavien::checksum(pkt.raw_data, len - 1, Navien::CHECKSUM_SEED_4B);
+    nextPacket = (nextPacket + 1) % (opt.units + 1);
+    return std::vector<uint8_t>(pkt.raw_data, pkt.raw_data + len);
+  }
+
+  // A control frame finished on the wire
+  void receive(const Frame &f) {
+    if (f.collided || f.bytes.size() != (size_t)Navien::HDR_SIZE + sizeof(Navien::CMD_DATA) + 1)
+      return;
+    const uint8_t *raw = f.bytes.data();
+    if (raw[2] != Navien::PACKET_DIRECTION_CONTROL || raw[Navien::HDR_SIZE] != Navien::CONTROL_COMMAND ||
+        SimNavien::checksum(raw, f.bytes.size() - 1, Navien::CHECKSUM_SEED_62) != raw[f.bytes.size() - 1])
+      return;
+    Pending p;
+    p.at_us = f.end_us() + (uint64_t)opt.reactMs * 1000;
+    memcpy(&p.cmd, raw + Navien::HDR_SIZE, sizeof(p.cmd));
+    pending.push_back(p);
+  }
+
+  // The cascade master passes commands on to every unit
+  void react(uint64_t now_us) {
+    while (!pending.empty() && pending.front().at_us <= now_us) {
+      const Navien::CMD_DATA &cmd = pending.front().cmd;
+      for (unsigned i = 0; i < opt.units; i++) {
+        Unit &u = units[i];
+        if (cmd.system_power == Navien::SYSTEM_POWER_ON) u.power = true;
+        if (cmd.system_power == Navien::SYSTEM_POWER_OFF) u.power = false;
+        if (cmd.set_temp) u.set_temp = cmd.set_temp;
+        if (cmd.hot_button_recirculation == Navien::RECIRCULATION_ON) u.recirc_active = true;
+        if (cmd.hot_button_recirculation == Navien::RECIRCULATION_OFF) u.recirc_active = false;
+        if (cmd.hot_button_recirculation == Navien::HOT_BUTTON_DOWN)
+          u.recirc_running_until_us = now_us + 60 * 1000000ULL;
+      }
+      commandsApplied++;
+      pending.pop_front();
+    }
+  }
+};
+
+// One heater system: its wire, the heater on it and the Navien under test
+struct Bus {
+  explicit Bus(uint8_t id) : navien(id ? 1 : 2, id) {}
+
+  SimNavien navien;
+  Heater heater;
+  std::vector<Frame> frames;      // on the wire or still to be delivered
+  size_t delivered = 0;           // frames[] before this are fully delivered
+  size_t deliveredBytes = 0;      // bytes of frames[delivered] already delivered
+  uint32_t framesSent[4] = {};
+  uint32_t framesCollided[4] = {};
+  uint64_t busyUs = 0;
+  size_t txSeen = 0;              // navien.host_tx bytes already on the wire
+  uint64_t nextNavilink_us = 0;
+  uint64_t nextCommand_us = 0;
+  unsigned commandsIssued = 0;
+
+  // Driver: issue times per command kind, completion latencies
+  uint64_t issuedAt_us[Navien::SEND_ANNOUNCE] = {};
+  std::vector<double> latenciesMs;
+  uint32_t results[4] = {};
+
+  // The incrementally kept cascade totals must match a full recount
+  uint32_t cascadeEvents = 0;
+  uint32_t cascadeMismatches = 0;
+  // Events handed over by another bus's Navien
+  uint32_t foreignEvents = 0;
+  // Rate-limited errors, summed from the "N more suppressed" of the reports
+  uint32_t suppressedReported = 0;
+
+  // Host CPU time in navien.loop()
+  double loopNs = 0;
+
+  // UDP model: the broadcaster's forced re-broadcast
+  bool forceWater[MAX_DEVICES] = {};
+  bool forceGas = false;
+  uint32_t forcedMs = 0;
+
+  void transmit(Source src, uint64_t start_us, std::vector<uint8_t> bytes);
+  bool busBusy(uint64_t t_us) const;
+  void deliver(uint64_t now_us);
+  void issueCommand(unsigned n);
+};
+
+void Bus::transmit(Source src, uint64_t start_us, std::vector<uint8_t> bytes) {
+  Frame f;
+  f.src = src;
+  f.start_us = start_us;
+  f.bytes = std::move(bytes);
+  busyUs += f.bytes.size() * BYTE_TIME_US;
+  framesSent[src]++;
+  // Anything on the wire at the same time is garbled, and garbles this
+  for (size_t i = delivered; i < frames.size(); i++) {
+    Frame &o = frames[i];
+    if (o.start_us < f.end_us() && f.start_us < o.end_us()) {
+      if (!o.collided) framesCollided[o.src]++;
+      if (!f.collided) framesCollided[f.src]++;
+      o.collided = f.collided = true;
+      for (auto &b : o.bytes) b ^= 0x5A;
+      for (auto &b : f.bytes) b ^= 0xA5;
+    }
+  }
+  // Keep frames[] in start order; a junk burst can be placed ahead of now
+  auto pos = std::upper_bound(frames.begin() + delivered, frames.end(), f.start_us,
+                              [](uint64_t t, const Frame &o) { return t < o.start_us; });
+  frames.insert(pos, std::move(f));
+}
+
+// Something is on the wire at t_us
+bool Bus::busBusy(uint64_t t_us) const {
+  for (size_t i = delivered; i < frames.size(); i++)
+    if (frames[i].start_us <= t_us && t_us < frames[i].end_us())
+      return true;
+  return false;
+}
+
+// Hand Navien every byte whose last bit is on the wire by now_us; frames
+// that end reach the heater.
+void Bus::deliver(uint64_t now_us) {
+  while (delivered < frames.size()) {
+    Frame &f = frames[delivered];
+    size_t due = f.start_us >= now_us ? 0 : std::min(f.bytes.size(), (size_t)((now_us - f.start_us) / BYTE_TIME_US));
+    if (due > deliveredBytes) {
+      navien.host_inject(f.bytes.data() + deliveredBytes, due - deliveredBytes);
+      deliveredBytes = due;
+    }
+    if (deliveredBytes < f.bytes.size())
+      break;
+    if (f.src != SRC_HEATER)
+      heater.receive(f);
+    delivered++;
+    deliveredBytes = 0;
+  }
+  // Keep the vector short on long runs
+  if (delivered > 1024) {
+    frames.erase(frames.begin(), frames.begin() + delivered);
+    delivered = 0;
+  }
+}
+
+void onCommandComplete(Navien::SendKind kind, uint8_t arg, Navien::CommandResult result, void *context) {
+  Bus &bus = *(Bus *)context;
+  bus.results[result]++;
+  if (result == Navien::COMMAND_CONFIRMED)
+    bus.latenciesMs.push_back((host_clock_us - bus.issuedAt_us[kind]) / 1000.0);
+  if (opt.verbose)
+    printf("%9.3f s  bus %u %s(%u) result %d\n", host_clock_us / 1e6, bus.navien.busId(),
+           Navien::sendKindName(kind), arg, (int)result);
+}
+
+void onCascade(const Navien::PACKET_EVENT *event, void *context) {
+  Bus &bus = *(Bus *)context;
+  if (event->bus != &bus.navien)
+    bus.foreignEvents++;
+  const Navien::NAVIEN_STATE *s = event->state;
+  Navien::NAVIEN_STATE_CASCADE sum{};
+  for (unsigned i = 0; i < MAX_DEVICES; i++) {
+    const Navien::NAVIEN_STATE_WATER &w = s->water[i];
+    if (!w.sequence)
+      continue;
+    sum.units++;
+    sum.flow_raw += w.flow_raw;
+    sum.capacity_raw += w.capacity_raw;
+    sum.units_firing += w.capacity_raw > 0;
+    sum.units_recirculating += w.recirculation_running;
+    sum.units_consuming += w.consumption_active;
+  }
+  const Navien::NAVIEN_STATE_CASCADE &c = *event->cascade;
+  bus.cascadeEvents++;
+  if (c.units != sum.units || c.flow_raw != sum.flow_raw || c.capacity_raw != sum.capacity_raw ||
+      c.units_firing != sum.units_firing || c.units_recirculating != sum.units_recirculating ||
+      c.units_consuming != sum.units_consuming) {
+    bus.cascadeMismatches++;
+    if (opt.verbose)
+      printf("%9.3f s  bus %u cascade mismatch: units %u/%u flow %u/%u capacity %u/%u\n", host_clock_us / 1e6,
+             bus.navien.busId(), c.units, sum.units, c.flow_raw, sum.flow_raw, c.capacity_raw, sum.capacity_raw);
+  }
+}
+
+// One UDP format sent twice, a datagram per record and through a batch
+// window.  Each stream is kept whole, datagrams joined by the separator, so
+// the two can be compared record for record.
+struct UdpModel {
+  struct Datagrams {
+    std::string text;
+    size_t largest = 0;
+    char separator;
+  } unbatchedOut, batchedOut;
+  UdpBatch unbatched, batched;
+
+  UdpModel(char separator)
+      : unbatchedOut{"", 0, separator}, batchedOut{"", 0, separator}, unbatched(onDatagram, &unbatchedOut, separator),
+        batched(onDatagram, &batchedOut, separator) {}
+
+  static void onDatagram(const uint8_t *data, size_t len, void *context) {
+    Datagrams &out = *(Datagrams *)context;
+    out.text.append((const char *)data, len);
+    if (out.separator)
+      out.text += out.separator;
+    out.largest = std::max(out.largest, len);
+  }
+
+  void add(const void *record, size_t len, uint32_t now, bool flush) {
+    unbatched.add((const uint8_t *)record, len, now);
+    batched.add((const uint8_t *)record, len, now, flush);
+  }
+
+  // Bytes on the network count each datagram's IPv4 and UDP headers
+  bool report(const char *name) {
+    const unsigned HEADERS = 28;
+    batched.flush();
+    const UdpBatch::STATS *u = unbatched.stats(), *b = batched.stats();
+    printf("udp %s: %u records; unbatched %.2f datagrams/s %.0f bytes/s; %u ms batches %.2f datagrams/s %.0f bytes/s, "
+           "%u sent early on edges, largest %zu bytes\n",
+           name, (unsigned)u->records, (double)u->datagrams / opt.seconds,
+           (double)(u->bytes + HEADERS * u->datagrams) / opt.seconds, (unsigned)batched.window(),
+           (double)b->datagrams / opt.seconds, (double)(b->bytes + HEADERS * b->datagrams) / opt.seconds,
+           (unsigned)b->flushes, batchedOut.largest);
+    return b->records > 0 && batchedOut.text == unbatchedOut.text && batchedOut.largest <= UdpBatch::MAX_DATAGRAM;
+  }
+};
+UdpModel jsonUdp('\n'), binaryUdp(0);
+
+// What each subscriber received, kept whole like UdpModel's streams
+struct Received {
+  std::string text;
+  uint32_t datagrams = 0, bytes = 0, lastMs = 0;
+};
+Received received[UdpSubscribers::MAX_SUBSCRIBERS];
+uint32_t flushRecords = 0;  // offered, which no interval holds back
+
+void onSubscriberDatagram(const uint8_t address[4], uint16_t port, const uint8_t *data, size_t len);
+UdpSubscribers subscribers(onSubscriberDatagram);
+// Subscribers whose TTL outlasts the run are renewed this often, as a
+// listener does; a renewal must change nothing
+const uint32_t RENEW_MS = 30000;
+uint32_t renewalsChanged = 0;
+
+void onSubscriberDatagram(const uint8_t address[4], uint16_t port, const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < UdpSubscribers::MAX_SUBSCRIBERS; i++) {
+    const UdpSubscribers::SUBSCRIBER *sub = subscribers.subscriber(i);
+    if (!sub || sub->request.port != port || memcmp(sub->request.address, address, 4))
+      continue;
+    Received &r = received[i];
+    r.text.append((const char *)data, len);
+    if (!sub->request.binary)
+      r.text += '\n';
+    r.datagrams++;
+    r.bytes += len;
+    r.lastMs = millis();
+  }
+}
+
+// Every subscriber's rates next to the broadcast's.  One that takes every
+// record of its format must get the broadcast's stream, one with an
+// interval at most a record per stream and interval besides the edges, and
+// none may get anything once its TTL has run out.  Renewals must not have
+// changed a subscriber or flushed its batch early.
+bool reportSubscribers(uint32_t startMs) {
+  const unsigned HEADERS = 28;
+  bool ok = renewalsChanged == 0;
+  subscribers.poll(millis());
+  subscribers.flush();
+  for (size_t i = 0; i < opt.subscribe.size(); i++) {
+    const UdpSubscribers::REQUEST &request = opt.subscribe[i];
+    const Received &r = received[i];
+    const UdpSubscribers::SUBSCRIBER *sub = subscribers.subscriber(i);
+    uint32_t records = sub ? sub->sent : 0;
+    char spec[128];
+    UdpSubscribers::describe(request, spec, sizeof(spec));
+    printf("udp subscriber %s: ", spec);
+    if (sub)
+      printf("%u records, %u held back, ", (unsigned)sub->sent, (unsigned)sub->dropped);
+    printf("%.2f datagrams/s %.0f bytes/s%s\n", (double)r.datagrams / opt.seconds,
+           (double)(r.bytes + HEADERS * r.datagrams) / opt.seconds, sub ? "" : ", expired");
+
+    // The model only sends water and gas
+    uint32_t activeMs = std::min(opt.seconds * 1000, request.ttl_s * 1000);
+    bool everything = (request.records & UdpSubscribers::RECORD_BINARY) == UdpSubscribers::RECORD_BINARY;
+    if (!request.interval_ms && everything && activeMs == opt.seconds * 1000) {
+      const UdpModel &model = request.binary ? binaryUdp : jsonUdp;
+      ok = ok && r.text == model.unbatchedOut.text && r.datagrams == model.batched.stats()->datagrams;
+    }
+    if (request.interval_ms && sub) {
+      uint32_t streams = opt.buses * (opt.units + 1);
+      ok = ok && records <= flushRecords + streams * (activeMs / request.interval_ms + 1);
+    }
+    ok = ok && r.datagrams > 0 && r.lastMs <= startMs + request.ttl_s * 1000;
+  }
+  return ok;
+}
+
+// Water edges sent without waiting out the window, as in NavienBroadcaster.ino
+const uint32_t BATCH_FLUSH_FIELDS = Navien::WATER_CHANGED_CONSUMPTION_ACTIVE | Navien::WATER_CHANGED_RECIRCULATION_ACTIVE |
+                                    Navien::WATER_CHANGED_RECIRCULATION_RUNNING | Navien::WATER_CHANGED_SYSTEM_POWER;
+
+// The broadcaster's throttle: a record when a unit's bytes change, and for
+// every unit every 5 s.  JSON is framed as the broadcaster's without the raw
+// hex; binary datagrams are whole packets.
+void onUdp(const Navien::PACKET_EVENT *event, void *context) {
+  Bus &bus = *(Bus *)context;
+  uint32_t now = millis();
+  if (now - bus.forcedMs >= 5000) {
+    std::fill(std::begin(bus.forceWater), std::end(bus.forceWater), true);
+    bus.forceGas = true;
+    bus.forcedMs = now;
+  }
+  char fields[1024];
+  uint8_t datagram[navienBinarySize(NAVIEN_WATER_FIELDS)];
+  size_t n;
+  uint8_t len;
+  std::string json;
+  bool flush = false;
+  if (event->kind == Navien::PACKET_KIND_WATER) {
+    uint8_t unit = event->water->device_number;
+    bool &force = bus.forceWater[unit];
+    if (!(event->changed_fields & Navien::WATER_CHANGED_RAW) && !force)
+      return;
+    force = false;
+    const uint8_t *payload = bus.navien.waterPayload(unit, &len);
+    navienFieldsToJSON<NAVIEN_WATER_FIELDS>(*event->water, payload, len, fields, sizeof(fields));
+    n = navienFieldsToBinary<NAVIEN_WATER_FIELDS>(Navien::PACKET_KIND_WATER, 0, bus.navien.busId(), unit, 0,
+                                                  *event->water, payload, len, datagram, sizeof(datagram));
+    json = "{\"type\":\"water\",";
+    flush = event->changed_fields & BATCH_FLUSH_FIELDS;
+  } else {
+    if (!(event->changed_fields & Navien::GAS_CHANGED_RAW) && !bus.forceGas)
+      return;
+    bus.forceGas = false;
+    const uint8_t *payload = bus.navien.gasPayload(&len);
+    navienFieldsToJSON<NAVIEN_GAS_FIELDS>(*event->gas, payload, len, fields, sizeof(fields));
+    n = navienFieldsToBinary<NAVIEN_GAS_FIELDS>(Navien::PACKET_KIND_GAS, 0, bus.navien.busId(), 0, 0, *event->gas,
+                                                payload, len, datagram, sizeof(datagram));
+    json = "{\"type\":\"gas\",";
+  }
+  json += fields;
+  json.back() = '}';
+  jsonUdp.add(json.data(), json.size(), now, flush);
+  binaryUdp.add(datagram, n, now, flush);
+  if (subscribers.count()) {
+    uint8_t record = event->kind == Navien::PACKET_KIND_WATER ? UdpSubscribers::RECORD_WATER
+                                                              : UdpSubscribers::RECORD_GAS;
+    uint8_t unit = event->kind == Navien::PACKET_KIND_WATER ? event->water->device_number : 0;
+    subscribers.add(record, bus.navien.busId(), unit, false, (const uint8_t *)json.data(), json.size(), now, flush);
+    subscribers.add(record, bus.navien.busId(), unit, true, datagram, n, now, flush);
+    flushRecords += flush;
+  }
+}
+
+void onError(const char *function, const char *message, void *context) {
+  const char *held = strstr(message, " more suppressed");
+  if (held) {
+    while (held > message && isdigit((unsigned char)held[-1]))
+      held--;
+    ((Bus *)context)->suppressedReported += strtoul(held, NULL, 10);
+  }
+  if (opt.verbose)
+    printf("%9.3f s  bus %u error %s: %s\n", host_clock_us / 1e6, ((Bus *)context)->navien.busId(), function,
+           message);
+}
+
+// Rotate through the four commands, each asking for a change
+void Bus::issueCommand(unsigned n) {
+  const Navien::NAVIEN_STATE_WATER &w = navien.currentState()->water[0];
+  int ret;
+  Navien::SendKind kind;
+  switch (n % 4) {
+    case 0: kind = Navien::SEND_SET_TEMP; ret = navien.setTemp(w.set_temp() == 45.0f ? 40.0f : 45.0f); break;
+    case 1: kind = Navien::SEND_RECIRCULATION; ret = navien.recirculation(!w.recirculation_active); break;
+    case 2: kind = Navien::SEND_HOT_BUTTON; ret = navien.hotButton(); break;
+    default: kind = Navien::SEND_POWER; ret = navien.power(!w.system_power); break;
+  }
+  if (ret > 0)
+    issuedAt_us[kind] = host_clock_us;
+  if (opt.verbose)
+    printf("%9.3f s  bus %u issue %s -> %d\n", host_clock_us / 1e6, navien.busId(), Navien::sendKindName(kind), ret);
+}
+
+double percentile(std::vector<double> v, double p) {
+  if (v.empty())
+    return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p / 100.0 * v.size()))];
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: navien_sim [options]\n"
+          "  --seconds N        simulated run time (default 120)\n"
+          "  --units N          cascaded units, 1-8 (default 1)\n"
+          "  --gap-ms MS        heater idle time between packets (default 60)\n"
+          "  --jitter-ms MS     random +/- on each gap (default 6)\n"
+          "  --loop-ms MS       interval between loop() calls (default 1)\n"
+          "  --noise-pct P      corrupt P%% of heater frames and add junk to P%% of gaps\n"
+          "  --navilink-s S     a NaviLink announces for the first S seconds\n"
+          "  --command-ms MS    interval between driver commands (default 3000)\n"
+          "  --react-ms MS      heater delay before a command shows (default 20)\n"
+          "  --buses N          independent heater systems served by one loop, 1-4 (default 1)\n"
+          "  --draw             hot water use for 20 s of every minute\n"
+          "  --batch-ms MS      compare UDP datagram rates unbatched and with this batch window\n"
+          "  --subscribe SPEC   a UDP subscriber, as the udpsubscribe Telnet command takes; repeatable\n"
+          "  --seed N           random seed (default 1)\n"
+          "  --check            exit 1 unless every issued command was confirmed\n"
+          "  -v                 print commands, results and errors as they happen\n");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    auto value = [&]() -> unsigned {
+      if (i + 1 >= argc) {
+        usage();
+        exit(2);
+      }
+      return (unsigned)strtoul(argv[++i], nullptr, 0);
+    };
+    if (a == "--seconds") opt.seconds = value();
+    else if (a == "--units") opt.units = value();
+    else if (a == "--gap-ms") opt.gapMs = value();
+    else if (a == "--jitter-ms") opt.jitterMs = value();
+    else if (a == "--loop-ms") opt.loopMs = std::max(1u, value());
+    else if (a == "--noise-pct") opt.noisePct = value();
+    else if (a == "--navilink-s") opt.navilinkS = value();
+    else if (a == "--command-ms") opt.commandMs = std::max(1u, value());
+    else if (a == "--react-ms") opt.reactMs = value();
+    else if (a == "--buses") opt.buses = value();
+    else if (a == "--draw") opt.draw = true;
+    else if (a == "--batch-ms") opt.batchMs = value();
+    else if (a == "--subscribe") {
+      UdpSubscribers::REQUEST request = {};
+      const char *error = "no subscription given";
+      if (i + 1 >= argc || !UdpSubscribers::parse(argv[++i], &request, &error)) {
+        fprintf(stderr, "--subscribe: %s\n", error);
+        return 2;
+      }
+      opt.subscribe.push_back(request);
+    }
+    else if (a == "--seed") opt.seed = value();
+    else if (a == "--check") opt.check = true;
+    else if (a == "-v") opt.verbose = true;
+    else { usage(); return 2; }
+  }
+  if (opt.units < 1 || opt.units > MAX_DEVICES || opt.buses < 1 || opt.buses > MAX_BUSES ||
+      opt.subscribe.size() > UdpSubscribers::MAX_SUBSCRIBERS) {
+    usage();
+    return 2;
+  }
+  rng = opt.seed ? opt.seed : 1;
+
+  const uint64_t start_us = 1000000;  // one second in so millis()-based timers are non-zero
+  const uint64_t end_us = start_us + opt.seconds * 1000000ULL;
+  const uint64_t navilinkEnd_us = start_us + opt.navilinkS * 1000000ULL;
+  host_clock_us = start_us;
+  for (UdpModel *m : {&jsonUdp, &binaryUdp}) {
+    m->batched.setWindow(opt.batchMs, millis());
+    m->unbatched.resetStats(millis());
+  }
+  const bool udp = opt.batchMs || !opt.subscribe.empty();
+  const uint32_t subscribedMs = millis();
+  uint32_t renewedMs = subscribedMs;
+  subscribers.setWindow(opt.batchMs, millis());
+  for (UdpSubscribers::REQUEST &request : opt.subscribe) {
+    subscribers.subscribe(request, millis());
+    if (!request.port)
+      request.port = request.binary ? UdpSubscribers::BINARY_PORT : UdpSubscribers::JSON_PORT;
+  }
+
+  std::vector<std::unique_ptr<Bus>> buses;
+  for (unsigned b = 0; b < opt.buses; b++) {
+    buses.emplace_back(new Bus(b));
+    Bus &bus = *buses.back();
+    bus.navien.onError(onError, &bus);
+    bus.navien.onCommandComplete(onCommandComplete, &bus);
+    bus.navien.subscribe("cascade", onCascade, &bus, Navien::PACKET_KIND_CASCADE);
+    if (udp)
+      bus.navien.subscribe("udp", onUdp, &bus, Navien::PACKET_KIND_WATER | Navien::PACKET_KIND_GAS);
+    bus.navien.setRxBufferSize(1024);
+    bus.navien.begin(16, 17);
+    // Heaters are not in step with each other
+    bus.heater.nextAt_us = start_us + b * 7000;
+    bus.nextNavilink_us = start_us + 200000;
+    bus.nextCommand_us = start_us + (uint64_t)opt.commandMs * 1000;
+  }
+
+  for (uint64_t now = start_us; now < end_us; now += opt.loopMs * 1000ULL) {
+    host_clock_us = now;
+    for (auto &bp : buses) {
+      Bus &bus = *bp;
+      Heater &heater = bus.heater;
+      heater.react(now);
+
+      // The heater keeps its cadence whatever else is on the bus
+      while (heater.nextAt_us <= now) {
+        std::vector<uint8_t> pkt = heater.next(heater.nextAt_us);
+        if (randomBelow(100) < opt.noisePct)
+          pkt[1 + randomBelow(pkt.size() - 1)] ^= 1 << randomBelow(8);
+        uint64_t end = heater.nextAt_us + pkt.size() * BYTE_TIME_US;
+        bus.transmit(SRC_HEATER, heater.nextAt_us, std::move(pkt));
+        int gap = (int)opt.gapMs + (opt.jitterMs ? (int)randomBelow(2 * opt.jitterMs + 1) - (int)opt.jitterMs : 0);
+        heater.nextAt_us = end + (uint64_t)std::max(gap, 1) * 1000;
+        if (randomBelow(100) < opt.noisePct) {
+          std::vector<uint8_t> junk(1 + randomBelow(4));
+          for (auto &b : junk) b = (uint8_t)random32();
+          bus.transmit(SRC_NOISE, end + (heater.nextAt_us - end) / 2, std::move(junk));
+        }
+      }
+      // A NaviLink waits for a quiet bus
+      if (now < navilinkEnd_us && now >= bus.nextNavilink_us && !bus.busBusy(now) &&
+          heater.nextAt_us > now + 10 * BYTE_TIME_US) {
+        bus.transmit(SRC_NAVILINK, now, std::vector<uint8_t>(Navien::ANNOUNCE_PACKET, Navien::ANNOUNCE_PACKET + 10));
+        bus.nextNavilink_us = now + (uint64_t)opt.navilinkMs * 1000;
+      }
+
+      bus.deliver(now);
+    }
+
+    // One loop serves every bus, as in NavienManager
+    for (auto &bp : buses) {
+      Bus &bus = *bp;
+      auto t0 = std::chrono::steady_clock::now();
+      bus.navien.loop();
+      bus.loopNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    }
+    jsonUdp.batched.poll(millis());
+    binaryUdp.batched.poll(millis());
+    subscribers.poll(millis());
+    if (!opt.subscribe.empty() && millis() - renewedMs >= RENEW_MS) {
+      renewedMs = millis();
+      for (const UdpSubscribers::REQUEST &request : opt.subscribe) {
+        bool changed;
+        if (request.ttl_s > opt.seconds && subscribers.subscribe(request, millis(), &changed) >= 0)
+          renewalsChanged += changed;
+      }
+    }
+
+    for (auto &bp : buses) {
+      Bus &bus = *bp;
+      SimNavien &navien = bus.navien;
+      // Whatever loop() wrote goes on the wire now, heard back by Navien too
+      if (navien.host_tx.size() > bus.txSeen) {
+        bus.transmit(SRC_NAVIEN, now, std::vector<uint8_t>(navien.host_tx.begin() + bus.txSeen, navien.host_tx.end()));
+        bus.txSeen = navien.host_tx.size();
+      }
+
+      if (now >= bus.nextCommand_us) {
+        if (navien.controlAvailable())
+          bus.issueCommand(bus.commandsIssued++);
+        bus.nextCommand_us = now + (uint64_t)opt.commandMs * 1000;
+      }
+    }
+  }
+
+  printf("Simulated %u s: %u unit(s), gap %u+/-%u ms, noise %u%%, NaviLink for %u s, loop() every %u ms",
+         opt.seconds, opt.units, opt.gapMs, opt.jitterMs, opt.noisePct, opt.navilinkS, opt.loopMs);
+  if (opt.buses > 1)
+    printf(", %u buses", opt.buses);
+  printf("\n");
+
+  // Counts still held go out from loop() once their interval passes with
+  // no error to carry them
+  host_clock_us = end_us + Navien::ERROR_REPORT_INTERVAL_MS * 1000;
+  for (auto &bp : buses)
+    bp->navien.loop();
+
+  bool ok = true, cascadeOk = true, tagsOk = true, errorsOk = true;
+  double totalNs = 0;
+  uint32_t totalPackets = 0;
+  for (auto &bp : buses) {
+    Bus &bus = *bp;
+    SimNavien &navien = bus.navien;
+    const uint32_t *results = bus.results;
+    if (opt.buses > 1)
+      printf("bus %u:\n", navien.busId());
+    const Navien::COMMAND_STATS *cs = navien.commandStats();
+    const Navien::TX_STATS *tx = navien.txStats();
+    const Navien::BUS_STATS *stats = navien.busStats();
+    printf("  bus: %.1f%% busy;", 100.0 * bus.busyUs / (end_us - start_us));
+    for (int s = 0; s < 4; s++)
+      printf(" %s %u frames (%u garbled)%s", SOURCE_NAMES[s], bus.framesSent[s], bus.framesCollided[s],
+             s < 3 ? "," : "\n");
+    printf("  heater: %u command packets applied\n", bus.heater.commandsApplied);
+    printf("  commands: %u issued, %u confirmed, %u superseded, %u failed, %u dropped, %u retries\n",
+           (unsigned)cs->issued, results[Navien::COMMAND_CONFIRMED], results[Navien::COMMAND_SUPERSEDED],
+           results[Navien::COMMAND_FAILED], results[Navien::COMMAND_DROPPED], (unsigned)cs->retries);
+    printf("  latency issue->confirmed: p50 %.0f ms p99 %.0f ms max %.0f ms; %.2f confirmed/min\n",
+           percentile(bus.latenciesMs, 50), percentile(bus.latenciesMs, 99), percentile(bus.latenciesMs, 100),
+           results[Navien::COMMAND_CONFIRMED] * 60.0 / opt.seconds);
+    printf("  queue->wire p99 <%u ms, wire->confirmed p99 <%u ms\n",
+           (unsigned)Navien::histogramPercentile(cs->queue_wire_hist, 99),
+           (unsigned)Navien::histogramPercentile(cs->wire_confirm_hist, 99));
+    printf("  transmit: %u sends (%u early), echo ok %u mismatch %u, %u overlaps seen, gap after water %u ms\n",
+           (unsigned)tx->sends, (unsigned)tx->early_sends, (unsigned)tx->echo_matched, (unsigned)tx->echo_mismatch,
+           (unsigned)tx->overlaps, (unsigned)navien.predictedGapMs(false));
+    printf("  collisions: %u (%.1f%% of sends), %u retransmits, %u given up\n", (unsigned)tx->collisions,
+           tx->sends ? 100.0 * tx->collisions / tx->sends : 0.0, (unsigned)tx->retransmits,
+           (unsigned)tx->retransmit_give_ups);
+    const Navien::ERROR_STATS *errors = navien.errorStats();
+    printf("  receive: %u checksum errors, %u resyncs, %u echo suppressed; errors %u passed on, %u rate limited\n",
+           (unsigned)stats->checksum_errors, (unsigned)stats->resyncs, (unsigned)stats->echo_suppressed,
+           (unsigned)errors->reported, (unsigned)errors->suppressed);
+    const Navien::NAVIEN_STATE_CASCADE &cascade = navien.currentState()->cascade;
+    printf("  cascade: %u units, %u events, %u mismatched; now %u firing, %.1f L/min, mean capacity %.1f%%\n",
+           cascade.units, bus.cascadeEvents, bus.cascadeMismatches, cascade.units_firing, cascade.flow_lpm(),
+           cascade.mean_capacity());
+    uint32_t packets = navien.rxStats()->packets;
+    printf("  host cpu: loop() %.1f ms for %u packets, %.0f ns/packet\n", bus.loopNs / 1e6, packets,
+           packets ? bus.loopNs / packets : 0.0);
+    totalNs += bus.loopNs;
+    totalPackets += packets;
+
+    ok = ok && cs->issued > 0 &&
+         results[Navien::COMMAND_CONFIRMED] + results[Navien::COMMAND_SUPERSEDED] >= cs->issued - 1 &&
+         !results[Navien::COMMAND_FAILED] && !results[Navien::COMMAND_DROPPED];
+    cascadeOk = cascadeOk && bus.cascadeEvents > 0 && bus.cascadeMismatches == 0 && cascade.units == opt.units;
+    tagsOk = tagsOk && bus.foreignEvents == 0;
+
+    errorsOk = errorsOk && bus.suppressedReported == errors->suppressed;
+    size_t perCode[Navien::ERROR_CODE_COUNT] = {};
+    for (size_t i = 0; navien.recentError(i); i++)
+      errorsOk = errorsOk && ++perCode[navien.recentError(i)->code] <= Navien::ERROR_RING_PER_CODE;
+  }
+  if (opt.buses > 1)
+    printf("all buses: loop() %.1f ms for %u packets, %.0f ns/packet, %.2f ms per simulated second\n",
+           totalNs / 1e6, totalPackets, totalPackets ? totalNs / totalPackets : 0.0, totalNs / 1e6 / opt.seconds);
+
+  bool batchOk = true, subscribersOk = true;
+  if (udp) {
+    batchOk &= jsonUdp.report("json");
+    batchOk &= binaryUdp.report("binary");
+  }
+  if (!opt.subscribe.empty())
+    subscribersOk = reportSubscribers(subscribedMs);
+
+  if (opt.check) {
+    printf("%s  every command confirmed\n", ok ? "PASSED" : "FAILED");
+    printf("%s  cascade totals match water[]\n", cascadeOk ? "PASSED" : "FAILED");
+    if (opt.buses > 1)
+      printf("%s  every event from its own bus\n", tagsOk ? "PASSED" : "FAILED");
+    if (opt.noisePct)
+      printf("%s  every rate-limited error reported in a count, ring shared between codes\n",
+             errorsOk ? "PASSED" : "FAILED");
+    if (opt.batchMs)
+      printf("%s  batched datagrams hold every record in order\n", batchOk ? "PASSED" : "FAILED");
+    if (!opt.subscribe.empty())
+      printf("%s  subscribers get their records, no faster than asked and not after their TTL, renewals change nothing\n",
+             subscribersOk ? "PASSED" : "FAILED");
+    return ok && cascadeOk && tagsOk && errorsOk && batchOk && subscribersOk ? 0 : 1;
+  }
+  return 0;
+}
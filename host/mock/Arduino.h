@@ -0,0 +1,39 @@
+// Host-side stand-in for the ESP32 Arduino core.
+//
+// Only the handful of symbols used by Navien.cpp are provided.  Time is
+// virtual: millis()/micros() return host_clock_us, which the harness
+// advances explicitly so that replay runs are deterministic and do not
+// depend on the speed of the machine running them.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <string>
+
+inline uint64_t host_clock_us = 0;
+
+inline unsigned long millis() { return (unsigned long)(host_clock_us / 1000); }
+inline unsigned long micros() { return (unsigned long)host_clock_us; }
+inline void yield() {}
+inline void delay(unsigned long ms) { host_clock_us += (uint64_t)ms * 1000; }
+// Seeded the same every run, like the rest of the host build
+inline long random(long howbig) { return howbig > 0 ? std::rand() % howbig : 0; }
+
+#define F(s) (s)
+
+// Serial console — output is discarded unless host_serial_echo is set.
+inline bool host_serial_echo = false;
+
+struct HostConsole {
+  void print(const char *s) { if (host_serial_echo) fputs(s, stderr); }
+  void println(const char *s = "") { if (host_serial_echo) fprintf(stderr, "%s\n", s); }
+  template <typename... Args>
+  void printf(const char *fmt, Args... args) { if (host_serial_echo) fprintf(stderr, fmt, args...); }
+};
+
+inline HostConsole Serial;
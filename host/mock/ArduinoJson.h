@@ -0,0 +1,253 @@
+// Host-side stand-in for ArduinoJson 7.
+//
+// Only what NavienBroadcaster.ino's records used before TelemetryWriter
+// (host/BaselineJson.cpp): a flat JsonDocument filled with doc["key"] = v,
+// serialized() and serializeJson() into a String.  Members keep the order
+// they were first assigned in.  Numbers print as the library prints them
+// with its ESP32 defaults (ARDUINOJSON_USE_DOUBLE, no NaN or Infinity):
+// writeFloat() and decomposeFloat() below are transcribed from its
+// TextFormatter.hpp and FloatParts.hpp, with a float stored as a float and
+// printed with 6 significant decimals, a double with 9.
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "WString.h"
+
+#define ARDUINOJSON_POSITIVE_EXPONENTIATION_THRESHOLD 1e7
+#define ARDUINOJSON_NEGATIVE_EXPONENTIATION_THRESHOLD 1e-5
+
+namespace ArduinoJsonHost {
+
+typedef double JsonFloat;
+
+struct FloatParts {
+  uint32_t integral;
+  uint32_t decimal;
+  int16_t exponent;
+  int8_t decimalPlaces;
+};
+
+inline int16_t normalize(JsonFloat &value) {
+  static const JsonFloat positive[] = { 1e1, 1e2, 1e4, 1e8, 1e16, 1e32, 1e64, 1e128, 1e256 };
+  static const JsonFloat negative[] = { 1e-1, 1e-2, 1e-4, 1e-8, 1e-16, 1e-32, 1e-64, 1e-128, 1e-256 };
+  int16_t powersOf10 = 0;
+
+  int8_t index = 8;
+  int bit = 1 << index;
+
+  if (value >= ARDUINOJSON_POSITIVE_EXPONENTIATION_THRESHOLD) {
+    for (; index >= 0; index--) {
+      if (value >= positive[index]) {
+        value *= negative[index];
+        powersOf10 = int16_t(powersOf10 + bit);
+      }
+      bit >>= 1;
+    }
+  }
+
+  if (value > 0 && value <= ARDUINOJSON_NEGATIVE_EXPONENTIATION_THRESHOLD) {
+    for (; index >= 0; index--) {
+      if (value < negative[index] * 10) {
+        value *= positive[index];
+        powersOf10 = int16_t(powersOf10 - bit);
+      }
+      bit >>= 1;
+    }
+  }
+
+  return powersOf10;
+}
+
+constexpr uint32_t pow10(int exponent) {
+  return (exponent == 0) ? 1 : 10 * pow10(exponent - 1);
+}
+
+inline FloatParts decomposeFloat(JsonFloat value, int8_t decimalPlaces) {
+  uint32_t maxDecimalPart = pow10(decimalPlaces);
+
+  int16_t exponent = normalize(value);
+
+  uint32_t integral = uint32_t(value);
+  // reduce number of decimal places by the number of integral places
+  for (uint32_t tmp = integral; tmp >= 10; tmp /= 10) {
+    maxDecimalPart /= 10;
+    decimalPlaces--;
+  }
+
+  JsonFloat remainder = (value - JsonFloat(integral)) * JsonFloat(maxDecimalPart);
+
+  uint32_t decimal = uint32_t(remainder);
+  remainder = remainder - JsonFloat(decimal);
+
+  // rounding: increment by 1 if remainder >= 0.5
+  decimal += uint32_t(remainder * 2);
+  if (decimal >= maxDecimalPart) {
+    decimal = 0;
+    integral++;
+    if (exponent && integral >= 10) {
+      exponent++;
+      integral = 1;
+    }
+  }
+
+  // remove trailing zeros
+  while (decimal % 10 == 0 && decimalPlaces > 0) {
+    decimal /= 10;
+    decimalPlaces--;
+  }
+
+  return { integral, decimal, exponent, decimalPlaces };
+}
+
+inline void writeInteger(std::string &out, int64_t value) {
+  out += std::to_string(value);
+}
+
+inline void writeDecimals(std::string &out, uint32_t value, int8_t width) {
+  char buffer[16];
+  char *begin = buffer + sizeof(buffer);
+  char *end = begin;
+
+  // write the string in reverse order
+  while (width--) {
+    *--begin = char(value % 10 + '0');
+    value /= 10;
+  }
+  *--begin = '.';
+
+  out.append(begin, end);
+}
+
+inline void writeFloat(std::string &out, JsonFloat value, int8_t decimalPlaces) {
+  if (std::isnan(value) || std::isinf(value)) {
+    out += "null";
+    return;
+  }
+
+  if (value < 0.0) {
+    out += '-';
+    value = -value;
+  }
+
+  FloatParts parts = decomposeFloat(value, decimalPlaces);
+
+  writeInteger(out, parts.integral);
+  if (parts.decimalPlaces)
+    writeDecimals(out, parts.decimal, parts.decimalPlaces);
+
+  if (parts.exponent) {
+    out += 'e';
+    writeInteger(out, parts.exponent);
+  }
+}
+
+inline void writeString(std::string &out, const char *value) {
+  out += '"';
+  for (const char *p = value; *p; p++) {
+    switch (*p) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\b': out += "\\b"; break;
+      case '\f': out += "\\f"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default: out += *p; break;
+    }
+  }
+  out += '"';
+}
+
+struct SerializedValue {
+  String text;
+};
+
+class JsonDocument;
+
+// doc["key"]: assigning sets the member's value, already serialized
+class MemberProxy {
+public:
+  MemberProxy(JsonDocument &doc, const char *key) : _doc(doc), _key(key) {}
+
+  template <typename T>
+  MemberProxy &operator=(T value) {
+    std::string text;
+    if constexpr (std::is_same_v<T, bool>) {
+      text = value ? "true" : "false";
+    } else if constexpr (std::is_same_v<T, float>) {
+      writeFloat(text, value, 6);
+    } else if constexpr (std::is_same_v<T, double>) {
+      writeFloat(text, value, 9);
+    } else if constexpr (std::is_integral_v<T>) {
+      writeInteger(text, (int64_t)value);
+    } else if constexpr (std::is_same_v<T, SerializedValue>) {
+      text = value.text.c_str();
+    } else if constexpr (std::is_same_v<T, String>) {
+      writeString(text, value.c_str());
+    } else {
+      writeString(text, value);
+    }
+    set(std::move(text));
+    return *this;
+  }
+
+private:
+  void set(std::string &&text);
+
+  JsonDocument &_doc;
+  std::string _key;
+};
+
+class JsonDocument {
+public:
+  MemberProxy operator[](const char *key) { return MemberProxy(*this, key); }
+
+  std::string serialize() const {
+    std::string out = "{";
+    for (size_t i = 0; i < _members.size(); i++) {
+      if (i)
+        out += ',';
+      writeString(out, _members[i].first.c_str());
+      out += ':';
+      out += _members[i].second;
+    }
+    out += '}';
+    return out;
+  }
+
+private:
+  friend class MemberProxy;
+  std::vector<std::pair<std::string, std::string>> _members;
+};
+
+inline void MemberProxy::set(std::string &&text) {
+  for (auto &m : _doc._members) {
+    if (m.first == _key) {
+      m.second = std::move(text);
+      return;
+    }
+  }
+  _doc._members.emplace_back(_key, std::move(text));
+}
+
+inline SerializedValue serialized(const String &text) {
+  return SerializedValue{ text };
+}
+
+inline size_t serializeJson(const JsonDocument &doc, String &out) {
+  std::string text = doc.serialize();
+  out = String(text.c_str());
+  return text.size();
+}
+
+}  // namespace ArduinoJsonHost
+
+using ArduinoJsonHost::JsonDocument;
+using ArduinoJsonHost::serialized;
+using ArduinoJsonHost::serializeJson;
@@ -0,0 +1,93 @@
+// Host-side stand-in for the ESP32 HardwareSerial class.
+//
+// Bytes "arrive on the wire" via host_inject() into a bounded RX buffer that
+// behaves like the Arduino core's ring buffer: once it is full, further bytes
+// are dropped and counted in host_rx_overflow.  Everything written by the
+// code under test is appended to host_tx.
+//
+// onReceive()/onReceiveError() callbacks run synchronously from host_inject(),
+// standing in for the core's UART event task preempting the main loop.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#define SERIAL_8N1 0x800001c
+
+typedef enum {
+  UART_NO_ERROR,
+  UART_BREAK_ERROR,
+  UART_BUFFER_FULL_ERROR,
+  UART_FIFO_OVF_ERROR,
+  UART_FRAME_ERROR,
+  UART_PARITY_ERROR
+} hardwareSerial_error_t;
+
+typedef std::function<void(void)> OnReceiveCb;
+typedef std::function<void(hardwareSerial_error_t)> OnReceiveErrorCb;
+
+class HardwareSerial {
+public:
+  explicit HardwareSerial(int uart_nr) : host_uart_nr(uart_nr) {}
+  virtual ~HardwareSerial() {}
+
+  void begin(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin) {
+    (void)baud; (void)config; (void)rxPin; (void)txPin;
+  }
+  size_t setRxBufferSize(size_t size) { host_rx_capacity = size; return size; }
+  void onReceive(OnReceiveCb function, bool onlyOnTimeout = false) {
+    (void)onlyOnTimeout;
+    host_on_receive = function;
+  }
+  void onReceiveError(OnReceiveErrorCb function) { host_on_receive_error = function; }
+
+  int available() { return (int)host_rx.size(); }
+  int peek() { return host_rx.empty() ? -1 : host_rx.front(); }
+  int read() {
+    if (host_rx.empty()) return -1;
+    uint8_t b = host_rx.front();
+    host_rx.pop_front();
+    return b;
+  }
+  size_t read(uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (n < size && !host_rx.empty()) {
+      buffer[n++] = host_rx.front();
+      host_rx.pop_front();
+    }
+    return n;
+  }
+  size_t write(const uint8_t *buffer, size_t size) {
+    host_tx.insert(host_tx.end(), buffer, buffer + size);
+    return size;
+  }
+
+  // --- host-only API ---
+  void host_inject(const uint8_t *data, size_t len) {
+    bool overflow = false;
+    for (size_t i = 0; i < len; i++) {
+      if (host_rx.size() >= host_rx_capacity) {
+        host_rx_overflow++;
+        overflow = true;
+        continue;
+      }
+      host_rx.push_back(data[i]);
+    }
+    if (overflow && host_on_receive_error)
+      host_on_receive_error(UART_BUFFER_FULL_ERROR);
+    if (host_on_receive)
+      host_on_receive();
+  }
+
+  int host_uart_nr;
+  size_t host_rx_capacity = 256;  // Arduino core default
+  size_t host_rx_overflow = 0;
+  std::deque<uint8_t> host_rx;
+  std::vector<uint8_t> host_tx;
+  OnReceiveCb host_on_receive;
+  OnReceiveErrorCb host_on_receive_error;
+};
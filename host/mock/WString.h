@@ -0,0 +1,115 @@
+// Host-side stand-in for the ESP32 Arduino core's String.
+//
+// Enough of it for the JSON records NavienBroadcaster.ino built before
+// TelemetryWriter (host/BaselineJson.cpp).  String(value, decimals) goes
+// through dtostrf(), transcribed from the core's stdlib_noniso.c, so that
+// one-decimal values print here as they did on the device.
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+inline char *dtostrf(double number, signed int width, unsigned int prec, char *s) {
+  bool negative = false;
+
+  if (std::isnan(number)) {
+    strcpy(s, "nan");
+    return s;
+  }
+  if (std::isinf(number)) {
+    strcpy(s, "inf");
+    return s;
+  }
+
+  char *out = s;
+
+  int fillme = width;  // how many cells to fill for the integer part
+  if (prec > 0)
+    fillme -= (prec + 1);
+
+  if (number < 0.0) {
+    negative = true;
+    fillme--;
+    number = -number;
+  }
+
+  // Round correctly so that print(1.999, 2) prints as "2.00"
+  double rounding = 2.0;
+  for (unsigned int i = 0; i < prec; ++i)
+    rounding *= 10.0;
+  rounding = 1.0 / rounding;
+
+  number += rounding;
+
+  double tenpow = 1.0;
+  unsigned int digitcount = 1;
+  while (number >= 10.0 * tenpow) {
+    tenpow *= 10.0;
+    digitcount++;
+  }
+
+  number /= tenpow;
+  fillme -= digitcount;
+
+  while (fillme-- > 0)
+    *out++ = ' ';
+
+  if (negative)
+    *out++ = '-';
+
+  digitcount += prec;
+  int8_t digit = 0;
+  while (digitcount-- > 0) {
+    digit = (int8_t)number;
+    if (digit > 9)
+      digit = 9;
+    *out++ = (char)('0' | digit);
+    if ((digitcount == prec) && (prec > 0))
+      *out++ = '.';
+    number -= digit;
+    number *= 10.0;
+  }
+
+  *out = 0;
+  return s;
+}
+
+class String {
+public:
+  String(const char *s = "") : _s(s ? s : "") {}
+  explicit String(int value) : _s(std::to_string(value)) {}
+  explicit String(unsigned int value) : _s(std::to_string(value)) {}
+  explicit String(long value) : _s(std::to_string(value)) {}
+  explicit String(unsigned long value) : _s(std::to_string(value)) {}
+  String(float value, unsigned int decimalPlaces = 2) { *this = fixed(value, decimalPlaces); }
+  String(double value, unsigned int decimalPlaces = 2) { *this = fixed(value, decimalPlaces); }
+
+  const char *c_str() const { return _s.c_str(); }
+  unsigned int length() const { return _s.length(); }
+  bool isEmpty() const { return _s.empty(); }
+  void reserve(unsigned int size) { _s.reserve(size); }
+  void remove(unsigned int index) { _s.erase(index < _s.length() ? index : _s.length()); }
+
+  String &operator+=(const String &s) { _s += s._s; return *this; }
+  String &operator+=(const char *s) { _s += s; return *this; }
+  String &operator+=(char c) { _s += c; return *this; }
+  String &operator+=(int value) { _s += std::to_string(value); return *this; }
+  String &operator+=(unsigned int value) { _s += std::to_string(value); return *this; }
+  String &operator+=(long value) { _s += std::to_string(value); return *this; }
+  String &operator+=(unsigned long value) { _s += std::to_string(value); return *this; }
+
+  bool operator==(const String &s) const { return _s == s._s; }
+  bool operator==(const char *s) const { return _s == s; }
+  bool operator!=(const char *s) const { return _s != s; }
+
+private:
+  static String fixed(double value, unsigned int decimalPlaces) {
+    std::string buf(decimalPlaces + 42, '\0');
+    return String(dtostrf(value, decimalPlaces + 2, decimalPlaces, &buf[0]));
+  }
+
+  std::string _s;
+};
@@ -0,0 +1,24 @@
+// Host-side stand-in for the FreeRTOS types used by Navien.cpp.
+//
+// The harness is single threaded, so this is only the API surface: the
+// "RX task" is emulated by HardwareSerial::host_inject() invoking the
+// onReceive() callback synchronously.
+
+#pragma once
+
+#include <cstdint>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
+
+// Nothing runs concurrently on the host, so critical sections are empty
+typedef struct { int unused; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
@@ -0,0 +1,38 @@
+// Host-side stand-in for FreeRTOS queues: fixed-depth, copy-in/copy-out,
+// never blocks.
+
+#pragma once
+
+#include <cstring>
+#include <deque>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+
+struct HostQueue {
+  size_t item_size;
+  UBaseType_t depth;
+  std::deque<std::vector<uint8_t>> items;
+};
+typedef HostQueue *QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(UBaseType_t depth, UBaseType_t item_size) {
+  return new HostQueue{ item_size, depth, {} };
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t) {
+  if (q->items.size() >= q->depth)
+    return pdFALSE;
+  const uint8_t *p = (const uint8_t *)item;
+  q->items.emplace_back(p, p + q->item_size);
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t) {
+  if (q->items.empty())
+    return pdFALSE;
+  memcpy(item, q->items.front().data(), q->item_size);
+  q->items.pop_front();
+  return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) { return (UBaseType_t)q->items.size(); }